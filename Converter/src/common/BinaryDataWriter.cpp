@@ -1,11 +1,15 @@
 ﻿
 #include "BinaryDataWriter.h"
 #include <stdexcept>
+#include <cstring>
+#include <boost/format.hpp>
+#include <boost/functional/hash.hpp>
 
 
 BinaryDataWriter::BinaryDataWriter(std::ostream& out, EndiannessType endianness)
 	: _out(out)
 	, _endianness(endianness)
+	, _pos(0)
 {
 }
 
@@ -13,22 +17,30 @@ BinaryDataWriter::~BinaryDataWriter()
 {
 }
 
+/** 現在位置からsizeバイトを書き込めるようにし、書き込み先を返す */
+char* BinaryDataWriter::reserve(size_t size)
+{
+	size_t end = _pos + size;
+	if (end > _buffer.size()) _buffer.resize(end);
+	char* p = &_buffer[_pos];
+	_pos = end;
+	return p;
+}
+
 void BinaryDataWriter::seekp(long pos)
 {
-	_out.seekp(pos);
+	_pos = static_cast<size_t>(pos);
 }
 
 void BinaryDataWriter::fill(char fillData, size_t size)
 {
-	for (size_t i = 0; i < size; i++)
-	{
-		writeByte(fillData);
-	}
+	if (size == 0) return;
+	std::memset(reserve(size), fillData, size);
 }
 
 void BinaryDataWriter::align(int unit)
 {
-	long pos = static_cast<long>(_out.tellp());
+	long pos = tellp();
 	int n = static_cast<int>(pos & (unit-1));
 	if (n)
 	{
@@ -37,60 +49,50 @@ void BinaryDataWriter::align(int unit)
 	}
 }
 
+BinaryDataWriter::Reference BinaryDataWriter::newReference()
+{
+	_dataPositions.push_back(-1L);
+	return static_cast<Reference>(_dataPositions.size() - 1);
+}
+
 void BinaryDataWriter::fixReferences()
 {
-	long currentPos = static_cast<long>(_out.tellp());
+	size_t currentPos = _pos;
 
-	for (ReferenceMapType::const_iterator i = _referenceMap.begin(), end = _referenceMap.end(); i != end; i++)
+	for (std::vector<std::pair<long, Reference> >::const_iterator i = _referencePositions.begin(), end = _referencePositions.end(); i != end; i++)
 	{
-		const Reference& ref = i->second;
-		if (ref.referencePos < 0) continue;	// 参照先なし
-		if (ref.dataPos < 0) throw std::logic_error(i->first + "に対応する dataPos が記録されていません");
-		
-		_out.seekp(ref.referencePos);
-		writeInt(static_cast<int>(ref.dataPos));
+		long dataPos = _dataPositions.at(i->second);
+		if (dataPos < 0) throw std::logic_error((boost::format("参照 %1% に対応する dataPos が記録されていません") % i->second).str());
+
+		_pos = static_cast<size_t>(i->first);
+		writeInt(static_cast<int>(dataPos));
 	}
-	
-	_out.seekp(currentPos);
+	_referencePositions.clear();
+
+	_pos = currentPos;
 }
 
-void BinaryDataWriter::writeReference(const std::string &key)
+void BinaryDataWriter::writeReference(Reference ref)
 {
-	Reference ref;
-	if (_referenceMap.find(key) != _referenceMap.end()) ref = _referenceMap.at(key);
-	
 	align(4);
-	ref.referencePos = static_cast<long>(_out.tellp());
-	_referenceMap[key] = ref;
+	_referencePositions.push_back(std::make_pair(tellp(), ref));
 	writeInt(0);
 }
 
-void BinaryDataWriter::setReference(const std::string &key)
+void BinaryDataWriter::setReference(Reference ref)
 {
-	Reference ref;
-	if (_referenceMap.find(key) != _referenceMap.end()) ref = _referenceMap.at(key);
-
 	align(4);
-	ref.dataPos = static_cast<long>(_out.tellp());
-	_referenceMap[key] = ref;
-
-//	long keyPos = _referenceMap.at(key);
-//	_out.seekp(keyPos);
-//	writeInt(static_cast<int>(currentPos));
-//
-//	_out.seekp(currentPos);
+	_dataPositions.at(ref) = tellp();
 }
 
 void BinaryDataWriter::writeByte(char data)
 {
-	char buf[1];
-	buf[0] = data;
-	_out.write(buf, sizeof(buf));
+	*reserve(1) = data;
 }
 
 void BinaryDataWriter::writeShort(short data)
 {
-	char buf[2];
+	char* buf = reserve(2);
 	if (_endianness == ET_LITTLE_ENDIAN)
 	{
 		buf[0] = static_cast<char>(data);
@@ -101,12 +103,11 @@ void BinaryDataWriter::writeShort(short data)
 		buf[0] = static_cast<char>(data >> 8);
 		buf[1] = static_cast<char>(data);
 	}
-	_out.write(buf, sizeof(buf));
 }
 
 void BinaryDataWriter::writeInt(int data)
 {
-	char buf[4];
+	char* buf = reserve(4);
 	if (_endianness == ET_LITTLE_ENDIAN)
 	{
 		buf[0] = static_cast<char>(data);
@@ -121,7 +122,6 @@ void BinaryDataWriter::writeInt(int data)
 		buf[2] = static_cast<char>(data >> 8);
 		buf[3] = static_cast<char>(data);
 	}
-	_out.write(buf, sizeof(buf));
 }
 
 void BinaryDataWriter::writeFloat(float data)
@@ -136,7 +136,52 @@ void BinaryDataWriter::writeFloat(float data)
 
 void BinaryDataWriter::writeString(const std::string& str)
 {
-	_out.write(str.c_str(), str.length());
-	writeByte(0);
+	writeBytes(str.c_str(), str.length() + 1);
+}
+
+void BinaryDataWriter::writeBytes(const char* data, size_t size)
+{
+	if (size == 0) return;
+	std::memcpy(reserve(size), data, size);
 }
 
+BinaryDataWriter::Reference BinaryDataWriter::writeSharedBytes(const char* data, size_t size, int alignment)
+{
+	size_t hash = boost::hash_range(data, data + size);
+
+	std::pair<SharedBlockMapType::const_iterator, SharedBlockMapType::const_iterator> range = _sharedBlocks.equal_range(hash);
+	for (SharedBlockMapType::const_iterator i = range.first; i != range.second; i++)
+	{
+		const SharedBlock& block = i->second;
+		if (block.size == size && (size == 0 || std::memcmp(&_buffer[block.pos], data, size) == 0))
+		{
+			return block.ref;
+		}
+	}
+
+	SharedBlock block;
+	block.ref = newReference();
+	align(alignment);
+	setReference(block.ref);
+	block.pos = tellp();
+	block.size = size;
+	writeBytes(data, size);
+	_sharedBlocks.insert(std::make_pair(hash, block));
+	return block.ref;
+}
+
+BinaryDataWriter::Reference BinaryDataWriter::writeSharedString(const std::string& str)
+{
+	return writeSharedBytes(str.c_str(), str.length() + 1);
+}
+
+void BinaryDataWriter::flush()
+{
+	if (!_buffer.empty())
+	{
+		_out.write(&_buffer[0], _buffer.size());
+	}
+	_buffer.clear();
+	_sharedBlocks.clear();
+	_pos = 0;
+}
@@ -3,20 +3,18 @@
 
 #include <iostream>
 #include <string>
-#include <map>
+#include <vector>
+#include <boost/unordered_map.hpp>
 
+/**
+ * バイナリデータの書き出し
+ * 出力はメモリ上のバッファに溜め、参照の解決もバッファ上で行い、flush()で一度に書き出します
+ */
 class BinaryDataWriter
 {
 public:
-	struct Reference
-	{
-		long	referencePos;
-		long	dataPos;
-		
-		Reference() : referencePos(-1L), dataPos(-1L) {}
-	};
-
-	typedef std::map<std::string, Reference> ReferenceMapType;
+	/** 参照のハンドル。newReference()で発行する */
+	typedef int Reference;
 
 	enum EndiannessType
 	{
@@ -28,23 +26,54 @@ public:
 	virtual ~BinaryDataWriter();
 
 	void seekp(long pos);
+	long tellp() const		{ return static_cast<long>(_pos); }
 	void fill(char fillData, size_t size);
 	void align(int n);
 
+	Reference newReference();
 	void fixReferences();
-	void writeReference(const std::string& key);
-	void setReference(const std::string& key);
+	void writeReference(Reference ref);
+	void setReference(Reference ref);
+	/** setReference()で記録した参照先の位置を返す（未設定のときは-1） */
+	long getReferencePosition(Reference ref) const	{ return _dataPositions.at(ref); }
 
 	void writeByte(char data);
 	void writeShort(short data);
 	void writeInt(int data);
 	void writeFloat(float data);
 	void writeString(const std::string& str);
+	void writeBytes(const char* data, size_t size);
+
+	/**
+	 * 共有ブロックの書き込み
+	 * 同じ内容をwriteShared*()で書き込み済みならその参照を返し、無ければ書き込んで新しい参照を返します
+	 * 新しく書き込むときは、先頭をalignmentバイト境界に揃えます
+	 */
+	Reference writeSharedBytes(const char* data, size_t size, int alignment = 4);
+	Reference writeSharedString(const std::string& str);
+
+	/** バッファの内容をストリームへ書き出して空にする */
+	void flush();
 
 private:
+	char* reserve(size_t size);
+
 	std::ostream&		_out;
 	EndiannessType		_endianness;
-	ReferenceMapType	_referenceMap;
+	std::vector<char>	_buffer;
+	size_t				_pos;
+
+	std::vector<long>	_dataPositions;		/**< 参照ごとの参照先の位置 */
+	std::vector<std::pair<long, Reference> >	_referencePositions;	/**< 参照を書き込んだ位置 */
+
+	struct SharedBlock
+	{
+		Reference	ref;
+		long		pos;
+		size_t		size;
+	};
+	typedef boost::unordered_multimap<size_t, SharedBlock> SharedBlockMapType;
+	SharedBlockMapType	_sharedBlocks;		/**< 内容のハッシュ値から共有ブロックを引く */
 };
 
 #endif /* defined(__BinaryDataWriter__) */
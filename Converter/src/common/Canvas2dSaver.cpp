@@ -267,23 +267,29 @@ void writeParts(std::ostream& out, textenc::Encoding outEncoding, ss::SsMotion::
 
 	// 各パーツのフレームごとのパラメータ値 
 	int outtedFrameCount = 0;
+	const SsMotionFrameDecoder::Tracks tracks(motion);
+	// フレーム間で使い回す作業領域 
+	std::vector<SsMotionFrameDecoder::FrameParam> r;
+	std::vector<int> order;
 	for (int frameNo = 0; frameNo < motion->getTotalFrame(); frameNo++)
 	{
 		// このフレームのパラメータを計算する 
-		std::vector<SsMotionFrameDecoder::FrameParam> r;
-		SsMotionFrameDecoder::decodeNodes(r, motion, frameNo, SsMotionFrameDecoder::InheritCalcuation_Calculate);
+		SsMotionFrameDecoder::decodeNodes(r, tracks, frameNo, SsMotionFrameDecoder::InheritCalcuation_Calculate);
 
 		// 優先順位でソート 
-		std::sort(r.begin(), r.end(), SsMotionFrameDecoder::FrameParam::priorityComparator);
+		SsMotionFrameDecoder::sortByPriority(order, r);
 
         // データ出力の必要ないものはリストから削除する
-        std::vector<SsMotionFrameDecoder::FrameParam>::iterator removes =
-            std::remove_if(r.begin(), r.end(), isRemovePart);
-        r.erase(removes, r.end());
+		std::vector<int>::iterator last = order.begin();
+		for (std::vector<int>::iterator i = order.begin(); i != order.end(); ++i)
+		{
+			if (!isRemovePart(r[*i])) *last++ = *i;
+		}
+		order.erase(last, order.end());
 
-        //int partCount = static_cast<int>(r.size());
+        //int partCount = static_cast<int>(order.size());
 
-		if (!r.empty())
+		if (!order.empty())
 		{
 			if (outtedFrameCount > 0) out << format(",%1%") % crlf;
 
@@ -292,8 +298,9 @@ void writeParts(std::ostream& out, textenc::Encoding outEncoding, ss::SsMotion::
 			SsMotionFrameDecoder::FrameParam dummy;
 
 			int partCount = 0;
-			BOOST_FOREACH( SsMotionFrameDecoder::FrameParam& param, r )
+			BOOST_FOREACH( int index, order )
 			{
+				const SsMotionFrameDecoder::FrameParam& param = r[index];
 				Indenting _;
 
 				if (partCount++ > 0) out << "," << crlf;
@@ -369,7 +376,7 @@ namespace
  */
 static void writeFrameParam(std::ostream& out, const SsMotionFrameDecoder::FrameParam& param, ss::SsImageList::ConstPtr imageList, const std::string& prefixLabel, int frameNo)
 {
-	SsNode::ConstPtr node = param.node;
+	const SsNode* node = param.node;
 
 	SsRect souRect  = getPicRect(param);
 
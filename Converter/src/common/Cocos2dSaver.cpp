@@ -11,7 +11,16 @@
 #include "MathUtil.h"
 #include "TextEncoding.h"
 #include "DebugUtil.h"
+#include "Compression.h"
+#include "SaverUtil.h"
 #include <cassert>
+#include <cmath>
+#include <sstream>
+#include <map>
+#include <algorithm>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <boost/exception_ptr.hpp>
 
 using boost::shared_ptr;
 using boost::format;
@@ -20,6 +29,15 @@ using namespace ss;
 // インデントあたりのスペース数
 #define SPACE_OF_INDENT		2
 
+// 並列エンコード時、１スレッドがまとめて受け持つフレーム数（この単位でバッファリングし出力する）
+#define FRAMES_PER_JOB		32
+
+// 量子化時の回転角（1周）のビット数
+// 回転角は1周で折り返した符号なしの値になるため、補間や誤差の判定は最短の向きの差（angleDifference）で行う
+#define QUANTIZE_ANGLE_BITS				16
+// 量子化時のスケールの小数部ビット数（8.8固定小数点）
+#define QUANTIZE_SCALE_FRACTION_BITS	8
+
 
 namespace {
 
@@ -27,31 +45,37 @@ namespace {
 	static const int		FormatVersion_3 = 3;		// 2013/10/30 パーツデータに、パーツタイプ、αブレンド方法を追加
 	static const int		FormatVersion_4 = 4;		// 2013/11/21 Cocos2d-xでアフィン変換を行うための情報を追加
 	static const int		FormatVersion_5 = 5;		// 2014/07/10 X,Y座標の精度をshortからfloatに変更
+	static const int		FormatVersion_6 = 6;		// 前フレームからの差分によるフレームデータとキーフレームインデックス、量子化テーブル、フレームデータの圧縮を追加
+
+	static const int		HeaderSize = 64;			// ヘッダー部として予約するサイズ
+	static const int		ExtendedHeaderSize = 128;	// 参照元の範囲の表を使うときに予約するサイズ
+	static const int		PageSize = 4096;			// セクションをページ境界に揃えるときの単位
 
 	static const int		CurrentFormatVersion = FormatVersion_5;
 
 
 
 
-	/** 現在のインデント数をカウントするクラス */
+	/** インデント数を保持するストリーム内の領域 */
+	static const int s_indentIndex = std::ios_base::xalloc();
+
+	/** 現在のインデント数をカウントするクラス（スレッド間で共有しないよう、出力先ストリームごとに保持する） */
 	class Indenting
 	{
-		static int s_count;
+		std::ostream&	_os;
 
 	public:
-		Indenting()  { s_count++; }
-		~Indenting() { s_count--; }
-		static int getCount() { return s_count; }
+		Indenting(std::ostream& os) : _os(os) { _os.iword(s_indentIndex)++; }
+		~Indenting() { _os.iword(s_indentIndex)--; }
+		static int getCount(std::ios_base& os) { return static_cast<int>(os.iword(s_indentIndex)); }
 	};
 
-	int Indenting::s_count = 0;
-
 
 	/** 現在のインデント数に合わせスペースを挿入するマニピュレータ */
 	std::ostream& indent(std::ostream& ros)
 	{
 		std::string s;
-		for (int i = 0; i < Indenting::getCount() * SPACE_OF_INDENT; i++) s.append(" ");
+		for (int i = 0; i < Indenting::getCount(ros) * SPACE_OF_INDENT; i++) s.append(" ");
 		return ros << s;
 	}
 
@@ -117,6 +141,12 @@ enum {
 	SS_DATA_FLAG_USE_COLOR_BLEND	= 1 << 1,
 	SS_DATA_FLAG_USE_ALPHA_BLEND	= 1 << 2,
 	SS_DATA_FLAG_USE_AFFINE_TRANS	= 1 << 3,
+	SS_DATA_FLAG_DELTA_FRAMES		= 1 << 4,
+	SS_DATA_FLAG_QUANTIZED			= 1 << 5,
+	SS_DATA_FLAG_COMPRESSED_FRAMES	= 1 << 6,
+	SS_DATA_FLAG_CURVES				= 1 << 7,
+	SS_DATA_FLAG_RECT_TABLE			= 1 << 8,
+	SS_DATA_FLAG_FIXED_RECORDS		= 1 << 9,
 
 	NUM_SS_DATA_FLAGS
 };
@@ -156,6 +186,31 @@ enum {
 									  SS_PART_FLAG_VERTEX_COLOR_BR
 };
 
+/** 差分形式のフレームデータで、前フレームから変化した要素を示すフラグ */
+enum {
+	SS_DELTA_FLAG_FLAGS				= 1 << 0,
+	SS_DELTA_FLAG_SOURCE_RECT		= 1 << 1,
+	SS_DELTA_FLAG_POSITION			= 1 << 2,
+	SS_DELTA_FLAG_ORIGIN			= 1 << 3,
+	SS_DELTA_FLAG_ROTATION			= 1 << 4,
+	SS_DELTA_FLAG_SCALE				= 1 << 5,
+	SS_DELTA_FLAG_OPACITY			= 1 << 6,
+	SS_DELTA_FLAG_VERTEX_OFFSET		= 1 << 7,
+	SS_DELTA_FLAG_COLOR_BLEND		= 1 << 8,
+
+	NUM_SS_DELTA_FLAGS,
+
+	SS_DELTA_FLAGS_ALL				= SS_DELTA_FLAG_FLAGS |
+									  SS_DELTA_FLAG_SOURCE_RECT |
+									  SS_DELTA_FLAG_POSITION |
+									  SS_DELTA_FLAG_ORIGIN |
+									  SS_DELTA_FLAG_ROTATION |
+									  SS_DELTA_FLAG_SCALE |
+									  SS_DELTA_FLAG_OPACITY |
+									  SS_DELTA_FLAG_VERTEX_OFFSET |
+									  SS_DELTA_FLAG_COLOR_BLEND
+};
+
 enum {
 	SS_USER_DATA_FLAG_NUMBER		= 1 << 0,
 	SS_USER_DATA_FLAG_RECT			= 1 << 1,
@@ -180,12 +235,26 @@ struct Context
 	const bool				binaryFormatMode;
 	const textenc::Encoding	outEncoding;
 	const Cocos2dSaver::Options	options;
+	Cocos2dSaver::QuantizationError	quantizationError;
+	Cocos2dSaver::ResamplingReport	resamplingReport;
 
 	const std::string		prefix;
 	const std::string		dataBase;
 	const std::string		imageDataLabel;
 	const std::string		frameDataLabel;
 	const std::string		partDataLabel;
+	const std::string		keyframeIndexLabel;
+	const std::string		frameTimesLabel;
+	const std::string		imageRectsLabel;
+
+	const BinaryDataWriter::Reference	imageDataRef;
+	const BinaryDataWriter::Reference	frameDataRef;
+	const BinaryDataWriter::Reference	partDataRef;
+	const BinaryDataWriter::Reference	keyframeIndexRef;
+	const BinaryDataWriter::Reference	frameChunkDataRef;
+	const BinaryDataWriter::Reference	curveDataRef;
+	const BinaryDataWriter::Reference	frameTimesRef;
+	const BinaryDataWriter::Reference	imageRectsRef;
 
 	Context(std::ostream& out, bool binaryFormatMode, textenc::Encoding outEncoding, const Cocos2dSaver::Options& options, const std::string& prefix)
 		: out(out)
@@ -200,6 +269,17 @@ struct Context
 		, imageDataLabel((format("%1%_imageData") % prefix).str())
 		, frameDataLabel((format("%1%_frameData") % prefix).str())
 		, partDataLabel((format("%1%_partData") % prefix).str())
+		, keyframeIndexLabel((format("%1%_keyframeIndex") % prefix).str())
+		, frameTimesLabel((format("%1%_frameTimes") % prefix).str())
+		, imageRectsLabel((format("%1%_imageRects") % prefix).str())
+		, imageDataRef(bout.newReference())
+		, frameDataRef(bout.newReference())
+		, partDataRef(bout.newReference())
+		, keyframeIndexRef(bout.newReference())
+		, frameChunkDataRef(bout.newReference())
+		, curveDataRef(bout.newReference())
+		, frameTimesRef(bout.newReference())
+		, imageRectsRef(bout.newReference())
 	{
 	}
 
@@ -208,13 +288,129 @@ struct Context
 		if (binaryFormatMode)
 		{
 			bout.fixReferences();
+			bout.flush();
 		}
 	}
 };
 
+
+/**
+ * フレームデータの出力先
+ * フレームごとに個別のバッファへ出力できるよう、Contextから分離しています
+ */
+struct FrameStream
+{
+	std::ostream&			out;
+	BinaryDataWriter		bout;
+	const bool				sourceFormatMode;
+	const textenc::Encoding	outEncoding;
+	const bool				quantize;
+	const int				positionFractionBits;
+	const bool				rectTable;
+	const bool				fixedRecords;
+
+	FrameStream(std::ostream& out, const Context& context)
+		: out(out)
+		, bout(out)
+		, sourceFormatMode(context.sourceFormatMode)
+		, outEncoding(context.outEncoding)
+		, quantize(context.options.quantize)
+		, positionFractionBits(context.options.positionFractionBits)
+		, rectTable(context.options.rectTable)
+		, fixedRecords(context.binaryFormatMode && context.options.fixedRecords)
+	{
+	}
+};
+
+
+/**
+ * パーツ１つ分のフレーム情報
+ * 省略可能な要素もプレイヤーが使う既定値で埋めておき、差分出力時に前フレームとそのまま比較できるようにしています
+ */
+struct PartFrame
+{
+	unsigned int	flags;				/**< SS_PART_FLAG_* */
+	int				partNo;
+	int				imageNo;
+	int				sx, sy, sw, sh;
+	int				rectNo;				/**< 参照元の範囲の表での番号（表を使うときにwriteParts内で割り当てる） */
+	float			dx, dy;
+	int				ox, oy;
+	float			rotation;
+	float			scaleX, scaleY;
+	int				opacity;
+	SsPoint			vertexOffsets[4];	/**< 左上、右上、左下、右下の順 */
+	int				blendNo;
+	unsigned int	colors[4];			/**< 左上、右上、左下、右下の順（ARGB） */
+};
+
+
+/**
+ * 前フレームから変化した要素だけを出力するエンコーダ
+ * パーツごとに直前に出力した値を保持します
+ */
+class PartFrameDeltaEncoder
+{
+	std::vector<PartFrame>	_prevFrames;
+	std::vector<bool>		_known;
+
+public:
+	/** キーフレームの先頭で呼び、以降は全要素を出力し直す */
+	void reset();
+	void write(FrameStream& stream, const PartFrame& pf);
+};
+
+
+/**
+ * １フレーム分のエンコード結果 
+ */
+struct FrameBlock
+{
+	std::string		userData;			/**< ユーザーデータ部 */
+	std::string		partFrameData;		/**< パーツのフレームデータ部（差分形式、参照元の範囲の表を使うときはwriteParts内で出力する） */
+	std::vector<PartFrame>	partFrames;	/**< 出力順に並べたパーツのフレーム情報 */
+	int				numUserData;
+	int				numParts;
+	int				ssDataFlags;		/**< このフレームの出力で必要になったSS_DATA_FLAG_* */
+	Cocos2dSaver::QuantizationError	quantizationError;	/**< このフレームの量子化で生じた誤差 */
+
+	FrameBlock() : numUserData(0), numParts(0), ssDataFlags(0) {}
+};
+
+
+/**
+ * 圧縮して出力したフレームデータのチャンク
+ */
+struct FrameChunk
+{
+	BinaryDataWriter::Reference	dataRef;
+	size_t						compressedSize;
+	size_t						size;				/**< 展開後のサイズ */
+};
+
+
+/**
+ * フレームのエンコードで使う作業領域
+ * フレーム間で使い回し、フレームごとのメモリ確保を避けます
+ */
+struct FrameScratch
+{
+	std::vector<SsMotionFrameDecoder::FrameParam>	params;
+	std::vector<int>								order;		/**< 出力するparamsを出力順に並べたインデックス */
+	SsMotionFrameDecoder::UserDataTable				userData;
+};
+
 static void writeParts(Context& context, ss::SsMotion::Ptr motion);
-static int writeFrameParam(Context& context, const SsMotionFrameDecoder::FrameParam& param, const SsMotionFrameDecoder::FrameParam& parentParam, bool relatively);
-static void writeUserData(Context& context, const SsMotionFrameDecoder::FrameParam& param);
+static void encodeFrames(std::vector<FrameBlock>& blocks, std::vector<FrameScratch>& scratches, const Context& context, const SsMotionFrameDecoder::Tracks& tracks, int startFrameNo, int endFrameNo, SsMotionFrameDecoder::InheritCalcuationType inheritCalc, int numJobs);
+static void encodeFrame(FrameBlock& block, FrameScratch& scratch, const Context& context, const SsMotionFrameDecoder::Tracks& tracks, int frameNo, SsMotionFrameDecoder::InheritCalcuationType inheritCalc);
+static void writePartFrames(std::string& result, const Context& context, int frameNo, const std::vector<PartFrame>& partFrames, PartFrameDeltaEncoder* deltaEncoder);
+static int makePartFrame(PartFrame& pf, const SsMotionFrameDecoder::FrameParam& param, const SsMotionFrameDecoder::FrameParam& parentParam, bool relatively);
+static void writePartFrame(FrameStream& stream, const PartFrame& pf);
+static void writeFixedPartFrames(FrameStream& stream, const std::vector<PartFrame>& partFrames);
+static void quantizePartFrame(PartFrame& pf, int positionFractionBits, Cocos2dSaver::QuantizationError& error);
+static void writeUserData(FrameStream& stream, const SsMotionFrameDecoder::FrameParam& param, const SsUserDataValue& value);
+static void writeCurves(Context& context, ss::SsMotion::Ptr motion);
+static void selectFrames(std::vector<int>& storedFrameNos, const std::vector<FrameBlock>& blocks, const Cocos2dSaver::Options& options, int fps, Cocos2dSaver::ResamplingReport& report);
 static void writeImageList(Context& context, ss::SsImageList::ConstPtr imageList);
 
 
@@ -229,7 +425,9 @@ void Cocos2dSaver::save(
 	ss::SsMotion::Ptr motion,
 	ss::SsImageList::ConstPtr optImageList, 
 	const std::string& prefixLabel,
-	const std::string& creatorComment)
+	const std::string& creatorComment,
+	QuantizationError* quantizationError,
+	ResamplingReport* resamplingReport)
 {
 	Context context(out, binaryFormatMode, outEncoding, options, prefixLabel);
 	
@@ -244,7 +442,7 @@ void Cocos2dSaver::save(
 	else
 	{
 		// ヘッダー部を予約しておく
-		context.bout.fill(0, 64);
+		context.bout.fill(0, options.rectTable ? ExtendedHeaderSize : HeaderSize);
 		// creator情報埋め込み
 		context.bout.writeString(creatorComment);
 		context.bout.align(64);
@@ -263,6 +461,9 @@ void Cocos2dSaver::save(
 	// 各パーツのフレームデータと、fpsなどの基盤情報の出力 
 	writeParts(context, motion);
 	if (context.sourceFormatMode) context.out << std::endl;
+
+	if (quantizationError) *quantizationError = context.quantizationError;
+	if (resamplingReport) *resamplingReport = context.resamplingReport;
 }
 
 
@@ -283,8 +484,6 @@ static bool isInvisiblePart(const SsMotionFrameDecoder::FrameParam& r)
  */
 void writeParts(Context& context, ss::SsMotion::Ptr motion)
 {
-	const bool parentageEnabled = false;
-
 	// フラグ初期化
 	int ssDataFlags = 0;
 	// デフォルトでは継承の計算を行う
@@ -300,141 +499,180 @@ void writeParts(Context& context, ss::SsMotion::Ptr motion)
 	}
 
 	// 各パーツのフレームごとのパラメータ値
-	std::vector<int> framesPartCounts;
-	std::vector<int> framesUserDataCounts;
-	for (int frameNo = 0; frameNo < motion->getTotalFrame(); frameNo++)
+	// フレームごとに個別のバッファへエンコードし、フレーム順に連結して出力する
+	const int numFrames = motion->getTotalFrame();
+	int numJobs = context.options.numJobs;
+	if (numJobs <= 0) numJobs = std::max(1, static_cast<int>(boost::thread::hardware_concurrency()));
+	const int framesPerBatch = numJobs * FRAMES_PER_JOB;
+
+	// 各アトリビュートを事前に全フレーム分展開しておく
+	const SsMotionFrameDecoder::Tracks tracks(motion);
+
+	// 差分形式のときは前フレームとの比較が必要になるため、フレーム順に出力する
+	const int keyframeInterval = context.options.keyframeInterval;
+	const bool deltaEnabled = keyframeInterval > 0;
+	PartFrameDeltaEncoder deltaEncoder;
+	std::vector<int> keyframes;
+	if (deltaEnabled) ssDataFlags |= SS_DATA_FLAG_DELTA_FRAMES;
+	if (context.options.quantize) ssDataFlags |= SS_DATA_FLAG_QUANTIZED;
+
+	// 圧縮するときはフレームのデータをチャンクごとのバッファへ出力し、チャンク単位で圧縮する
+	// フレームデータのオフセットは、展開したチャンクの先頭からの位置になる
+	const int framesPerChunk = context.options.framesPerChunk;
+	const bool compressEnabled = context.binaryFormatMode && framesPerChunk > 0;
+	std::ostringstream chunkBuf(std::ios_base::out | std::ios_base::binary);
+	BinaryDataWriter chunkOut(chunkBuf);
+	BinaryDataWriter& frameOut = compressEnabled ? chunkOut : context.bout;
+	std::vector<FrameChunk> chunks;
+	if (compressEnabled) ssDataFlags |= SS_DATA_FLAG_COMPRESSED_FRAMES;
+
+	// カーブ形式ではパーツのフレーム情報をプレイヤーが計算するため、フレームごとにはユーザーデータだけを出力する
+	const bool curveEnabled = context.binaryFormatMode && context.options.curveFormat;
+	if (curveEnabled) ssDataFlags |= SS_DATA_FLAG_CURVES;
+
+	// 参照元の範囲は画像ごとの表にまとめ、フレームには出現順に割り当てた表での番号を出力する
+	const bool rectTableEnabled = context.options.rectTable;
+	saverutil::ImageRectList imageRectList(0);
+	if (rectTableEnabled) ssDataFlags |= SS_DATA_FLAG_RECT_TABLE;
+
+	// 固定長形式では、要素ごとの配列をそのまま読めるようフレームのデータを16バイト境界に置く
+	const bool fixedRecordsEnabled = context.binaryFormatMode && context.options.fixedRecords;
+	const int partFrameDataAlignment = fixedRecordsEnabled ? 16 : 4;
+	if (fixedRecordsEnabled) ssDataFlags |= SS_DATA_FLAG_FIXED_RECORDS;
+
+	// フレームを間引くときは全フレームを先にエンコードしてから、出力するフレームを選ぶ
+	// 出力するフレームには元のフレームNoを記録し、間のフレームはプレイヤーが前後のフレームから補間する
+	// 以降、フレームデータの並び（recordNo）は出力するフレームの順で、間引かないときはフレームNoと同じになる
+	const bool resampleEnabled = context.options.resampleFps > 0 || context.options.maxResampleError >= 0;
+	std::vector<FrameBlock> blocks;
+	std::vector<FrameScratch> scratches(numJobs);
+	std::vector<int> storedFrameNos;
+	if (resampleEnabled)
+	{
+		encodeFrames(blocks, scratches, context, tracks, 0, numFrames, inheritCalc, numJobs);
+		selectFrames(storedFrameNos, blocks, context.options, motion->getBaseTickTime(), context.resamplingReport);
+		context.resamplingReport.numFrames = numFrames;
+		context.resamplingReport.numStoredFrames = static_cast<int>(storedFrameNos.size());
+	}
+	else
 	{
-		// このフレームのパラメータを計算する
-		std::vector<SsMotionFrameDecoder::FrameParam> r;
-		SsMotionFrameDecoder::decodeNodes(r, motion, frameNo, inheritCalc);
+		for (int frameNo = 0; frameNo < numFrames; frameNo++) storedFrameNos.push_back(frameNo);
+	}
+	const int numStoredFrames = static_cast<int>(storedFrameNos.size());
+	// 1フレームも間引けなかったときは、間引かないときと同じ形式で出力する
+	const bool frameTimesEnabled = numStoredFrames < numFrames;
 
-//		if (context.sourceFormatMode)
-//		{
-//			debug::dumpPrefix(context.out, frameNo);
-//			debug::dumpFrameParamList(context.out, r);
-//			debug::dumpSuffix(context.out);
-//		}
+	// メモリにマップして読むとき、使わないセクションのページに触れずに済むよう
+	// フレームのデータ、フレームのインデックス、パーツ情報の先頭をページ境界に揃える（バイナリ形式のみ）
+	const bool pageAlignEnabled = context.binaryFormatMode && context.options.pageAlign;
+	if (pageAlignEnabled) context.bout.align(PageSize);
 
-		if (!parentageEnabled)
-		{
-			// 優先順位でソート 
-			std::sort(r.begin(), r.end(), SsMotionFrameDecoder::FrameParam::priorityComparator);
-		}
-		
+	std::vector<int> framesPartCounts;
+	std::vector<int> framesUserDataCounts;
+	std::vector<BinaryDataWriter::Reference> framesPartFrameDataRefs(numStoredFrames);
+	std::vector<BinaryDataWriter::Reference> framesUserDataRefs(numStoredFrames);
+	std::vector<long> framesPartFrameDataOffsets(numStoredFrames);
+	std::vector<long> framesUserDataOffsets(numStoredFrames);
+	for (int batchStartRecordNo = 0; batchStartRecordNo < numStoredFrames; batchStartRecordNo += framesPerBatch)
+	{
+		int batchEndRecordNo = std::min(numStoredFrames, batchStartRecordNo + framesPerBatch);
+		if (!resampleEnabled) encodeFrames(blocks, scratches, context, tracks, batchStartRecordNo, batchEndRecordNo, inheritCalc, numJobs);
 
-		// ユーザーデータが含まれているものだけ抜き出す
-		std::vector<SsMotionFrameDecoder::FrameParam> userDataInc;
-		BOOST_FOREACH( const SsMotionFrameDecoder::FrameParam& v, r )
-		{
-			if (v.udat.value.hasData())
-			{
-				userDataInc.push_back(v);
-			}
-		}
-		
-		// このフレームのユーザーデータを出力する
-		if (!userDataInc.empty())
+		for (int recordNo = batchStartRecordNo; recordNo < batchEndRecordNo; recordNo++)
 		{
-			std::string label = (format("%1%_userData_%2%") % context.prefix % frameNo).str();
-		
-			if (context.sourceFormatMode)
-			{
-				context.out << format("static const ss_u16 %1%[] = {") % label;
-				context.out << std::endl;
-			}
-			else
-			{
-				context.bout.setReference(label);
-			}
+			const int frameNo = storedFrameNos[recordNo];
+			FrameBlock& block = resampleEnabled ? blocks.at(frameNo) : blocks.at(recordNo - batchStartRecordNo);
+			if (curveEnabled) block.numParts = 0;
 
-			bool first = true;
-			BOOST_FOREACH( const SsMotionFrameDecoder::FrameParam& v, userDataInc )
+			if (rectTableEnabled)
 			{
-				Indenting _;
-
-				if (context.sourceFormatMode)
+				BOOST_FOREACH( PartFrame& pf, block.partFrames )
 				{
-					if (!first) context.out << "," << std::endl;
-					first = false;
-					context.out << indent;
+					if (pf.imageNo >= 0) pf.rectNo = imageRectList.append(pf.imageNo, SsRect(pf.sx, pf.sy, pf.sx + pf.sw, pf.sy + pf.sh));
 				}
-
-				writeUserData(context, v);
-			}
-		
-			if (context.sourceFormatMode)
-			{
-				context.out << std::endl;
-
-				context.out << "};";
-				context.out << std::endl;
 			}
-		}
-		framesUserDataCounts.push_back(static_cast<int>(userDataInc.size()));
-
 
-		// 継承計算を行う場合、表示されないものはリストから削除する
-		if (!context.options.useTragetAffineTransformation)
-		{
-			std::vector<SsMotionFrameDecoder::FrameParam>::iterator removes =
-				std::remove_if(r.begin(), r.end(), isInvisiblePart);
-			r.erase(removes, r.end());
-		}
-        
-		int partCount = static_cast<int>(r.size());
-		framesPartCounts.push_back(partCount);
-
-		if (!r.empty())
-		{
-			std::string label = (format("%1%_partFrameData_%2%") % context.prefix % frameNo).str();
-		
-			if (context.sourceFormatMode)
+			if (deltaEnabled)
 			{
-				context.out << format("static const ss_u16 %1%[] = {") % label;
-				context.out << std::endl;
+				// キーフレームでは全パーツの全要素を出力する
+				if (recordNo % keyframeInterval == 0)
+				{
+					deltaEncoder.reset();
+					keyframes.push_back(recordNo);
+				}
+				writePartFrames(block.partFrameData, context, frameNo, block.partFrames, &deltaEncoder);
 			}
-			else
+			else if (rectTableEnabled)
 			{
-				context.bout.setReference(label);
+				writePartFrames(block.partFrameData, context, frameNo, block.partFrames, NULL);
 			}
 
-			SsMotionFrameDecoder::FrameParam dummy;
-
-			int partCount = 0;
-			BOOST_FOREACH( SsMotionFrameDecoder::FrameParam& param, r )
+			// このフレームのユーザーデータを出力する
+			if (block.numUserData)
 			{
-				Indenting _;
-
-				if (context.sourceFormatMode)
+				if (context.binaryFormatMode)
 				{
-					if (partCount > 0) context.out << "," << std::endl;
-					context.out << indent;
+					// 同じ内容のブロックを出力済みならそれを参照する
+					framesUserDataRefs[recordNo] = frameOut.writeSharedBytes(block.userData.data(), block.userData.size());
+				}
+				else
+				{
+					context.out.write(block.userData.data(), block.userData.size());
 				}
-				partCount++;
+			}
+			framesUserDataCounts.push_back(block.numUserData);
 
-				if (param.node->isRoot())
+			// このフレームのパーツ情報を出力する
+			if (block.numParts)
+			{
+				if (context.binaryFormatMode)
 				{
-					ssDataFlags |= writeFrameParam(context, param, dummy, parentageEnabled);
+					// 静止ポーズやループなどで同じ内容になったフレームは出力済みのブロックを参照する
+					framesPartFrameDataRefs[recordNo] = frameOut.writeSharedBytes(block.partFrameData.data(), block.partFrameData.size(), partFrameDataAlignment);
 				}
 				else
 				{
-					//int paramIndex = toCocos2dPartId(param.node->getParentId());
-					ssDataFlags |= writeFrameParam(context, param, dummy, parentageEnabled);
+					context.out.write(block.partFrameData.data(), block.partFrameData.size());
 				}
 			}
-			
-			if (context.sourceFormatMode)
-			{
-				context.out << std::endl;
+			framesPartCounts.push_back(block.numParts);
 
-				context.out << "};";
-				context.out << std::endl;
+			ssDataFlags |= block.ssDataFlags;
+
+			// チャンクの区切りで、溜めたフレームのデータを圧縮して出力する
+			if (compressEnabled && ((recordNo + 1) % framesPerChunk == 0 || recordNo + 1 == numStoredFrames))
+			{
+				for (int chunkRecordNo = recordNo - recordNo % framesPerChunk; chunkRecordNo <= recordNo; chunkRecordNo++)
+				{
+					if (framesPartCounts[chunkRecordNo]) framesPartFrameDataOffsets[chunkRecordNo] = chunkOut.getReferencePosition(framesPartFrameDataRefs[chunkRecordNo]);
+					if (framesUserDataCounts[chunkRecordNo]) framesUserDataOffsets[chunkRecordNo] = chunkOut.getReferencePosition(framesUserDataRefs[chunkRecordNo]);
+				}
+				chunkOut.flush();
+				std::string raw = chunkBuf.str();
+				chunkBuf.str("");
+
+				std::vector<char> compressed;
+				compression::compress(raw.data(), raw.size(), compressed);
+
+				FrameChunk chunk;
+				chunk.dataRef = context.bout.newReference();
+				chunk.compressedSize = compressed.size();
+				chunk.size = raw.size();
+				context.bout.setReference(chunk.dataRef);
+				context.bout.writeBytes(&compressed[0], compressed.size());
+				chunks.push_back(chunk);
 			}
+
+			Cocos2dSaver::QuantizationError& error = context.quantizationError;
+			error.position = std::max(error.position, block.quantizationError.position);
+			error.rotation = std::max(error.rotation, block.quantizationError.rotation);
+			error.scale    = std::max(error.scale,    block.quantizationError.scale);
 		}
 	}
 
 
 	// フレームごとのパラメータ値を参照するためのインデックス 
+	if (pageAlignEnabled) context.bout.align(PageSize);
 	if (context.sourceFormatMode)
 	{
 		context.out << format("static const SSFrameData %1%[] = {") % context.frameDataLabel;
@@ -442,16 +680,17 @@ void writeParts(Context& context, ss::SsMotion::Ptr motion)
 	}
 	else
 	{
-		context.bout.setReference(context.frameDataLabel);
+		context.bout.setReference(context.frameDataRef);
 	}
 	
-	for (int frameNo = 0; frameNo < motion->getTotalFrame(); frameNo++)
+	for (int recordNo = 0; recordNo < numStoredFrames; recordNo++)
 	{
-		Indenting _;
+		Indenting _(context.out);
+		const int frameNo = storedFrameNos[recordNo];
 
 		if (context.sourceFormatMode)
 		{
-			if (frameNo > 0) context.out << "," << std::endl;
+			if (recordNo > 0) context.out << "," << std::endl;
 			context.out << indent;
 		}
 
@@ -462,14 +701,14 @@ void writeParts(Context& context, ss::SsMotion::Ptr motion)
 		//	ss_s16		numUserData;
 		//} SSFrameData;
 
-		int partCount = framesPartCounts.at(frameNo);
-		int userDataCount = framesUserDataCounts.at(frameNo);
+		int partCount = framesPartCounts.at(recordNo);
+		int userDataCount = framesUserDataCounts.at(recordNo);
 		
-		std::string partFrameDataLabel = (format("%1%_partFrameData_%2%") % context.prefix % frameNo).str();
-		std::string userDataLabel = (format("%1%_userData_%2%") % context.prefix % frameNo).str();
-
 		if (context.sourceFormatMode)
 		{
+			std::string partFrameDataLabel = (format("%1%_partFrameData_%2%") % context.prefix % frameNo).str();
+			std::string userDataLabel = (format("%1%_userData_%2%") % context.prefix % frameNo).str();
+
 			context.out << "{ ";
 
 			if (partCount)
@@ -497,18 +736,26 @@ void writeParts(Context& context, ss::SsMotion::Ptr motion)
 		}
 		else
 		{
-			if (partCount)
+			if (partCount && compressEnabled)
 			{
-				context.bout.writeReference(partFrameDataLabel);
+				context.bout.writeInt(framesPartFrameDataOffsets[recordNo]);
+			}
+			else if (partCount)
+			{
+				context.bout.writeReference(framesPartFrameDataRefs[recordNo]);
 			}
 			else
 			{
 				context.bout.writeInt(0);
 			}
 
-			if (userDataCount)
+			if (userDataCount && compressEnabled)
+			{
+				context.bout.writeInt(framesUserDataOffsets[recordNo]);
+			}
+			else if (userDataCount)
 			{
-				context.bout.writeReference(userDataLabel);
+				context.bout.writeReference(framesUserDataRefs[recordNo]);
 			}
 			else
 			{
@@ -528,24 +775,210 @@ void writeParts(Context& context, ss::SsMotion::Ptr motion)
 	}
 
 
+	// 任意のフレームへ移動するときに、デコードを始めるキーフレームの一覧
+	if (deltaEnabled)
+	{
+		if (context.sourceFormatMode)
+		{
+			context.out << format("static const ss_s16 %1%[] = {") % context.keyframeIndexLabel;
+			context.out << std::endl;
+			{
+				Indenting _(context.out);
+				context.out << indent;
+				for (size_t i = 0; i < keyframes.size(); i++)
+				{
+					if (i > 0) context.out << ", ";
+					context.out << keyframes[i];
+				}
+				context.out << std::endl;
+			}
+			context.out << "};";
+			context.out << std::endl;
+		}
+		else
+		{
+			context.bout.setReference(context.keyframeIndexRef);
+			BOOST_FOREACH( int frameNo, keyframes )
+			{
+				context.bout.writeShort(frameNo);
+			}
+		}
+	}
+
+
+	// 出力したフレームごとの元のフレームNo
+	if (frameTimesEnabled)
+	{
+		if (context.sourceFormatMode)
+		{
+			context.out << format("static const ss_s16 %1%[] = {") % context.frameTimesLabel;
+			context.out << std::endl;
+			{
+				Indenting _(context.out);
+				context.out << indent;
+				for (size_t i = 0; i < storedFrameNos.size(); i++)
+				{
+					if (i > 0) context.out << ", ";
+					context.out << storedFrameNos[i];
+				}
+				context.out << std::endl;
+			}
+			context.out << "};";
+			context.out << std::endl;
+		}
+		else
+		{
+			context.bout.setReference(context.frameTimesRef);
+			BOOST_FOREACH( int frameNo, storedFrameNos )
+			{
+				context.bout.writeShort(frameNo);
+			}
+		}
+	}
+
+
+	// 画像ごとの参照元の範囲の表
+	const int numRectImages = imageRectList.numImages();
+	if (rectTableEnabled && numRectImages > 0)
+	{
+		//typedef struct {
+		//	ss_s16		left;
+		//	ss_s16		top;
+		//	ss_s16		width;
+		//	ss_s16		height;
+		//} SSTextureRect;
+
+		//typedef struct {
+		//	ss_offset	rects;
+		//	ss_s16		numRects;
+		//	ss_s16		reserved;
+		//} SSImageRects;
+
+		std::vector<BinaryDataWriter::Reference> rectsRefs(numRectImages);
+		for (int imageNo = 0; imageNo < numRectImages; imageNo++)
+		{
+			std::vector<SsRect> rects = imageRectList.getRectList(imageNo);
+			if (rects.empty()) continue;
+
+			if (context.sourceFormatMode)
+			{
+				context.out << format("static const SSTextureRect %1%_rects%2%[] = {") % context.prefix % imageNo;
+				context.out << std::endl;
+				{
+					Indenting _(context.out);
+					for (size_t i = 0; i < rects.size(); i++)
+					{
+						if (i > 0) context.out << "," << std::endl;
+						context.out << indent << format("{ %1%, %2%, %3%, %4% }") % rects[i].getLeft() % rects[i].getTop() % rects[i].getWidth() % rects[i].getHeight();
+					}
+					context.out << std::endl;
+				}
+				context.out << "};";
+				context.out << std::endl;
+			}
+			else
+			{
+				rectsRefs[imageNo] = context.bout.newReference();
+				context.bout.setReference(rectsRefs[imageNo]);
+				BOOST_FOREACH( const SsRect& rect, rects )
+				{
+					context.bout.writeShort(rect.getLeft());
+					context.bout.writeShort(rect.getTop());
+					context.bout.writeShort(rect.getWidth());
+					context.bout.writeShort(rect.getHeight());
+				}
+			}
+		}
+
+		if (context.sourceFormatMode)
+		{
+			context.out << format("static const SSImageRects %1%[] = {") % context.imageRectsLabel;
+			context.out << std::endl;
+		}
+		else
+		{
+			context.bout.setReference(context.imageRectsRef);
+		}
+		for (int imageNo = 0; imageNo < numRectImages; imageNo++)
+		{
+			int numRects = static_cast<int>(imageRectList.getRectList(imageNo).size());
+			if (context.sourceFormatMode)
+			{
+				Indenting _(context.out);
+				if (imageNo > 0) context.out << "," << std::endl;
+				context.out << indent << "{ ";
+				if (numRects)
+				{
+					std::string label = (format("%1%_rects%2%") % context.prefix % imageNo).str();
+					context.out << format("(ss_offset)((char*)%1% - (char*)&%2%)") % label % context.dataBase;
+				}
+				else
+				{
+					context.out << "0";
+				}
+				context.out << format(", %1%, 0 }") % numRects;
+			}
+			else
+			{
+				if (numRects)
+				{
+					context.bout.writeReference(rectsRefs[imageNo]);
+				}
+				else
+				{
+					context.bout.writeInt(0);
+				}
+				context.bout.writeShort(numRects);
+				context.bout.writeShort(0);
+			}
+		}
+		if (context.sourceFormatMode)
+		{
+			context.out << std::endl;
+			context.out << "};";
+			context.out << std::endl;
+		}
+	}
+
+
+	// 圧縮したフレームデータのチャンク一覧
+	if (compressEnabled)
+	{
+		//typedef struct {
+		//	ss_offset	data;
+		//	ss_u32		compressedSize;
+		//	ss_u32		size;
+		//} SSFrameChunk;
+
+		context.bout.setReference(context.frameChunkDataRef);
+		BOOST_FOREACH( const FrameChunk& chunk, chunks )
+		{
+			context.bout.writeReference(chunk.dataRef);
+			context.bout.writeInt(static_cast<int>(chunk.compressedSize));
+			context.bout.writeInt(static_cast<int>(chunk.size));
+		}
+	}
+
+
 	std::vector<SsNode::ConstPtr> nodes = utilities::listTreeNodes(motion->getRootNode());
+	std::vector<BinaryDataWriter::Reference> partNameRefs(nodes.size());
+	if (pageAlignEnabled) context.bout.align(PageSize);
 
 	// パーツ名 
 	{
 		int partCount = 0;
 		BOOST_FOREACH( SsNode::ConstPtr node, nodes )
 		{
-			std::string label = (format("%1%_partName%2%") % context.prefix % partCount).str();
 			std::string encodedName = textenc::convert(node->getName(), textenc::SHIFT_JIS, context.outEncoding);
 			if (context.sourceFormatMode)
 			{
+				std::string label = (format("%1%_partName%2%") % context.prefix % partCount).str();
 				context.out << format("static const char %1%[] = \"%2%\";") % label % encodedName;
 				context.out << std::endl;
 			}
 			else
 			{
-				context.bout.setReference(label);
-				context.bout.writeString(encodedName);
+				partNameRefs[partCount] = context.bout.writeSharedString(encodedName);
 			}
 			partCount++;
 		}
@@ -560,15 +993,14 @@ void writeParts(Context& context, ss::SsMotion::Ptr motion)
 		}
 		else
 		{
-			context.bout.setReference(context.partDataLabel);
+			context.bout.setReference(context.partDataRef);
 		}
 
 		int partCount = 0;
 		BOOST_FOREACH( SsNode::ConstPtr node, nodes )
 		{
-			Indenting _;
+			Indenting _(context.out);
 
-			std::string label = (format("%1%_partName%2%") % context.prefix % partCount).str();
 			int id = toCocos2dPartId(node->getId());
 			int parentId = toCocos2dPartId(node->getParentId());
 			int imageNo = node->getPicId();
@@ -594,6 +1026,7 @@ void writeParts(Context& context, ss::SsMotion::Ptr motion)
 			{
 				if (partCount > 0) context.out << "," << std::endl;
 				context.out << indent;
+				std::string label = (format("%1%_partName%2%") % context.prefix % partCount).str();
 				context.out << "{ ";
 				context.out << format("(ss_offset)((char*)%1% - (char*)&%2%)") % label % context.dataBase;
 				context.out << format(", %1%, %2%, %3%, %4%, %5%") % id % parentId % imageNo % type % alphaBlend;
@@ -601,7 +1034,7 @@ void writeParts(Context& context, ss::SsMotion::Ptr motion)
 			}
 			else
 			{
-				context.bout.writeReference(label);
+				context.bout.writeReference(partNameRefs[partCount]);
 				context.bout.writeShort(id);
 				context.bout.writeShort(parentId);
 				context.bout.writeShort(imageNo);
@@ -621,15 +1054,29 @@ void writeParts(Context& context, ss::SsMotion::Ptr motion)
 	}
 
 
+	// パーツごとのキーフレームと補間方法
+	if (curveEnabled)
+	{
+		writeCurves(context, motion);
+	}
+
+
 	// すべての情報を束ねるデータ本体 
-	const unsigned int version = CurrentFormatVersion;
+	// 差分形式、量子化、圧縮、カーブ形式、間引き、参照元の範囲の表、固定長形式は対応したプレイヤーでしか読めないため、使うときだけバージョンを上げる
+	const bool extendedHeader = deltaEnabled || context.options.quantize || compressEnabled || curveEnabled || frameTimesEnabled || rectTableEnabled || fixedRecordsEnabled;
+	const unsigned int version = extendedHeader ? FormatVersion_6 : CurrentFormatVersion;
 
 	const unsigned int id0 = 0xffffffff;
 	const unsigned int id1 = toId("SSBA");
 	const unsigned int flags = ssDataFlags;
 	int fps = motion->getBaseTickTime();
 	int numParts = motion->getRootNode()->countTreeNodes();
-	int numFrames = motion->getTotalFrame();
+	int numKeyframes = static_cast<int>(keyframes.size());
+	int positionFractionBits = context.options.quantize ? context.options.positionFractionBits : 0;
+	int angleBits = context.options.quantize ? QUANTIZE_ANGLE_BITS : 0;
+	int scaleFractionBits = context.options.quantize ? QUANTIZE_SCALE_FRACTION_BITS : 0;
+	int numChunks = static_cast<int>(chunks.size());
+	int numFrameTimes = frameTimesEnabled ? numStoredFrames : 0;
 
 	//typedef struct {
 	//	ss_u32		id[2];
@@ -641,6 +1088,20 @@ void writeParts(Context& context, ss::SsMotion::Ptr motion)
 	//	ss_s16		numParts;
 	//	ss_s16		numFrames;
 	//	ss_s16		fps;
+	//	ss_s16		numKeyframes;		// version 6以降
+	//	ss_offset	keyframeIndex;		// version 6以降
+	//	ss_u16		positionFractionBits;	// version 6以降
+	//	ss_u16		angleBits;				// version 6以降（1周の範囲に折り返して格納する。補間は最短の向きで行う）
+	//	ss_u16		scaleFractionBits;		// version 6以降
+	//	ss_s16		numFrameTimes;			// version 6以降
+	//	ss_s16		framesPerChunk;			// version 6以降（バイナリ形式のみ）
+	//	ss_s16		numChunks;				// version 6以降（バイナリ形式のみ）
+	//	ss_offset	chunkData;				// version 6以降（バイナリ形式のみ）
+	//	ss_offset	curveData;				// version 6以降（バイナリ形式のみ）
+	//	ss_offset	frameTimes;				// version 6以降
+	//	ss_offset	imageRects;				// version 6以降（参照元の範囲の表を使うときのみ）
+	//	ss_s16		numRectImages;			// version 6以降（参照元の範囲の表を使うときのみ）
+	//	ss_s16		reserved;				// version 6以降（参照元の範囲の表を使うときのみ）
 	//} SSData;
 
 	if (context.sourceFormatMode)
@@ -648,7 +1109,7 @@ void writeParts(Context& context, ss::SsMotion::Ptr motion)
 		context.out << format("SSData %1% = {") % context.dataBase;
 		context.out << std::endl;
 		{
-			Indenting _;
+			Indenting _(context.out);
 
 			context.out << indent << format("{0x%1$08x, 0x%2$08x},") % id0 % id1 << std::endl;
 			context.out << indent << format("%1%,") % version << std::endl;
@@ -660,33 +1121,434 @@ void writeParts(Context& context, ss::SsMotion::Ptr motion)
 
 			context.out << indent << format("%1%,") % numParts << std::endl;
 			context.out << indent << format("%1%,") % numFrames << std::endl;
-			context.out << indent << format("%1%") % fps << std::endl;
-
-			context.out << "};";
-			context.out << std::endl;
-		}
-	}
-	else
-	{
-		// ファイル先頭に書き込む
-		context.bout.seekp(0);
-		
-		context.bout.writeInt(id0);
-		context.bout.writeInt(id1);
+			if (!extendedHeader)
+			{
+				context.out << indent << format("%1%") % fps << std::endl;
+			}
+			else
+			{
+				context.out << indent << format("%1%,") % fps << std::endl;
+				context.out << indent << format("%1%,") % numKeyframes << std::endl;
+				if (deltaEnabled)
+				{
+					context.out << indent << format("(ss_offset)((char*)%1% - (char*)&%2%),") % context.keyframeIndexLabel % context.dataBase << std::endl;
+				}
+				else
+				{
+					context.out << indent << "0," << std::endl;
+				}
+				if (!frameTimesEnabled && !rectTableEnabled)
+				{
+					context.out << indent << format("%1%, %2%, %3%, 0") % positionFractionBits % angleBits % scaleFractionBits << std::endl;
+				}
+				else
+				{
+					context.out << indent << format("%1%, %2%, %3%, %4%,") % positionFractionBits % angleBits % scaleFractionBits % numFrameTimes << std::endl;
+					context.out << indent << "0, 0, 0, 0," << std::endl;
+					context.out << indent;
+					if (frameTimesEnabled)
+					{
+						context.out << format("(ss_offset)((char*)%1% - (char*)&%2%)") % context.frameTimesLabel % context.dataBase;
+					}
+					else
+					{
+						context.out << "0";
+					}
+					if (rectTableEnabled)
+					{
+						context.out << "," << std::endl;
+						context.out << indent;
+						if (numRectImages > 0)
+						{
+							context.out << format("(ss_offset)((char*)%1% - (char*)&%2%),") % context.imageRectsLabel % context.dataBase;
+						}
+						else
+						{
+							context.out << "0,";
+						}
+						context.out << format(" %1%, 0") % numRectImages;
+					}
+					context.out << std::endl;
+				}
+			}
+
+			context.out << "};";
+			context.out << std::endl;
+		}
+	}
+	else
+	{
+		// ファイル先頭に書き込む
+		context.bout.seekp(0);
+		
+		context.bout.writeInt(id0);
+		context.bout.writeInt(id1);
 		context.bout.writeInt(version);
 		context.bout.writeInt(flags);
 
-		context.bout.writeReference(context.partDataLabel);
-		context.bout.writeReference(context.frameDataLabel);
-		context.bout.writeReference(context.imageDataLabel);
+		context.bout.writeReference(context.partDataRef);
+		context.bout.writeReference(context.frameDataRef);
+		context.bout.writeReference(context.imageDataRef);
 
 		context.bout.writeShort(numParts);
 		context.bout.writeShort(numFrames);
 		context.bout.writeShort(fps);
+
+		if (extendedHeader)
+		{
+			context.bout.writeShort(numKeyframes);
+			if (deltaEnabled)
+			{
+				context.bout.writeReference(context.keyframeIndexRef);
+			}
+			else
+			{
+				context.bout.writeInt(0);
+			}
+			context.bout.writeShort(positionFractionBits);
+			context.bout.writeShort(angleBits);
+			context.bout.writeShort(scaleFractionBits);
+			context.bout.writeShort(numFrameTimes);
+
+			context.bout.writeShort(compressEnabled ? framesPerChunk : 0);
+			context.bout.writeShort(numChunks);
+			if (compressEnabled)
+			{
+				context.bout.writeReference(context.frameChunkDataRef);
+			}
+			else
+			{
+				context.bout.writeInt(0);
+			}
+
+			if (curveEnabled)
+			{
+				context.bout.writeReference(context.curveDataRef);
+			}
+			else
+			{
+				context.bout.writeInt(0);
+			}
+
+			if (frameTimesEnabled)
+			{
+				context.bout.writeReference(context.frameTimesRef);
+			}
+			else
+			{
+				context.bout.writeInt(0);
+			}
+
+			// ここから先は予約を広げたヘッダー部に書き込む
+			if (rectTableEnabled)
+			{
+				if (numRectImages > 0)
+				{
+					context.bout.writeReference(context.imageRectsRef);
+				}
+				else
+				{
+					context.bout.writeInt(0);
+				}
+				context.bout.writeShort(numRectImages);
+				context.bout.writeShort(0);
+			}
+		}
+	}
+}
+
+
+
+/**
+ * フレームをエンコードするワーカー
+ * 担当するフレームを一定間隔で受け持ち、個別のFrameBlockに出力します
+ */
+class FrameEncodeWorker
+{
+	std::vector<FrameBlock>&						_blocks;
+	std::vector<FrameScratch>&						_scratches;
+	const Context&									_context;
+	const SsMotionFrameDecoder::Tracks&				_tracks;
+	const int										_startFrameNo;
+	const int										_endFrameNo;
+	const SsMotionFrameDecoder::InheritCalcuationType	_inheritCalc;
+	const int										_numJobs;
+
+	std::vector<boost::exception_ptr>				_errors;
+	std::vector<int>								_errorFrameNos;
+
+public:
+	FrameEncodeWorker(std::vector<FrameBlock>& blocks, std::vector<FrameScratch>& scratches, const Context& context, const SsMotionFrameDecoder::Tracks& tracks, int startFrameNo, int endFrameNo, SsMotionFrameDecoder::InheritCalcuationType inheritCalc, int numJobs)
+		: _blocks(blocks)
+		, _scratches(scratches)
+		, _context(context)
+		, _tracks(tracks)
+		, _startFrameNo(startFrameNo)
+		, _endFrameNo(endFrameNo)
+		, _inheritCalc(inheritCalc)
+		, _numJobs(numJobs)
+		, _errors(numJobs)
+		, _errorFrameNos(numJobs, endFrameNo)
+	{
+	}
+
+	void run(int jobNo)
+	{
+		int frameNo = _startFrameNo + jobNo;
+		try
+		{
+			for (; frameNo < _endFrameNo; frameNo += _numJobs)
+			{
+				encodeFrame(_blocks.at(frameNo - _startFrameNo), _scratches.at(jobNo), _context, _tracks, frameNo, _inheritCalc);
+			}
+		}
+		catch (...)
+		{
+			// ワーカーごとに保持するのでロックは不要
+			_errors[jobNo] = boost::current_exception();
+			_errorFrameNos[jobNo] = frameNo;
+		}
+	}
+
+	/**
+	 * ワーカー内で発生した例外をメインスレッドで元の型のまま投げ直す
+	 * 複数のワーカーで失敗したときは、直列処理と同じく最も若いフレームの例外を選びます
+	 */
+	void rethrowIfFailed() const
+	{
+		int failedJob = -1;
+		for (int jobNo = 0; jobNo < _numJobs; jobNo++)
+		{
+			if (!_errors[jobNo]) continue;
+			if (failedJob < 0 || _errorFrameNos[jobNo] < _errorFrameNos[failedJob]) failedJob = jobNo;
+		}
+		if (failedJob >= 0) boost::rethrow_exception(_errors[failedJob]);
+	}
+};
+
+
+/**
+ * 指定範囲のフレームをエンコードする
+ * numJobsが2以上のときは複数スレッドで並列に処理します
+ */
+static void encodeFrames(std::vector<FrameBlock>& blocks, std::vector<FrameScratch>& scratches, const Context& context, const SsMotionFrameDecoder::Tracks& tracks, int startFrameNo, int endFrameNo, SsMotionFrameDecoder::InheritCalcuationType inheritCalc, int numJobs)
+{
+	blocks.clear();
+	blocks.resize(endFrameNo - startFrameNo);
+
+	if (numJobs <= 1 || endFrameNo - startFrameNo <= 1)
+	{
+		for (int frameNo = startFrameNo; frameNo < endFrameNo; frameNo++)
+		{
+			encodeFrame(blocks.at(frameNo - startFrameNo), scratches.at(0), context, tracks, frameNo, inheritCalc);
+		}
+		return;
+	}
+
+	// アトリビュート定義など関数内staticの初期化をメインスレッドで済ませておく
+	SsMotionFrameDecoder::FrameParam warmup;
+
+	FrameEncodeWorker worker(blocks, scratches, context, tracks, startFrameNo, endFrameNo, inheritCalc, numJobs);
+	boost::thread_group threads;
+	for (int jobNo = 0; jobNo < numJobs; jobNo++)
+	{
+		threads.create_thread(boost::bind(&FrameEncodeWorker::run, &worker, jobNo));
 	}
+	threads.join_all();
+
+	worker.rethrowIfFailed();
 }
 
 
+/**
+ * １フレーム分のパーツ情報とユーザーデータをエンコードする
+ */
+static void encodeFrame(FrameBlock& block, FrameScratch& scratch, const Context& context, const SsMotionFrameDecoder::Tracks& tracks, int frameNo, SsMotionFrameDecoder::InheritCalcuationType inheritCalc)
+{
+	const bool parentageEnabled = false;
+
+	// このフレームのパラメータを計算する
+	std::vector<SsMotionFrameDecoder::FrameParam>& r = scratch.params;
+	std::vector<int>& order = scratch.order;
+	const SsMotionFrameDecoder::UserDataTable& userData = scratch.userData;
+	SsMotionFrameDecoder::decodeNodes(r, tracks, frameNo, inheritCalc, false, &scratch.userData);
+
+//	if (context.sourceFormatMode)
+//	{
+//		debug::dumpPrefix(context.out, frameNo);
+//		debug::dumpFrameParamList(context.out, r);
+//		debug::dumpSuffix(context.out);
+//	}
+
+	if (!parentageEnabled)
+	{
+		// 優先順位でソート 
+		SsMotionFrameDecoder::sortByPriority(order, r);
+	}
+	else
+	{
+		order.resize(r.size());
+		for (size_t i = 0; i < order.size(); i++) order[i] = static_cast<int>(i);
+	}
+
+
+	// ユーザーデータが含まれているものを数える
+	int numUserData = 0;
+	BOOST_FOREACH( int index, order )
+	{
+		if (userData.find(r[index].node->getId())) numUserData++;
+	}
+
+	// このフレームのユーザーデータを出力する
+	if (numUserData > 0)
+	{
+		std::ostringstream buf(std::ios_base::out | std::ios_base::binary);
+		FrameStream stream(buf, context);
+
+		if (stream.sourceFormatMode)
+		{
+			std::string label = (format("%1%_userData_%2%") % context.prefix % frameNo).str();
+			stream.out << format("static const ss_u16 %1%[] = {") % label;
+			stream.out << std::endl;
+		}
+
+		bool first = true;
+		BOOST_FOREACH( int index, order )
+		{
+			const SsUserDataValue* value = userData.find(r[index].node->getId());
+			if (!value) continue;
+
+			Indenting _(stream.out);
+
+			if (stream.sourceFormatMode)
+			{
+				if (!first) stream.out << "," << std::endl;
+				first = false;
+				stream.out << indent;
+			}
+
+			writeUserData(stream, r[index], *value);
+		}
+
+		if (stream.sourceFormatMode)
+		{
+			stream.out << std::endl;
+
+			stream.out << "};";
+			stream.out << std::endl;
+		}
+		stream.bout.flush();
+		block.userData = buf.str();
+	}
+	block.numUserData = numUserData;
+
+
+	// 継承計算を行う場合、表示されないものはリストから削除する
+	if (!context.options.useTragetAffineTransformation)
+	{
+		std::vector<int>::iterator last = order.begin();
+		for (std::vector<int>::iterator i = order.begin(); i != order.end(); ++i)
+		{
+			if (!isInvisiblePart(r[*i])) *last++ = *i;
+		}
+		order.erase(last, order.end());
+	}
+
+	block.numParts = static_cast<int>(order.size());
+
+	SsMotionFrameDecoder::FrameParam dummy;
+
+	block.partFrames.resize(order.size());
+	for (size_t i = 0; i < order.size(); i++)
+	{
+		const SsMotionFrameDecoder::FrameParam& param = r[order[i]];
+		if (param.node->isRoot())
+		{
+			block.ssDataFlags |= makePartFrame(block.partFrames[i], param, dummy, parentageEnabled);
+		}
+		else
+		{
+			//int paramIndex = toCocos2dPartId(param.node->getParentId());
+			block.ssDataFlags |= makePartFrame(block.partFrames[i], param, dummy, parentageEnabled);
+		}
+
+		// 量子化後の値に丸めておき、差分の判定も丸めた値で行う
+		if (context.options.quantize)
+		{
+			quantizePartFrame(block.partFrames[i], context.options.positionFractionBits, block.quantizationError);
+		}
+	}
+
+	// 差分形式のときは前フレームの出力結果に依存するため、ここでは出力しない
+	// 参照元の範囲の表を使うときも、出現順に番号を割り当てるためここでは出力しない
+	if (context.options.keyframeInterval <= 0 && !context.options.rectTable)
+	{
+		writePartFrames(block.partFrameData, context, frameNo, block.partFrames, NULL);
+	}
+}
+
+
+/**
+ * １フレーム分のパーツ情報を出力する
+ * deltaEncoderが指定されたときは前フレームからの差分で出力します
+ */
+static void writePartFrames(std::string& result, const Context& context, int frameNo, const std::vector<PartFrame>& partFrames, PartFrameDeltaEncoder* deltaEncoder)
+{
+	result.clear();
+	if (partFrames.empty()) return;
+
+	std::ostringstream buf(std::ios_base::out | std::ios_base::binary);
+	FrameStream stream(buf, context);
+
+	// 固定長形式はバイナリ形式のみで、差分形式とは組み合わせない
+	if (stream.fixedRecords)
+	{
+		writeFixedPartFrames(stream, partFrames);
+		stream.bout.flush();
+		result = buf.str();
+		return;
+	}
+
+	if (stream.sourceFormatMode)
+	{
+		std::string label = (format("%1%_partFrameData_%2%") % context.prefix % frameNo).str();
+		stream.out << format("static const ss_u16 %1%[] = {") % label;
+		stream.out << std::endl;
+	}
+
+	int partCount = 0;
+	BOOST_FOREACH( const PartFrame& pf, partFrames )
+	{
+		Indenting _(stream.out);
+
+		if (stream.sourceFormatMode)
+		{
+			if (partCount > 0) stream.out << "," << std::endl;
+			stream.out << indent;
+		}
+		partCount++;
+
+		if (deltaEncoder)
+		{
+			deltaEncoder->write(stream, pf);
+		}
+		else
+		{
+			writePartFrame(stream, pf);
+		}
+	}
+
+	if (stream.sourceFormatMode)
+	{
+		stream.out << std::endl;
+
+		stream.out << "};";
+		stream.out << std::endl;
+	}
+	stream.bout.flush();
+	result = buf.str();
+}
+
 
 namespace
 {
@@ -721,14 +1583,59 @@ namespace
 	{
 		return (color.a << 24) | (color.r << 16) | (color.g << 8) | color.b;
 	}
+
+
+	/** 座標を、小数部fractionBitsビットの固定小数点数にする */
+	static int quantizePosition(float value, int fractionBits)
+	{
+		return static_cast<int>(std::floor(static_cast<double>(value) * (1 << fractionBits) + 0.5));
+	}
+
+	static float dequantizePosition(int value, int fractionBits)
+	{
+		return static_cast<float>(value) / (1 << fractionBits);
+	}
+
+	/** 回転角（度）を、1周をQUANTIZE_ANGLE_BITSビットで表した値にする */
+	static int quantizeAngle(float degree)
+	{
+		double turns = static_cast<double>(degree) / 360.0;
+		long long value = static_cast<long long>(std::floor(turns * (1 << QUANTIZE_ANGLE_BITS) + 0.5));
+		return static_cast<int>(value & ((1 << QUANTIZE_ANGLE_BITS) - 1));
+	}
+
+	static float dequantizeAngle(int value)
+	{
+		return static_cast<float>(value) * 360.0f / (1 << QUANTIZE_ANGLE_BITS);
+	}
+
+	/** fromからtoへ最短の向きで回転するときの角度（度）を[-180, 180)の範囲で返す */
+	static float angleDifference(float from, float to)
+	{
+		float diff = std::fmod(to - from + 180.0f, 360.0f);
+		if (diff < 0) diff += 360.0f;
+		return diff - 180.0f;
+	}
+
+	/** スケールを8.8固定小数点数にする（範囲外の値は丸める） */
+	static int quantizeScale(float value)
+	{
+		int fixed = static_cast<int>(std::floor(static_cast<double>(value) * (1 << QUANTIZE_SCALE_FRACTION_BITS) + 0.5));
+		return std::max(-0x8000, std::min(0x7fff, fixed));
+	}
+
+	static float dequantizeScale(int value)
+	{
+		return static_cast<float>(value) / (1 << QUANTIZE_SCALE_FRACTION_BITS);
+	}
 	
 	
 
 	class DataWriter
 	{
-		Context&	_context;
+		FrameStream&	_context;
 	public:
-		DataWriter(Context& context) : _context(context) {}
+		DataWriter(FrameStream& context) : _context(context) {}
 
 		void writeShort(int data, bool addAheadComma = true)
 		{
@@ -775,6 +1682,50 @@ namespace
 			writeInt(c.i);
 		}
 
+		/** 15bitずつ、続きがあるときは最上位bitを立てたshortの並びで出力する */
+		void writeVarUInt(unsigned int data, bool addAheadComma = true)
+		{
+			do
+			{
+				unsigned int unit = data & 0x7fff;
+				data >>= 15;
+				if (data) unit |= 0x8000;
+				writeShort(unit, addAheadComma);
+				addAheadComma = true;
+			} while (data);
+		}
+
+		/** 符号付き整数を、絶対値が小さいほど短くなるように出力する */
+		void writeVarInt(int data, bool addAheadComma = true)
+		{
+			unsigned int zigzag = (static_cast<unsigned int>(data) << 1) ^ static_cast<unsigned int>(data >> 31);
+			writeVarUInt(zigzag, addAheadComma);
+		}
+
+		void writeFlags(unsigned int data, bool addAheadComma = true)
+		{
+			if (_context.quantize) writeVarUInt(data, addAheadComma);
+			else writeInt(data, addAheadComma);
+		}
+
+		void writePosition(float data, bool addAheadComma = true)
+		{
+			if (_context.quantize) writeVarInt(quantizePosition(data, _context.positionFractionBits), addAheadComma);
+			else writeFloat(data, addAheadComma);
+		}
+
+		void writeRotation(float data, bool addAheadComma = true)
+		{
+			if (_context.quantize) writeShort(quantizeAngle(data), addAheadComma);
+			else writeFloat(data, addAheadComma);
+		}
+
+		void writeScale(float data, bool addAheadComma = true)
+		{
+			if (_context.quantize) writeShort(quantizeScale(data), addAheadComma);
+			else writeFloat(data, addAheadComma);
+		}
+
 		void writeShortPoint(const SsPoint& data, bool addAheadComma = true)
 		{
 			writeShort(data.x, addAheadComma);
@@ -828,11 +1779,12 @@ namespace
 
 
 /**
- * １パーツ分のフレーム情報を出力する 
+ * １パーツ分のフレーム情報を求める
+ * 出力に必要になるSS_DATA_FLAG_*を返します
  */
-static int writeFrameParam(Context& context, const SsMotionFrameDecoder::FrameParam& param, const SsMotionFrameDecoder::FrameParam& parentParam, bool parentageEnabled)
+static int makePartFrame(PartFrame& pf, const SsMotionFrameDecoder::FrameParam& param, const SsMotionFrameDecoder::FrameParam& parentParam, bool parentageEnabled)
 {
-	SsNode::ConstPtr node = param.node;
+	const SsNode* node = param.node;
 
 	SsRect   souRect  = getPicRect(param);
 	SsPointF position = getPosition(param);
@@ -891,32 +1843,9 @@ static int writeFrameParam(Context& context, const SsMotionFrameDecoder::FramePa
 	}
 
 
-	// 各要素を出力する
-	DataWriter w(context);
-	
-	w.writeInt(flags, false);
-	w.writeShort(toCocos2dPartId(node->getId()));
-	w.writeShort(souRect.getLeft());
-	w.writeShort(souRect.getTop());
-	w.writeShort(souRect.getWidth());
-	w.writeShort(souRect.getHeight());
-	w.writeFloat(position.x);
-	w.writeFloat(position.y);
-
-	if (flags & SS_PART_FLAG_ORIGIN_X) w.writeShort(origin.x);
-	if (flags & SS_PART_FLAG_ORIGIN_Y) w.writeShort(origin.y);
-	if (flags & SS_PART_FLAG_ROTATION) w.writeFloat(angle);
-	if (flags & SS_PART_FLAG_SCALE_X) w.writeFloat(param.scax.value);
-	if (flags & SS_PART_FLAG_SCALE_Y) w.writeFloat(param.scay.value);
-	if (flags & SS_PART_FLAG_OPACITY) w.writeShort(opacity);
-	if (flags & SS_PART_FLAG_VERTEX_OFFSET_TL) w.writeShortPoint(param.vert.value.v[SS_VERTEX_TOP_LEFT]);
-	if (flags & SS_PART_FLAG_VERTEX_OFFSET_TR) w.writeShortPoint(param.vert.value.v[SS_VERTEX_TOP_RIGHT]);
-	if (flags & SS_PART_FLAG_VERTEX_OFFSET_BL) w.writeShortPoint(param.vert.value.v[SS_VERTEX_BOTTOM_LEFT]);
-	if (flags & SS_PART_FLAG_VERTEX_OFFSET_BR) w.writeShortPoint(param.vert.value.v[SS_VERTEX_BOTTOM_RIGHT]);
-
+	int blendNo = 0;
 	if (flags & SS_PART_FLAGS_COLOR_BLEND)
 	{
-		int blendNo = 0;
 		switch (param.pcol.value.blend)
 		{
 			case SsColorBlendValue::BLEND_MIX:		blendNo = 0; break;
@@ -926,13 +1855,36 @@ static int writeFrameParam(Context& context, const SsMotionFrameDecoder::FramePa
 			default:
 				throw std::logic_error("Not blend type");
 		}
-		w.writeShort(blendNo);
+	}
 
-		if (flags & SS_PART_FLAG_COLOR) w.writeInt(calcBlendColor(param.pcol.value.colors[0]));
-		if (flags & SS_PART_FLAG_VERTEX_COLOR_TL) w.writeInt(calcBlendColor(param.pcol.value.colors[SS_VERTEX_TOP_LEFT]));
-		if (flags & SS_PART_FLAG_VERTEX_COLOR_TR) w.writeInt(calcBlendColor(param.pcol.value.colors[SS_VERTEX_TOP_RIGHT]));
-		if (flags & SS_PART_FLAG_VERTEX_COLOR_BL) w.writeInt(calcBlendColor(param.pcol.value.colors[SS_VERTEX_BOTTOM_LEFT]));
-		if (flags & SS_PART_FLAG_VERTEX_COLOR_BR) w.writeInt(calcBlendColor(param.pcol.value.colors[SS_VERTEX_BOTTOM_RIGHT]));
+	static const int vertexIndices[4] = { SS_VERTEX_TOP_LEFT, SS_VERTEX_TOP_RIGHT, SS_VERTEX_BOTTOM_LEFT, SS_VERTEX_BOTTOM_RIGHT };
+	static const unsigned int vertexColorFlags[4] = { SS_PART_FLAG_VERTEX_COLOR_TL, SS_PART_FLAG_VERTEX_COLOR_TR, SS_PART_FLAG_VERTEX_COLOR_BL, SS_PART_FLAG_VERTEX_COLOR_BR };
+
+	// 省略される要素にはプレイヤー側の既定値を入れておく
+	pf.flags    = flags;
+	pf.partNo   = toCocos2dPartId(node->getId());
+	pf.imageNo  = node->getPicId();
+	pf.sx       = souRect.getLeft();
+	pf.sy       = souRect.getTop();
+	pf.sw       = souRect.getWidth();
+	pf.sh       = souRect.getHeight();
+	pf.rectNo   = 0;
+	pf.dx       = position.x;
+	pf.dy       = position.y;
+	pf.ox       = (flags & SS_PART_FLAG_ORIGIN_X) ? origin.x : pf.sw / 2;
+	pf.oy       = (flags & SS_PART_FLAG_ORIGIN_Y) ? origin.y : pf.sh / 2;
+	pf.rotation = (flags & SS_PART_FLAG_ROTATION) ? angle : 0;
+	pf.scaleX   = (flags & SS_PART_FLAG_SCALE_X) ? param.scax.value : 1.0f;
+	pf.scaleY   = (flags & SS_PART_FLAG_SCALE_Y) ? param.scay.value : 1.0f;
+	pf.opacity  = (flags & SS_PART_FLAG_OPACITY) ? opacity : 255;
+	pf.blendNo  = blendNo;
+	for (int i = 0; i < 4; i++)
+	{
+		pf.vertexOffsets[i] = param.vert.value.v[vertexIndices[i]];
+
+		pf.colors[i] = 0x00ffffff;
+		if (flags & SS_PART_FLAG_COLOR) pf.colors[i] = calcBlendColor(param.pcol.value.colors[0]);
+		if (flags & vertexColorFlags[i]) pf.colors[i] = calcBlendColor(param.pcol.value.colors[vertexIndices[i]]);
 	}
 
 
@@ -943,18 +1895,478 @@ static int writeFrameParam(Context& context, const SsMotionFrameDecoder::FramePa
 }
 
 
+/**
+ * １パーツ分のフレーム情報を出力する 
+ */
+static void writePartFrame(FrameStream& stream, const PartFrame& pf)
+{
+	const unsigned int flags = pf.flags;
+
+	// 各要素を出力する
+	DataWriter w(stream);
+	
+	w.writeFlags(flags, false);
+	w.writeShort(pf.partNo);
+	if (stream.rectTable)
+	{
+		w.writeShort(pf.rectNo);
+	}
+	else
+	{
+		w.writeShort(pf.sx);
+		w.writeShort(pf.sy);
+		w.writeShort(pf.sw);
+		w.writeShort(pf.sh);
+	}
+	w.writePosition(pf.dx);
+	w.writePosition(pf.dy);
+
+	if (flags & SS_PART_FLAG_ORIGIN_X) w.writeShort(pf.ox);
+	if (flags & SS_PART_FLAG_ORIGIN_Y) w.writeShort(pf.oy);
+	if (flags & SS_PART_FLAG_ROTATION) w.writeRotation(pf.rotation);
+	if (flags & SS_PART_FLAG_SCALE_X) w.writeScale(pf.scaleX);
+	if (flags & SS_PART_FLAG_SCALE_Y) w.writeScale(pf.scaleY);
+	if (flags & SS_PART_FLAG_OPACITY) w.writeShort(pf.opacity);
+	if (flags & SS_PART_FLAG_VERTEX_OFFSET_TL) w.writeShortPoint(pf.vertexOffsets[0]);
+	if (flags & SS_PART_FLAG_VERTEX_OFFSET_TR) w.writeShortPoint(pf.vertexOffsets[1]);
+	if (flags & SS_PART_FLAG_VERTEX_OFFSET_BL) w.writeShortPoint(pf.vertexOffsets[2]);
+	if (flags & SS_PART_FLAG_VERTEX_OFFSET_BR) w.writeShortPoint(pf.vertexOffsets[3]);
+
+	if (flags & SS_PART_FLAGS_COLOR_BLEND)
+	{
+		w.writeShort(pf.blendNo);
+
+		if (flags & SS_PART_FLAG_COLOR) w.writeInt(pf.colors[0]);
+		if (flags & SS_PART_FLAG_VERTEX_COLOR_TL) w.writeInt(pf.colors[0]);
+		if (flags & SS_PART_FLAG_VERTEX_COLOR_TR) w.writeInt(pf.colors[1]);
+		if (flags & SS_PART_FLAG_VERTEX_COLOR_BL) w.writeInt(pf.colors[2]);
+		if (flags & SS_PART_FLAG_VERTEX_COLOR_BR) w.writeInt(pf.colors[3]);
+	}
+}
+
+
+/**
+ * １フレーム分のパーツ情報を、要素ごとの固定長の配列で出力する
+ * 省略可能な要素も既定値で埋め、プレイヤーがフラグを見ずにポインタのキャストで読めるようにします
+ * 頂点変形とカラーブレンドは使うパーツが少ないため、パーツごとの有無をビットマップで示し、使うパーツの分だけ出力します
+ */
+static void writeFixedPartFrames(FrameStream& stream, const std::vector<PartFrame>& partFrames)
+{
+	// パーツ数を8の倍数に切り上げた数を配列の長さにすると、どの配列も16バイトの倍数になり先頭が16バイト境界に揃う
+	//	ss_u16		partNo[stride];
+	//	ss_u32		flags[stride];
+	//	ss_s16		sourceRect[stride][4];		// 参照元の範囲の表を使うときは ss_u16 rectNo[stride]
+	//	float		position[stride][2];
+	//	ss_s16		origin[stride][2];
+	//	float		rotation[stride];
+	//	float		scale[stride][2];
+	//	ss_u16		opacity[stride];
+	//	ss_u16		colorBlendFuncNo[stride];
+	//	ss_u32		vertexOffsetMask[maskWords];	// maskWordsは(stride+31)/32を4の倍数に切り上げた数
+	//	ss_u32		colorBlendMask[maskWords];
+	//	ss_s16		vertexOffsets[numVertexOffsetParts][4][2];	// 左上、右上、左下、右下の順
+	//	ss_u32		colors[numColorBlendParts][4];				// 左上、右上、左下、右下の順（ARGB）
+	const int numParts = static_cast<int>(partFrames.size());
+	const int stride = (numParts + 7) & ~7;
+	const int maskWords = (((stride + 31) / 32) + 3) & ~3;
+	BinaryDataWriter& w = stream.bout;
+
+	BOOST_FOREACH( const PartFrame& pf, partFrames ) w.writeShort(pf.partNo);
+	w.fill(0, (stride - numParts) * 2);
+
+	BOOST_FOREACH( const PartFrame& pf, partFrames ) w.writeInt(pf.flags);
+	w.fill(0, (stride - numParts) * 4);
+
+	if (stream.rectTable)
+	{
+		BOOST_FOREACH( const PartFrame& pf, partFrames ) w.writeShort(pf.rectNo);
+		w.fill(0, (stride - numParts) * 2);
+	}
+	else
+	{
+		BOOST_FOREACH( const PartFrame& pf, partFrames )
+		{
+			w.writeShort(pf.sx);
+			w.writeShort(pf.sy);
+			w.writeShort(pf.sw);
+			w.writeShort(pf.sh);
+		}
+		w.fill(0, (stride - numParts) * 8);
+	}
+
+	BOOST_FOREACH( const PartFrame& pf, partFrames )
+	{
+		w.writeFloat(pf.dx);
+		w.writeFloat(pf.dy);
+	}
+	w.fill(0, (stride - numParts) * 8);
+
+	BOOST_FOREACH( const PartFrame& pf, partFrames )
+	{
+		w.writeShort(pf.ox);
+		w.writeShort(pf.oy);
+	}
+	w.fill(0, (stride - numParts) * 4);
+
+	BOOST_FOREACH( const PartFrame& pf, partFrames ) w.writeFloat(pf.rotation);
+	w.fill(0, (stride - numParts) * 4);
+
+	BOOST_FOREACH( const PartFrame& pf, partFrames )
+	{
+		w.writeFloat(pf.scaleX);
+		w.writeFloat(pf.scaleY);
+	}
+	w.fill(0, (stride - numParts) * 8);
+
+	BOOST_FOREACH( const PartFrame& pf, partFrames ) w.writeShort(pf.opacity);
+	w.fill(0, (stride - numParts) * 2);
+
+	BOOST_FOREACH( const PartFrame& pf, partFrames ) w.writeShort((pf.flags & SS_PART_FLAGS_COLOR_BLEND) ? pf.blendNo : 0);
+	w.fill(0, (stride - numParts) * 2);
+
+	std::vector<unsigned int> vertexOffsetMask(maskWords);
+	std::vector<unsigned int> colorBlendMask(maskWords);
+	for (int i = 0; i < numParts; i++)
+	{
+		if (partFrames[i].flags & SS_PART_FLAGS_VERTEX_OFFSET) vertexOffsetMask[i / 32] |= 1u << (i % 32);
+		if (partFrames[i].flags & SS_PART_FLAGS_COLOR_BLEND) colorBlendMask[i / 32] |= 1u << (i % 32);
+	}
+	BOOST_FOREACH( unsigned int bits, vertexOffsetMask ) w.writeInt(bits);
+	BOOST_FOREACH( unsigned int bits, colorBlendMask ) w.writeInt(bits);
+
+	BOOST_FOREACH( const PartFrame& pf, partFrames )
+	{
+		if ((pf.flags & SS_PART_FLAGS_VERTEX_OFFSET) == 0) continue;
+		for (int v = 0; v < 4; v++)
+		{
+			bool exists = (pf.flags & (SS_PART_FLAG_VERTEX_OFFSET_TL << v)) != 0;
+			w.writeShort(exists ? pf.vertexOffsets[v].x : 0);
+			w.writeShort(exists ? pf.vertexOffsets[v].y : 0);
+		}
+	}
+
+	BOOST_FOREACH( const PartFrame& pf, partFrames )
+	{
+		if ((pf.flags & SS_PART_FLAGS_COLOR_BLEND) == 0) continue;
+		for (int v = 0; v < 4; v++) w.writeInt(pf.colors[v]);
+	}
+}
+
+
+/**
+ * 座標、回転角、スケールを量子化後の値に丸め、生じた誤差の最大値を記録する
+ */
+static void quantizePartFrame(PartFrame& pf, int positionFractionBits, Cocos2dSaver::QuantizationError& error)
+{
+	float dx = dequantizePosition(quantizePosition(pf.dx, positionFractionBits), positionFractionBits);
+	float dy = dequantizePosition(quantizePosition(pf.dy, positionFractionBits), positionFractionBits);
+	error.position = std::max(error.position, std::max(std::fabs(dx - pf.dx), std::fabs(dy - pf.dy)));
+	pf.dx = dx;
+	pf.dy = dy;
+
+	// 回転角は1周の範囲に丸められるので、同じ向きとの差を誤差とする
+	float rotation = dequantizeAngle(quantizeAngle(pf.rotation));
+	error.rotation = std::max(error.rotation, std::fabs(angleDifference(pf.rotation, rotation)));
+	pf.rotation = rotation;
+
+	float scaleX = dequantizeScale(quantizeScale(pf.scaleX));
+	float scaleY = dequantizeScale(quantizeScale(pf.scaleY));
+	error.scale = std::max(error.scale, std::max(std::fabs(scaleX - pf.scaleX), std::fabs(scaleY - pf.scaleY)));
+	pf.scaleX = scaleX;
+	pf.scaleY = scaleY;
+}
+
+
+/**
+ * 前後のフレームからプレイヤーが補間するフレーム情報を求める
+ * プレイヤーのblendPartFrameと同じ計算を行います
+ */
+static void blendPartFrame(PartFrame& result, const PartFrame& from, const PartFrame& to, float ratio)
+{
+	result = from;
+	result.dx = from.dx + (to.dx - from.dx) * ratio;
+	result.dy = from.dy + (to.dy - from.dy) * ratio;
+	result.rotation = from.rotation + angleDifference(from.rotation, to.rotation) * ratio;
+	result.scaleX = from.scaleX + (to.scaleX - from.scaleX) * ratio;
+	result.scaleY = from.scaleY + (to.scaleY - from.scaleY) * ratio;
+	result.opacity = from.opacity + static_cast<int>((to.opacity - from.opacity) * ratio);
+	for (int v = 0; v < 4; v++)
+	{
+		result.vertexOffsets[v].x = from.vertexOffsets[v].x + static_cast<int>((to.vertexOffsets[v].x - from.vertexOffsets[v].x) * ratio);
+		result.vertexOffsets[v].y = from.vertexOffsets[v].y + static_cast<int>((to.vertexOffsets[v].y - from.vertexOffsets[v].y) * ratio);
+	}
+	result.flags |= to.flags & SS_PART_FLAGS_VERTEX_OFFSET;
+}
+
+
+/** 補間できない要素（表示するパーツとその並び、フラグ、画像の範囲、原点、カラーブレンド）が同じか判定する */
+static bool isSameStructure(const PartFrame& lhs, const PartFrame& rhs)
+{
+	return lhs.flags == rhs.flags
+		&& lhs.partNo == rhs.partNo
+		&& lhs.sx == rhs.sx && lhs.sy == rhs.sy && lhs.sw == rhs.sw && lhs.sh == rhs.sh
+		&& lhs.ox == rhs.ox && lhs.oy == rhs.oy
+		&& lhs.blendNo == rhs.blendNo
+		&& std::equal(lhs.colors, lhs.colors + 4, rhs.colors);
+}
+
+static bool isSameStructure(const FrameBlock& lhs, const FrameBlock& rhs)
+{
+	if (lhs.partFrames.size() != rhs.partFrames.size()) return false;
+	for (size_t i = 0; i < lhs.partFrames.size(); i++)
+	{
+		if (!isSameStructure(lhs.partFrames[i], rhs.partFrames[i])) return false;
+	}
+	return true;
+}
+
+
+/**
+ * フレームframeをフレームfromとtoの補間で置き換えたときの誤差の最大値をerrorに記録する
+ * 表示するパーツや補間できない要素が変わってしまい、置き換えられないときはfalseを返す
+ */
+static bool measureBlendError(Cocos2dSaver::ResamplingReport& error, const FrameBlock& from, const FrameBlock& to, const FrameBlock& frame, float ratio)
+{
+	if (from.partFrames.size() != frame.partFrames.size()) return false;
+
+	PartFrame blended;
+	for (size_t i = 0; i < from.partFrames.size(); i++)
+	{
+		const PartFrame& pf = from.partFrames[i];
+		const PartFrame& actual = frame.partFrames[i];
+
+		// 次のフレームに無いパーツは、プレイヤーでは前のフレームの値のまま表示される
+		const PartFrame* next = &pf;
+		BOOST_FOREACH( const PartFrame& npf, to.partFrames )
+		{
+			if (npf.partNo == pf.partNo) { next = &npf; break; }
+		}
+		blendPartFrame(blended, pf, *next, ratio);
+		if (!isSameStructure(blended, actual)) return false;
+
+		error.position = std::max(error.position, std::max(std::fabs(blended.dx - actual.dx), std::fabs(blended.dy - actual.dy)));
+		error.rotation = std::max(error.rotation, std::fabs(angleDifference(actual.rotation, blended.rotation)));
+		const float size = static_cast<float>(std::max(std::abs(pf.sw), std::abs(pf.sh)));
+		error.scale = std::max(error.scale, std::max(std::fabs(blended.scaleX - actual.scaleX), std::fabs(blended.scaleY - actual.scaleY)) * size);
+		error.opacity = std::max(error.opacity, std::abs(blended.opacity - actual.opacity));
+		for (int v = 0; v < 4; v++)
+		{
+			error.vertexOffset = std::max(error.vertexOffset, std::abs(blended.vertexOffsets[v].x - actual.vertexOffsets[v].x));
+			error.vertexOffset = std::max(error.vertexOffset, std::abs(blended.vertexOffsets[v].y - actual.vertexOffsets[v].y));
+		}
+	}
+	return true;
+}
+
+
+/** フレームfromとtoの間のフレームがすべて、補間で許容誤差内に復元できるか判定する */
+static bool canBlendFrames(const std::vector<FrameBlock>& blocks, int fromFrameNo, int toFrameNo, float maxError)
+{
+	for (int frameNo = fromFrameNo + 1; frameNo < toFrameNo; frameNo++)
+	{
+		Cocos2dSaver::ResamplingReport error;
+		float ratio = static_cast<float>(frameNo - fromFrameNo) / static_cast<float>(toFrameNo - fromFrameNo);
+		if (!measureBlendError(error, blocks[fromFrameNo], blocks[toFrameNo], blocks[frameNo], ratio)) return false;
+		if (error.position > maxError || error.rotation > maxError || error.scale > maxError
+		 || error.opacity > 1 || error.vertexOffset > maxError) return false;
+	}
+	return true;
+}
+
+
+/**
+ * 出力するフレームを選ぶ
+ * resampleFpsを指定したときはその間隔のフレームを候補とし、maxResampleErrorを指定したときは
+ * 候補のうち前後から許容誤差内に補間できるものを間引く
+ * 先頭と最後のフレーム、ユーザーデータのあるフレーム、補間できない要素が変わるフレームは必ず残す
+ */
+static void selectFrames(std::vector<int>& storedFrameNos, const std::vector<FrameBlock>& blocks, const Cocos2dSaver::Options& options, int fps, Cocos2dSaver::ResamplingReport& report)
+{
+	const int numFrames = static_cast<int>(blocks.size());
+	storedFrameNos.clear();
+	if (numFrames == 0) return;
+
+	std::vector<bool> mustKeep(numFrames, false);
+	mustKeep.front() = true;
+	mustKeep.back() = true;
+	for (int frameNo = 1; frameNo < numFrames; frameNo++)
+	{
+		if (blocks[frameNo].numUserData || !isSameStructure(blocks[frameNo - 1], blocks[frameNo])) mustKeep[frameNo] = true;
+	}
+
+	std::vector<int> candidates;
+	for (int frameNo = 0; frameNo < numFrames; frameNo++)
+	{
+		bool candidate = mustKeep[frameNo];
+		if (options.resampleFps <= 0 || options.resampleFps >= fps)
+		{
+			candidate = true;
+		}
+		else
+		{
+			// resampleFpsの間隔に最も近いフレーム
+			int i = static_cast<int>(std::floor(frameNo * options.resampleFps / static_cast<float>(fps) + 0.5f));
+			if (static_cast<int>(std::floor(i * fps / static_cast<float>(options.resampleFps) + 0.5f)) == frameNo) candidate = true;
+		}
+		if (candidate) candidates.push_back(frameNo);
+	}
+
+	if (options.maxResampleError < 0)
+	{
+		storedFrameNos = candidates;
+	}
+	else
+	{
+		// 直前に残したフレームから補間できる限り先の候補まで間引く
+		int anchor = candidates.front();
+		int pending = -1;
+		storedFrameNos.push_back(anchor);
+		for (size_t i = 1; i < candidates.size(); i++)
+		{
+			const int frameNo = candidates[i];
+			if (canBlendFrames(blocks, anchor, frameNo, options.maxResampleError))
+			{
+				pending = frameNo;
+				if (mustKeep[frameNo])
+				{
+					storedFrameNos.push_back(frameNo);
+					anchor = frameNo;
+					pending = -1;
+				}
+			}
+			else if (pending >= 0)
+			{
+				// 補間できた最後の候補を残し、そこから同じ候補を試し直す
+				storedFrameNos.push_back(pending);
+				anchor = pending;
+				pending = -1;
+				i--;
+			}
+			else
+			{
+				storedFrameNos.push_back(frameNo);
+				anchor = frameNo;
+			}
+		}
+	}
+
+	// 間引いたフレームを補間で置き換えたときの誤差を求める
+	for (size_t i = 1; i < storedFrameNos.size(); i++)
+	{
+		const int fromFrameNo = storedFrameNos[i - 1];
+		const int toFrameNo = storedFrameNos[i];
+		for (int frameNo = fromFrameNo + 1; frameNo < toFrameNo; frameNo++)
+		{
+			float ratio = static_cast<float>(frameNo - fromFrameNo) / static_cast<float>(toFrameNo - fromFrameNo);
+			measureBlendError(report, blocks[fromFrameNo], blocks[toFrameNo], blocks[frameNo], ratio);
+		}
+	}
+}
+
+
+void PartFrameDeltaEncoder::reset()
+{
+	_known.assign(_known.size(), false);
+}
+
+
+/**
+ * １パーツ分のフレーム情報を、前フレームから変化した要素だけ出力する
+ *
+ * パーツ番号(u16)、変化した要素を示すSS_DELTA_FLAG_*(u16)に続き、
+ * 変化した要素の値をSS_DELTA_FLAG_*の順に出力します
+ * キーフレーム以降で初めて出力するパーツは全要素を出力します
+ */
+void PartFrameDeltaEncoder::write(FrameStream& stream, const PartFrame& pf)
+{
+	const size_t partNo = static_cast<size_t>(pf.partNo);
+	if (partNo >= _prevFrames.size())
+	{
+		_prevFrames.resize(partNo + 1);
+		_known.resize(partNo + 1, false);
+	}
+	PartFrame& prev = _prevFrames[partNo];
+
+	unsigned int delta = SS_DELTA_FLAGS_ALL;
+	if (_known[partNo])
+	{
+		delta = 0;
+		if (pf.flags != prev.flags) delta |= SS_DELTA_FLAG_FLAGS;
+		if (pf.sx != prev.sx || pf.sy != prev.sy || pf.sw != prev.sw || pf.sh != prev.sh) delta |= SS_DELTA_FLAG_SOURCE_RECT;
+		if (pf.dx != prev.dx || pf.dy != prev.dy) delta |= SS_DELTA_FLAG_POSITION;
+		if (pf.ox != prev.ox || pf.oy != prev.oy) delta |= SS_DELTA_FLAG_ORIGIN;
+		if (pf.rotation != prev.rotation) delta |= SS_DELTA_FLAG_ROTATION;
+		if (pf.scaleX != prev.scaleX || pf.scaleY != prev.scaleY) delta |= SS_DELTA_FLAG_SCALE;
+		if (pf.opacity != prev.opacity) delta |= SS_DELTA_FLAG_OPACITY;
+		for (int i = 0; i < 4; i++)
+		{
+			if (pf.vertexOffsets[i].x != prev.vertexOffsets[i].x || pf.vertexOffsets[i].y != prev.vertexOffsets[i].y) delta |= SS_DELTA_FLAG_VERTEX_OFFSET;
+			if (pf.colors[i] != prev.colors[i]) delta |= SS_DELTA_FLAG_COLOR_BLEND;
+		}
+		if (pf.blendNo != prev.blendNo) delta |= SS_DELTA_FLAG_COLOR_BLEND;
+	}
+
+	// 各要素を出力する
+	DataWriter w(stream);
+
+	w.writeShort(pf.partNo, false);
+	w.writeShort(delta);
+
+	if (delta & SS_DELTA_FLAG_FLAGS) w.writeFlags(pf.flags);
+	if ((delta & SS_DELTA_FLAG_SOURCE_RECT) && stream.rectTable)
+	{
+		w.writeShort(pf.rectNo);
+	}
+	else if (delta & SS_DELTA_FLAG_SOURCE_RECT)
+	{
+		w.writeShort(pf.sx);
+		w.writeShort(pf.sy);
+		w.writeShort(pf.sw);
+		w.writeShort(pf.sh);
+	}
+	if (delta & SS_DELTA_FLAG_POSITION)
+	{
+		w.writePosition(pf.dx);
+		w.writePosition(pf.dy);
+	}
+	if (delta & SS_DELTA_FLAG_ORIGIN)
+	{
+		w.writeShort(pf.ox);
+		w.writeShort(pf.oy);
+	}
+	if (delta & SS_DELTA_FLAG_ROTATION) w.writeRotation(pf.rotation);
+	if (delta & SS_DELTA_FLAG_SCALE)
+	{
+		w.writeScale(pf.scaleX);
+		w.writeScale(pf.scaleY);
+	}
+	if (delta & SS_DELTA_FLAG_OPACITY) w.writeShort(pf.opacity);
+	if (delta & SS_DELTA_FLAG_VERTEX_OFFSET)
+	{
+		for (int i = 0; i < 4; i++) w.writeShortPoint(pf.vertexOffsets[i]);
+	}
+	if (delta & SS_DELTA_FLAG_COLOR_BLEND)
+	{
+		w.writeShort(pf.blendNo);
+		for (int i = 0; i < 4; i++) w.writeInt(pf.colors[i]);
+	}
+
+	prev = pf;
+	_known[partNo] = true;
+}
+
+
 /**
  * ユーザーデータを出力する
  */
-static void writeUserData(Context& context, const SsMotionFrameDecoder::FrameParam& param)
+static void writeUserData(FrameStream& stream, const SsMotionFrameDecoder::FrameParam& param, const SsUserDataValue& value)
 {
-	SsNode::ConstPtr node = param.node;
+	const SsNode* node = param.node;
 	
 	// 出力が必要な要素を判断
 	unsigned int flags = 0;
-	if (param.udat.value.hasData())
+	if (value.hasData())
 	{
-		const SsUserDataValue& value = param.udat.value;
 		if (value.number)	flags |= SS_USER_DATA_FLAG_NUMBER;
 		if (value.rect)		flags |= SS_USER_DATA_FLAG_RECT;
 		if (value.point)	flags |= SS_USER_DATA_FLAG_POINT;
@@ -962,14 +2374,13 @@ static void writeUserData(Context& context, const SsMotionFrameDecoder::FramePar
 	}
 
 	// 各要素を出力する
-	DataWriter w(context);
+	DataWriter w(stream);
 	
 	w.writeShort(flags, false);
 	w.writeShort(toCocos2dPartId(node->getId()));
 	
 	if (flags & SS_USER_DATA_FLAGS)
 	{
-		const SsUserDataValue& value = param.udat.value;
 		if (flags & SS_USER_DATA_FLAG_NUMBER) w.writeInt(value.number.get());
 		if (flags & SS_USER_DATA_FLAG_RECT)   w.writeIntRect(value.rect.get());
 		if (flags & SS_USER_DATA_FLAG_POINT)  w.writeIntPoint(value.point.get());
@@ -978,6 +2389,236 @@ static void writeUserData(Context& context, const SsMotionFrameDecoder::FramePar
 }
 
 
+/**
+ * 同じ内容の値を１つだけ出力するためのテーブル
+ * 参照を先に発行しておき、内容はwrite()でまとめて出力します
+ */
+class SharedValueTable
+{
+	typedef std::map<std::string, BinaryDataWriter::Reference> ValueMap;
+
+	ValueMap								_values;
+	std::vector<ValueMap::const_iterator>	_order;		/**< 登録順 */
+
+public:
+	/** dataの出力先を指す参照を返す */
+	BinaryDataWriter::Reference getReference(BinaryDataWriter& bout, const std::string& data)
+	{
+		std::pair<ValueMap::iterator, bool> result = _values.insert(std::make_pair(data, 0));
+		if (result.second)
+		{
+			result.first->second = bout.newReference();
+			_order.push_back(result.first);
+		}
+		return result.first->second;
+	}
+
+	void write(BinaryDataWriter& bout) const
+	{
+		BOOST_FOREACH( ValueMap::const_iterator value, _order )
+		{
+			bout.setReference(value->second);
+			bout.writeBytes(value->first.data(), value->first.size());
+		}
+	}
+};
+
+
+/**
+ * パーツごとのキーフレームと補間方法を出力する（カーブ形式）
+ * パーツはパーツ情報と同じ順（ルートノードからの行きがけ順）に並べ、
+ * プレイヤーはSsMotionFrameDecoderと同じ計算でフレームごとの値を求めます
+ */
+static void writeCurves(Context& context, ss::SsMotion::Ptr motion)
+{
+	const SsNode::Topology& topology = motion->getRootNode()->getTopology();
+	std::vector<SsNode::ConstPtr> nodes = utilities::listTreeNodes(motion->getRootNode());
+	assert(static_cast<int>(nodes.size()) == topology.size());
+
+	// プレイヤーで値を計算するアトリビュート
+	static const SsAttributeTag::Tag curveTags[] =
+	{
+		SsAttributeTag::POSX, SsAttributeTag::POSY, SsAttributeTag::ANGL, SsAttributeTag::SCAX, SsAttributeTag::SCAY, SsAttributeTag::TRAN,
+		SsAttributeTag::PRIO, SsAttributeTag::FLPH, SsAttributeTag::FLPV, SsAttributeTag::HIDE,
+		SsAttributeTag::IMGX, SsAttributeTag::IMGY, SsAttributeTag::IMGW, SsAttributeTag::IMGH, SsAttributeTag::ORFX, SsAttributeTag::ORFY,
+		SsAttributeTag::PCOL, SsAttributeTag::VERT
+	};
+	static const int numCurveTags = sizeof(curveTags) / sizeof(curveTags[0]);
+
+	//typedef struct {
+	//	ss_s16		parentIndex;
+	//	ss_u16		type;			// SsPart::Type
+	//	ss_u16		inheritEach;
+	//	ss_s16		firstFrameNo;
+	//	ss_s16		picLeft, picTop, picWidth, picHeight;
+	//	ss_s16		originX, originY;
+	//	ss_s16		numAttributes;
+	//	ss_s16		reserved;
+	//	ss_offset	attributes;		// SSCurveAttribute[numAttributes]
+	//} SSCurveNode;
+
+	context.bout.setReference(context.curveDataRef);
+
+	std::vector<std::vector<SsAttribute::ConstPtr> > nodesAttributes(topology.size());
+	std::vector<BinaryDataWriter::Reference> attributesRefs(topology.size());
+	for (int nodeIndex = 0; nodeIndex < topology.size(); nodeIndex++)
+	{
+		const SsNode* node = topology.nodes[nodeIndex];
+		assert(node == nodes[nodeIndex].get());
+
+		// フレームを持つ範囲の先頭（SsAttributes::hasFrame()と同じく、キーフレームを持つ全アトリビュートから求める）
+		int firstFrameNo = 0x7fff;
+		for (int i = SsAttributeTag::Unknown + 1; i < SsAttributeTag::NumTags; i++)
+		{
+			SsAttribute::ConstPtr attr = node->getAttribute(static_cast<SsAttributeTag::Tag>(i));
+			if (attr && attr->getTimeline()->hasTimeline())
+			{
+				firstFrameNo = std::min(firstFrameNo, attr->getTimeline()->getFirstFrameNo());
+			}
+		}
+
+		std::vector<SsAttribute::ConstPtr>& attributes = nodesAttributes[nodeIndex];
+		for (int i = 0; i < numCurveTags; i++)
+		{
+			SsAttribute::ConstPtr attr = node->getAttribute(curveTags[i]);
+			if (attr) attributes.push_back(attr);
+		}
+
+		const SsRect& picArea = node->getPicArea();
+		attributesRefs[nodeIndex] = context.bout.newReference();
+
+		context.bout.writeShort(topology.parentIndices[nodeIndex]);
+		context.bout.writeShort(node->getType());
+		context.bout.writeShort(node->isInheritEach() ? 1 : 0);
+		context.bout.writeShort(firstFrameNo);
+		context.bout.writeShort(picArea.getLeft());
+		context.bout.writeShort(picArea.getTop());
+		context.bout.writeShort(picArea.getWidth());
+		context.bout.writeShort(picArea.getHeight());
+		context.bout.writeShort(node->getOrigin().x);
+		context.bout.writeShort(node->getOrigin().y);
+		context.bout.writeShort(static_cast<int>(attributes.size()));
+		context.bout.writeShort(0);
+		context.bout.writeReference(attributesRefs[nodeIndex]);
+	}
+
+	//typedef struct {
+	//	ss_u16		tag;			// SsAttributeTag::Tag
+	//	ss_u16		numKeys;
+	//	ss_u16		hasInheritPercent;
+	//	ss_u16		reserved;
+	//	float		inheritPercent;
+	//	ss_offset	keys;			// SSCurveKey[numKeys]
+	//} SSCurveAttribute;
+
+	std::vector<BinaryDataWriter::Reference> keysRefs;
+	for (int nodeIndex = 0; nodeIndex < topology.size(); nodeIndex++)
+	{
+		context.bout.setReference(attributesRefs[nodeIndex]);
+		BOOST_FOREACH( SsAttribute::ConstPtr attr, nodesAttributes[nodeIndex] )
+		{
+			const boost::optional<float>& inheritPercent = attr->getInheritedPercent();
+			keysRefs.push_back(context.bout.newReference());
+
+			context.bout.writeShort(attr->getTag());
+			context.bout.writeShort(attr->getTimeline()->getNumKeyframes());
+			context.bout.writeShort(inheritPercent ? 1 : 0);
+			context.bout.writeShort(0);
+			context.bout.writeFloat(inheritPercent ? inheritPercent.get() : 0.0f);
+			context.bout.writeReference(keysRefs.back());
+		}
+	}
+
+	//typedef struct {
+	//	ss_s16		frameNo;
+	//	ss_u16		curveType;		// SsCurve::Type
+	//	ss_u32		value;			// 数値アトリビュートはfloat、VERT、PCOLは値へのオフセット
+	//	ss_offset	curve;			// エルミート、ベジェのときのパラメータ float[4] (startT, startV, endT, endV)
+	//} SSCurveKey;
+	//
+	//typedef struct {
+	//	ss_s16		v[4][2];		// 左上、右上、左下、右下の順
+	//} SSCurveVertex4;
+	//
+	//typedef struct {
+	//	ss_u16		type;			// SsColorBlendValue::Type
+	//	ss_u16		blend;			// SsColorBlendValue::Blend
+	//	ss_u32		colors[4];		// 左上、右上、左下、右下の順（ARGB）
+	//} SSCurveColorBlend;
+
+	// 曲線のパラメータとVERT、PCOLの値は、同じ内容のものを共有するためキーの後にまとめて出力する
+	SharedValueTable sharedValues;
+
+	int attributeCount = 0;
+	for (int nodeIndex = 0; nodeIndex < topology.size(); nodeIndex++)
+	{
+		BOOST_FOREACH( SsAttribute::ConstPtr attr, nodesAttributes[nodeIndex] )
+		{
+			const SsKeyframeTimeline& timeline = *attr->getTimeline();
+			const bool floatValue = SsMotionFrameDecoder::Tracks::isFloatTag(attr->getTag());
+
+			context.bout.setReference(keysRefs[attributeCount++]);
+			for (int i = 0; i < timeline.getNumKeyframes(); i++)
+			{
+				const SsKeyframe& key = timeline.getKeyframe(i);
+				const SsCurve& curve = key.getCurve();
+
+				context.bout.writeShort(key.getFrameNo());
+				context.bout.writeShort(curve.getType());
+				if (floatValue)
+				{
+					context.bout.writeFloat(static_cast<const SsFloatValue*>(key.getValue())->value);
+				}
+				else
+				{
+					std::ostringstream buf(std::ios_base::out | std::ios_base::binary);
+					BinaryDataWriter w(buf);
+					if (attr->getTag() == SsAttributeTag::VERT)
+					{
+						const SsVertex4Value* value = static_cast<const SsVertex4Value*>(key.getValue());
+						for (int v = 0; v < 4; v++)
+						{
+							w.writeShort(value->v[v].x);
+							w.writeShort(value->v[v].y);
+						}
+					}
+					else
+					{
+						const SsColorBlendValue* value = static_cast<const SsColorBlendValue*>(key.getValue());
+						w.writeShort(value->type);
+						w.writeShort(value->blend);
+						for (int v = 0; v < 4; v++)
+						{
+							w.writeInt(calcBlendColor(value->colors[v]));
+						}
+					}
+					w.flush();
+					context.bout.writeReference(sharedValues.getReference(context.bout, buf.str()));
+				}
+
+				if (curve.getType() == SsCurve::Hermite || curve.getType() == SsCurve::Bezier)
+				{
+					std::ostringstream buf(std::ios_base::out | std::ios_base::binary);
+					BinaryDataWriter w(buf);
+					w.writeFloat(curve.getStartT());
+					w.writeFloat(curve.getStartV());
+					w.writeFloat(curve.getEndT());
+					w.writeFloat(curve.getEndV());
+					w.flush();
+					context.bout.writeReference(sharedValues.getReference(context.bout, buf.str()));
+				}
+				else
+				{
+					context.bout.writeInt(0);
+				}
+			}
+		}
+	}
+
+	sharedValues.write(context.bout);
+}
+
+
 #if 0
 static const char girl_images_0[] = "girl.png";
 const char* girl_images[] = {
@@ -991,10 +2632,9 @@ const char* girl_images[] = {
 void writeImageList(Context& context, ss::SsImageList::ConstPtr imageList)
 {
 	// ファイル名文字列定義
+	std::vector<BinaryDataWriter::Reference> imageRefs;
 	BOOST_FOREACH( SsImage::ConstPtr image, imageList->getImages() )
 	{
-		int index = image->getId();
-		std::string label = (format("%1%_image_%2%") % context.prefix % index).str();
 		boost::filesystem::path path = image->getPath();
 		boost::filesystem::path filename = path;
 		if (!context.options.notModifyImagePath)
@@ -1005,13 +2645,14 @@ void writeImageList(Context& context, ss::SsImageList::ConstPtr imageList)
 
 		if (context.sourceFormatMode)
 		{
+			int index = image->getId();
+			std::string label = (format("%1%_image_%2%") % context.prefix % index).str();
 			context.out << format("static const char %1%[] = \"%2%\";") % label % filename.generic_string();
 			context.out << std::endl;
 		}
 		else
 		{
-			context.bout.setReference(label);
-			context.bout.writeString(filename.generic_string());
+			imageRefs.push_back(context.bout.writeSharedString(filename.generic_string()));
 		}
 	}
 
@@ -1021,7 +2662,7 @@ void writeImageList(Context& context, ss::SsImageList::ConstPtr imageList)
 		context.out << format("const char* %1%_images[] = {") % context.prefix;
 		context.out << std::endl;
 		{
-			Indenting _;
+			Indenting _(context.out);
 			BOOST_FOREACH( SsImage::ConstPtr image, imageList->getImages() )
 			{
 				int index = image->getId();
@@ -1047,26 +2688,27 @@ void writeImageList(Context& context, ss::SsImageList::ConstPtr imageList)
 	}
 	else
 	{
-		context.bout.setReference(context.imageDataLabel);
+		context.bout.setReference(context.imageDataRef);
 	}
 
 	{
-		Indenting _;
+		Indenting _(context.out);
+		size_t imageCount = 0;
 		BOOST_FOREACH( SsImage::ConstPtr image, imageList->getImages() )
 		{
-			int index = image->getId();
-			std::string label = (format("%1%_image_%2%") % context.prefix % index).str();
-
 			if (context.sourceFormatMode)
 			{
+				int index = image->getId();
+				std::string label = (format("%1%_image_%2%") % context.prefix % index).str();
 				context.out << indent;
 				context.out << format("(ss_offset)((char*)%1% - (char*)&%2%),") % label % context.dataBase;
 				context.out << std::endl;
 			}
 			else
 			{
-				context.bout.writeReference(label);
+				context.bout.writeReference(imageRefs.at(imageCount));
 			}
+			imageCount++;
 		}
 
 		if (context.sourceFormatMode)
@@ -13,6 +13,41 @@ struct Cocos2dSaver
 	{
 		bool	useTragetAffineTransformation;
 		bool	notModifyImagePath;
+		int		numJobs;		/**< フレームのエンコードに使うスレッド数（0以下のときはCPU数） */
+		int		keyframeInterval;	/**< 前フレームからの差分で出力するときのキーフレーム間隔（0のときは差分形式を使わない） */
+		bool	quantize;			/**< 座標、回転角、スケールを固定小数点に量子化して出力する */
+		int		positionFractionBits;	/**< 量子化するときの座標の小数部ビット数 */
+		int		framesPerChunk;		/**< フレームデータを圧縮するときの１チャンクのフレーム数（0のときは圧縮しない。バイナリ形式のみ） */
+		bool	curveFormat;		/**< フレームを展開せず、キーフレームと補間方法を出力してプレイヤーで計算する（バイナリ形式のみ） */
+		int		resampleFps;		/**< このfpsに相当する間隔でフレームを残し、間のフレームはプレイヤーで補間する（0のときは行わない） */
+		float	maxResampleError;	/**< 前後のフレームから線形補間で復元できるフレームを間引くときの許容誤差（ピクセル、度。負のときは行わない） */
+		bool	rectTable;			/**< 参照元の範囲を画像ごとの表にまとめ、フレームには表での番号を出力する */
+		bool	fixedRecords;		/**< フレームのパーツ情報を要素ごとの固定長の配列で出力する（バイナリ形式のみ） */
+		bool	pageAlign;			/**< フレームのデータ、フレームのインデックス、パーツ情報の先頭をページ境界に揃える（バイナリ形式のみ） */
+	};
+
+	/** 量子化で生じた誤差の最大値 */
+	struct QuantizationError
+	{
+		float	position;		/**< 座標（ピクセル） */
+		float	rotation;		/**< 回転角（度） */
+		float	scale;			/**< スケール */
+
+		QuantizationError() : position(0), rotation(0), scale(0) {}
+	};
+
+	/** フレームを間引いた結果と、補間による復元で生じる誤差の最大値 */
+	struct ResamplingReport
+	{
+		int		numFrames;		/**< 元のフレーム数 */
+		int		numStoredFrames;	/**< 出力したフレーム数 */
+		float	position;		/**< 座標（ピクセル） */
+		float	rotation;		/**< 回転角（度） */
+		float	scale;			/**< スケール（パーツの長辺でのピクセル） */
+		int		opacity;		/**< 不透明度（0-255） */
+		int		vertexOffset;	/**< 頂点変形（ピクセル） */
+
+		ResamplingReport() : numFrames(0), numStoredFrames(0), position(0), rotation(0), scale(0), opacity(0), vertexOffset(0) {}
 	};
 
 	/** cocos2dプレイヤー形式で出力する */
@@ -24,7 +59,9 @@ struct Cocos2dSaver
 		ss::SsMotion::Ptr motion,
 		ss::SsImageList::ConstPtr optImageList,
 		const std::string& prefixLabel,
-		const std::string& creatorComment
+		const std::string& creatorComment,
+		QuantizationError* quantizationError = NULL,
+		ResamplingReport* resamplingReport = NULL
 		);
 };
 
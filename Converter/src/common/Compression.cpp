@@ -0,0 +1,145 @@
+﻿#include "Compression.h"
+#include <cstring>
+
+namespace compression
+{
+	static const size_t	MIN_MATCH = 4;
+	static const size_t	MAX_OFFSET = 0xffff;
+	static const int	HASH_BITS = 14;
+
+
+	static unsigned int read32(const unsigned char* p)
+	{
+		return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<unsigned int>(p[3]) << 24);
+	}
+
+	static size_t hash(unsigned int value)
+	{
+		return (value * 2654435761U) >> (32 - HASH_BITS);
+	}
+
+	/** 15を超える長さの残りを、255の並びと端数で出力する */
+	static void writeLength(std::vector<char>& out, size_t length)
+	{
+		for (; length >= 255; length -= 255) out.push_back(static_cast<char>(255));
+		out.push_back(static_cast<char>(length));
+	}
+
+	/** リテラルと一致（matchLengthが0のときはリテラルのみ）を１シーケンスとして出力する */
+	static void writeSequence(std::vector<char>& out, const unsigned char* literals, size_t literalLength, size_t offset, size_t matchLength)
+	{
+		size_t matchCode = matchLength ? matchLength - MIN_MATCH : 0;
+		unsigned char token = static_cast<unsigned char>(((literalLength < 15 ? literalLength : 15) << 4) | (matchCode < 15 ? matchCode : 15));
+		out.push_back(static_cast<char>(token));
+		if (literalLength >= 15) writeLength(out, literalLength - 15);
+		out.insert(out.end(), literals, literals + literalLength);
+
+		if (matchLength)
+		{
+			out.push_back(static_cast<char>(offset));
+			out.push_back(static_cast<char>(offset >> 8));
+			if (matchCode >= 15) writeLength(out, matchCode - 15);
+		}
+	}
+
+
+	void compress(const char* data, size_t size, std::vector<char>& out)
+	{
+		const unsigned char* src = reinterpret_cast<const unsigned char*>(data);
+		std::vector<long> table(1 << HASH_BITS, -1L);
+
+		out.clear();
+		size_t anchor = 0;
+		size_t pos = 0;
+		while (pos + MIN_MATCH <= size)
+		{
+			size_t h = hash(read32(src + pos));
+			long candidate = table[h];
+			table[h] = static_cast<long>(pos);
+
+			if (candidate < 0
+			 || pos - candidate > MAX_OFFSET
+			 || std::memcmp(src + candidate, src + pos, MIN_MATCH) != 0)
+			{
+				pos++;
+				continue;
+			}
+
+			size_t length = MIN_MATCH;
+			while (pos + length < size && src[candidate + length] == src[pos + length]) length++;
+
+			writeSequence(out, src + anchor, pos - anchor, pos - candidate, length);
+
+			// 一致した範囲も以降の検索対象にする
+			size_t end = pos + length;
+			for (pos++; pos < end && pos + MIN_MATCH <= size; pos++)
+			{
+				table[hash(read32(src + pos))] = static_cast<long>(pos);
+			}
+			pos = end;
+			anchor = end;
+		}
+
+		// 残りをリテラルとして出力する（常に最後のシーケンスを置く）
+		writeSequence(out, src + anchor, size - anchor, 0, 0);
+	}
+
+
+	bool decompress(const char* data, size_t size, char* out, size_t outSize)
+	{
+		const unsigned char* ip = reinterpret_cast<const unsigned char*>(data);
+		const unsigned char* const iend = ip + size;
+		unsigned char* op = reinterpret_cast<unsigned char*>(out);
+		unsigned char* const ostart = op;
+		unsigned char* const oend = op + outSize;
+
+		while (ip < iend)
+		{
+			unsigned int token = *ip++;
+
+			size_t literalLength = token >> 4;
+			if (literalLength == 15)
+			{
+				unsigned char b;
+				do
+				{
+					if (ip >= iend) return false;
+					b = *ip++;
+					literalLength += b;
+				} while (b == 255);
+			}
+			if (literalLength > static_cast<size_t>(iend - ip) || literalLength > static_cast<size_t>(oend - op)) return false;
+			std::memcpy(op, ip, literalLength);
+			ip += literalLength;
+			op += literalLength;
+
+			// 最後のシーケンスはリテラルのみ
+			if (ip >= iend) break;
+
+			if (iend - ip < 2) return false;
+			size_t offset = ip[0] | (ip[1] << 8);
+			ip += 2;
+			if (offset == 0 || offset > static_cast<size_t>(op - ostart)) return false;
+
+			size_t matchLength = token & 15;
+			if (matchLength == 15)
+			{
+				unsigned char b;
+				do
+				{
+					if (ip >= iend) return false;
+					b = *ip++;
+					matchLength += b;
+				} while (b == 255);
+			}
+			matchLength += MIN_MATCH;
+			if (matchLength > static_cast<size_t>(oend - op)) return false;
+
+			// 重なりがあり得るので1バイトずつコピーする
+			const unsigned char* match = op - offset;
+			for (size_t i = 0; i < matchLength; i++) *op++ = *match++;
+		}
+		return op == oend;
+	}
+
+};
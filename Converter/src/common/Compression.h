@@ -0,0 +1,30 @@
+﻿#ifndef _COMPRESSION_H_
+#define _COMPRESSION_H_
+
+#include <cstddef>
+#include <vector>
+
+/**
+ * ssbaのフレームデータを圧縮するためのLZ77系の圧縮
+ *
+ * 圧縮データは次のシーケンスの並びです
+ *   token(1byte)        上位4bit:リテラル長、下位4bit:一致長-4（15のときは後続の拡張バイトを加算する）
+ *   [リテラル長の拡張]   255が続く間、各バイトを加算
+ *   リテラル
+ *   offset(2byte LE)    一致位置までの距離（最後のシーケンスには無い）
+ *   [一致長の拡張]       255が続く間、各バイトを加算
+ * 展開には元のサイズが必要です
+ * プレイヤー（SSPlayer.cppのdecompressFrameChunk）にも同じ展開処理があるので、形式を変えるときは両方を揃えること
+ */
+namespace compression
+{
+
+	/** dataを圧縮し、結果をoutに格納する */
+	void compress(const char* data, size_t size, std::vector<char>& out);
+
+	/** 圧縮データをoutSizeバイトに展開する。データが壊れているときはfalseを返す */
+	bool decompress(const char* data, size_t size, char* out, size_t outSize);
+
+};
+
+#endif	// _COMPRESSION_H_
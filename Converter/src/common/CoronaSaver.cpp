@@ -19,6 +19,7 @@
 using boost::shared_ptr;
 using boost::format;
 using namespace ss;
+using saverutil::ImageRectList;
 
 // インデントあたりのスペース数 
 #define SPACE_OF_INDENT		2
@@ -68,71 +69,11 @@ namespace {
     }
 
 
-    class ImageRectList
-    {
-        typedef std::map<SsRect, int> RectMap;
-        typedef std::vector<shared_ptr<RectMap> > RectMapList;
-        
-        RectMapList _list;
-        
-    public:
-        ImageRectList(size_t numImages)
-        {
-            addImage(static_cast<int>(numImages) - 1);
-        }
-        
-        int append(int imageNo, const SsRect& rect)
-        {
-            assert(imageNo >= 0);
- 
-            addImage(imageNo);
-            
-            RectMap::const_iterator i = _list[imageNo]->find(rect);
-            if (i != _list[imageNo]->end())
-            {
-                return i->second;
-            }
-            
-            int no = static_cast<int>(_list[imageNo]->size());
-            (*_list[imageNo])[rect] = no;
-            return no;
-        }
-        
-        void addImage(int imageNo)
-        {
-            size_t n = imageNo + 1;
-            while (_list.size() < n)
-            {
-                _list.push_back(shared_ptr<RectMap>(new RectMap()));
-            }
-        }
-        
-        int numImages() const
-        {
-            return static_cast<int>(_list.size());
-        }
-        
-        std::vector<SsRect> getRectList(int imageNo) const
-        {
-            assert(imageNo >= 0 && imageNo < static_cast<int>(_list.size()));
-
-            std::vector<SsRect> list;
-            list.resize(_list[imageNo]->size());
-
-            for (RectMap::iterator i = _list[imageNo]->begin(), end = _list[imageNo]->end(); i != end; i++)
-            {
-                list[i->second] = i->first;
-            }
-            
-            return list;
-        }
-    };
-
 };
 
 
 static void writeParts(std::ostream& out, textenc::Encoding outEncoding, ss::SsMotion::Ptr motion, ss::SsImageList::ConstPtr imageList, const std::string& prefixLabel, const CoronaSaver::Options& options);
-static void writeFrameParam(std::ostream& out, const SsMotionFrameDecoder::FrameParam& param, ImageRectList& imageRectList, ss::SsImageList::ConstPtr imageList, const std::string& prefixLabel, int frameNo , std::string& udat);
+static void writeFrameParam(std::ostream& out, const SsMotionFrameDecoder::FrameParam& param, const SsUserDataValue* userData, ImageRectList& imageRectList, ss::SsImageList::ConstPtr imageList, const std::string& prefixLabel, int frameNo , std::string& udat);
 static void writeImageList(std::ostream& out, ss::SsImageList::ConstPtr imageList, const std::string& prefixLabel, const CoronaSaver::Options& options);
 static void writeImageRectList(std::ostream& out, const ImageRectList& imageRectList, CoronaSaver::Options& options);
 
@@ -314,42 +255,50 @@ void writeParts(std::ostream& out, textenc::Encoding outEncoding, ss::SsMotion::
 	std::string udat_string = "";
 	// 各パーツのフレームごとのパラメータ値 
 	int outtedFrameCount = 0;
+	const SsMotionFrameDecoder::Tracks tracks(motion);
+	// フレーム間で使い回す作業領域 
+	std::vector<SsMotionFrameDecoder::FrameParam> r;
+	std::vector<int> order;
+	SsMotionFrameDecoder::UserDataTable userData;
 	for (int frameNo = 0; frameNo < motion->getTotalFrame(); frameNo++)
 	{
 		// このフレームのパラメータを計算する 
-		std::vector<SsMotionFrameDecoder::FrameParam> r;
-		SsMotionFrameDecoder::decodeNodes(r, motion, frameNo, SsMotionFrameDecoder::InheritCalcuation_Calculate, true);
+		SsMotionFrameDecoder::decodeNodes(r, tracks, frameNo, SsMotionFrameDecoder::InheritCalcuation_Calculate, true, &userData);
 
 		// 優先順位でソート 
-		std::sort(r.begin(), r.end(), SsMotionFrameDecoder::FrameParam::priorityComparator);
+		SsMotionFrameDecoder::sortByPriority(order, r);
 
         // データ出力の必要ないものはリストから削除する
 		bool (*removeFunc)(const SsMotionFrameDecoder::FrameParam& r) = 
 			options.isOmitNullPart ? isRemovePartAndNull : isRemovePart;
 
-        std::vector<SsMotionFrameDecoder::FrameParam>::iterator removes =
-            std::remove_if(r.begin(), r.end(), removeFunc);
-        r.erase(removes, r.end());
+		std::vector<int>::iterator last = order.begin();
+		for (std::vector<int>::iterator i = order.begin(); i != order.end(); ++i)
+		{
+			if (!removeFunc(r[*i])) *last++ = *i;
+		}
+		order.erase(last, order.end());
 
-        //int partCount = static_cast<int>(r.size());
+        //int partCount = static_cast<int>(order.size());
 
-		//if (!r.empty())
+		//if (!order.empty())
 		{
 			if (outtedFrameCount > 0) out << format(",%1%") % crlf;
 
 			out << format("{%1%") % crlf;
 
-            if (!r.empty())
+            if (!order.empty())
             {
                 int partCount = 0;
-                BOOST_FOREACH( SsMotionFrameDecoder::FrameParam& param, r )
+                BOOST_FOREACH( int index, order )
                 {
+                    const SsMotionFrameDecoder::FrameParam& param = r[index];
                     Indenting _;
                     
                     if (partCount++ > 0) out << "," << crlf;
                     out << indent;
                     
-                    writeFrameParam(out, param, imageRectList, imageList, prefixLabel, frameNo , udat_string);
+                    writeFrameParam(out, param, userData.find(param.node->getId()), imageRectList, imageList, prefixLabel, frameNo , udat_string);
                 }
                 out << crlf;
             }
@@ -481,9 +430,9 @@ namespace
 /**
  * １パーツ分のフレーム情報を出力する 
  */
-static void writeFrameParam(std::ostream& out, const SsMotionFrameDecoder::FrameParam& param, ImageRectList& imageRectList, ss::SsImageList::ConstPtr imageList, const std::string& prefixLabel, int frameNo , std::string& udat)
+static void writeFrameParam(std::ostream& out, const SsMotionFrameDecoder::FrameParam& param, const SsUserDataValue* userData, ImageRectList& imageRectList, ss::SsImageList::ConstPtr imageList, const std::string& prefixLabel, int frameNo , std::string& udat)
 {
-	SsNode::ConstPtr node = param.node;
+	const SsNode* node = param.node;
 
 	SsRect souRect  = getPicRect(param);
 
@@ -542,9 +491,9 @@ static void writeFrameParam(std::ostream& out, const SsMotionFrameDecoder::Frame
 	//params.addInt(0, 0);	// 未対応：頂点変形
 
 	saverutil::ParameterBuffer udat_params;
-	if (param.udat.value.hasData())
+	if (userData)
 	{
-		const SsUserDataValue& value = param.udat.value;
+		const SsUserDataValue& value = *userData;
 		//少数丸め、整数書式かを合わせるため多少強引な方法をとります。
 		if (value.number)
 		{
@@ -598,7 +547,7 @@ static void writeFrameParam(std::ostream& out, const SsMotionFrameDecoder::Frame
 	out << "{ ";
 	out << params.toEllipsisString();
 	//ユーザーデータ追加 kurooka
-	if ( param.udat.value.hasData()  )
+	if ( userData  )
 	{
 		std::string out_str ="[\"";
 		out_str += boost::lexical_cast<std::string>(frameNo);
@@ -28,15 +28,15 @@ namespace debug
 		out << "*/" << std::endl;
 	}
 
-	void dumpFrameParamList(std::ostream& out, const std::vector<SsMotionFrameDecoder::FrameParam>& paramList)
+	void dumpFrameParamList(std::ostream& out, const std::vector<SsMotionFrameDecoder::FrameParam>& paramList, const SsMotionFrameDecoder::UserDataTable* userData)
 	{
 		BOOST_FOREACH( const SsMotionFrameDecoder::FrameParam& param, paramList )
 		{
-			debug::dumpFrameParam(out, param);
+			debug::dumpFrameParam(out, param, userData ? userData->find(param.node->getId()) : 0);
 		}
 	}
 
-	void dumpFrameParam(std::ostream& out, const ss::SsMotionFrameDecoder::FrameParam& param)
+	void dumpFrameParam(std::ostream& out, const ss::SsMotionFrameDecoder::FrameParam& param, const SsUserDataValue* userData)
 	{
 		out << format("part[%1%,%2%], ") % param.node->getId() % param.node->getName();
 		out << format("posx[%1%], ") % param.posx.value;
@@ -44,14 +44,14 @@ namespace debug
 		out << format("scax[%1%], ") % param.scax.value;
 		out << format("scay[%1%], ") % param.scay.value;
 		out << format("angl[rad:%1% deg:%2%], ") % param.angl.value % mathutil::radianToDegree(param.angl.value);
-		out << format("hide[%1%,%2%], ") % param.hide.value % (param.hide.inheritPercent ? param.hide.inheritPercent.get() : -1);
-		out << format("tran[%1%,%2%], ") % param.tran.value % (param.tran.inheritPercent ? param.tran.inheritPercent.get() : -1);
-		out << format("flph[%1%,%2%], ") % param.flph.value % (param.flph.inheritPercent ? param.flph.inheritPercent.get() : -1);
-		out << format("flpv[%1%,%2%], ") % param.flpv.value % (param.flpv.inheritPercent ? param.flpv.inheritPercent.get() : -1);
+		out << format("hide[%1%,%2%], ") % param.hide.value % (param.hide.inheritPercent.isSet ? param.hide.inheritPercent.percent : -1);
+		out << format("tran[%1%,%2%], ") % param.tran.value % (param.tran.inheritPercent.isSet ? param.tran.inheritPercent.percent : -1);
+		out << format("flph[%1%,%2%], ") % param.flph.value % (param.flph.inheritPercent.isSet ? param.flph.inheritPercent.percent : -1);
+		out << format("flpv[%1%,%2%], ") % param.flpv.value % (param.flpv.inheritPercent.isSet ? param.flpv.inheritPercent.percent : -1);
 		
-		if (param.udat.value.hasData())
+		if (userData)
 		{
-			const SsUserDataValue& value = param.udat.value;
+			const SsUserDataValue& value = *userData;
 		
 			out << "udat[";
 			if (value.number)
@@ -18,8 +18,8 @@ namespace debug
 	void dumpPrefix(std::ostream& out, int frameNo);
 	void dumpSuffix(std::ostream& out);
 
-	void dumpFrameParamList(std::ostream& out, const std::vector<SsMotionFrameDecoder::FrameParam>& paramList);
-	void dumpFrameParam(std::ostream& out, const ss::SsMotionFrameDecoder::FrameParam& param);
+	void dumpFrameParamList(std::ostream& out, const std::vector<SsMotionFrameDecoder::FrameParam>& paramList, const SsMotionFrameDecoder::UserDataTable* userData = 0);
+	void dumpFrameParam(std::ostream& out, const ss::SsMotionFrameDecoder::FrameParam& param, const SsUserDataValue* userData = 0);
 
 
 }	// namespace debug
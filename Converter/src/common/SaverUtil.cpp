@@ -3,6 +3,7 @@
 #include <sstream>
 #include <iomanip>
 #include <cmath>
+#include <cassert>
 
 namespace saverutil {
 
@@ -104,4 +105,58 @@ std::string ParameterBuffer::toEllipsisString() const
 }
 
 
+
+/**
+ * ImageRectList
+ */
+
+ImageRectList::ImageRectList(size_t numImages)
+{
+	addImage(static_cast<int>(numImages) - 1);
+}
+
+int ImageRectList::append(int imageNo, const ss::SsRect& rect)
+{
+	assert(imageNo >= 0);
+
+	addImage(imageNo);
+
+	RectMap::const_iterator i = _list[imageNo].find(rect);
+	if (i != _list[imageNo].end())
+	{
+		return i->second;
+	}
+
+	int no = static_cast<int>(_list[imageNo].size());
+	_list[imageNo][rect] = no;
+	return no;
+}
+
+void ImageRectList::addImage(int imageNo)
+{
+	size_t n = imageNo + 1;
+	if (_list.size() < n) _list.resize(n);
+}
+
+int ImageRectList::numImages() const
+{
+	return static_cast<int>(_list.size());
+}
+
+std::vector<ss::SsRect> ImageRectList::getRectList(int imageNo) const
+{
+	assert(imageNo >= 0 && imageNo < static_cast<int>(_list.size()));
+
+	std::vector<ss::SsRect> list;
+	list.resize(_list[imageNo].size());
+
+	for (RectMap::const_iterator i = _list[imageNo].begin(), end = _list[imageNo].end(); i != end; i++)
+	{
+		list[i->second] = i->first;
+	}
+
+	return list;
+}
+
+
 };	// saverutil
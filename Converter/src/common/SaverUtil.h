@@ -3,7 +3,9 @@
 
 #include <string>
 #include <vector>
+#include <map>
 #include <boost/optional/optional.hpp>
+#include "SsMotion.h"
 
 namespace saverutil {
 
@@ -44,6 +46,30 @@ namespace saverutil {
 		std::string toEllipsisString() const;
 	};
 
+
+
+	/**
+	 * ImageRectList
+	 * 画像ごとに参照元の範囲を重複なく並べ、登録順の番号で引けるようにします
+	 */
+	class ImageRectList
+	{
+		typedef std::map<ss::SsRect, int> RectMap;
+
+		std::vector<RectMap>	_list;
+
+	public:
+		ImageRectList(size_t numImages);
+
+		/** 範囲を登録し、その画像での番号を返す。登録済みのときは同じ番号を返す */
+		int append(int imageNo, const ss::SsRect& rect);
+		void addImage(int imageNo);
+
+		int numImages() const;
+		/** 画像に登録した範囲を番号順に返す */
+		std::vector<ss::SsRect> getRectList(int imageNo) const;
+	};
+
 };	// saverutil
 
 #endif	// _SAVER_UTIL_H_
@@ -24,9 +24,6 @@ SsPoint::SsPoint(int x, int y)
 	: x(x), y(y)
 {}
 	
-SsPoint::~SsPoint()
-{}
-
 bool SsPoint::isZero() const
 {
 	return x == 0 && y == 0;
@@ -176,9 +173,6 @@ SsColor::SsColor(ColorType r, ColorType g, ColorType b, ColorType a)
 	: r(r), g(g), b(b), a(a)
 {}
 
-SsColor::~SsColor()
-{}
-
 SsColor::ColorType SsColor::clip(int value)
 {
 	if (value <= 0) return 0;
@@ -287,14 +281,35 @@ std::string SsKeyframe::toString() const
 }
 
 
+/** フレーム番号でキーフレームを比較する */
+static bool keyframeFrameNoLess(const SsKeyframe& lhs, const SsKeyframe& rhs)
+{
+	return lhs.getFrameNo() < rhs.getFrameNo();
+}
+
+
 /**
  * キーフレームタイムライン 
  */
 SsKeyframeTimeline::SsKeyframeTimeline(const std::vector<SsKeyframe>& keyframes)
+	: _timeline(keyframes)
 {
-	BOOST_FOREACH( const SsKeyframe& keyframe, keyframes )
+	// フレーム番号順に並べ、同じフレームのキーは後に指定されたものを残す
+	std::stable_sort(_timeline.begin(), _timeline.end(), keyframeFrameNoLess);
+
+	Timeline::iterator out = _timeline.begin();
+	for (Timeline::iterator i = _timeline.begin(); i != _timeline.end(); ++i)
 	{
-		_timeline[keyframe.getFrameNo()] = keyframe;
+		Timeline::iterator next = i + 1;
+		if (next != _timeline.end() && next->getFrameNo() == i->getFrameNo()) continue;
+		*out++ = *i;
+	}
+	_timeline.erase(out, _timeline.end());
+
+	_frameNos.reserve(_timeline.size());
+	BOOST_FOREACH( const SsKeyframe& keyframe, _timeline )
+	{
+		_frameNos.push_back(keyframe.getFrameNo());
 	}
 }
 
@@ -311,10 +326,10 @@ std::string SsKeyframeTimeline::toString() const
 	std::stringstream ss;
 	ss << "[";
 	bool first = true;
-	BOOST_FOREACH( const Timeline::value_type& i, _timeline )
+	BOOST_FOREACH( const SsKeyframe& keyframe, _timeline )
 	{
 		if (!first) ss << ",";
-		ss << i.second.toString();
+		ss << keyframe.toString();
 		first = false;
 	}
 	ss << "]";
@@ -328,54 +343,100 @@ bool SsKeyframeTimeline::hasTimeline() const
 
 int SsKeyframeTimeline::getFirstFrameNo() const
 {
-	return !_timeline.empty() ? _timeline.begin()->first : -1;
+	return !_frameNos.empty() ? _frameNos.front() : -1;
 }
 
 int SsKeyframeTimeline::getLastFrameNo() const
 {
-	return !_timeline.empty() ? _timeline.rbegin()->first : -1;
+	return !_frameNos.empty() ? _frameNos.back() : -1;
+}
+
+/** [first, last)の範囲から、指定フレーム以前で最後のキーフレーム位置を返す。無いときはfirst-1を返す */
+int SsKeyframeTimeline::findForwardIndex(int frameNo, int first, int last) const
+{
+	const int* begin = _frameNos.empty() ? 0 : &_frameNos[0];
+	const int* i = std::upper_bound(begin + first, begin + last, frameNo);
+	return static_cast<int>(i - begin) - 1;
 }
 
 /** 指定フレーム以前のキーフレームを探す。見つからないときはInvalidを返す */
 SsKeyframe::ConstPtr SsKeyframeTimeline::findForward(int frameNo) const
 {
-	std::pair<int, SsKeyframe> i;
-	BOOST_REVERSE_FOREACH( i, _timeline )
-	{
-		if (i.first <= frameNo)
-		{
-			return &_timeline.at(i.first);
-		}
-	}
-	return Invalid;
+	int index = findForwardIndex(frameNo, 0, static_cast<int>(_frameNos.size()));
+	return index >= 0 ? &_timeline[index] : Invalid;
 }
 
 /** 指定フレーム以後のキーフレームを探す。見つからないときはInvalidを返す */
 SsKeyframe::ConstPtr SsKeyframeTimeline::findBackward(int frameNo) const
 {
-	std::pair<int, SsKeyframe> i;
-	BOOST_FOREACH( i, _timeline )
-	{
-		if (i.first >= frameNo)
-		{
-			return &_timeline.at(i.first);
-		}
-	}
-	return Invalid;
+	std::vector<int>::const_iterator i = std::lower_bound(_frameNos.begin(), _frameNos.end(), frameNo);
+	return i != _frameNos.end() ? &_timeline[i - _frameNos.begin()] : Invalid;
 }
 
 /** 指定フレームのキーフレームを探す。見つからないときはInvalidを返す */
 SsKeyframe::ConstPtr SsKeyframeTimeline::find(int frameNo) const
 {
-	std::pair<int, SsKeyframe> i;
-	BOOST_FOREACH( i, _timeline )
+	std::vector<int>::const_iterator i = std::lower_bound(_frameNos.begin(), _frameNos.end(), frameNo);
+	return (i != _frameNos.end() && *i == frameNo) ? &_timeline[i - _frameNos.begin()] : Invalid;
+}
+
+
+/**
+ * タイムラインの検索位置を保持するカーソル
+ */
+SsKeyframeTimeline::Cursor::Cursor(const SsKeyframeTimeline& timeline)
+	: _timeline(timeline), _frameNo(0), _index(-1)
+{
+	_index = _timeline.findForwardIndex(_frameNo, 0, static_cast<int>(_timeline._frameNos.size()));
+}
+
+SsKeyframeTimeline::Cursor::Cursor(const SsKeyframeTimeline& timeline, int frameNo)
+	: _timeline(timeline), _frameNo(frameNo), _index(-1)
+{
+	_index = _timeline.findForwardIndex(_frameNo, 0, static_cast<int>(_timeline._frameNos.size()));
+}
+
+/** 指定フレームへ移動する。前方へ少しずつ移動するときは線形に、それ以外は二分探索で位置を求める */
+void SsKeyframeTimeline::Cursor::seek(int frameNo)
+{
+	const std::vector<int>& frameNos = _timeline._frameNos;
+	const int size = static_cast<int>(frameNos.size());
+
+	if (frameNo < _frameNo)
+	{
+		// 後方へ戻るときは現在位置より前を探す
+		_index = _timeline.findForwardIndex(frameNo, 0, _index + 1);
+	}
+	else
 	{
-		if (i.first == frameNo)
+		// 前方へ進むときは数キー分だけ線形に進め、それでも届かなければ残りを二分探索する
+		const int LinearSteps = 4;
+		int steps = 0;
+		while (_index + 1 < size && frameNos[_index + 1] <= frameNo)
 		{
-			return &_timeline.at(i.first);
+			if (++steps > LinearSteps)
+			{
+				_index = _timeline.findForwardIndex(frameNo, _index + 1, size);
+				break;
+			}
+			_index++;
 		}
 	}
-	return Invalid;
+	_frameNo = frameNo;
+}
+
+/** 現在フレーム以前のキーフレームを返す。見つからないときはInvalidを返す */
+SsKeyframe::ConstPtr SsKeyframeTimeline::Cursor::getForward() const
+{
+	return _index >= 0 ? &_timeline._timeline[_index] : Invalid;
+}
+
+/** 現在フレーム以後のキーフレームを返す。見つからないときはInvalidを返す */
+SsKeyframe::ConstPtr SsKeyframeTimeline::Cursor::getBackward() const
+{
+	const std::vector<int>& frameNos = _timeline._frameNos;
+	if (_index >= 0 && frameNos[_index] == _frameNo) return &_timeline._timeline[_index];
+	return _index + 1 < static_cast<int>(frameNos.size()) ? &_timeline._timeline[_index + 1] : Invalid;
 }
 
 /** 無効なキーフレーム */
@@ -520,9 +581,37 @@ const std::string SsAttributeTag::toString(const Tag tag)
 // 文字列からenum値を取得
 SsAttributeTag::Tag SsAttributeTag::toEnum(const std::string& s)
 {
-	#define SS_ATTRIBUTE_TAG_TO_INT(unused, data, elem) if (s == BOOST_PP_STRINGIZE(elem)) return elem;
-	BOOST_PP_SEQ_FOR_EACH(SS_ATTRIBUTE_TAG_TO_INT, ~, SS_ATTRIBUTE_TAG_SEQ)
-	return SsAttributeTag::Unknown;
+	return toEnum(s.data(), s.size());
+}
+
+// タグ文字列（4文字）を32bit値にまとめる 
+static unsigned int packAttributeTag(const char* s)
+{
+	return static_cast<unsigned char>(s[0])
+		| (static_cast<unsigned char>(s[1]) << 8)
+		| (static_cast<unsigned char>(s[2]) << 16)
+		| (static_cast<unsigned char>(s[3]) << 24);
+}
+
+typedef boost::unordered_map<unsigned int, SsAttributeTag::Tag> AttributeTagTable;
+
+static AttributeTagTable makeAttributeTagTable()
+{
+	AttributeTagTable table;
+	#define SS_ATTRIBUTE_TAG_TO_TABLE(unused, data, elem) table[packAttributeTag(BOOST_PP_STRINGIZE(elem))] = SsAttributeTag::elem;
+	BOOST_PP_SEQ_FOR_EACH(SS_ATTRIBUTE_TAG_TO_TABLE, ~, SS_ATTRIBUTE_TAG_SEQ)
+	return table;
+}
+
+// 文字列からenum値を取得（表引きで定数時間） 
+SsAttributeTag::Tag SsAttributeTag::toEnum(const char* s, size_t length)
+{
+	// タグは全て4文字 
+	if (length != 4) return SsAttributeTag::Unknown;
+
+	static const AttributeTagTable table = makeAttributeTagTable();
+	AttributeTagTable::const_iterator it = table.find(packAttributeTag(s));
+	return it != table.end() ? it->second : SsAttributeTag::Unknown;
 }
 
 const SsAttributeType& SsAttributeTag::getType(const Tag tag)
@@ -718,29 +807,43 @@ SsNode::Ptr SsNode::createNodes(std::vector<SsPart::Ptr>& parts)
 	// ルートパーツが見つからない 
 	if (!rootPart) return Ptr();
 
+	// 親IDごとに子パーツをまとめておく（パーツの並び順は保つ） 
+	PartsByParent partsByParent;
+	BOOST_FOREACH( SsPart::Ptr& part, parts )
+	{
+		if (part->id < 0) continue;
+		partsByParent[part->parentId].push_back(part);
+	}
+
 	// ルートノード構築 
 	Ptr rootNode = Ptr(new SsNode(rootPart));
+	rootNode->_topology.reset(new Topology());
+	rootNode->_topology->nodes.reserve(parts.size());
+	rootNode->_topology->parentIndices.reserve(parts.size());
 
-	createChildren(rootNode, parts);
+	createChildren(rootNode, partsByParent, *rootNode->_topology, -1);
 
 	return rootNode;
 }
 
-void SsNode::createChildren(Ptr node, std::vector<SsPart::Ptr>& parts)
+void SsNode::createChildren(Ptr node, const PartsByParent& partsByParent, Topology& topology, int parentIndex)
 {
-	int nodeId = node->_part->id;
-	BOOST_FOREACH( SsPart::Ptr& part, parts )
+	// 行きがけ順に平坦化した階層へ加える 
+	int nodeIndex = topology.size();
+	topology.nodes.push_back(node.get());
+	topology.parentIndices.push_back(parentIndex);
+
+	PartsByParent::const_iterator children = partsByParent.find(node->_part->id);
+	if (children == partsByParent.end()) return;
+
+	BOOST_FOREACH( const SsPart::Ptr& part, children->second )
 	{
-		if (part->id < 0) continue;
-		if (part->parentId == nodeId)
-		{
-			Ptr childNode = Ptr(new SsNode(part));
+		Ptr childNode = Ptr(new SsNode(part));
 
-			childNode->_parent = node;
-			node->_children.push_back(childNode);
+		childNode->_parent = node;
+		node->_children.push_back(childNode);
 
-			createChildren(childNode, parts);
-		}
+		createChildren(childNode, partsByParent, topology, nodeIndex);
 	}
 }
 
@@ -765,11 +868,20 @@ static void countTreeNodesSub(int& count, const SsNode* node)
 
 int SsNode::countTreeNodes() const
 {
+	if (_topology) return _topology->size();
+
 	int count = 0;
 	countTreeNodesSub(count, this);
 	return count;
 }
 
+/** 平坦化したノード階層を返す。createNodes()で作られたルートノードのみ保持している */
+const SsNode::Topology& SsNode::getTopology() const
+{
+	assert(_topology);
+	return *_topology;
+}
+
 bool SsNode::hasFrame(int frameNo) const
 {
 	return _part->attributes.hasFrame(frameNo);
@@ -6,6 +6,7 @@
 #include <map>
 #include <boost/optional/optional.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/unordered_map.hpp>
 #include <boost/preprocessor.hpp>
 
 namespace ss
@@ -26,7 +27,6 @@ public:
 
 	SsPoint(void);
 	SsPoint(int x, int y);
-	~SsPoint();
 	
 	bool isZero() const;
 
@@ -125,7 +125,6 @@ public:
 
 	SsColor();
 	SsColor(ColorType r, ColorType g, ColorType b, ColorType a);
-	~SsColor();
 
 	static ColorType clip(int value);
 	static ColorType clip(float value);
@@ -209,16 +208,41 @@ private:
 
 /**
  * キーフレームタイムライン 
+ * キーフレームはフレーム番号順に連続した配列で保持し、二分探索で検索します
  */
 class SsKeyframeTimeline
 {
 private:
-	typedef std::map<int, SsKeyframe> Timeline;
+	typedef std::vector<SsKeyframe> Timeline;
 
 public:
 	typedef boost::shared_ptr<SsKeyframeTimeline> Ptr;
 	typedef boost::shared_ptr<const SsKeyframeTimeline> ConstPtr;
 
+	/**
+	 * タイムラインの検索位置を保持するカーソル
+	 * フレーム番号を順に進めながら検索する場合、１フレームあたり償却O(1)で前後のキーフレームを得られます
+	 */
+	class Cursor
+	{
+	public:
+		Cursor(const SsKeyframeTimeline& timeline);
+		Cursor(const SsKeyframeTimeline& timeline, int frameNo);
+
+		/** 指定フレームへ移動する。前方へ少しずつ移動するときは線形に、それ以外は二分探索で位置を求める */
+		void seek(int frameNo);
+
+		/** 現在フレーム以前のキーフレームを返す。見つからないときはInvalidを返す */
+		SsKeyframe::ConstPtr getForward() const;
+		/** 現在フレーム以後のキーフレームを返す。見つからないときはInvalidを返す */
+		SsKeyframe::ConstPtr getBackward() const;
+
+	private:
+		const SsKeyframeTimeline&	_timeline;
+		int							_frameNo;
+		int							_index;		/**< 現在フレーム以前で最後のキーフレーム位置。無いときは-1 */
+	};
+
 	SsKeyframeTimeline(const std::vector<SsKeyframe>& keyframes);
 	SsKeyframeTimeline(void);
 	~SsKeyframeTimeline();
@@ -227,6 +251,11 @@ public:
 	int getFirstFrameNo() const;
 	int getLastFrameNo() const;
 
+	/** キーフレーム数を返す */
+	int getNumKeyframes() const						{ return static_cast<int>(_timeline.size()); }
+	/** index番目のキーフレームを返す（フレーム番号順） */
+	const SsKeyframe& getKeyframe(int index) const	{ return _timeline.at(index); }
+
 	/** 指定フレーム以前のキーフレームを探す。見つからないときはInvalidを返す */
 	SsKeyframe::ConstPtr findForward(int frameNo) const;
 	/** 指定フレーム以後のキーフレームを探す。見つからないときはInvalidを返す */
@@ -240,7 +269,11 @@ public:
 	std::string toString() const;
 
 private:
-	Timeline	_timeline;
+	/** [first, last)の範囲から、指定フレーム以前で最後のキーフレーム位置を返す。無いときはfirst-1を返す */
+	int findForwardIndex(int frameNo, int first, int last) const;
+
+	Timeline			_timeline;
+	std::vector<int>	_frameNos;	/**< 二分探索用に_timelineのフレーム番号だけを並べたもの */
 };
 
 
@@ -419,6 +452,9 @@ public:
 	/** 文字列からenum値を取得 */
 	static Tag toEnum(const std::string& s);
 
+	/** 文字列からenum値を取得（表引きで定数時間） */
+	static Tag toEnum(const char* s, size_t length);
+
 
 	static const SsAttributeType& getType(const Tag tag);
 
@@ -539,6 +575,19 @@ public:
 	typedef boost::shared_ptr<const SsNode> ConstPtr;
 	typedef std::vector<ConstPtr> ChildrenList;
 
+	/**
+	 * 平坦化したノード階層
+	 * ルートノードから行きがけ順にノードを並べ、親ノードの位置を持ちます
+	 * 親は必ず子より前に並ぶため、先頭から１度走査するだけで親の値を参照できます
+	 */
+	struct Topology
+	{
+		std::vector<const SsNode*>	nodes;
+		std::vector<int>			parentIndices;	/**< 親ノードの位置。ルートノードは-1 */
+
+		int size() const	{ return static_cast<int>(nodes.size()); }
+	};
+
 	static Ptr createNodes(std::vector<SsPart::Ptr>& parts);
 	~SsNode();
 
@@ -546,6 +595,9 @@ public:
 	const ChildrenList& getChildren() const;
 	int countTreeNodes() const;
 
+	/** 平坦化したノード階層を返す。createNodes()で作られたルートノードのみ保持している */
+	const Topology& getTopology() const;
+
 	bool hasFrame(int frameNo) const;
 	SsAttribute::ConstPtr getAttribute(SsAttributeTag::Tag tag) const;
 
@@ -564,11 +616,14 @@ public:
 private:
 	SsNode(SsPart::Ptr part);
 
-	static void createChildren(Ptr node, std::vector<SsPart::Ptr>& parts);
+	typedef boost::unordered_map<int, std::vector<SsPart::Ptr> > PartsByParent;
+
+	static void createChildren(Ptr node, const PartsByParent& partsByParent, Topology& topology, int parentIndex);
 
-	SsPart::Ptr		_part;
-	Ptr				_parent;
-	ChildrenList	_children;
+	SsPart::Ptr					_part;
+	Ptr							_parent;
+	ChildrenList				_children;
+	boost::shared_ptr<Topology>	_topology;
 };
 
 
@@ -5,6 +5,7 @@
 #include <cassert>
 #include <cmath>
 #include <memory>
+#include <algorithm>
 
 namespace ss
 {
@@ -252,12 +253,12 @@ static SsColor::ColorType calcCurveColor(const InterpolationParams& params, SsCo
 
 
 
-/** キーフレームタイムラインからフレームの補間値を返す */
-static float calcFloatAttribute(SsAttribute::ConstPtr attribute, int frameNo)
+/** キーフレームタイムラインからフレームの補間値を返す（cursorは指定フレームへ移動済みであること） */
+static float calcFloatAttribute(SsAttribute::ConstPtr attribute, const SsKeyframeTimeline::Cursor& cursor, int frameNo)
 {
 	const SsAttributeType& attributeType = SsAttributeTag::getType(attribute->getTag());
-	SsKeyframe::ConstPtr forward = attribute->getTimeline()->findForward(frameNo);
-	SsKeyframe::ConstPtr backward = attribute->getTimeline()->findBackward(frameNo);
+	SsKeyframe::ConstPtr forward = cursor.getForward();
+	SsKeyframe::ConstPtr backward = cursor.getBackward();
 	
 	float forwardValue = (forward == SsKeyframeTimeline::Invalid)
 			? 0 : static_cast<const SsFloatValue*>(forward->getValue())->value;
@@ -296,12 +297,20 @@ static float calcFloatAttribute(SsAttribute::ConstPtr attribute, int frameNo)
 	return calcCurve(params, forwardValue, backwardValue);
 }
 
+/** キーフレームタイムラインからフレームの補間値を返す */
+static float calcFloatAttribute(SsAttribute::ConstPtr attribute, int frameNo)
+{
+	SsKeyframeTimeline::Cursor cursor(*attribute->getTimeline(), frameNo);
+	return calcFloatAttribute(attribute, cursor, frameNo);
+}
+
 
 static SsVertex4Value calcVertex4Attribute(SsAttribute::ConstPtr attribute, int frameNo)
 {
 	const SsAttributeType& attributeType = SsAttributeTag::getType(attribute->getTag());
-	SsKeyframe::ConstPtr forward = attribute->getTimeline()->findForward(frameNo);
-	SsKeyframe::ConstPtr backward = attribute->getTimeline()->findBackward(frameNo);
+	SsKeyframeTimeline::Cursor cursor(*attribute->getTimeline(), frameNo);
+	SsKeyframe::ConstPtr forward = cursor.getForward();
+	SsKeyframe::ConstPtr backward = cursor.getBackward();
 	
 	SsVertex4Value forwardValue;
 	if (forward != SsKeyframeTimeline::Invalid)
@@ -346,8 +355,9 @@ static SsVertex4Value calcVertex4Attribute(SsAttribute::ConstPtr attribute, int
 static SsColorBlendValue calcColorBlendAttribute(SsAttribute::ConstPtr attribute, int frameNo)
 {
 	const SsAttributeType& attributeType = SsAttributeTag::getType(attribute->getTag());
-	SsKeyframe::ConstPtr forward = attribute->getTimeline()->findForward(frameNo);
-	SsKeyframe::ConstPtr backward = attribute->getTimeline()->findBackward(frameNo);
+	SsKeyframeTimeline::Cursor cursor(*attribute->getTimeline(), frameNo);
+	SsKeyframe::ConstPtr forward = cursor.getForward();
+	SsKeyframe::ConstPtr backward = cursor.getBackward();
 	
 	SsColorBlendValue forwardValue;
 	if (forward != SsKeyframeTimeline::Invalid)
@@ -430,13 +440,36 @@ static SsColorBlendValue calcColorBlendAttribute(SsAttribute::ConstPtr attribute
  * 
  **************************************************/
 
+void SsMotionFrameDecoder::InheritPercent::set(const boost::optional<float>& value)
+{
+	isSet = value.is_initialized();
+	percent = isSet ? value.get() : 0;
+}
+
+static SsMotionFrameDecoder::Vertex4 toVertex4(const SsVertex4Value& src)
+{
+	SsMotionFrameDecoder::Vertex4 dst;
+	std::copy(src.v, src.v + 4, dst.v);
+	return dst;
+}
+
+static SsMotionFrameDecoder::ColorBlend toColorBlend(const SsColorBlendValue& src)
+{
+	SsMotionFrameDecoder::ColorBlend dst;
+	dst.type = src.type;
+	dst.blend = src.blend;
+	std::copy(src.colors, src.colors + 4, dst.colors);
+	return dst;
+}
+
+
 static void initFloatValue(SsMotionFrameDecoder::FloatValue& value, const SsAttributeTag::Tag tag)
 {
 	const SsAttributeType& type = SsAttributeTag::getType(tag);
 
 	value.value = static_cast<const SsFloatValue*>(type.getDefaultValue())->value;
 	value.inheritPercent.reset();
-	if (type.isInheritable()) value.inheritPercent = type.getDefaultInheritPercent();
+	if (type.isInheritable()) value.inheritPercent.set(type.getDefaultInheritPercent());
 }
 
 static void decodeFloatValue(SsMotionFrameDecoder::FloatValue& value, SsAttribute::ConstPtr attr, int frameNo)
@@ -444,7 +477,19 @@ static void decodeFloatValue(SsMotionFrameDecoder::FloatValue& value, SsAttribut
 	if (attr)
 	{
 		value.value = calcFloatAttribute(attr, frameNo);
-		value.inheritPercent = attr->getInheritedPercent();
+		value.inheritPercent.set(attr->getInheritedPercent());
+	}
+}
+
+static void decodeFloatValue(SsMotionFrameDecoder::FloatValue& value, SsAttribute::ConstPtr attr, int frameNo, const SsMotionFrameDecoder::Tracks& tracks, int nodeIndex)
+{
+	if (attr)
+	{
+		const float* track = tracks.getTrack(nodeIndex, attr->getTag());
+		value.value = (track && frameNo >= 0 && frameNo < tracks.getNumFrames())
+			? track[frameNo]
+			: calcFloatAttribute(attr, frameNo);
+		value.inheritPercent.set(attr->getInheritedPercent());
 	}
 }
 
@@ -453,17 +498,17 @@ static void initVertex4Value(SsMotionFrameDecoder::Vertex4Value& value, const Ss
 {
 	const SsAttributeType& type = SsAttributeTag::getType(tag);
 
-	value.value = *(static_cast<const SsVertex4Value*>(type.getDefaultValue()));
+	value.value = toVertex4(*(static_cast<const SsVertex4Value*>(type.getDefaultValue())));
 	value.inheritPercent.reset();
-	if (type.isInheritable()) value.inheritPercent = type.getDefaultInheritPercent();
+	if (type.isInheritable()) value.inheritPercent.set(type.getDefaultInheritPercent());
 }
 
 static void decodeVertex4Value(SsMotionFrameDecoder::Vertex4Value& value, SsAttribute::ConstPtr attr, int frameNo)
 {
 	if (attr)
 	{
-		value.value = calcVertex4Attribute(attr, frameNo);
-		value.inheritPercent = attr->getInheritedPercent();
+		value.value = toVertex4(calcVertex4Attribute(attr, frameNo));
+		value.inheritPercent.set(attr->getInheritedPercent());
 	}
 }
 
@@ -472,41 +517,68 @@ static void initColorBlendValue(SsMotionFrameDecoder::ColorBlendValue& value, co
 {
 	const SsAttributeType& type = SsAttributeTag::getType(tag);
 
-	value.value = *(static_cast<const SsColorBlendValue*>(type.getDefaultValue()));
+	value.value = toColorBlend(*(static_cast<const SsColorBlendValue*>(type.getDefaultValue())));
 	value.inheritPercent.reset();
-	if (type.isInheritable()) value.inheritPercent = type.getDefaultInheritPercent();
+	if (type.isInheritable()) value.inheritPercent.set(type.getDefaultInheritPercent());
 }
 
 static void decodeColorBlendValue(SsMotionFrameDecoder::ColorBlendValue& value, SsAttribute::ConstPtr attr, int frameNo)
 {
 	if (attr)
 	{
-		value.value = calcColorBlendAttribute(attr, frameNo);
-		value.inheritPercent = attr->getInheritedPercent();
+		value.value = toColorBlend(calcColorBlendAttribute(attr, frameNo));
+		value.inheritPercent.set(attr->getInheritedPercent());
 	}
 }
 
 
-static void initUserDataValue(SsMotionFrameDecoder::UserDataValue& value, const SsAttributeTag::Tag tag)
-{
-	const SsAttributeType& type = SsAttributeTag::getType(tag);
-
-	value.value = *(static_cast<const SsUserDataValue*>(type.getDefaultValue()));
-}
-
-static void decodeUserDataValue(SsMotionFrameDecoder::UserDataValue& value, SsAttribute::ConstPtr attr, int frameNo)
+static void decodeUserDataValue(SsMotionFrameDecoder::UserDataTable& userData, const SsNode* node, int frameNo)
 {
+	SsAttribute::ConstPtr attr = node->getAttribute(SsAttributeTag::UDAT);
 	if (attr)
 	{
 		SsKeyframe::ConstPtr keyframe = attr->getTimeline()->find(frameNo);
 		if (keyframe != SsKeyframeTimeline::Invalid)
 		{
-			value.value = *(static_cast<const SsUserDataValue*>(keyframe->getValue()));
+			const SsUserDataValue* value = static_cast<const SsUserDataValue*>(keyframe->getValue());
+			if (value->hasData()) userData.set(node->getId(), value);
 		}
 	}
 }
 
 
+SsMotionFrameDecoder::UserDataTable::UserDataTable()
+{
+}
+
+SsMotionFrameDecoder::UserDataTable::~UserDataTable()
+{
+}
+
+void SsMotionFrameDecoder::UserDataTable::clear()
+{
+	BOOST_FOREACH( int nodeId, _usedIds )
+	{
+		_values[nodeId] = 0;
+	}
+	_usedIds.clear();
+}
+
+void SsMotionFrameDecoder::UserDataTable::set(int nodeId, const SsUserDataValue* value)
+{
+	assert(nodeId >= 0);
+	if (nodeId >= static_cast<int>(_values.size())) _values.resize(nodeId + 1, 0);
+	if (!_values[nodeId]) _usedIds.push_back(nodeId);
+	_values[nodeId] = value;
+}
+
+/** ノードのユーザーデータを返す。無いときはNULLを返す */
+const SsUserDataValue* SsMotionFrameDecoder::UserDataTable::find(int nodeId) const
+{
+	return (nodeId >= 0 && nodeId < static_cast<int>(_values.size())) ? _values[nodeId] : 0;
+}
+
+
 SsMotionFrameDecoder::FrameParam::FrameParam(void)
 {
 	clear();
@@ -514,7 +586,7 @@ SsMotionFrameDecoder::FrameParam::FrameParam(void)
 
 void SsMotionFrameDecoder::FrameParam::clear()
 {
-	node.reset();
+	node = 0;
 
 	initFloatValue(posx, SsAttributeTag::POSX);
 	initFloatValue(posy, SsAttributeTag::POSY);
@@ -534,10 +606,9 @@ void SsMotionFrameDecoder::FrameParam::clear()
 	initFloatValue(orfy, SsAttributeTag::ORFY);
 	initVertex4Value(vert, SsAttributeTag::VERT);
 	initColorBlendValue(pcol, SsAttributeTag::PCOL);
-	initUserDataValue(udat, SsAttributeTag::UDAT);
 }
 
-void SsMotionFrameDecoder::FrameParam::decode(SsNode::ConstPtr node_, int frameNo)
+void SsMotionFrameDecoder::FrameParam::decode(const SsNode* node_, int frameNo)
 {
 	clear();
 	
@@ -561,10 +632,34 @@ void SsMotionFrameDecoder::FrameParam::decode(SsNode::ConstPtr node_, int frameN
 	decodeFloatValue(orfy, node->getAttribute(SsAttributeTag::ORFY), frameNo);
 	decodeVertex4Value(vert, node->getAttribute(SsAttributeTag::VERT), frameNo);
 	decodeColorBlendValue(pcol, node->getAttribute(SsAttributeTag::PCOL), frameNo);
-	decodeUserDataValue(udat, node->getAttribute(SsAttributeTag::UDAT), frameNo);
 }
 
 
+void SsMotionFrameDecoder::FrameParam::decode(const SsNode* node_, int frameNo, const Tracks& tracks, int nodeIndex)
+{
+	clear();
+	
+	node = node_;
+
+	decodeFloatValue(posx, node->getAttribute(SsAttributeTag::POSX), frameNo, tracks, nodeIndex);
+	decodeFloatValue(posy, node->getAttribute(SsAttributeTag::POSY), frameNo, tracks, nodeIndex);
+	decodeFloatValue(angl, node->getAttribute(SsAttributeTag::ANGL), frameNo, tracks, nodeIndex);
+	decodeFloatValue(scax, node->getAttribute(SsAttributeTag::SCAX), frameNo, tracks, nodeIndex);
+	decodeFloatValue(scay, node->getAttribute(SsAttributeTag::SCAY), frameNo, tracks, nodeIndex);
+	decodeFloatValue(tran, node->getAttribute(SsAttributeTag::TRAN), frameNo, tracks, nodeIndex);
+	decodeFloatValue(prio, node->getAttribute(SsAttributeTag::PRIO), frameNo, tracks, nodeIndex);
+	decodeFloatValue(flph, node->getAttribute(SsAttributeTag::FLPH), frameNo, tracks, nodeIndex);
+	decodeFloatValue(flpv, node->getAttribute(SsAttributeTag::FLPV), frameNo, tracks, nodeIndex);
+	decodeFloatValue(hide, node->getAttribute(SsAttributeTag::HIDE), frameNo, tracks, nodeIndex);
+	decodeFloatValue(imgx, node->getAttribute(SsAttributeTag::IMGX), frameNo, tracks, nodeIndex);
+	decodeFloatValue(imgy, node->getAttribute(SsAttributeTag::IMGY), frameNo, tracks, nodeIndex);
+	decodeFloatValue(imgw, node->getAttribute(SsAttributeTag::IMGW), frameNo, tracks, nodeIndex);
+	decodeFloatValue(imgh, node->getAttribute(SsAttributeTag::IMGH), frameNo, tracks, nodeIndex);
+	decodeFloatValue(orfx, node->getAttribute(SsAttributeTag::ORFX), frameNo, tracks, nodeIndex);
+	decodeFloatValue(orfy, node->getAttribute(SsAttributeTag::ORFY), frameNo, tracks, nodeIndex);
+	decodeVertex4Value(vert, node->getAttribute(SsAttributeTag::VERT), frameNo);
+	decodeColorBlendValue(pcol, node->getAttribute(SsAttributeTag::PCOL), frameNo);
+}
 
 
 
@@ -617,10 +712,26 @@ bool SsMotionFrameDecoder::FrameParam::isScaleZero(const FrameParam& r)
     return r.scax.value == 0 || r.scay.value == 0;
 }
 
-/** ユーザーデータがあるか */
-bool SsMotionFrameDecoder::FrameParam::hasUserData(const FrameParam& r)
+/** 優先順位で比較する（インデックス列のソート用） */
+class PriorityIndexComparator
+{
+	const std::vector<SsMotionFrameDecoder::FrameParam>&	_paramList;
+
+public:
+	PriorityIndexComparator(const std::vector<SsMotionFrameDecoder::FrameParam>& paramList) : _paramList(paramList) {}
+
+	bool operator()(int lhs, int rhs) const
+	{
+		return SsMotionFrameDecoder::FrameParam::priorityComparator(_paramList[lhs], _paramList[rhs]);
+	}
+};
+
+/** 優先順位でソートしたインデックス列を作る。paramListは並べ替えない */
+void SsMotionFrameDecoder::sortByPriority(std::vector<int>& order, const std::vector<FrameParam>& paramList)
 {
-	return r.udat.value.hasData();
+	order.resize(paramList.size());
+	for (size_t i = 0; i < order.size(); i++) order[i] = static_cast<int>(i);
+	std::sort(order.begin(), order.end(), PriorityIndexComparator(paramList));
 }
 
 
@@ -657,7 +768,7 @@ public:
 			if (canIndividually)
 			{
 				// 設定されていなかったら継承しないことにする
-				if (!(param.*ptr).inheritPercent) (param.*ptr).inheritPercent = 0.0f;
+				if (!(param.*ptr).inheritPercent.isSet) (param.*ptr).inheritPercent.set(0.0f);
 			}
 		}
 		else
@@ -669,7 +780,7 @@ public:
 
 	bool isInherit(FloatValuePtr ptr) const
 	{
-		return ((param.*ptr).inheritPercent).get() != 0;
+		return (param.*ptr).inheritPercent.isSet && (param.*ptr).inheritPercent.percent != 0;
 	}
 };
 
@@ -784,16 +895,48 @@ static void calcInheritance(SsMotionFrameDecoder::FrameParam& param, const SsMot
 	}
 }
 
-static void decodeNodesSub(std::vector<SsMotionFrameDecoder::FrameParam>& paramList, SsNode::ConstPtr node, int frameNo, const SsMotionFrameDecoder::FrameParam& parentParam, int depth, SsMotionFrameDecoder::InheritCalcuationType inheritCalcuation, bool isRootOrigin)
+/** フレームが無いため出力しないパラメータか */
+static bool isUndecodedParam(const SsMotionFrameDecoder::FrameParam& param)
+{
+	return param.node == 0;
+}
+
+/**
+ * 平坦化したノード階層を先頭から１度走査し、各ノードのパラメータを求める
+ * 親のパラメータは必ず先に求まっているため、再帰せずに継承を反映できます
+ */
+static void decodeTopology(std::vector<SsMotionFrameDecoder::FrameParam>& paramList, const SsNode::Topology& topology, int frameNo, SsMotionFrameDecoder::InheritCalcuationType inheritCalcuation, bool isRootOrigin, const SsMotionFrameDecoder::Tracks* tracks, SsMotionFrameDecoder::UserDataTable* userData)
 {
-	// 自分自身のパラメータを展開する 
-	SsMotionFrameDecoder::FrameParam param;
+	const SsMotionFrameDecoder::FrameParam rootParam;
 
-	if (node->hasFrame(frameNo))
+	// いったん全ノード分の領域を使い、フレームの無いノードは親として参照するためだけに初期値のまま残す 
+	paramList.resize(topology.size());
+
+	for (int nodeIndex = 0; nodeIndex < topology.size(); nodeIndex++)
 	{
-		param.decode(node, frameNo);
+		const SsNode* node = topology.nodes[nodeIndex];
+		const int parentIndex = topology.parentIndices[nodeIndex];
+		const SsMotionFrameDecoder::FrameParam& parentParam = (parentIndex >= 0) ? paramList[parentIndex] : rootParam;
+
+		// 自分自身のパラメータを展開する 
+		SsMotionFrameDecoder::FrameParam& param = paramList[nodeIndex];
 
-        if (depth == 0 && isRootOrigin)
+		if (!node->hasFrame(frameNo))
+		{
+			param.clear();
+			continue;
+		}
+
+		if (tracks)
+		{
+			param.decode(node, frameNo, *tracks, nodeIndex);
+		}
+		else
+		{
+			param.decode(node, frameNo);
+		}
+
+        if (parentIndex < 0 && isRootOrigin)
         {
             param.posx.value = 0;
             param.posy.value = 0;
@@ -805,21 +948,150 @@ static void decodeNodesSub(std::vector<SsMotionFrameDecoder::FrameParam>& paramL
 			calcInheritance(param, parentParam);
 		}
 
-		paramList.push_back(param);
+		if (userData) decodeUserDataValue(*userData, node, frameNo);
 	}
 
-	BOOST_FOREACH( SsNode::ConstPtr child, node->getChildren() )
+	// フレームの無いノードを除く（行きがけ順は保たれる） 
+	paramList.erase(std::remove_if(paramList.begin(), paramList.end(), isUndecodedParam), paramList.end());
+}
+
+void SsMotionFrameDecoder::decodeNodes(std::vector<FrameParam>& paramList, SsMotion::ConstPtr motion, int frameNo, InheritCalcuationType inheritCalcuation, bool isRootOrigin, UserDataTable* userData)
+{
+	if (userData) userData->clear();
+
+	decodeTopology(paramList, motion->getRootNode()->getTopology(), frameNo, inheritCalcuation, isRootOrigin, 0, userData);
+}
+
+void SsMotionFrameDecoder::decodeNodes(std::vector<FrameParam>& paramList, const Tracks& tracks, int frameNo, InheritCalcuationType inheritCalcuation, bool isRootOrigin, UserDataTable* userData)
+{
+	if (userData) userData->clear();
+
+	decodeTopology(paramList, tracks.getMotion()->getRootNode()->getTopology(), frameNo, inheritCalcuation, isRootOrigin, &tracks, userData);
+}
+
+
+/** キーフレームタイムラインからフレームの補間値を返す */
+float SsMotionFrameDecoder::decode(SsAttribute::ConstPtr attribute, int frameNo)
+{
+	return calcFloatAttribute(attribute, frameNo);
+}
+
+/** キーフレームタイムラインからフレームの補間値を返す。cursorを指定フレームへ移動させて検索する */
+float SsMotionFrameDecoder::decode(SsAttribute::ConstPtr attribute, SsKeyframeTimeline::Cursor& cursor, int frameNo)
+{
+	cursor.seek(frameNo);
+	return calcFloatAttribute(attribute, cursor, frameNo);
+}
+
+
+/**************************************************
+ * 事前展開したトラック 
+ **************************************************/
+
+/** 区間内で補間値が変化しないか判定する */
+static bool isConstantSpan(SsKeyframe::ConstPtr forward, SsKeyframe::ConstPtr backward)
+{
+	switch (forward->getCurve().getType())
 	{
-		decodeNodesSub(paramList, child, frameNo, param, depth + 1, inheritCalcuation, isRootOrigin);
+	case SsCurve::None:
+		return true;
+	case SsCurve::Linear:
+		return static_cast<const SsFloatValue*>(forward->getValue())->value
+			== static_cast<const SsFloatValue*>(backward->getValue())->value;
+	default:
+		return false;
 	}
 }
 
-void SsMotionFrameDecoder::decodeNodes(std::vector<FrameParam>& paramList, SsMotion::ConstPtr motion, int frameNo, InheritCalcuationType inheritCalcuation, bool isRootOrigin)
+/**
+ * タイムラインを[0, numFrames)の範囲で展開する
+ * 値が変化しない区間は１度だけ計算し、残りは同じ値で埋めます
+ */
+static void bakeFloatTrack(float* track, int numFrames, SsAttribute::ConstPtr attribute)
 {
-	paramList.clear();
+	SsKeyframeTimeline::Cursor cursor(*attribute->getTimeline());
+
+	int frameNo = 0;
+	while (frameNo < numFrames)
+	{
+		cursor.seek(frameNo);
+		float value = calcFloatAttribute(attribute, cursor, frameNo);
+		track[frameNo] = value;
+
+		// 同じ値が続く区間の終わりを求める
+		SsKeyframe::ConstPtr forward = cursor.getForward();
+		SsKeyframe::ConstPtr backward = cursor.getBackward();
+		int spanEnd = frameNo + 1;
+		if (forward == SsKeyframeTimeline::Invalid)
+		{
+			// 最初のキーフレームより前
+			spanEnd = (backward != SsKeyframeTimeline::Invalid) ? backward->getFrameNo() : numFrames;
+		}
+		else if (backward == SsKeyframeTimeline::Invalid)
+		{
+			// 最後のキーフレームより後
+			spanEnd = numFrames;
+		}
+		else if (forward != backward && isConstantSpan(forward, backward))
+		{
+			spanEnd = backward->getFrameNo();
+		}
+		spanEnd = std::min(std::max(spanEnd, frameNo + 1), numFrames);
 
-	FrameParam rootParam;
-	decodeNodesSub(paramList, motion->getRootNode(), frameNo, rootParam, 0, inheritCalcuation, isRootOrigin);
+		std::fill(track + frameNo + 1, track + spanEnd, value);
+		frameNo = spanEnd;
+	}
+}
+
+
+SsMotionFrameDecoder::Tracks::Tracks(SsMotion::ConstPtr motion)
+	: _motion(motion)
+	, _numNodes(motion->getRootNode()->countTreeNodes())
+	, _numFrames(motion->getTotalFrame())
+	, _hasTrack(_numNodes * SsAttributeTag::NumTags, false)
+{
+	const SsNode::Topology& topology = motion->getRootNode()->getTopology();
+	for (int nodeIndex = 0; nodeIndex < topology.size(); nodeIndex++)
+	{
+		bakeNode(topology.nodes[nodeIndex], nodeIndex);
+	}
+}
+
+SsMotionFrameDecoder::Tracks::~Tracks()
+{
+}
+
+void SsMotionFrameDecoder::Tracks::bakeNode(const SsNode* node, int nodeIndex)
+{
+	for (int i = SsAttributeTag::Unknown + 1; i < SsAttributeTag::NumTags; i++)
+	{
+		SsAttributeTag::Tag tag = static_cast<SsAttributeTag::Tag>(i);
+		if (!isFloatTag(tag)) continue;
+
+		SsAttribute::ConstPtr attr = node->getAttribute(tag);
+		if (!attr) continue;
+
+		// このアトリビュートを持つノードが現れたときに全ノード分の領域を確保する
+		std::vector<float>& values = _values[tag];
+		if (values.empty()) values.resize(static_cast<size_t>(_numNodes) * _numFrames);
+
+		bakeFloatTrack(&values[static_cast<size_t>(nodeIndex) * _numFrames], _numFrames, attr);
+		_hasTrack[nodeIndex * SsAttributeTag::NumTags + tag] = true;
+	}
+}
+
+/** ノードのトラック先頭を返す。アトリビュートが無いか数値アトリビュートでないときはNULLを返す */
+const float* SsMotionFrameDecoder::Tracks::getTrack(int nodeIndex, SsAttributeTag::Tag tag) const
+{
+	if (nodeIndex < 0 || nodeIndex >= _numNodes) return 0;
+	if (!_hasTrack[nodeIndex * SsAttributeTag::NumTags + tag]) return 0;
+	return &_values[tag][static_cast<size_t>(nodeIndex) * _numFrames];
+}
+
+/** 数値アトリビュートか判定する */
+bool SsMotionFrameDecoder::Tracks::isFloatTag(SsAttributeTag::Tag tag)
+{
+	return tag >= SsAttributeTag::POSX && tag <= SsAttributeTag::ORFY;
 }
 
 
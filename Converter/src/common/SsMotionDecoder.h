@@ -2,6 +2,7 @@
 #define _SS_MOTION_DECODER_H_
 
 #include "SsMotion.h"
+#include <vector>
 #include <boost/optional/optional.hpp>
 
 namespace ss
@@ -10,33 +11,85 @@ namespace ss
 struct SsMotionFrameDecoder
 {
 public:
+	/**
+	 * 継承率
+	 * FrameParamを単純にコピーできるよう、未設定の状態をフラグで持ちます
+	 */
+	struct InheritPercent
+	{
+		bool	isSet;
+		float	percent;
+
+		void reset()					{ isSet = false; percent = 0; }
+		void set(float value)			{ isSet = true; percent = value; }
+		void set(const boost::optional<float>& value);
+	};
+
 	struct FloatValue
 	{
 		float					value;
-		boost::optional<float>	inheritPercent;
+		InheritPercent			inheritPercent;
 	};
 	
+	/** 4頂点座標（SsVertex4Valueの値部分） */
+	struct Vertex4
+	{
+		SsPoint					v[4];
+	};
+
 	struct Vertex4Value
 	{
-		SsVertex4Value			value;
-		boost::optional<float>	inheritPercent;
+		Vertex4					value;
+		InheritPercent			inheritPercent;
 	};
 	
+	/** カラーブレンド（SsColorBlendValueの値部分） */
+	struct ColorBlend
+	{
+		SsColorBlendValue::Type		type;
+		SsColorBlendValue::Blend	blend;
+		SsColor						colors[4];
+	};
+
 	struct ColorBlendValue
 	{
-		SsColorBlendValue		value;
-		boost::optional<float>	inheritPercent;
+		ColorBlend				value;
+		InheritPercent			inheritPercent;
 	};
-	
-	struct UserDataValue
+
+
+	/**
+	 * フレームごとのユーザーデータ
+	 * ノードIDをキーに、キーフレームが持つ値を参照します
+	 * clear()しても領域は解放しないため、フレーム間で使い回すことができます
+	 */
+	class UserDataTable
 	{
-		SsUserDataValue			value;
+	public:
+		UserDataTable();
+		~UserDataTable();
+
+		void clear();
+		void set(int nodeId, const SsUserDataValue* value);
+		/** ノードのユーザーデータを返す。無いときはNULLを返す */
+		const SsUserDataValue* find(int nodeId) const;
+		bool empty() const				{ return _usedIds.empty(); }
+
+	private:
+		std::vector<const SsUserDataValue*>	_values;	/**< ノードIDで引く */
+		std::vector<int>					_usedIds;
 	};
 
 
+	class Tracks;
+
+	/**
+	 * １パーツ１フレーム分のパラメータ
+	 * ヒープを使うメンバーを持たず、単純にコピーできます（ユーザーデータはUserDataTableで扱います）
+	 */
 	struct FrameParam
 	{
-		SsNode::ConstPtr	node;
+		const SsNode*		node;
         
         FloatValue          posx;
         FloatValue          posy;
@@ -56,12 +109,13 @@ public:
         FloatValue          orfy;
         Vertex4Value		vert;
         ColorBlendValue		pcol;
-		UserDataValue		udat;
 		
 
 		FrameParam(void);
 		void clear();
-		void decode(SsNode::ConstPtr node, int frameNo);
+		void decode(const SsNode* node, int frameNo);
+		/** 展開済みのトラックから値を取得する。nodeIndexはトラック内でのノードの位置 */
+		void decode(const SsNode* node, int frameNo, const Tracks& tracks, int nodeIndex);
 
 
 		/** 優先順位を比較する、優先順位が同じ場合はIDを比較する */
@@ -84,13 +138,18 @@ public:
         
         /** スケールが０か判定する */
         static bool isScaleZero(const FrameParam& r);
-		
-		/** ユーザーデータがあるか */
-		static bool hasUserData(const FrameParam& r);
 	};
 
+	/** 優先順位でソートしたインデックス列を作る。paramListは並べ替えない */
+	static void sortByPriority(std::vector<int>& order, const std::vector<FrameParam>& paramList);
+
 	/** キーフレームタイムラインからフレームの補間値を返す */
 	static float decode(SsAttribute::ConstPtr attribute, int frameNo);
+	/**
+	 * キーフレームタイムラインからフレームの補間値を返す
+	 * フレーム順に連続して求めるときは、同じタイムラインのcursorを使い回すことで検索を償却O(1)で行います
+	 */
+	static float decode(SsAttribute::ConstPtr attribute, SsKeyframeTimeline::Cursor& cursor, int frameNo);
 	
 	
 	enum InheritCalcuationType {
@@ -98,7 +157,45 @@ public:
 		InheritCalcuation_Calculate		/**< 親のパラメータを継承した計算を行う */
 	};
 
-	static void decodeNodes(std::vector<FrameParam>& paramList, SsMotion::ConstPtr motion, int frameNo, InheritCalcuationType inheritCalcuation, bool isRootOrigin = false);
+	/**
+	 * フレームのパラメータを求める
+	 * userDataを指定したときは、このフレームにキーのあるユーザーデータを格納する
+	 */
+	static void decodeNodes(std::vector<FrameParam>& paramList, SsMotion::ConstPtr motion, int frameNo, InheritCalcuationType inheritCalcuation, bool isRootOrigin = false, UserDataTable* userData = 0);
+	/** 展開済みのトラックを参照してフレームのパラメータを求める */
+	static void decodeNodes(std::vector<FrameParam>& paramList, const Tracks& tracks, int frameNo, InheritCalcuationType inheritCalcuation, bool isRootOrigin = false, UserDataTable* userData = 0);
+
+
+	/**
+	 * 数値アトリビュートをモーション全体にわたって事前に展開したトラック
+	 * アトリビュートごとに[ノード][フレーム]の順で値を並べた配列を保持します
+	 * ノードの位置はSsNode::Topologyでの位置（ルートノードからの行きがけ順）です
+	 */
+	class Tracks
+	{
+	public:
+		explicit Tracks(SsMotion::ConstPtr motion);
+		~Tracks();
+
+		SsMotion::ConstPtr getMotion() const	{ return _motion; }
+		int getNumNodes() const					{ return _numNodes; }
+		int getNumFrames() const				{ return _numFrames; }
+
+		/** ノードのトラック先頭を返す。アトリビュートが無いか数値アトリビュートでないときはNULLを返す */
+		const float* getTrack(int nodeIndex, SsAttributeTag::Tag tag) const;
+
+		/** 数値アトリビュートか判定する */
+		static bool isFloatTag(SsAttributeTag::Tag tag);
+
+	private:
+		void bakeNode(const SsNode* node, int nodeIndex);
+
+		SsMotion::ConstPtr	_motion;
+		int					_numNodes;
+		int					_numFrames;
+		std::vector<float>	_values[SsAttributeTag::NumTags];	/**< [ノード][フレーム] */
+		std::vector<bool>	_hasTrack;							/**< [ノード][タグ] */
+	};
 };
 
 }
@@ -3,212 +3,717 @@
 #include <iostream>
 #include <fstream>
 #include <stdexcept>
-#include <boost/property_tree/ptree.hpp>
-#include <boost/property_tree/xml_parser.hpp>
+#include <bitset>
+#include <cctype>
+#include <cerrno>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
 #include <boost/foreach.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/preprocessor.hpp>
 #include "XmlUtil.h"
 #include "TextEncoding.h"
 #include "FileUtil.h"
 #include "MathUtil.h"
 
 using namespace ss;
-using boost::property_tree::ptree;
 using boost::optional;
 using boost::shared_ptr;
 
 
-static shared_ptr<SsMotion::Param> readHeader(const ptree& pt);
-static std::vector<SsImage::Ptr> readImageList(const ptree& pt);
-static shared_ptr<SsImage> readImage(const ptree& pt);
-static shared_ptr<SsPart> readPart(const ptree& pt, textenc::Encoding encoding, int motionEndFrameNo);
-static shared_ptr<SsAttribute> readAttribute(const ptree& pt, textenc::Encoding encoding);
-static shared_ptr<SsKeyframe> readKey(const ptree& pt, const SsAttributeTag::Tag& tag, textenc::Encoding encoding);
-static bool readColors(SsColor& color, const ptree& pt);
-static bool readPoint(SsPoint& point, const ptree& pt);
-static bool readRect(SsRect& rect, const ptree& pt, bool normalizeEnabled);
+/**
+ * ssaxで扱う要素名 
+ */
+struct SsaxElement
+{
+	#define SSAX_ELEMENT_SEQ \
+		(SpriteStudioMotion)(Header)(EndFrame)(BaseTickTime)\
+		(OptionState)(ScreenSize)(CanvasWidth)(CanvasHeight)(MarginWidth)(MarginHeight)\
+		(ImageList)(Image)(Parts)(Part)\
+		(Type)(Name)(ID)(ParentID)(PicID)(PictArea)(Left)(Top)(Right)(Bottom)\
+		(OriginX)(OriginY)(TransBlendType)(InheritType)\
+		(Attributes)(Attribute)(Key)\
+		(Value)(TopLeft)(TopRight)(BottomLeft)(BottomRight)(X)(Y)\
+		(Red)(Green)(Blue)(Alpha)(Blend)(Number)(Rect)(Point)(String)\
+
+	enum Id
+	{
+		Unknown,
+		BOOST_PP_SEQ_ENUM(SSAX_ELEMENT_SEQ)
+		,
+		NumIds
+	};
+
+	/** 要素名からIdを得る */
+	static Id toId(const std::string& name);
+
+	/**
+	 * 親要素の下でchildが読み取り対象になるか 
+	 * Singleは最初に現れたものだけ（ptreeのget_optionalと同じ）、Repeatedは全て 
+	 */
+	enum Occurrence { None, Single, Repeated };
+	static Occurrence getOccurrence(Id parent, Id child);
+};
+
+typedef boost::unordered_map<std::string, SsaxElement::Id> SsaxElementTable;
+
+static SsaxElementTable makeSsaxElementTable()
+{
+	SsaxElementTable table;
+	#define SSAX_ELEMENT_TO_TABLE(unused, data, elem) table[BOOST_PP_STRINGIZE(elem)] = SsaxElement::elem;
+	BOOST_PP_SEQ_FOR_EACH(SSAX_ELEMENT_TO_TABLE, ~, SSAX_ELEMENT_SEQ)
+	return table;
+}
 
+SsaxElement::Id SsaxElement::toId(const std::string& name)
+{
+	static const SsaxElementTable table = makeSsaxElementTable();
+	SsaxElementTable::const_iterator it = table.find(name);
+	return it != table.end() ? it->second : Unknown;
+}
 
 
 /**
- * ssaxファイルをロード
+ * 要素の親子関係 
+ * 親Unknownはドキュメント自身を表す 
  */
-ss::SsMotion::Ptr SsaxLoader::load(const std::string& filename, ResultCode* outResult)
+static const struct
 {
-    ResultCode result = SUCCESS;
-
-	do
+	SsaxElement::Id parent;
+	SsaxElement::Id child;
+	SsaxElement::Occurrence occurrence;
+}
+s_ssaxSchema[] =
+{
+	#define SSAX_CHILD(parent, child, occurrence) { SsaxElement::parent, SsaxElement::child, SsaxElement::occurrence },
+	SSAX_CHILD(Unknown, SpriteStudioMotion, Single)
+	SSAX_CHILD(SpriteStudioMotion, Header, Repeated)
+	SSAX_CHILD(SpriteStudioMotion, ImageList, Repeated)
+	SSAX_CHILD(SpriteStudioMotion, Parts, Single)
+
+	SSAX_CHILD(Header, EndFrame, Single)
+	SSAX_CHILD(Header, BaseTickTime, Single)
+	SSAX_CHILD(Header, OptionState, Single)
+	SSAX_CHILD(OptionState, ScreenSize, Repeated)
+	SSAX_CHILD(ScreenSize, CanvasWidth, Single)
+	SSAX_CHILD(ScreenSize, CanvasHeight, Single)
+	SSAX_CHILD(ScreenSize, MarginWidth, Single)
+	SSAX_CHILD(ScreenSize, MarginHeight, Single)
+
+	SSAX_CHILD(ImageList, Image, Repeated)
+
+	SSAX_CHILD(Parts, Part, Repeated)
+	SSAX_CHILD(Part, Type, Single)
+	SSAX_CHILD(Part, Name, Single)
+	SSAX_CHILD(Part, ID, Single)
+	SSAX_CHILD(Part, ParentID, Single)
+	SSAX_CHILD(Part, PicID, Single)
+	SSAX_CHILD(Part, PictArea, Single)
+	SSAX_CHILD(Part, OriginX, Single)
+	SSAX_CHILD(Part, OriginY, Single)
+	SSAX_CHILD(Part, TransBlendType, Single)
+	SSAX_CHILD(Part, InheritType, Single)
+	SSAX_CHILD(Part, Attributes, Single)
+	SSAX_CHILD(PictArea, Left, Single)
+	SSAX_CHILD(PictArea, Top, Single)
+	SSAX_CHILD(PictArea, Right, Single)
+	SSAX_CHILD(PictArea, Bottom, Single)
+
+	SSAX_CHILD(Attributes, Attribute, Repeated)
+	SSAX_CHILD(Attribute, Key, Repeated)
+	SSAX_CHILD(Key, Value, Single)
+	SSAX_CHILD(Key, TopLeft, Single)
+	SSAX_CHILD(Key, TopRight, Single)
+	SSAX_CHILD(Key, BottomLeft, Single)
+	SSAX_CHILD(Key, BottomRight, Single)
+	SSAX_CHILD(Key, Type, Single)
+	SSAX_CHILD(Key, Blend, Single)
+	SSAX_CHILD(Key, Number, Single)
+	SSAX_CHILD(Key, Rect, Single)
+	SSAX_CHILD(Key, Point, Single)
+	SSAX_CHILD(Key, String, Single)
+
+	#define SSAX_COLOR_CHILDREN(parent) \
+		SSAX_CHILD(parent, Red, Single) \
+		SSAX_CHILD(parent, Green, Single) \
+		SSAX_CHILD(parent, Blue, Single) \
+		SSAX_CHILD(parent, Alpha, Single)
+	#define SSAX_VERTEX_CHILDREN(parent) \
+		SSAX_CHILD(parent, X, Single) \
+		SSAX_CHILD(parent, Y, Single) \
+		SSAX_COLOR_CHILDREN(parent)
+	SSAX_COLOR_CHILDREN(Value)
+	SSAX_VERTEX_CHILDREN(TopLeft)
+	SSAX_VERTEX_CHILDREN(TopRight)
+	SSAX_VERTEX_CHILDREN(BottomLeft)
+	SSAX_VERTEX_CHILDREN(BottomRight)
+	SSAX_CHILD(Point, X, Single)
+	SSAX_CHILD(Point, Y, Single)
+	SSAX_CHILD(Rect, Top, Single)
+	SSAX_CHILD(Rect, Left, Single)
+	SSAX_CHILD(Rect, Bottom, Single)
+	SSAX_CHILD(Rect, Right, Single)
+};
+
+SsaxElement::Occurrence SsaxElement::getOccurrence(Id parent, Id child)
+{
+	struct Table
 	{
-		// XMLのエンコーディング判定
-		std::string enc = xmlutil::getEncoding(filename);
-		textenc::Encoding encoding = textenc::findEncoding(enc);
-
-		// ssaxをxmlとしてパース
-		ptree pt;
-        try {
-            read_xml(filename, pt);
-        } catch (boost::property_tree::xml_parser_error& /*ex*/) {
-            result = XML_PARSE_ERROR;
-            break;
-        }
-
-		shared_ptr<SsMotion::Param> param;
-		std::vector<SsImage::Ptr> images;
-		BOOST_FOREACH( const ptree::value_type& v, pt.get_child("SpriteStudioMotion") )
+		Occurrence occurrences[NumIds][NumIds];
+		Table()
 		{
-			const std::string& key = v.first;
-			if (key == "Header")
-			{
-				param = readHeader(v.second);
-			}
-			else if (key == "ImageList")
+			for (int i = 0; i < NumIds; i++)
+				for (int j = 0; j < NumIds; j++) occurrences[i][j] = None;
+			for (size_t i = 0; i < sizeof(s_ssaxSchema) / sizeof(s_ssaxSchema[0]); i++)
 			{
-				images = readImageList(v.second);
+				occurrences[s_ssaxSchema[i].parent][s_ssaxSchema[i].child] = s_ssaxSchema[i].occurrence;
 			}
 		}
-		// <Header>部の読み取り失敗 
-		if (!param) break;
+	};
+	static const Table table;
+	return table.occurrences[parent][child];
+}
 
-		// モーション全体の最終フレーム番号 
-		int motionEndFrameNo = param->endFrameNo;
 
-		std::vector<SsPart::Ptr> parts;
-		BOOST_FOREACH( const ptree::value_type& v, pt.get_child("SpriteStudioMotion.Parts") )
-		{
-			if (v.first == "Part")
-			{
-				const ptree& part = v.second;
-				shared_ptr<SsPart> sspart = readPart(part, encoding, motionEndFrameNo);
-				parts.push_back(sspart);
-			}
-		}
+/**
+ * 文字列を数値として読み取る 
+ * ptreeのget_optionalと同じく、前後の空白以外の余分な文字があれば失敗とする 
+ */
+static const char* skipSpaces(const char* p)
+{
+	while (*p && std::isspace(static_cast<unsigned char>(*p))) ++p;
+	return p;
+}
 
-		SsNode::Ptr rootNode = SsNode::createNodes(parts);
-		SsImageList::Ptr imageList = SsImageList::Ptr(new SsImageList(images));
+static optional<long> toLong(const std::string& s)
+{
+	const char* begin = s.c_str();
+	char* end;
+	errno = 0;
+	long value = std::strtol(begin, &end, 10);
+	if (end == begin || errno == ERANGE || *skipSpaces(end) != '\0') return optional<long>();
+	return value;
+}
 
-        if (outResult) *outResult = result;
-		return boost::shared_ptr<ss::SsMotion>(
-			new SsMotion(rootNode, *param, imageList));
+static optional<int> toInt(const std::string& s)
+{
+	optional<long> value = toLong(s);
+	if (!value || value.get() < INT_MIN || value.get() > INT_MAX) return optional<int>();
+	return static_cast<int>(value.get());
+}
 
-	} while (false);
+static optional<float> toFloat(const std::string& s)
+{
+	// strtofが受け付けるinf,nan,16進表記は対象外 
+	const char* begin = skipSpaces(s.c_str());
+	for (const char* p = begin; *p && !std::isspace(static_cast<unsigned char>(*p)); ++p)
+	{
+		if (!std::isdigit(static_cast<unsigned char>(*p))
+		 && *p != '+' && *p != '-' && *p != '.' && *p != 'e' && *p != 'E') return optional<float>();
+	}
 
-    if (outResult) *outResult = result;
-	return boost::shared_ptr<ss::SsMotion>();
+	char* end;
+	float value = std::strtof(begin, &end);
+	if (end == begin || std::fabs(value) == HUGE_VALF || *skipSpaces(end) != '\0') return optional<float>();
+	return value;
+}
+
+static optional<int> toInt(const xmlutil::Attributes& attributes, const char* name)
+{
+	const std::string* value = xmlutil::findAttribute(attributes, name);
+	return value ? toInt(*value) : optional<int>();
 }
 
+static optional<float> toFloat(const xmlutil::Attributes& attributes, const char* name)
+{
+	const std::string* value = xmlutil::findAttribute(attributes, name);
+	return value ? toFloat(*value) : optional<float>();
+}
 
 
 /**
- * <Header>部の読み取り
+ * <PictArea>, <Rect>の読み取り値 
  */
-static shared_ptr<SsMotion::Param> readHeader(const ptree& pt)
+struct RectFields
 {
-	do
+	optional<int> left, top, right, bottom;
+};
+
+/**
+ * <Value>, <TopLeft>等の頂点、<Point>の読み取り値 
+ */
+struct VertexFields
+{
+	optional<int> x, y;
+	optional<int> red, green, blue, alpha;
+};
+
+/**
+ * <Header>の読み取り値 
+ */
+struct HeaderFields
+{
+	optional<int> endFrameNo;
+	optional<int> baseTickTime;
+	optional<int> canvasWidth, canvasHeight, marginWidth, marginHeight;
+
+	/** <ScreenSize>の読み取り値 */
+	optional<int> screenSize[4];
+	/** 不完全な<ScreenSize>を読んだ後は以降を無視する */
+	bool screenSizeStopped;
+};
+
+/**
+ * <Part>の読み取り値 
+ */
+struct PartFields
+{
+	optional<int> root;
+	optional<int> type;
+	optional<std::string> name;
+	optional<int> id, parentId, picId;
+	RectFields picArea;
+	optional<int> originX, originY;
+	optional<int> transBlendType, inheritType;
+	std::vector<SsAttribute::Ptr> attributes;
+};
+
+/**
+ * <Attribute>の読み取り値 
+ */
+struct AttributeFields
+{
+	SsAttributeTag::Tag tag;
+	optional<float> inheritedPercent;
+	std::vector<SsKeyframe> keyframes;
+	/** 不正な<Key>を読んだ後は以降を無視する */
+	bool keyStopped;
+};
+
+/**
+ * <Key>の読み取り値 
+ */
+struct KeyFields
+{
+	enum VertexIndex
 	{
-		shared_ptr<SsMotion::Param> param = shared_ptr<SsMotion::Param>(new SsMotion::Param());
+		VertexValue,
+		VertexTopLeft,
+		VertexTopRight,
+		VertexBottomLeft,
+		VertexBottomRight,
+		VertexPoint,
+		NumVertices
+	};
+
+	optional<int> time;
+	optional<int> curveType;
+	optional<float> curveStartT, curveStartV, curveEndT, curveEndV;
+
+	optional<float> value;
+	optional<int> type, blend;
+	optional<long> number;
+	optional<std::string> str;
+	VertexFields vertices[NumVertices];
+	RectFields rect;
+};
+
+
+static shared_ptr<SsMotion::Param> makeHeader(const HeaderFields& fields);
+static shared_ptr<SsImage> makeImage(const xmlutil::Attributes& attributes);
+static shared_ptr<SsPart> makePart(const PartFields& fields, textenc::Encoding encoding, int motionEndFrameNo);
+static shared_ptr<SsKeyframe> makeKey(const KeyFields& fields, const SsAttributeTag::Tag& tag, textenc::Encoding encoding);
+static bool readColors(SsColor& color, const VertexFields& fields);
+static bool readPoint(SsPoint& point, const VertexFields& fields);
+static bool readRect(SsRect& rect, const RectFields& fields, bool normalizeEnabled);
 
-		// ※とりあえず必要なパラメータのみ取得しています 
 
-		// 必須(?)パラメータ 
-		optional<int> endFrameNo = pt.get_optional<int>("EndFrame");
-		if (!endFrameNo) break;
-		optional<int> baseTickTime = pt.get_optional<int>("BaseTickTime");
-		if (!baseTickTime) break;
+/**
+ * ssaxのSAXハンドラ 
+ * 要素が閉じた時点でSsPart, SsAttribute, SsKeyframeを構築していく 
+ */
+class SsaxHandler : public xmlutil::SaxHandler
+{
+public:
+	SsaxHandler()
+		: _encoding(textenc::findEncoding(""))
+		, _hasRoot(false)
+		, _hasParts(false)
+	{
+		_stack.push_back(Frame(SsaxElement::Unknown, true));
+	}
+
+	/** ドキュメント要素と<Parts>を読めたか */
+	bool isComplete() const { return _hasRoot && _hasParts; }
 
-		param->endFrameNo = endFrameNo.get();
-		param->baseTickTime = baseTickTime.get();
-		param->CanvasWidth = 0;
-		param->CanvasHeight = 0;
-		param->MarginWidth = 0;
-		param->MarginHeight = 0;
+	shared_ptr<SsMotion::Param> getParam() const { return _param; }
+	std::vector<SsImage::Ptr>& getImages() { return _images; }
+	std::vector<SsPart::Ptr>& getParts() { return _parts; }
 
+	virtual void declaration(const std::string& encoding)
+	{
+		_encoding = textenc::findEncoding(encoding);
+	}
 
+	virtual void startElement(const std::string& name, const xmlutil::Attributes& attributes)
+	{
+		Frame& parent = _stack.back();
+		SsaxElement::Id id = SsaxElement::toId(name);
 
-		optional<const ptree&> OptionState = pt.get_child_optional("OptionState");
-		if (OptionState)
+		bool active = false;
+		if (id != SsaxElement::Unknown)
 		{
-			BOOST_FOREACH(const ptree::value_type& v2, pt.get_child("OptionState"))
+			if (parent.active)
 			{
-				if (v2.first == "ScreenSize")
+				SsaxElement::Occurrence occurrence = SsaxElement::getOccurrence(parent.id, id);
+				active = occurrence == SsaxElement::Repeated
+					|| (occurrence == SsaxElement::Single && !parent.seen[id]);
+			}
+			parent.seen.set(id);
+		}
+
+		_stack.push_back(Frame(id, active));
+		if (active) begin(id, attributes);
+	}
+
+	virtual void endElement(const std::string& /*name*/, const std::string& text)
+	{
+		const Frame frame = _stack.back();
+		_stack.pop_back();
+		if (frame.active) end(frame.id, _stack.back().id, text);
+	}
+
+private:
+	struct Frame
+	{
+		SsaxElement::Id id;
+		bool active;
+		std::bitset<SsaxElement::NumIds> seen;
+
+		Frame(SsaxElement::Id id, bool active) : id(id), active(active) {}
+	};
+
+	/** 要素の開始。属性を読み取る */
+	void begin(SsaxElement::Id id, const xmlutil::Attributes& attributes)
+	{
+		switch (id)
+		{
+			case SsaxElement::SpriteStudioMotion:
+				_hasRoot = true;
+				break;
+			case SsaxElement::Header:
+				_header = HeaderFields();
+				_header.screenSizeStopped = false;
+				break;
+			case SsaxElement::ScreenSize:
+				for (int i = 0; i < 4; i++) _header.screenSize[i] = optional<int>();
+				break;
+			case SsaxElement::ImageList:
+				_images.clear();
+				_imageStopped = false;
+				break;
+			case SsaxElement::Image:
+				if (!_imageStopped)
 				{
-					const ptree& ScreenSize = v2.second;
-					optional<int> CanvasWidth = ScreenSize.get_optional<int>("CanvasWidth");
-					if (!CanvasWidth) break;
-					optional<int> CanvasHeight = ScreenSize.get_optional<int>("CanvasHeight");
-					if (!CanvasHeight) break;
-					optional<int> MarginWidth = ScreenSize.get_optional<int>("MarginWidth");
-					if (!MarginWidth) break;
-					optional<int> MarginHeight = ScreenSize.get_optional<int>("MarginHeight");
-					if (!MarginHeight) break;
-
-					param->CanvasWidth = CanvasWidth.get();
-					param->CanvasHeight = CanvasHeight.get();
-					param->MarginWidth = MarginWidth.get();
-					param->MarginHeight = MarginHeight.get();
+					shared_ptr<SsImage> image = makeImage(attributes);
+					if (image) _images.push_back(image);
+					else _imageStopped = true;
 				}
+				break;
+			case SsaxElement::Parts:
+				_hasParts = true;
+				break;
+			case SsaxElement::Part:
+				_part = PartFields();
+				_part.root = toInt(attributes, "Root");
+				break;
+			case SsaxElement::Attribute:
+			{
+				// Tag文字列からタグを求める 
+				const std::string* tagStr = xmlutil::findAttribute(attributes, "Tag");
+				_attribute.tag = tagStr ? SsAttributeTag::toEnum(tagStr->data(), tagStr->size()) : SsAttributeTag::Unknown;
+				_attribute.inheritedPercent = toFloat(attributes, "Inherit");
+				_attribute.keyframes.clear();
+				_attribute.keyStopped = false;
+				break;
 			}
+			case SsaxElement::Key:
+				_key = KeyFields();
+				_key.time = toInt(attributes, "Time");
+				_key.curveType = toInt(attributes, "CurveType");
+				_key.curveStartT = toFloat(attributes, "CurveStartT");
+				_key.curveStartV = toFloat(attributes, "CurveStartV");
+				_key.curveEndT = toFloat(attributes, "CurveEndT");
+				_key.curveEndV = toFloat(attributes, "CurveEndV");
+				break;
+			default:
+				break;
 		}
+	}
 
+	/** 要素の終了。テキストを親の読み取り値へ格納し、構築できるものは構築する */
+	void end(SsaxElement::Id id, SsaxElement::Id parent, const std::string& text)
+	{
+		switch (parent)
+		{
+			case SsaxElement::Header:		readHeaderValue(id, text); break;
+			case SsaxElement::ScreenSize:	readScreenSizeValue(id, text); break;
+			case SsaxElement::Part:			readPartValue(id, text); break;
+			case SsaxElement::PictArea:		readRectValue(_part.picArea, id, text); break;
+			case SsaxElement::Key:			readKeyValue(id, text); break;
+			case SsaxElement::Value:		readVertexValue(_key.vertices[KeyFields::VertexValue], id, text); break;
+			case SsaxElement::TopLeft:		readVertexValue(_key.vertices[KeyFields::VertexTopLeft], id, text); break;
+			case SsaxElement::TopRight:		readVertexValue(_key.vertices[KeyFields::VertexTopRight], id, text); break;
+			case SsaxElement::BottomLeft:	readVertexValue(_key.vertices[KeyFields::VertexBottomLeft], id, text); break;
+			case SsaxElement::BottomRight:	readVertexValue(_key.vertices[KeyFields::VertexBottomRight], id, text); break;
+			case SsaxElement::Point:		readVertexValue(_key.vertices[KeyFields::VertexPoint], id, text); break;
+			case SsaxElement::Rect:			readRectValue(_key.rect, id, text); break;
+			default: break;
+		}
 
+		switch (id)
+		{
+			case SsaxElement::Header:
+				_param = makeHeader(_header);
+				break;
+			case SsaxElement::ScreenSize:
+				endScreenSize();
+				break;
+			case SsaxElement::Part:
+			{
+				// モーション全体の最終フレーム番号は<Header>が<Parts>より前にある前提 
+				int motionEndFrameNo = _param ? _param->endFrameNo : 0;
+				shared_ptr<SsPart> part = makePart(_part, _encoding, motionEndFrameNo);
+				if (part) _parts.push_back(part);
+				break;
+			}
+			case SsaxElement::Attribute:
+				if (_attribute.tag != SsAttributeTag::Unknown)
+				{
+					// タイムラインを構築する 
+					shared_ptr<SsKeyframeTimeline> timeline = 
+						shared_ptr<SsKeyframeTimeline>(new SsKeyframeTimeline(_attribute.keyframes));
+					_part.attributes.push_back(shared_ptr<SsAttribute>(
+						new SsAttribute(_attribute.tag, _attribute.inheritedPercent, timeline)));
+				}
+				break;
+			case SsaxElement::Key:
+				if (_attribute.tag != SsAttributeTag::Unknown && !_attribute.keyStopped)
+				{
+					shared_ptr<SsKeyframe> keyframe = makeKey(_key, _attribute.tag, _encoding);
+					if (keyframe) _attribute.keyframes.push_back(*keyframe);
+					else _attribute.keyStopped = true;
+				}
+				break;
+			default:
+				break;
+		}
+	}
 
-		return param;
+	void readHeaderValue(SsaxElement::Id id, const std::string& text)
+	{
+		switch (id)
+		{
+			case SsaxElement::EndFrame:		_header.endFrameNo = toInt(text); break;
+			case SsaxElement::BaseTickTime:	_header.baseTickTime = toInt(text); break;
+			default: break;
+		}
+	}
+
+	void readScreenSizeValue(SsaxElement::Id id, const std::string& text)
+	{
+		switch (id)
+		{
+			case SsaxElement::CanvasWidth:	_header.screenSize[0] = toInt(text); break;
+			case SsaxElement::CanvasHeight:	_header.screenSize[1] = toInt(text); break;
+			case SsaxElement::MarginWidth:	_header.screenSize[2] = toInt(text); break;
+			case SsaxElement::MarginHeight:	_header.screenSize[3] = toInt(text); break;
+			default: break;
+		}
+	}
+
+	void endScreenSize()
+	{
+		if (_header.screenSizeStopped) return;
+		for (int i = 0; i < 4; i++)
+		{
+			if (!_header.screenSize[i])
+			{
+				_header.screenSizeStopped = true;
+				return;
+			}
+		}
+		_header.canvasWidth = _header.screenSize[0];
+		_header.canvasHeight = _header.screenSize[1];
+		_header.marginWidth = _header.screenSize[2];
+		_header.marginHeight = _header.screenSize[3];
+	}
+
+	void readPartValue(SsaxElement::Id id, const std::string& text)
+	{
+		switch (id)
+		{
+			case SsaxElement::Type:				_part.type = toInt(text); break;
+			case SsaxElement::Name:				_part.name = text; break;
+			case SsaxElement::ID:				_part.id = toInt(text); break;
+			case SsaxElement::ParentID:			_part.parentId = toInt(text); break;
+			case SsaxElement::PicID:			_part.picId = toInt(text); break;
+			case SsaxElement::OriginX:			_part.originX = toInt(text); break;
+			case SsaxElement::OriginY:			_part.originY = toInt(text); break;
+			case SsaxElement::TransBlendType:	_part.transBlendType = toInt(text); break;	// alpha blend
+			case SsaxElement::InheritType:		_part.inheritType = toInt(text); break;
+			default: break;
+		}
+	}
+
+	void readKeyValue(SsaxElement::Id id, const std::string& text)
+	{
+		switch (id)
+		{
+			case SsaxElement::Value:	_key.value = toFloat(text); break;
+			case SsaxElement::Type:		_key.type = toInt(text); break;
+			case SsaxElement::Blend:	_key.blend = toInt(text); break;
+			case SsaxElement::Number:	_key.number = toLong(text); break;
+			case SsaxElement::String:	_key.str = text; break;
+			default: break;
+		}
+	}
+
+	static void readVertexValue(VertexFields& fields, SsaxElement::Id id, const std::string& text)
+	{
+		switch (id)
+		{
+			case SsaxElement::X:		fields.x = toInt(text); break;
+			case SsaxElement::Y:		fields.y = toInt(text); break;
+			case SsaxElement::Red:		fields.red = toInt(text); break;
+			case SsaxElement::Green:	fields.green = toInt(text); break;
+			case SsaxElement::Blue:		fields.blue = toInt(text); break;
+			case SsaxElement::Alpha:	fields.alpha = toInt(text); break;
+			default: break;
+		}
+	}
+
+	static void readRectValue(RectFields& fields, SsaxElement::Id id, const std::string& text)
+	{
+		switch (id)
+		{
+			case SsaxElement::Left:		fields.left = toInt(text); break;
+			case SsaxElement::Top:		fields.top = toInt(text); break;
+			case SsaxElement::Right:	fields.right = toInt(text); break;
+			case SsaxElement::Bottom:	fields.bottom = toInt(text); break;
+			default: break;
+		}
+	}
+
+	std::vector<Frame>			_stack;
+	textenc::Encoding			_encoding;
+	bool						_hasRoot;
+	bool						_hasParts;
+
+	HeaderFields				_header;
+	PartFields					_part;
+	AttributeFields				_attribute;
+	KeyFields					_key;
+	bool						_imageStopped;
+
+	shared_ptr<SsMotion::Param>	_param;
+	std::vector<SsImage::Ptr>	_images;
+	std::vector<SsPart::Ptr>	_parts;
+};
+
+
+
+/**
+ * ssaxファイルをロード
+ */
+ss::SsMotion::Ptr SsaxLoader::load(const std::string& filename, ResultCode* outResult)
+{
+    ResultCode result = SUCCESS;
+
+	do
+	{
+		// ssaxを先頭から一度だけ走査し、要素が閉じるごとにモーションを構築する 
+		// XMLのエンコーディングもXML宣言から同時に判定する 
+		SsaxHandler handler;
+		if (!xmlutil::parseFile(filename, handler) || !handler.isComplete())
+		{
+			result = XML_PARSE_ERROR;
+			break;
+		}
+
+		// <Header>部の読み取り失敗 
+		shared_ptr<SsMotion::Param> param = handler.getParam();
+		if (!param) break;
+
+		SsNode::Ptr rootNode = SsNode::createNodes(handler.getParts());
+		SsImageList::Ptr imageList = SsImageList::Ptr(new SsImageList(handler.getImages()));
+
+        if (outResult) *outResult = result;
+		return boost::shared_ptr<ss::SsMotion>(
+			new SsMotion(rootNode, *param, imageList));
 
 	} while (false);
-	return shared_ptr<SsMotion::Param>();
+
+    if (outResult) *outResult = result;
+	return boost::shared_ptr<ss::SsMotion>();
 }
 
 
+
 /**
- * <ImageList>部の読み取り
+ * <Header>部の読み取り値からパラメータを構築する 
  */
-static std::vector<SsImage::Ptr> readImageList(const ptree& pt)
+static shared_ptr<SsMotion::Param> makeHeader(const HeaderFields& fields)
 {
 	do
 	{
-		std::vector<SsImage::Ptr> images;
+		shared_ptr<SsMotion::Param> param = shared_ptr<SsMotion::Param>(new SsMotion::Param());
 
-		// <Image>群の読み込み 
-		BOOST_FOREACH( const ptree::value_type& v, pt.get_child("") )
-		{
-			if (v.first == "Image")
-			{
-				const ptree& key = v.second;
-				shared_ptr<SsImage> image = readImage(key);
-				if (!image) break;
-				images.push_back(image);
-			}
-		}
+		// ※とりあえず必要なパラメータのみ取得しています 
 
-		return images;
+		// 必須(?)パラメータ 
+		if (!fields.endFrameNo) break;
+		if (!fields.baseTickTime) break;
+
+		param->endFrameNo = fields.endFrameNo.get();
+		param->baseTickTime = fields.baseTickTime.get();
+		param->CanvasWidth = fields.canvasWidth.get_value_or(0);
+		param->CanvasHeight = fields.canvasHeight.get_value_or(0);
+		param->MarginWidth = fields.marginWidth.get_value_or(0);
+		param->MarginHeight = fields.marginHeight.get_value_or(0);
+
+		return param;
 
 	} while (false);
-	return std::vector<SsImage::Ptr>();
+	return shared_ptr<SsMotion::Param>();
 }
 
 
 /**
  * <Image>からSsImageを構築する 
  */
-static shared_ptr<SsImage> readImage(const ptree& pt)
+static shared_ptr<SsImage> makeImage(const xmlutil::Attributes& attributes)
 {
 	do
 	{
 		// <Image Id="1" Path=".\number.png" Width="512" Height="512" Bpp="8"/>
 
 		// 必須パラメータ 
-		optional<int> id = pt.get_optional<int>("<xmlattr>.Id");
+		optional<int> id = toInt(attributes, "Id");
 		if (!id) break;
-		optional<std::string> path = pt.get_optional<std::string>("<xmlattr>.Path");
+		const std::string* path = xmlutil::findAttribute(attributes, "Path");
 		if (!path) break;
-		optional<int> width = pt.get_optional<int>("<xmlattr>.Width");
+		optional<int> width = toInt(attributes, "Width");
 		if (!width) break;
-		optional<int> height = pt.get_optional<int>("<xmlattr>.Height");
+		optional<int> height = toInt(attributes, "Height");
 		if (!height) break;
-		optional<int> bpp = pt.get_optional<int>("<xmlattr>.Bpp");
+		optional<int> bpp = toInt(attributes, "Bpp");
 		if (!bpp) break;
 
         // バックスラッシュを/に置き換える
-        std::string npath = FileUtil::replaceBackslash(path.get());
+        std::string npath = FileUtil::replaceBackslash(*path);
 
 		SsSize size(width.get(), height.get());
 
@@ -220,96 +725,62 @@ static shared_ptr<SsImage> readImage(const ptree& pt)
 
 
 /**
- * <Part>からパーツを構築する 
+ * <Part>の読み取り値からパーツを構築する 
  */
-static shared_ptr<SsPart> readPart(const ptree& pt, textenc::Encoding encoding, int motionEndFrameNo)
+static shared_ptr<SsPart> makePart(const PartFields& fields, textenc::Encoding encoding, int motionEndFrameNo)
 {
 	do
 	{
 		shared_ptr<SsPart> part = shared_ptr<SsPart>(new SsPart());
 
 		// 必須パラメータ 
-		optional<int> type = pt.get_optional<int>("Type");
-		if (!type) break;
-
-		// オプションパラメータ 
-		optional<int> root = pt.get_optional<int>("<xmlattr>.Root");
-		optional<std::string> name = pt.get_optional<std::string>("Name");
-		optional<int> id = pt.get_optional<int>("ID");
-		optional<int> parentId = pt.get_optional<int>("ParentID");
-
-		optional<int> picId = pt.get_optional<int>("PicID");
-		optional<int> picAreaLeft = pt.get_optional<int>("PictArea.Left");
-		optional<int> picAreaTop = pt.get_optional<int>("PictArea.Top");
-		optional<int> picAreaRight = pt.get_optional<int>("PictArea.Right");
-		optional<int> picAreaBottom = pt.get_optional<int>("PictArea.Bottom");
-		optional<int> originX = pt.get_optional<int>("OriginX");
-		optional<int> originY = pt.get_optional<int>("OriginY");
-
-		optional<int> transBlendType = pt.get_optional<int>("TransBlendType");	// alpha blend
-		optional<int> inheritType = pt.get_optional<int>("InheritType");
-
+		if (!fields.type) break;
 
 		// Rootアトリビュートが1のときはRootパーツとして扱う
-		if (root && root.get() == 1)
+		if (fields.root && fields.root.get() == 1)
 		{
 			part->type = SsPart::TypeRoot;
 		}
 		else
 		{
-			part->type = static_cast<SsPart::Type>(type.get());
+			part->type = static_cast<SsPart::Type>(fields.type.get());
 		}
 
-		if (name)
+		if (fields.name)
 		{
-			std::string n = textenc::convert(name.get(), encoding, textenc::SHIFT_JIS);
+			std::string n = textenc::convert(fields.name.get(), encoding, textenc::SHIFT_JIS);
 			part->name = n;
 		}
-		if (id) part->id = id.get();
-		if (parentId) part->parentId = parentId.get();
+		if (fields.id) part->id = fields.id.get();
+		if (fields.parentId) part->parentId = fields.parentId.get();
 
-		if (picId) part->picId = picId.get();
-		if (picAreaLeft && picAreaTop && picAreaRight && picAreaBottom)
+		if (fields.picId) part->picId = fields.picId.get();
+		if (fields.picArea.left && fields.picArea.top && fields.picArea.right && fields.picArea.bottom)
 		{
 			part->picArea = SsRect(
-				picAreaLeft.get(), 
-				picAreaTop.get(),
-				picAreaRight.get(),
-				picAreaBottom.get());
+				fields.picArea.left.get(), 
+				fields.picArea.top.get(),
+				fields.picArea.right.get(),
+				fields.picArea.bottom.get());
 		}
-		if (transBlendType)
+		if (fields.transBlendType)
 		{
-			int blendType = transBlendType.get();
+			int blendType = fields.transBlendType.get();
 			if (blendType < 0 || blendType >= SsPart::NumAlphaBlend) blendType = 0;
 			part->alphaBlend = static_cast<SsPart::AlphaBlend>(blendType);
 		}
-		if (originX && originY)
+		if (fields.originX && fields.originY)
 		{
 			part->origin = SsPoint(
-				originX.get(),
-				originY.get());
+				fields.originX.get(),
+				fields.originY.get());
 		}
-		if (inheritType)
+		if (fields.inheritType)
 		{
-			part->inheritEach = inheritType.get() != 0;
+			part->inheritEach = fields.inheritType.get() != 0;
 		}
 
-		std::vector<SsAttribute::Ptr> attributes;
-		optional<const ptree&> attrs = pt.get_child_optional("Attributes");
-		if (attrs)
-		{
-			BOOST_FOREACH( const ptree::value_type& v2, pt.get_child("Attributes") )
-			{
-				if (v2.first == "Attribute")
-				{
-					const ptree& attr = v2.second;
-					shared_ptr<SsAttribute> attribute = readAttribute(attr, encoding);
-					if (!attribute) continue;
-					attributes.push_back(attribute);
-				}
-			}
-		}
-		part->attributes = SsAttributes(attributes, motionEndFrameNo);
+		part->attributes = SsAttributes(fields.attributes, motionEndFrameNo);
 
 		return part;
 
@@ -319,131 +790,66 @@ static shared_ptr<SsPart> readPart(const ptree& pt, textenc::Encoding encoding,
 
 
 /**
- * <Attribute>からアニメーションアトリビュートを構築する 
- */
-static shared_ptr<SsAttribute> readAttribute(const ptree& pt, textenc::Encoding encoding)
-{
-	do
-	{
-		// 必須パラメータ 
-		optional<std::string> tagStr = pt.get_optional<std::string>("<xmlattr>.Tag");
-		if (!tagStr) break;
-
-		// Tag文字列からタグを求める 
-		SsAttributeTag::Tag tag = SsAttributeTag::toEnum(tagStr.get());
-		if (tag == SsAttributeTag::Unknown) break;
-
-		// オプションパラメータ 
-		optional<float> inheritedPercent = pt.get_optional<float>("<xmlattr>.Inherit");
-
-		// <Key>群の読み込み 
-		std::vector<SsKeyframe> keyframes;
-		BOOST_FOREACH( const ptree::value_type& v, pt.get_child("") )
-		{
-			if (v.first == "Key")
-			{
-				const ptree& key = v.second;
-				shared_ptr<SsKeyframe> keyframe = readKey(key, tag, encoding);
-				if (!keyframe) break;
-				keyframes.push_back(*keyframe);
-			}
-		}
-
-		// タイムラインを構築する 
-		shared_ptr<SsKeyframeTimeline> timeline = 
-			shared_ptr<SsKeyframeTimeline>(new SsKeyframeTimeline(keyframes));
-
-		return shared_ptr<SsAttribute>(
-			new SsAttribute(tag, inheritedPercent, timeline));
-
-	} while (false);
-	return shared_ptr<SsAttribute>();
-}
-
-
-/**
- * <Key>からキーフレームを構築する
+ * <Key>の読み取り値からキーフレームを構築する
  */
-static shared_ptr<SsKeyframe> readKey(const ptree& pt, const SsAttributeTag::Tag& tag, textenc::Encoding encoding)
+static shared_ptr<SsKeyframe> makeKey(const KeyFields& fields, const SsAttributeTag::Tag& tag, textenc::Encoding encoding)
 {
 	do
 	{
 		// 必須パラメータ 
-		optional<int> time = pt.get_optional<int>("<xmlattr>.Time");
-		if (!time) break;
+		if (!fields.time) break;
 
 		boost::shared_ptr<SsValue> ssValue;
 		if (tag == SsAttributeTag::VERT)
 		{
 			// 頂点変形
-			optional<int> topLeftX = pt.get_optional<int>("TopLeft.X");
-			optional<int> topLeftY = pt.get_optional<int>("TopLeft.Y");
-			optional<int> topRightX = pt.get_optional<int>("TopRight.X");
-			optional<int> topRightY = pt.get_optional<int>("TopRight.Y");
-			optional<int> bottomLeftX = pt.get_optional<int>("BottomLeft.X");
-			optional<int> bottomLeftY = pt.get_optional<int>("BottomLeft.Y");
-			optional<int> bottomRightX = pt.get_optional<int>("BottomRight.X");
-			optional<int> bottomRightY = pt.get_optional<int>("BottomRight.Y");
-			if (!topLeftX || !topLeftY) break;
-			if (!topRightX || !topRightY) break;
-			if (!bottomLeftX || !bottomLeftY) break;
-			if (!bottomRightX || !bottomRightY) break;
-			
 			SsVertex4Value* value = new SsVertex4Value();
-			value->v[SS_VERTEX_TOP_LEFT].x = topLeftX.get();
-			value->v[SS_VERTEX_TOP_LEFT].y = topLeftY.get();
-			value->v[SS_VERTEX_TOP_RIGHT].x = topRightX.get();
-			value->v[SS_VERTEX_TOP_RIGHT].y = topRightY.get();
-			value->v[SS_VERTEX_BOTTOM_LEFT].x = bottomLeftX.get();
-			value->v[SS_VERTEX_BOTTOM_LEFT].y = bottomLeftY.get();
-			value->v[SS_VERTEX_BOTTOM_RIGHT].x = bottomRightX.get();
-			value->v[SS_VERTEX_BOTTOM_RIGHT].y = bottomRightY.get();
+			bool result;
+			result = readPoint(value->v[SS_VERTEX_TOP_LEFT], fields.vertices[KeyFields::VertexTopLeft]);
+			if (result) result = readPoint(value->v[SS_VERTEX_TOP_RIGHT], fields.vertices[KeyFields::VertexTopRight]);
+			if (result) result = readPoint(value->v[SS_VERTEX_BOTTOM_LEFT], fields.vertices[KeyFields::VertexBottomLeft]);
+			if (result) result = readPoint(value->v[SS_VERTEX_BOTTOM_RIGHT], fields.vertices[KeyFields::VertexBottomRight]);
+			if (!result)
+			{
+				delete value;
+				break;
+			}
 			
 			ssValue = boost::shared_ptr<SsValue>(value);
 		}
 		else if (tag == SsAttributeTag::PCOL)
 		{
 			// カラーブレンド
-			optional<int> type = pt.get_optional<int>("Type");
-			optional<int> blend = pt.get_optional<int>("Blend");
-			if (!type || !blend) break;
-			if (type.get() < 0 || type.get() >= SsColorBlendValue::END_OF_TYPE) break;
-			if (blend.get() < 0 || blend.get() >= SsColorBlendValue::END_OF_BLEND) break;
+			if (!fields.type || !fields.blend) break;
+			if (fields.type.get() < 0 || fields.type.get() >= SsColorBlendValue::END_OF_TYPE) break;
+			if (fields.blend.get() < 0 || fields.blend.get() >= SsColorBlendValue::END_OF_BLEND) break;
 
 			SsColorBlendValue value;
-			value.type = static_cast<SsColorBlendValue::Type>(type.get());
-			value.blend = static_cast<SsColorBlendValue::Blend>(SsColorBlendValue::BLEND_MIX + blend.get());
+			value.type = static_cast<SsColorBlendValue::Type>(fields.type.get());
+			value.blend = static_cast<SsColorBlendValue::Blend>(SsColorBlendValue::BLEND_MIX + fields.blend.get());
 			
 			if (value.type == SsColorBlendValue::TYPE_COLORTYPE_PARTS)
 			{
 				// 単色
-				optional<const ptree&> v = pt.get_child_optional("Value");
-				if (!v) break;
-
-				bool result = readColors(value.colors[0], v.get());
+				const VertexFields& v = fields.vertices[KeyFields::VertexValue];
+				bool result = readColors(value.colors[0], v);
 				if (!result) break;
 				// 後の処理で扱いやすいように他の頂点ワークにも同じ値を設定しておく
-				readColors(value.colors[1], v.get());
-				readColors(value.colors[2], v.get());
-				readColors(value.colors[3], v.get());
+				readColors(value.colors[1], v);
+				readColors(value.colors[2], v);
+				readColors(value.colors[3], v);
 			}
 			else if (value.type == SsColorBlendValue::TYPE_COLORTYPE_VERTEX)
 			{
 				// 頂点カラー
-				optional<const ptree&> tl = pt.get_child_optional("TopLeft");
-				optional<const ptree&> tr = pt.get_child_optional("TopRight");
-				optional<const ptree&> bl = pt.get_child_optional("BottomLeft");
-				optional<const ptree&> br = pt.get_child_optional("BottomRight");
-				if (!tl || !tr || !bl || !br) break;
-
 				bool result;
-				result = readColors(value.colors[SS_VERTEX_TOP_LEFT], tl.get());
+				result = readColors(value.colors[SS_VERTEX_TOP_LEFT], fields.vertices[KeyFields::VertexTopLeft]);
 				if (!result) break;
-				result = readColors(value.colors[SS_VERTEX_TOP_RIGHT], tr.get());
+				result = readColors(value.colors[SS_VERTEX_TOP_RIGHT], fields.vertices[KeyFields::VertexTopRight]);
 				if (!result) break;
-				result = readColors(value.colors[SS_VERTEX_BOTTOM_LEFT], bl.get());
+				result = readColors(value.colors[SS_VERTEX_BOTTOM_LEFT], fields.vertices[KeyFields::VertexBottomLeft]);
 				if (!result) break;
-				result = readColors(value.colors[SS_VERTEX_BOTTOM_RIGHT], br.get());
+				result = readColors(value.colors[SS_VERTEX_BOTTOM_RIGHT], fields.vertices[KeyFields::VertexBottomRight]);
 				if (!result) break;
 			}
 			else if (value.type == SsColorBlendValue::TYPE_COLORTYPE_NONE)
@@ -467,40 +873,30 @@ static shared_ptr<SsKeyframe> readKey(const ptree& pt, const SsAttributeTag::Tag
 			SsUserDataValue value;
 			
 			// Number
-			optional<long> number = pt.get_optional<long>("Number");
-			if (number)
+			if (fields.number)
 			{
-				int n = number.get() >= INT_MAX ? INT_MAX : static_cast<int>(number.get());
+				int n = fields.number.get() >= INT_MAX ? INT_MAX : static_cast<int>(fields.number.get());
 				value.number = n;
 			}
 
 			// Rect
-			optional<const ptree&> rectPt = pt.get_child_optional("Rect");
-			if (rectPt)
+			SsRect rect;
+			if (readRect(rect, fields.rect, false))	// 座標の正規化は行わない
 			{
-				SsRect rect;
-				if (readRect(rect, rectPt.get(), false))	// 座標の正規化は行わない
-				{
-					value.rect = rect;
-				}
+				value.rect = rect;
 			}
 
 			// Point
-			optional<const ptree&> pointPt = pt.get_child_optional("Point");
-			if (pointPt)
+			SsPoint point;
+			if (readPoint(point, fields.vertices[KeyFields::VertexPoint]))
 			{
-				SsPoint point;
-				if (readPoint(point, pointPt.get()))
-				{
-					value.point = point;
-				}
+				value.point = point;
 			}
 
 			// String
-			optional<std::string> str = pt.get_optional<std::string>("String");
-			if (str)
+			if (fields.str)
 			{
-				std::string s = textenc::convert(str.get(), encoding, textenc::SHIFT_JIS);
+				std::string s = textenc::convert(fields.str.get(), encoding, textenc::SHIFT_JIS);
 				value.str = s;
 			}
 		
@@ -508,10 +904,9 @@ static shared_ptr<SsKeyframe> readKey(const ptree& pt, const SsAttributeTag::Tag
 		}
 		else
 		{
-			optional<float> value = pt.get_optional<float>("Value");
-			if (!value) break;
+			if (!fields.value) break;
 			
-			float v = value.get();
+			float v = fields.value.get();
 
 			// 回転角は度で定義されているが、内部ではラジアンで持つ
 			if (tag == SsAttributeTag::ANGL)
@@ -526,23 +921,17 @@ static shared_ptr<SsKeyframe> readKey(const ptree& pt, const SsAttributeTag::Tag
 
 		// CurveTypeアトリビュート、無ければデフォルトはNone
 		SsCurve::Type curveType = SsCurve::None;
-		optional<int> curveTypeValue = pt.get_optional<int>("<xmlattr>.CurveType");
-		if (curveTypeValue)
+		if (fields.curveType)
 		{
-            int type = curveTypeValue.get();
+            int type = fields.curveType.get();
             if (type < 0 || type >= SsCurve::END_OF_TYPE) type = SsCurve::Linear;   // 不正値
 			curveType = static_cast<SsCurve::Type>(type);
 		}
 
-		optional<float> curveStartT = pt.get_optional<float>("<xmlattr>.CurveStartT");
-		optional<float> curveStartV = pt.get_optional<float>("<xmlattr>.CurveStartV");
-		optional<float> curveEndT = pt.get_optional<float>("<xmlattr>.CurveEndT");
-		optional<float> curveEndV = pt.get_optional<float>("<xmlattr>.CurveEndV");
-        
 		return shared_ptr<SsKeyframe>(
-			curveStartT ?
-			new SsKeyframe(time.get(), ssValue, curveType, curveStartT.get(), curveStartV.get(), curveEndT.get(), curveEndV.get()):
-			new SsKeyframe(time.get(), ssValue, curveType)
+			fields.curveStartT ?
+			new SsKeyframe(fields.time.get(), ssValue, curveType, fields.curveStartT.get(), fields.curveStartV.get(), fields.curveEndT.get(), fields.curveEndV.get()):
+			new SsKeyframe(fields.time.get(), ssValue, curveType)
 		);
 
 	} while (false);
@@ -553,20 +942,16 @@ static shared_ptr<SsKeyframe> readKey(const ptree& pt, const SsAttributeTag::Tag
 /**
  * カラーパラメータ読み込み
  */
-static bool readColors(SsColor& color, const ptree& pt)
+static bool readColors(SsColor& color, const VertexFields& fields)
 {
 	do
 	{
-		optional<int> red   = pt.get_optional<int>("Red");
-		optional<int> green = pt.get_optional<int>("Green");
-		optional<int> blue  = pt.get_optional<int>("Blue");
-		optional<int> alpha = pt.get_optional<int>("Alpha");
-		if (!red || !green || !blue || !alpha) break;
+		if (!fields.red || !fields.green || !fields.blue || !fields.alpha) break;
 		
-		color.r = static_cast<SsColor::ColorType>(red.get());
-		color.g = static_cast<SsColor::ColorType>(green.get());
-		color.b = static_cast<SsColor::ColorType>(blue.get());
-		color.a = static_cast<SsColor::ColorType>(alpha.get());
+		color.r = static_cast<SsColor::ColorType>(fields.red.get());
+		color.g = static_cast<SsColor::ColorType>(fields.green.get());
+		color.b = static_cast<SsColor::ColorType>(fields.blue.get());
+		color.a = static_cast<SsColor::ColorType>(fields.alpha.get());
 		return true;
 	}
 	while (false);
@@ -577,16 +962,14 @@ static bool readColors(SsColor& color, const ptree& pt)
 /**
  * Point読み込み
  */
-static bool readPoint(SsPoint& point, const ptree& pt)
+static bool readPoint(SsPoint& point, const VertexFields& fields)
 {
 	do
 	{
-		optional<int> x = pt.get_optional<int>("X");
-		optional<int> y = pt.get_optional<int>("Y");
-		if (!x || !y) break;
+		if (!fields.x || !fields.y) break;
 
-		point.x = x.get();
-		point.y = y.get();
+		point.x = fields.x.get();
+		point.y = fields.y.get();
 		return true;
 	}
 	while (false);
@@ -597,22 +980,16 @@ static bool readPoint(SsPoint& point, const ptree& pt)
 /**
  * Rect読み込み
  */
-static bool readRect(SsRect& rect, const ptree& pt, bool normalizeEnabled)
+static bool readRect(SsRect& rect, const RectFields& fields, bool normalizeEnabled)
 {
 	do
 	{
-		optional<int> top    = pt.get_optional<int>("Top");
-		optional<int> left   = pt.get_optional<int>("Left");
-		optional<int> bottom = pt.get_optional<int>("Bottom");
-		optional<int> right  = pt.get_optional<int>("Right");
-		if (!top || !left || !bottom || !right) break;
+		if (!fields.top || !fields.left || !fields.bottom || !fields.right) break;
 		
-		SsRect r(left.get(), top.get(), right.get(), bottom.get(), normalizeEnabled);
+		SsRect r(fields.left.get(), fields.top.get(), fields.right.get(), fields.bottom.get(), normalizeEnabled);
 		rect = r;
 		return true;
 	}
 	while (false);
 	return false;
 }
-
-
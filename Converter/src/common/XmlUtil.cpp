@@ -1,48 +1,455 @@
 ﻿
 #include "XmlUtil.h"
 #include <fstream>
-#include <iostream>
-#include <boost/xpressive/xpressive.hpp>
+#include <algorithm>
+#include <cstring>
 
 
 namespace xmlutil
 {
 
-/** XMLファイルのエンコーディングを得る */
-std::string getEncoding(const std::string& filename)
+/** 属性リストから名前で値を探す。見つからなければNULLを返す */
+const std::string* findAttribute(const Attributes& attributes, const char* name)
 {
-	using namespace boost::xpressive;
+	for (Attributes::const_iterator it = attributes.begin(); it != attributes.end(); ++it)
+	{
+		if (it->first == name) return &it->second;
+	}
+	return 0;
+}
 
-	std::string enc = "";
-	std::ifstream ifs(filename.c_str(), std::ifstream::binary | std::ifstream::in);
-	if (ifs)
+
+namespace
+{
+
+/** XMLの空白文字か？ */
+inline bool isSpace(char c)
+{
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+/** 要素名の終端文字か？ */
+inline bool isNameEnd(char c)
+{
+	return isSpace(c) || c == '/' || c == '>' || c == '?';
+}
+
+/** 属性名の終端文字か？ */
+inline bool isAttributeNameEnd(char c)
+{
+	return isSpace(c) || c == '/' || c == '<' || c == '>' || c == '=' || c == '?' || c == '!';
+}
+
+
+/** Unicodeのコードポイントを UTF-8 で追加する */
+void appendUtf8(unsigned long code, std::string& out)
+{
+	if (code < 0x80)
+	{
+		out += static_cast<char>(code);
+	}
+	else if (code < 0x800)
+	{
+		out += static_cast<char>(0xC0 | (code >> 6));
+		out += static_cast<char>(0x80 | (code & 0x3F));
+	}
+	else if (code < 0x10000)
+	{
+		out += static_cast<char>(0xE0 | (code >> 12));
+		out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+		out += static_cast<char>(0x80 | (code & 0x3F));
+	}
+	else
+	{
+		out += static_cast<char>(0xF0 | (code >> 18));
+		out += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+		out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+		out += static_cast<char>(0x80 | (code & 0x3F));
+	}
+}
+
+/**
+ * 文字参照を展開しながら[first, last)をoutへ追加する 
+ * 未知の実体参照はそのまま残す 
+ */
+bool appendDecoded(const char* first, const char* last, std::string& out)
+{
+	static const struct { const char* name; size_t length; char c; } entities[] =
+	{
+		{ "amp;", 4, '&' },
+		{ "lt;", 3, '<' },
+		{ "gt;", 3, '>' },
+		{ "quot;", 5, '"' },
+		{ "apos;", 5, '\'' },
+	};
+
+	while (first != last)
+	{
+		const char* amp = std::find(first, last, '&');
+		out.append(first, amp);
+		if (amp == last) break;
+
+		const char* p = amp + 1;
+		const size_t rest = last - p;
+		bool replaced = false;
+		for (size_t i = 0; i < sizeof(entities) / sizeof(entities[0]); i++)
+		{
+			if (rest >= entities[i].length && std::memcmp(p, entities[i].name, entities[i].length) == 0)
+			{
+				out += entities[i].c;
+				first = p + entities[i].length;
+				replaced = true;
+				break;
+			}
+		}
+		if (replaced) continue;
+
+		if (rest >= 1 && *p == '#')
+		{
+			// 数値文字参照 
+			++p;
+			const bool hex = p != last && *p == 'x';
+			if (hex) ++p;
+			unsigned long code = 0;
+			for (; p != last; ++p)
+			{
+				int digit;
+				if (*p >= '0' && *p <= '9') digit = *p - '0';
+				else if (hex && *p >= 'a' && *p <= 'f') digit = *p - 'a' + 10;
+				else if (hex && *p >= 'A' && *p <= 'F') digit = *p - 'A' + 10;
+				else break;
+				code = code * (hex ? 16 : 10) + digit;
+				if (code > 0x10FFFF) return false;
+			}
+			if (p == last || *p != ';') return false;
+			appendUtf8(code, out);
+			first = p + 1;
+			continue;
+		}
+
+		out += '&';
+		first = amp + 1;
+	}
+	return true;
+}
+
+
+/**
+ * SAX形式のパーサ 
+ * 入力を先頭から一度だけ走査し、要素名とテキストのバッファは深さごとに使い回す 
+ * 入力は分けて渡すことができ、途中で途切れたトークンは続きを受け取ってから読み直す 
+ */
+class SaxParser
+{
+public:
+	SaxParser(SaxHandler& handler)
+		: _p(0), _end(0), _handler(handler), _depth(0), _started(false)
+	{}
+
+	/**
+	 * [begin, end)を走査する 
+	 * isLastがfalseのときは末尾で途切れたトークンを読まずに残し、その先頭をrestへ返す 
+	 * 次の呼び出しではrestからのデータに続きを足して渡す 
+	 */
+	bool parse(const char* begin, const char* end, bool isLast, const char*& rest)
+	{
+		_p = begin;
+		_end = end;
+		rest = end;
+
+		if (!_started)
+		{
+			// UTF-8のBOMは読み飛ばす 
+			if (_end - _p < 3 && !isLast)
+			{
+				rest = _p;
+				return true;
+			}
+			if (_end - _p >= 3
+			 && static_cast<unsigned char>(_p[0]) == 0xEF
+			 && static_cast<unsigned char>(_p[1]) == 0xBB
+			 && static_cast<unsigned char>(_p[2]) == 0xBF)
+			{
+				_p += 3;
+			}
+			_started = true;
+		}
+
+		while (true)
+		{
+			const char* tokenStart = _p;
+			skipSpaces();
+			if (_p == _end)
+			{
+				if (!isLast)
+				{
+					rest = tokenStart;
+					return true;
+				}
+				break;
+			}
+
+			bool result;
+			if (*_p != '<')
+			{
+				result = parseText(tokenStart);
+			}
+			else if (++_p == _end)
+			{
+				result = false;
+			}
+			else
+			{
+				switch (*_p)
+				{
+					case '/': ++_p; result = parseEndTag(); break;
+					case '?': ++_p; result = parseInstruction(); break;
+					case '!': ++_p; result = parseMarkup(); break;
+					default:        result = parseStartTag(); break;
+				}
+			}
+
+			if (!result)
+			{
+				// 続きがあるときは、途切れたトークンとして続きを受け取ってから読み直す 
+				// （各トークンはハンドラへの通知を最後に行うため、読み直しても通知は重複しない） 
+				if (isLast) return false;
+				rest = tokenStart;
+				return true;
+			}
+		}
+		return _depth == 0;
+	}
+
+private:
+	void skipSpaces()
+	{
+		while (_p != _end && isSpace(*_p)) ++_p;
+	}
+
+	const char* find(char c) const
+	{
+		const char* p = _p;
+		while (p != _end && *p != c) ++p;
+		return p;
+	}
+
+	const char* find(const char* s) const
 	{
-		ifs.seekg(0, std::ios::end);
-		size_t length = static_cast<size_t>(ifs.tellg());
-		ifs.seekg(0, std::ios::beg);
+		const char* p = std::search(_p, _end, s, s + std::strlen(s));
+		return p;
+	}
 
-		char* buffer = new char[length];
-		ifs.read(buffer, length);
-		std::string buf(buffer);
+	bool startsWith(const char* s) const
+	{
+		size_t len = std::strlen(s);
+		return static_cast<size_t>(_end - _p) >= len && std::memcmp(_p, s, len) == 0;
+	}
 
-		sregex declpt = sregex::compile("<\\?xml [^>]+\\?>");
-		smatch m;
-		if (regex_search(buf, m, declpt))
+	/** テキスト。空白のみの区間は捨て、それ以外は前後の空白も含めて連結する */
+	bool parseText(const char* textStart)
+	{
+		if (_depth == 0) return false;
+		const char* textEnd = find('<');
+		if (textEnd == _end) return false;
+		if (!appendDecoded(textStart, textEnd, _texts[_depth - 1])) return false;
+		_p = textEnd;
+		return true;
+	}
+
+	/** 開始タグ（'<'の直後から） */
+	bool parseStartTag()
+	{
+		const char* nameStart = _p;
+		while (_p != _end && !isNameEnd(*_p)) ++_p;
+		if (_p == nameStart || _p == _end) return false;
+
+		if (_names.size() <= _depth)
 		{
-			std::string decl = m.str();
-			//std::cout << decl << std::endl;
+			_names.resize(_depth + 1);
+			_texts.resize(_depth + 1);
+		}
+		std::string& name = _names[_depth];
+		name.assign(nameStart, _p);
+		_texts[_depth].clear();
+
+		if (!parseAttributes()) return false;
+		skipSpaces();
 
-			sregex encpt = sregex::compile("encoding=[\"']([\\w\\-]+)[\"']");
-			if (regex_search(decl, m, encpt))
+		if (startsWith("/>"))
+		{
+			_p += 2;
+			_handler.startElement(name, _attributes);
+			_handler.endElement(name, _texts[_depth]);
+		}
+		else if (_p != _end && *_p == '>')
+		{
+			++_p;
+			_handler.startElement(name, _attributes);
+			++_depth;
+		}
+		else
+		{
+			return false;
+		}
+		return true;
+	}
+
+	/** 終了タグ（"</"の直後から） */
+	bool parseEndTag()
+	{
+		if (_depth == 0) return false;
+		const char* nameStart = _p;
+		while (_p != _end && !isNameEnd(*_p)) ++_p;
+		const std::string& name = _names[_depth - 1];
+		if (static_cast<size_t>(_p - nameStart) != name.size() || !std::equal(nameStart, _p, name.begin())) return false;
+		skipSpaces();
+		if (_p == _end || *_p != '>') return false;
+		++_p;
+
+		--_depth;
+		_handler.endElement(_names[_depth], _texts[_depth]);
+		return true;
+	}
+
+	/** 属性リスト */
+	bool parseAttributes()
+	{
+		_attributes.clear();
+		while (true)
+		{
+			skipSpaces();
+			const char* nameStart = _p;
+			while (_p != _end && !isAttributeNameEnd(*_p)) ++_p;
+			if (_p == nameStart) break;
+			const char* nameEnd = _p;
+
+			skipSpaces();
+			if (_p == _end || *_p != '=') return false;
+			++_p;
+			skipSpaces();
+			if (_p == _end || (*_p != '"' && *_p != '\'')) return false;
+			const char quote = *_p++;
+			const char* valueEnd = find(quote);
+			if (valueEnd == _end) return false;
+
+			_attributes.push_back(std::make_pair(std::string(nameStart, nameEnd), std::string()));
+			if (!appendDecoded(_p, valueEnd, _attributes.back().second)) return false;
+			_p = valueEnd + 1;
+		}
+		return true;
+	}
+
+	/** 処理命令（"<?"の直後から）。XML宣言ならencodingを通知する */
+	bool parseInstruction()
+	{
+		const char* close = find("?>");
+		if (close == _end) return false;
+
+		if (startsWith("xml") && close - _p > 3 && isSpace(_p[3]))
+		{
+			_p += 3;
+			if (!parseAttributes()) return false;
+			skipSpaces();
+			if (_p != close) return false;
+
+			const std::string* encoding = findAttribute(_attributes, "encoding");
+			_handler.declaration(encoding ? *encoding : std::string());
+		}
+		_p = close + 2;
+		return true;
+	}
+
+	/** コメント、CDATA、DOCTYPE（"<!"の直後から） */
+	bool parseMarkup()
+	{
+		if (startsWith("--"))
+		{
+			const char* close = find("-->");
+			if (close == _end) return false;
+			_p = close + 3;
+		}
+		else if (startsWith("[CDATA["))
+		{
+			_p += 7;
+			const char* close = find("]]>");
+			if (close == _end) return false;
+			if (_depth > 0) _texts[_depth - 1].append(_p, close);
+			_p = close + 3;
+		}
+		else
+		{
+			// DOCTYPE等は内部サブセットの[]を考慮して読み飛ばす 
+			int bracket = 0;
+			for (; _p != _end; ++_p)
 			{
-				enc = m[1];
-				//std::cout << enc << std::endl;
+				if (*_p == '[') bracket++;
+				else if (*_p == ']') bracket--;
+				else if (*_p == '>' && bracket <= 0) break;
 			}
+			if (_p == _end) return false;
+			++_p;
 		}
+		return true;
+	}
+
+	const char*		_p;
+	const char*		_end;
+	SaxHandler&		_handler;
+	size_t			_depth;
+	bool			_started;
+	std::vector<std::string>	_names;
+	std::vector<std::string>	_texts;
+	Attributes		_attributes;
+};
+
+}	// namespace
+
+
+
+/**
+ * メモリ上のXMLを先頭から一度だけ走査し、ハンドラへイベントを通知する 
+ */
+bool parse(const char* begin, const char* end, SaxHandler& handler)
+{
+	SaxParser parser(handler);
+	const char* rest;
+	return parser.parse(begin, end, true, rest);
+}
+
+
+/**
+ * XMLファイルを一定の大きさずつ読み込みながらparseする 
+ * バッファには未処理のトークンと、読み込んだ１回分のデータだけを置く 
+ */
+bool parseFile(const std::string& filename, SaxHandler& handler)
+{
+	static const size_t CHUNK_SIZE = 64 * 1024;
+
+	std::ifstream ifs(filename.c_str(), std::ifstream::binary | std::ifstream::in);
+	if (!ifs) return false;
+
+	SaxParser parser(handler);
+	std::vector<char> buffer;
+	size_t size = 0;	// バッファに残っている未処理のデータの大きさ 
+	while (true)
+	{
+		if (buffer.size() < size + CHUNK_SIZE) buffer.resize(size + CHUNK_SIZE);
+		ifs.read(&buffer[size], CHUNK_SIZE);
+		if (ifs.bad()) return false;
+		size += static_cast<size_t>(ifs.gcount());
+		const bool isLast = ifs.eof();
+
+		const char* begin = &buffer[0];
+		const char* rest;
+		if (!parser.parse(begin, begin + size, isLast, rest)) return false;
+		if (isLast) return true;
 
-		delete [] buffer;
+		// 途切れたトークンをバッファの先頭へ詰める 
+		const size_t consumed = rest - begin;
+		std::copy(buffer.begin() + consumed, buffer.begin() + size, buffer.begin());
+		size -= consumed;
 	}
-	return enc;
 }
 
 
@@ -2,11 +2,47 @@
 #define _XML_UTIL_H_
 
 #include <string>
+#include <vector>
+#include <utility>
 
 namespace xmlutil
 {
-	/** XMLファイルのエンコーディングを得る */
-	std::string getEncoding(const std::string& filename);
+	/** 要素の属性リスト（名前, 値） */
+	typedef std::vector<std::pair<std::string, std::string> > Attributes;
+
+	/** 属性リストから名前で値を探す。見つからなければNULLを返す */
+	const std::string* findAttribute(const Attributes& attributes, const char* name);
+
+
+	/**
+	 * SAX形式のパースイベントを受け取るハンドラ 
+	 */
+	class SaxHandler
+	{
+	public:
+		virtual ~SaxHandler() {}
+
+		/** XML宣言を読んだ。encoding指定が無いときは空文字列 */
+		virtual void declaration(const std::string& /*encoding*/) {}
+
+		/** 開始タグを読んだ */
+		virtual void startElement(const std::string& name, const Attributes& attributes) = 0;
+
+		/**
+		 * 終了タグを読んだ 
+		 * textには要素直下のテキスト（空白のみの区間は除く）を連結したものが入る 
+		 */
+		virtual void endElement(const std::string& name, const std::string& text) = 0;
+	};
+
+	/**
+	 * メモリ上のXMLを先頭から一度だけ走査し、ハンドラへイベントを通知する 
+	 * 文法エラーのときはfalseを返す 
+	 */
+	bool parse(const char* begin, const char* end, SaxHandler& handler);
+
+	/** XMLファイルを一定の大きさずつ読み込みながらparseする。読み込みに失敗したときもfalseを返す */
+	bool parseFile(const std::string& filename, SaxHandler& handler);
 };
 
 #endif	// _XML_UTIL_H_
@@ -4,6 +4,7 @@
 #include <vector>
 #include <map>
 #include <fstream>
+#include <sstream>
 
 #include <boost/foreach.hpp>
 #include <boost/shared_ptr.hpp>
@@ -60,6 +61,17 @@ struct Options
 	std::vector<fs::path>       ssfList;
 	bool						useTragetAffineTransformation;
 	bool						notModifyImagePath;
+	int							numJobs;
+	int							keyframeInterval;
+	bool						quantize;
+	int							positionFractionBits;
+	int							framesPerChunk;
+	bool						curveFormat;
+	int							resampleFps;
+	float						maxResampleError;
+	bool						rectTable;
+	bool						fixedRecords;
+	bool						pageAlign;
 };
 
 /** コマンドライン引数をパースしオプションを返す */
@@ -177,10 +189,67 @@ SsPlayerConverterResultCode ssaxToCocos2d(std::ostream& out, const Options& opti
 	Cocos2dSaver::Options saverOpt;
 	saverOpt.useTragetAffineTransformation = options.useTragetAffineTransformation;
 	saverOpt.notModifyImagePath = options.notModifyImagePath;
+	saverOpt.numJobs = options.numJobs;
+	saverOpt.keyframeInterval = options.keyframeInterval;
+	saverOpt.quantize = options.quantize;
+	saverOpt.positionFractionBits = options.positionFractionBits;
+	saverOpt.framesPerChunk = options.framesPerChunk;
+	saverOpt.curveFormat = options.curveFormat;
+	saverOpt.resampleFps = options.resampleFps;
+	saverOpt.maxResampleError = options.maxResampleError;
+	saverOpt.rectTable = options.rectTable;
+	saverOpt.fixedRecords = options.fixedRecords;
+	saverOpt.pageAlign = options.pageAlign;
+	const bool resample = options.resampleFps > 0 || options.maxResampleError >= 0;
 
 	std::string prefix = ssaxPath.stem().generic_string();
 	std::string comment = (boost::format("Created by %1% v%2%") % APP_NAME % APP_VERSION).str();
-	Cocos2dSaver::save(out, options.binaryFormatMode, options.outFileEncoding, saverOpt, motion, imageList, prefix, comment);
+
+	// 間引きで減ったサイズを報告するため、間引かないときのサイズを求めておく
+	std::streamoff fullSize = 0;
+	if (resample)
+	{
+		Cocos2dSaver::Options fullOpt = saverOpt;
+		fullOpt.resampleFps = 0;
+		fullOpt.maxResampleError = -1;
+		std::ostringstream fullOut(std::ios_base::out | std::ios_base::binary);
+		Cocos2dSaver::save(fullOut, options.binaryFormatMode, options.outFileEncoding, fullOpt, motion, imageList, prefix, comment);
+		fullSize = static_cast<std::streamoff>(fullOut.str().size());
+	}
+
+	Cocos2dSaver::QuantizationError quantizationError;
+	Cocos2dSaver::ResamplingReport resamplingReport;
+	std::streampos startPos = out.tellp();
+	Cocos2dSaver::save(out, options.binaryFormatMode, options.outFileEncoding, saverOpt, motion, imageList, prefix, comment, &quantizationError, &resamplingReport);
+
+	if (options.quantize)
+	{
+		// 量子化で生じた誤差を報告する
+		std::cout << boost::format("%1%: max quantization error: position %2%px, rotation %3%deg, scale %4%")
+			% ssaxPath.filename().generic_string()
+			% quantizationError.position
+			% quantizationError.rotation
+			% quantizationError.scale
+			<< std::endl;
+	}
+
+	if (resample)
+	{
+		// 間引いたフレーム数と、補間で復元したときの誤差を報告する
+		std::streamoff size = out.tellp() - startPos;
+		std::cout << boost::format("%1%: stored %2%/%3% frames, %4% -> %5% bytes, max interpolation error: position %6%px, rotation %7%deg, scale %8%px, opacity %9%, vertex %10%px")
+			% ssaxPath.filename().generic_string()
+			% resamplingReport.numStoredFrames
+			% resamplingReport.numFrames
+			% fullSize
+			% size
+			% resamplingReport.position
+			% resamplingReport.rotation
+			% resamplingReport.scale
+			% resamplingReport.opacity
+			% resamplingReport.vertexOffset
+			<< std::endl;
+	}
 
     return SSPC_SUCCESS;
 }
@@ -219,6 +288,16 @@ static shared_ptr<Options> parseOptions(int argc, const char* argv[])
 		("encoding,e", po::value< std::string >(),			"Encoding of output file (UTF8/UTF8N/SJIS) default:UTF8.")
 		("affine,a",										"Use Cocos2d-x affine transformation.")
 		("nm,m",											"Not modify image path.")
+		("jobs,j", po::value<int>(),						"Number of threads to encode frames (0:auto) default:0.")
+		("keyframe,k", po::value<int>(),					"Output only changes from the previous frame, with a keyframe every N frames (0:disable) default:0.")
+		("quantize,q", po::value<int>(),					"Quantize position, rotation and scale. N is fraction bits of position (0-8).")
+		("chunk,z", po::value<int>(),						"Compress frame data in chunks of N frames, binary format only (0:disable) default:0.")
+		("curve,r",											"Output keyframes and curves evaluated at runtime instead of baked frames, binary format only.")
+		("fps,f", po::value<int>(),							"Store frames at N fps and interpolate the rest at runtime (0:disable) default:0.")
+		("drop,d", po::value<float>(),						"Drop frames that interpolation restores within error E (px, deg). Negative disables. default:-1.")
+		("rect,t",											"Output texture rects as a per-image table referenced by index from frames.")
+		("fixed,x",											"Output frames as aligned fixed-stride arrays per element, binary format only.")
+		("page,p",											"Align frame data, frame table and part table to page boundaries for memory-mapped loading, binary format only.")
 		("in,i", po::value< std::vector<std::string> >(),	"ssax, ssf filename.")
 		("verbose,v",										"Verbose mode.")
 		;
@@ -309,6 +388,165 @@ static shared_ptr<Options> parseOptions(int argc, const char* argv[])
 	}
 
 
+	// *** フレームのエンコードに使うスレッド数
+	int numJobs = 0;	// default
+	if (vm.count("jobs"))
+	{
+		numJobs = vm["jobs"].as<int>();
+		if (numJobs < 0)
+		{
+			std::cerr << "Invalid number of jobs: " << numJobs << std::endl;
+			usage(std::cout, desc);
+            options->resultCode = SSPC_ILLEGAL_ARGUMENT;
+			return options;
+		}
+	}
+
+
+	// *** 差分形式で出力するときのキーフレーム間隔
+	int keyframeInterval = 0;	// default
+	if (vm.count("keyframe"))
+	{
+		keyframeInterval = vm["keyframe"].as<int>();
+		if (keyframeInterval < 0)
+		{
+			std::cerr << "Invalid keyframe interval: " << keyframeInterval << std::endl;
+			usage(std::cout, desc);
+            options->resultCode = SSPC_ILLEGAL_ARGUMENT;
+			return options;
+		}
+	}
+
+
+	// *** 量子化して出力するときの座標の小数部ビット数
+	bool quantize = vm.count("quantize") != 0;
+	int positionFractionBits = 0;
+	if (quantize)
+	{
+		positionFractionBits = vm["quantize"].as<int>();
+		if (positionFractionBits < 0 || positionFractionBits > 8)
+		{
+			std::cerr << "Invalid fraction bits of position: " << positionFractionBits << std::endl;
+			usage(std::cout, desc);
+            options->resultCode = SSPC_ILLEGAL_ARGUMENT;
+			return options;
+		}
+	}
+
+
+	// *** フレームデータを圧縮するときの１チャンクのフレーム数
+	int framesPerChunk = 0;	// default
+	if (vm.count("chunk"))
+	{
+		framesPerChunk = vm["chunk"].as<int>();
+		if (framesPerChunk < 0 || framesPerChunk > 0x7fff)
+		{
+			std::cerr << "Invalid number of frames per chunk: " << framesPerChunk << std::endl;
+			usage(std::cout, desc);
+            options->resultCode = SSPC_ILLEGAL_ARGUMENT;
+			return options;
+		}
+		if (framesPerChunk > 0 && !binaryFormatMode)
+		{
+			std::cerr << "Frame data can be compressed only in binary format." << std::endl;
+			usage(std::cout, desc);
+            options->resultCode = SSPC_ILLEGAL_ARGUMENT;
+			return options;
+		}
+	}
+
+
+	// *** キーフレームと補間方法で出力する（フレームごとの値はプレイヤーで計算する）
+	bool curveFormat = vm.count("curve") != 0;
+	if (curveFormat)
+	{
+		if (!binaryFormatMode)
+		{
+			std::cerr << "Curve format can be output only in binary format." << std::endl;
+			usage(std::cout, desc);
+            options->resultCode = SSPC_ILLEGAL_ARGUMENT;
+			return options;
+		}
+		if (keyframeInterval > 0 || quantize || framesPerChunk > 0)
+		{
+			std::cerr << "Curve format can not be combined with keyframe, quantize and chunk options." << std::endl;
+			usage(std::cout, desc);
+            options->resultCode = SSPC_ILLEGAL_ARGUMENT;
+			return options;
+		}
+	}
+
+
+	// *** フレームを間引き、間のフレームはプレイヤーで補間する
+	int resampleFps = 0;	// default
+	if (vm.count("fps"))
+	{
+		resampleFps = vm["fps"].as<int>();
+		if (resampleFps < 0)
+		{
+			std::cerr << "Invalid fps: " << resampleFps << std::endl;
+			usage(std::cout, desc);
+            options->resultCode = SSPC_ILLEGAL_ARGUMENT;
+			return options;
+		}
+	}
+	float maxResampleError = -1;	// default
+	if (vm.count("drop"))
+	{
+		maxResampleError = vm["drop"].as<float>();
+	}
+	if ((resampleFps > 0 || maxResampleError >= 0) && curveFormat)
+	{
+		std::cerr << "Curve format can not be combined with fps and drop options." << std::endl;
+		usage(std::cout, desc);
+        options->resultCode = SSPC_ILLEGAL_ARGUMENT;
+		return options;
+	}
+
+
+	// *** 参照元の範囲を画像ごとの表にまとめる
+	bool rectTable = vm.count("rect") != 0;
+	if (rectTable && curveFormat)
+	{
+		std::cerr << "Curve format can not be combined with rect option." << std::endl;
+		usage(std::cout, desc);
+        options->resultCode = SSPC_ILLEGAL_ARGUMENT;
+		return options;
+	}
+
+
+	// *** フレームのパーツ情報を要素ごとの固定長の配列で出力する
+	bool fixedRecords = vm.count("fixed") != 0;
+	if (fixedRecords)
+	{
+		if (!binaryFormatMode)
+		{
+			std::cerr << "Fixed-stride frames can be output only in binary format." << std::endl;
+			usage(std::cout, desc);
+            options->resultCode = SSPC_ILLEGAL_ARGUMENT;
+			return options;
+		}
+		if (keyframeInterval > 0 || quantize || curveFormat)
+		{
+			std::cerr << "Fixed-stride frames can not be combined with keyframe, quantize and curve options." << std::endl;
+			usage(std::cout, desc);
+            options->resultCode = SSPC_ILLEGAL_ARGUMENT;
+			return options;
+		}
+	}
+
+
+	// *** メモリにマップして読むときのため、セクションをページ境界に揃える
+	bool pageAlign = vm.count("page") != 0;
+	if (pageAlign && !binaryFormatMode)
+	{
+		std::cerr << "Page alignment can be used only in binary format." << std::endl;
+		usage(std::cout, desc);
+        options->resultCode = SSPC_ILLEGAL_ARGUMENT;
+		return options;
+	}
+
+
 	// *** 入力ファイル名チェック
 	std::vector<fs::path> sources;
 	{
@@ -393,6 +631,17 @@ static shared_ptr<Options> parseOptions(int argc, const char* argv[])
 	options->ssfList = ssfList;
 	options->useTragetAffineTransformation = vm.count("affine") != 0;
 	options->notModifyImagePath = vm.count("nm") != 0;
+	options->numJobs = numJobs;
+	options->keyframeInterval = keyframeInterval;
+	options->quantize = quantize;
+	options->positionFractionBits = positionFractionBits;
+	options->framesPerChunk = framesPerChunk;
+	options->curveFormat = curveFormat;
+	options->resampleFps = resampleFps;
+	options->maxResampleError = maxResampleError;
+	options->rectTable = rectTable;
+	options->fixedRecords = fixedRecords;
+	options->pageAlign = pageAlign;
 
 	return options;
 }
@@ -31,6 +31,7 @@ using namespace cocos2d;
 
 static const ss_u32 SSDATA_ID_0 = 0xffffffff;
 static const ss_u32 SSDATA_ID_1 = 0x53534241;
+static const ss_u32 SSDATA_VERSION = 5;	// 差分形式のフレームデータ（バージョン6以降）には対応しない
 
 
 
@@ -97,6 +98,7 @@ public:
 	{
 		CCAssert(data->id[0] == SSDATA_ID_0, "Not id 0 matched.");
 		CCAssert(data->id[1] == SSDATA_ID_1, "Not id 1 matched.");
+		CCAssert(data->version <= SSDATA_VERSION, "Version number of data does not match.");
 	}
 	
 	ss_u32 getFlags() const { return m_data->flags; }
@@ -586,6 +588,15 @@ void SSPlayer::setAnimation(const SSData* ssData, SSImageList* imageList)
 	CCAssert(ssData != NULL, "zero is ssData pointer");
 	CCAssert(imageList != NULL, "zero is imageList pointer");
 
+	// このプレイヤーが読めないバージョンのデータは設定しない
+	// reject data of versions this player cannot read.
+	if (ssData->version > SSDATA_VERSION)
+	{
+		CCLOG("SSPlayer::setAnimation: unsupported data version %u (max %u)", ssData->version, SSDATA_VERSION);
+		CCAssert(false, "Version number of data does not match.");
+		return;
+	}
+
 	clearAnimation();
 
 	SSDataHandle* dataHandle = new SSDataHandle(ssData);
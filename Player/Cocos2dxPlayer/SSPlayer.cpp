@@ -2,7 +2,41 @@
 #include "SSPlayer.h"
 #include "SSPlayerData.h"
 #include <cstring>
+#include <cmath>
+#include <cctype>
 #include <string>
+#include <vector>
+#include <map>
+#include <list>
+#include <algorithm>
+#include <climits>
+
+// ssbaファイルをメモリにマップして読み込みます（SSDataFile）
+// mmapを使える環境でのみ有効にしています. それ以外の環境ではファイルを読み込んでヒープに保持します.
+#if (CC_TARGET_PLATFORM == CC_PLATFORM_IOS) || (CC_TARGET_PLATFORM == CC_PLATFORM_MAC) || (CC_TARGET_PLATFORM == CC_PLATFORM_ANDROID) || (CC_TARGET_PLATFORM == CC_PLATFORM_LINUX)
+#define USE_MAPPED_FILE		1
+#else
+#define USE_MAPPED_FILE		0
+#endif
+
+// CPUの数をsysconfで求めます（SSPlayerBatchのワーカースレッドの数）
+// 求められない環境では、BATCH_EVALUATION_THREADSが-1のときワーカースレッドを使いません.
+#if (CC_TARGET_PLATFORM == CC_PLATFORM_IOS) || (CC_TARGET_PLATFORM == CC_PLATFORM_MAC) || (CC_TARGET_PLATFORM == CC_PLATFORM_ANDROID) || (CC_TARGET_PLATFORM == CC_PLATFORM_LINUX)
+#define USE_SYSCONF			1
+#else
+#define USE_SYSCONF			0
+#endif
+
+#include <pthread.h>
+
+#if USE_MAPPED_FILE
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#endif
+#if USE_MAPPED_FILE || USE_SYSCONF
+#include <unistd.h>
+#endif
 
 using namespace cocos2d;
 
@@ -66,6 +100,35 @@ using namespace cocos2d;
 #define ADJUST_UV_BY_CONTENT_SCALE_FACTOR	0	// (0:disable, 1:enable)
 
 
+// 圧縮されたフレームデータを展開して保持しておくチャンクの数（プレイヤーごと）
+#define FRAME_CHUNK_CACHE_SIZE	2
+
+// プレイヤー間で共有する、デコードしたフレームのキャッシュのメモリの上限の初期値（バイト数, 0:使わない）
+// 上限は16の区画に等分するため、使うときはアニメーションの数に合わせて十分な大きさを設定してください.
+#define SHARED_FRAME_CACHE_MEMORY_BUDGET	0
+
+
+// SSPlayerLoaderでssbaの読み込みと画像のデコードを行うワーカースレッドの数
+#define ASYNC_LOADER_THREADS			2
+// SSPlayerLoaderでテクスチャの転送に使う１フレームあたりの時間の初期値（ミリ秒）
+#define ASYNC_LOADER_UPLOAD_BUDGET		4.0f
+
+
+// SSAssetManagerのメモリの上限の初期値（バイト数, 0:上限なし）
+#define ASSET_MANAGER_MEMORY_BUDGET		0
+
+
+// SSPlayerBatchでフレームの評価を行うワーカースレッドの数（-1:CPUの数から決める, 0:使わない）
+#define BATCH_EVALUATION_THREADS		-1
+// SSPlayerBatchでワーカースレッドを使う、プレイヤーの最少数
+#define BATCH_EVALUATION_MIN_PLAYERS	8
+
+
+
+// SS_DECODER_BEGIN から SS_DECODER_END までは、cocos2d-xに依存しないフレームのデコード部分です.
+// Utilities/Cocos2d-x/curve_checker がこの範囲を切り出してビルドします.
+// 範囲内で新たにcocos2d-xの型や関数を使うときは、curve_checker.py の置き換え定義（shim）も更新してください.
+// SS_DECODER_BEGIN
 
 /**
  * definition
@@ -73,7 +136,26 @@ using namespace cocos2d;
 
 static const ss_u32 SSDATA_ID_0 = 0xffffffff;
 static const ss_u32 SSDATA_ID_1 = 0x53534241;
-static const ss_u32 SSDATA_VERSION = 5;
+static const ss_u32 SSDATA_VERSION = 6;
+static const ss_u32 SSDATA_VERSION_MIN = 5;	// 差分形式のフレームデータを含まないデータ
+static const ss_u32 SSDATA_VERSION_5_FLAGS = 0x0f;	// バージョン5で使えるフラグ（SS_DATA_FLAG_USE_VERTEX_OFFSET〜SS_DATA_FLAG_USE_AFFINE_TRANS）
+
+// SS_DECODER_END
+
+
+
+/** ssbaファイルのフルパスを返します */
+static std::string getFullPath(const char* ssbaPath, const char* dir)
+{
+	std::string path;
+	if (dir) path.append(dir);
+	path.append(ssbaPath);
+#if (COCOS2D_VERSION >= 0x00020100)
+	return CCFileUtils::sharedFileUtils()->fullPathForFilename(path.c_str());
+#else
+	return CCFileUtils::sharedFileUtils()->fullPathFromRelativePath(path.c_str());
+#endif
+}
 
 
 
@@ -90,14 +172,7 @@ unsigned char* SSPlayerHelper::loadFile(const char* ssbaPath, const char* dir)
 {
 	CCAssert(ssbaPath != NULL, "SSPlayerHelper::loadFile: Invalid argument.");
 
-	std::string path;
-	if (dir) path.append(dir);
-	path.append(ssbaPath);
-#if (COCOS2D_VERSION >= 0x00020100)
-	std::string fullpath = CCFileUtils::sharedFileUtils()->fullPathForFilename(path.c_str());
-#else
-	std::string fullpath = CCFileUtils::sharedFileUtils()->fullPathFromRelativePath(path.c_str());
-#endif
+	std::string fullpath = getFullPath(ssbaPath, dir);
 	unsigned long nSize = 0;
 	unsigned char* data = CCFileUtils::sharedFileUtils()->getFileData(fullpath.c_str(), "rb", &nSize);
 	return data;
@@ -126,7 +201,156 @@ void SSPlayerHelper::createFromFile(unsigned char** outData, SSPlayer** outPlaye
 	*outPlayer = SSPlayer::create(ssdata, *outImageList);
 }
 
+/** ssbaファイルからSSPlayer/SSImageListオブジェクトを構築します
+ *  ファイルはSSDataFileで読み込み、SSPlayerが保持するため、破棄の必要はありません.
+ *  Create SSPlayer/SSImageList objects, from ssba file.
+ *  The file is loaded as SSDataFile and retained by SSPlayer, no need to discard.
+ */
+void SSPlayerHelper::createFromFile(SSPlayer** outPlayer, SSImageList** outImageList, const char* ssbaPath, const char* dir)
+{
+	CCAssert(
+		outPlayer != NULL &&
+		outImageList != NULL &&
+		ssbaPath != NULL,
+		"SSPlayerHelper::createFromFile: Invalid argument.");
+
+	*outPlayer = NULL;
+	*outImageList = NULL;
+	SSDataFile* dataFile = SSDataFile::create(ssbaPath, dir);
+	if (!dataFile) return;
+
+	*outImageList = SSImageList::create(dataFile->getData(), dir);
+	*outPlayer = SSPlayer::create(dataFile, *outImageList);
+}
+
+
+
+/**
+ * SSDataFile
+ */
+
+/** ssbaファイルの内容を読み込みます. mmapを使える環境ではマップします.
+ *  CCObjectを生成しないため、ワーカースレッドからも呼べます.
+ */
+static bool loadFileData(const char* fullpath, const unsigned char*& outData, size_t& outSize, bool& outMapped)
+{
+	outData = NULL;
+	outSize = 0;
+	outMapped = false;
+
+#if USE_MAPPED_FILE
+	// 読み込み専用でマップし、触れたページだけが読み込まれるようにする
+	int fd = open(fullpath, O_RDONLY);
+	if (fd >= 0)
+	{
+		struct stat st;
+		if (fstat(fd, &st) == 0 && st.st_size > 0)
+		{
+			void* addr = mmap(NULL, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+			if (addr != MAP_FAILED)
+			{
+				outData = static_cast<const unsigned char*>(addr);
+				outSize = static_cast<size_t>(st.st_size);
+				outMapped = true;
+			}
+		}
+		close(fd);
+		if (outMapped) return true;
+	}
+#endif
+
+	// マップできないときは、ファイル全体をヒープに読み込む
+	unsigned long nSize = 0;
+	outData = CCFileUtils::sharedFileUtils()->getFileData(fullpath, "rb", &nSize);
+	outSize = static_cast<size_t>(nSize);
+	return outData != NULL;
+}
+
+/** loadFileDataで読み込んだ内容を破棄します.
+ */
+static void unloadFileData(const unsigned char* data, size_t size, bool mapped)
+{
+	if (!data) return;
+#if USE_MAPPED_FILE
+	if (mapped)
+	{
+		munmap(const_cast<unsigned char*>(data), size);
+		return;
+	}
+#endif
+	delete [] data;
+}
+
+SSDataFile::SSDataFile(void)
+	: m_data(NULL)
+	, m_size(0)
+	, m_mapped(false)
+	, m_assetManager(NULL)
+{
+}
+
+SSDataFile::~SSDataFile()
+{
+	unload();
+}
+
+SSDataFile* SSDataFile::create(const char* ssbaPath, const char* dir)
+{
+	CCAssert(ssbaPath != NULL, "zero is ssbaPath pointer");
+
+	SSDataFile* dataFile = new SSDataFile();
+	if (dataFile && dataFile->init(ssbaPath, dir))
+	{
+		dataFile->autorelease();
+		return dataFile;
+	}
+	CC_SAFE_DELETE(dataFile);
+	return NULL;
+}
+
+bool SSDataFile::init(const char* ssbaPath, const char* dir)
+{
+	CCAssert(ssbaPath != NULL, "zero is ssbaPath pointer");
+
+	std::string fullpath = getFullPath(ssbaPath, dir);
+	return initWithFullPath(fullpath.c_str());
+}
+
+/** 解決済みのパスから読み込みます. CCFileUtilsのパスの解決を使わないため、ワーカースレッドからも呼べます.
+ */
+bool SSDataFile::initWithFullPath(const char* fullpath)
+{
+	CCAssert(fullpath != NULL, "zero is fullpath pointer");
+
+	unload();
+	return loadFileData(fullpath, m_data, m_size, m_mapped);
+}
+
+/** loadFileDataで読み込んだ内容を引き取ります. 破棄はこのオブジェクトが行います.
+ */
+bool SSDataFile::initWithFileData(const unsigned char* data, size_t size, bool mapped)
+{
+	CCAssert(data != NULL, "zero is data pointer");
+
+	unload();
+	m_data = data;
+	m_size = size;
+	m_mapped = mapped;
+	return true;
+}
+
+void SSDataFile::unload()
+{
+	if (!m_data) return;
+	unloadFileData(m_data, m_size, m_mapped);
+	m_data = NULL;
+	m_size = 0;
+	m_mapped = false;
+}
+
+
 
+// SS_DECODER_BEGIN
 
 /**
  * SSDataHandle
@@ -140,15 +364,23 @@ public:
 	{
 		CCAssert(data->id[0] == SSDATA_ID_0, "Not id 0 matched.");
 		CCAssert(data->id[1] == SSDATA_ID_1, "Not id 1 matched.");
-		CCAssert(data->version == SSDATA_VERSION, "Version number of data does not match.");
+		CCAssert(data->version >= SSDATA_VERSION_MIN && data->version <= SSDATA_VERSION, "Version number of data does not match.");
 	}
 	
 	const SSData* getData() const { return m_data; }
 	
-	ss_u32 getFlags() const { return m_data->flags; }
+	/** バージョン5のデータでは、バージョン6で追加されたフラグを無視する */
+	ss_u32 getFlags() const { return m_data->version >= 6 ? m_data->flags : m_data->flags & SSDATA_VERSION_5_FLAGS; }
 	int getNumParts() const { return m_data->numParts; }
 	int getNumFrames() const { return m_data->numFrames; }
 	int getFps() const { return m_data->fps; }
+	int getNumKeyframes() const { return m_data->version >= 6 ? m_data->numKeyframes : 0; }
+	int getPositionFractionBits() const { return m_data->version >= 6 ? m_data->positionFractionBits : 0; }
+	int getAngleBits() const { return m_data->version >= 6 ? m_data->angleBits : 0; }
+	int getScaleFractionBits() const { return m_data->version >= 6 ? m_data->scaleFractionBits : 0; }
+	int getFramesPerChunk() const { return m_data->version >= 6 ? m_data->framesPerChunk : 0; }
+	int getNumChunks() const { return m_data->version >= 6 ? m_data->numChunks : 0; }
+	int getNumFrameTimes() const { return m_data->version >= 6 ? m_data->numFrameTimes : 0; }
 
 	const SSPartData* getPartData() const
 	{
@@ -165,6 +397,65 @@ public:
 		return static_cast<const ss_offset*>(getAddress(m_data->imageData));
 	}
 	
+	const ss_s16* getKeyframeIndex() const
+	{
+		return static_cast<const ss_s16*>(getAddress(m_data->keyframeIndex));
+	}
+	
+	const SSFrameChunk* getFrameChunks() const
+	{
+		return static_cast<const SSFrameChunk*>(getAddress(m_data->chunkData));
+	}
+	
+	const SSCurveNode* getCurveNodes() const
+	{
+		return static_cast<const SSCurveNode*>(getAddress(m_data->curveData));
+	}
+	
+	const ss_s16* getFrameTimes() const
+	{
+		return static_cast<const ss_s16*>(getAddress(m_data->frameTimes));
+	}
+	
+	/** フレームデータの数. フレームを間引いたときはフレーム数より少ない */
+	int getNumFrameRecords() const
+	{
+		int numFrameTimes = getNumFrameTimes();
+		return numFrameTimes > 0 ? numFrameTimes : m_data->numFrames;
+	}
+	
+	/** フレームを表示するときに使うフレームデータ（そのフレーム以前で最も近いもの）の番号を返す */
+	int findFrameRecord(int frameNo) const
+	{
+		int numFrameTimes = getNumFrameTimes();
+		if (numFrameTimes == 0) return frameNo;
+		const ss_s16* frameTimes = getFrameTimes();
+		return static_cast<int>(std::upper_bound(frameTimes, frameTimes + numFrameTimes, frameNo) - frameTimes) - 1;
+	}
+	
+	/** フレームデータの元のフレームNoを返す */
+	int getFrameRecordTime(int recordNo) const
+	{
+		return getNumFrameTimes() > 0 ? getFrameTimes()[recordNo] : recordNo;
+	}
+	
+	/** 参照元の範囲の表を持つ画像の数. 表を使うデータ(SS_DATA_FLAG_RECT_TABLE)でのみ有効 */
+	int getNumRectImages() const { return m_data->version >= 6 ? m_data->numRectImages : 0; }
+	
+	const SSImageRects* getImageRects() const
+	{
+		return static_cast<const SSImageRects*>(getAddress(m_data->imageRects));
+	}
+	
+	/** 画像imageNoの参照元の範囲の表からrectNo番目を返す. 無いときはNULLを返す. 表を使うデータでのみ有効 */
+	const SSTextureRect* getTextureRect(int imageNo, int rectNo) const
+	{
+		if (imageNo < 0 || imageNo >= getNumRectImages()) return NULL;
+		const SSImageRects& imageRects = getImageRects()[imageNo];
+		if (rectNo < 0 || rectNo >= imageRects.numRects) return NULL;
+		return static_cast<const SSTextureRect*>(getAddress(imageRects.rects)) + rectNo;
+	}
+	
 	const void* getAddress(ss_offset offset) const
 	{
 		return static_cast<const void*>( reinterpret_cast<const char*>(m_data) + offset );
@@ -233,6 +524,47 @@ public:
 		c.i = readU32();
 		return c.f;
 	}
+
+	/** 15bitずつ、続きがあるときは最上位bitが立ったss_u16の並びで記録された値を読み込みます.
+	 */
+	unsigned int readVarU32()
+	{
+		unsigned int value = 0;
+		int shift = 0;
+		ss_u16 unit;
+		do
+		{
+			unit = readU16();
+			value |= static_cast<unsigned int>(unit & 0x7fff) << shift;
+			shift += 15;
+		} while (unit & 0x8000);
+		return value;
+	}
+
+	int readVarS32()
+	{
+		unsigned int zigzag = readVarU32();
+		return static_cast<int>(zigzag >> 1) ^ -static_cast<int>(zigzag & 1);
+	}
+
+	/** 小数部fractionBitsビットの固定小数点数を読み込みます.
+	 */
+	float readVarFixed(int fractionBits)
+	{
+		return static_cast<float>(readVarS32()) / (1 << fractionBits);
+	}
+
+	float readFixed16(int fractionBits)
+	{
+		return static_cast<float>(readS16()) / (1 << fractionBits);
+	}
+
+	/** 1周をangleBitsビットで表した回転角を、度で読み込みます.
+	 */
+	float readAngle(int angleBits)
+	{
+		return static_cast<float>(readU16()) * 360.0f / (1 << angleBits);
+	}
 	
 	void readColor(ccColor4B& color)
 	{
@@ -259,6 +591,8 @@ private:
 	const ss_u16*	m_dataPtr;
 };
 
+// SS_DECODER_END
+
 
 
 /**
@@ -266,6 +600,7 @@ private:
  */
 
 SSImageList::SSImageList(void)
+	: m_keepTextureCache(false)
 {
 }
 
@@ -343,11 +678,14 @@ bool SSImageList::init(const char* imageFilenames[], const char* imageDir)
 
 void SSImageList::removeAll()
 {
-	CCTextureCache* texCache = CCTextureCache::sharedTextureCache();
-	for (size_t i = 0, count = m_imageList.count(); i < count; i++)
+	if (!m_keepTextureCache)
 	{
-		CCTexture2D* tex = static_cast<CCTexture2D*>( m_imageList.objectAtIndex(i) );
-		texCache->removeTexture(tex);
+		CCTextureCache* texCache = CCTextureCache::sharedTextureCache();
+		for (size_t i = 0, count = m_imageList.count(); i < count; i++)
+		{
+			CCTexture2D* tex = static_cast<CCTexture2D*>( m_imageList.objectAtIndex(i) );
+			texCache->removeTexture(tex);
+		}
 	}
 
 	m_imageList.removeAllObjects();
@@ -456,6 +794,11 @@ private:
 	float	m_rotation;
 	cocos2d::CCSprite*	m_sprite;
 	CCAffineTransform	m_trans;
+
+	// 前のフレームで追加の変換を設定したスプライトと値
+	cocos2d::CCSprite*	m_transSprite;
+	CCAffineTransform	m_appliedTrans;
+	bool				m_transformChanged;
 };
 
 SSPartState::SSPartState()
@@ -477,6 +820,9 @@ void SSPartState::init()
 	m_rotation = 0.0f;
 	m_sprite = NULL;
 	m_trans = CCAffineTransformMakeIdentity();
+	m_transSprite = NULL;
+	m_appliedTrans = CCAffineTransformMakeIdentity();
+	m_transformChanged = true;
 }
 
 void SSPartState::copyParameters(SSPlayer::PartState& state) const
@@ -506,6 +852,8 @@ private:
 	static CCGLProgram* getCustomShaderProgram();
 
 private:
+	friend class SSDirectRenderer;
+
 	CCGLProgram*	_defaultShaderProgram;
 	bool			_useCustomShaderProgram;
 	float			_opacity;
@@ -536,6 +884,8 @@ public:
 
 
 
+// SS_DECODER_BEGIN
+
 /**
  * flags definition
  */
@@ -545,6 +895,12 @@ enum {
 	SS_DATA_FLAG_USE_COLOR_BLEND	= 1 << 1,
 	SS_DATA_FLAG_USE_ALPHA_BLEND	= 1 << 2,
 	SS_DATA_FLAG_USE_AFFINE_TRANS	= 1 << 3,
+	SS_DATA_FLAG_DELTA_FRAMES		= 1 << 4,
+	SS_DATA_FLAG_QUANTIZED			= 1 << 5,
+	SS_DATA_FLAG_COMPRESSED_FRAMES	= 1 << 6,
+	SS_DATA_FLAG_CURVES				= 1 << 7,
+	SS_DATA_FLAG_RECT_TABLE			= 1 << 8,
+	SS_DATA_FLAG_FIXED_RECORDS		= 1 << 9,
 
 	NUM_SS_DATA_FLAGS
 };
@@ -584,6 +940,20 @@ enum {
 	NUM_SS_PART_FLAGS
 };
 
+enum {
+	SS_DELTA_FLAG_FLAGS				= 1 << 0,
+	SS_DELTA_FLAG_SOURCE_RECT		= 1 << 1,
+	SS_DELTA_FLAG_POSITION			= 1 << 2,
+	SS_DELTA_FLAG_ORIGIN			= 1 << 3,
+	SS_DELTA_FLAG_ROTATION			= 1 << 4,
+	SS_DELTA_FLAG_SCALE				= 1 << 5,
+	SS_DELTA_FLAG_OPACITY			= 1 << 6,
+	SS_DELTA_FLAG_VERTEX_OFFSET		= 1 << 7,
+	SS_DELTA_FLAG_COLOR_BLEND		= 1 << 8,
+
+	NUM_SS_DELTA_FLAGS
+};
+
 enum {
 	SS_USER_DATA_FLAG_NUMBER		= 1 << 0,
 	SS_USER_DATA_FLAG_RECT			= 1 << 1,
@@ -601,566 +971,3137 @@ enum {
 
 
 /**
- * SSPlayer
+ * SSPartFrame
+ * 1パーツ分のフレーム情報. 省略された要素には既定値が入ります.
  */
 
-SSPlayer::SSPlayer(void)
-	: m_ssDataHandle(0)
-	, m_imageList(0)
-	, m_frameSkipEnabled(true)
-	, m_delegate(0)
-	, m_playEndTarget(NULL)
-	, m_playEndSelector(NULL)
-	, m_batch(0)
-	, m_ssPlayerScaleX( 1.0f )
-	, m_ssPlayerScaleY( 1.0f )
-	, m_ssPlayerFlipX( false )
-	, m_ssPlayerFlipY( false )
-	, m_integerPositionEnabled(false)
+struct SSPartFrame
 {
-}
+	ss_u32		flags;
+	int			sx, sy, sw, sh;
+	int			rectNo;					// 参照元の範囲の表での番号. 表を使わないときは-1
+	float		dx, dy;
+	int			ox, oy;
+	float		rotation;
+	float		scaleX, scaleY;
+	int			opacity;
+	int			vertexOffsets[4][2];	// TL, TR, BL, BR
+	int			colorBlendFuncNo;
+	ccColor4B	colors[4];				// TL, TR, BL, BR
+};
 
-SSPlayer* SSPlayer::create()
-{
-	SSPlayer* player = new SSPlayer();
-	if (player && player->init())
-	{
-		player->autorelease();
-		return player;
-	}
-	CC_SAFE_DELETE(player);
-	return NULL;
-}
-	
-SSPlayer* SSPlayer::create(const SSData* ssData, SSImageList* imageList, int loop)
+
+
+/**
+ * フレームデータのチャンクを展開します. コンバータの圧縮形式に対応します.
+ * データが壊れているときはfalseを返します.
+ * コンバータのcompression::decompress（Compression.cpp）と同じ処理なので、形式を変えるときは両方を揃えてください.
+ */
+
+static bool decompressFrameChunk(const unsigned char* ip, size_t size, unsigned char* op, size_t outSize)
 {
-	SSPlayer* player = create();
-	if (player)
+	static const size_t MIN_MATCH = 4;
+
+	const unsigned char* const iend = ip + size;
+	unsigned char* const ostart = op;
+	unsigned char* const oend = op + outSize;
+
+	while (ip < iend)
 	{
-		player->setAnimation(ssData, imageList, loop);
+		unsigned int token = *ip++;
+
+		// リテラル長. 15のときは255が続く間、後続のバイトを加算する
+		size_t literalLength = token >> 4;
+		if (literalLength == 15)
+		{
+			unsigned char b;
+			do
+			{
+				if (ip >= iend) return false;
+				b = *ip++;
+				literalLength += b;
+			} while (b == 255);
+		}
+		if (literalLength > static_cast<size_t>(iend - ip) || literalLength > static_cast<size_t>(oend - op)) return false;
+		std::memcpy(op, ip, literalLength);
+		ip += literalLength;
+		op += literalLength;
+
+		// 最後のシーケンスはリテラルのみ
+		if (ip >= iend) break;
+
+		if (iend - ip < 2) return false;
+		size_t offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if (offset == 0 || offset > static_cast<size_t>(op - ostart)) return false;
+
+		size_t matchLength = token & 15;
+		if (matchLength == 15)
+		{
+			unsigned char b;
+			do
+			{
+				if (ip >= iend) return false;
+				b = *ip++;
+				matchLength += b;
+			} while (b == 255);
+		}
+		matchLength += MIN_MATCH;
+		if (matchLength > static_cast<size_t>(oend - op)) return false;
+
+		// 重なりがあり得るので1バイトずつコピーする
+		const unsigned char* match = op - offset;
+		for (size_t i = 0; i < matchLength; i++) *op++ = *match++;
 	}
-	return player;
+	return op == oend;
 }
 
-SSPlayer::~SSPlayer()
-{
-	this->unscheduleUpdate();
-	clearAnimation();
-	releaseParts();
-	
-}
 
-bool SSPlayer::init()
-{
-    if ( !CCSprite::init() )
-    {
-        return false;
-    }
 
-	return true;
-}
+/**
+ * SSFrameChunkCache
+ * 圧縮されたフレームデータのチャンクを必要になったときに展開し、最近使ったものを保持します.
+ */
 
-void SSPlayer::allocParts(int numParts, bool useCustomShaderProgram)
+class SSFrameChunkCache
 {
-	//BatchNodeの数はパーツ数ではなく、構造によって変わってくるので、setFrameメソッドで動的に行う
-	//ここではインスタンスは生成せず、削除のみを行う
-	//パーツ数が同じでも構造が違えばBatchNodeの数は変わってくるので、
-	//以前のパーツ数に関わらず子要素を全て削除する
-	this->removeAllChildrenWithCleanup(true);
-	if (m_partStates.count() != numParts)
+public:
+	SSFrameChunkCache(const SSDataHandle* dataHandle)
+		: m_dataHandle(dataHandle)
+		, m_entries(FRAME_CHUNK_CACHE_SIZE)
+		, m_useCount(0)
 	{
-		// 既存パーツ解放
-		// release old parts.
-		m_partStates.removeAllObjects();
+	}
 
-		m_jointSprites.removeAllObjects();
-		m_batchSprites.removeAllObjects();
+	/** 展開したチャンクの先頭アドレスを返します.
+	 *  チャンクが壊れていて展開できないときはNULLを返します.
+	 */
+	const char* getChunk(int chunkNo)
+	{
+		CCAssert(chunkNo >= 0 && chunkNo < m_dataHandle->getNumChunks(), "chunkNo is out of range.");
 
-		// パーツ数だけSPartStateを作成する
-		// create SSPartState objects.
-		for (int i = 0; i < numParts; i++)
+		Entry* lru = &m_entries[0];
+		for (size_t i = 0; i < m_entries.size(); i++)
 		{
-			SSPartState* state = new SSPartState();
-			m_partStates.addObject(state);
+			Entry& entry = m_entries[i];
+			if (entry.chunkNo == chunkNo)
+			{
+				entry.lastUsed = ++m_useCount;
+				return entry.valid && !entry.data.empty() ? &entry.data[0] : NULL;
+			}
+			if (entry.lastUsed < lru->lastUsed) lru = &entry;
 		}
+
+		// 最も長く使われていないエントリへ展開する
+		const SSFrameChunk& chunk = m_dataHandle->getFrameChunks()[chunkNo];
+		lru->chunkNo = -1;
+		lru->data.resize(chunk.size);
+		bool result = decompressFrameChunk(
+			static_cast<const unsigned char*>(m_dataHandle->getAddress(chunk.data)), chunk.compressedSize,
+			reinterpret_cast<unsigned char*>(lru->data.empty() ? NULL : &lru->data[0]), chunk.size);
+		CCAssert(result, "Frame chunk is broken.");
+
+		// 壊れたチャンクも展開できなかったことを覚えておき、毎回展開し直さないようにする
+		lru->chunkNo = chunkNo;
+		lru->lastUsed = ++m_useCount;
+		lru->valid = result;
+		return lru->valid && !lru->data.empty() ? &lru->data[0] : NULL;
 	}
-	else
+
+private:
+	struct Entry
 	{
-		// SPartState初期化
-		// initialize SPartState objects.
-		for (int i = 0; i < numParts; i++)
-		{
-			SSPartState* partState = static_cast<SSPartState*>( m_partStates.objectAtIndex(i) );
-			partState->init();
-		}
-	}
-}
+		int					chunkNo;
+		unsigned int		lastUsed;
+		bool				valid;		// 展開できたか
+		std::vector<char>	data;
 
-void SSPlayer::releaseParts()
-{
-	// パーツの子CCSpriteを全て削除
-	// remove children CCSprite objects.
-	this->removeAllChildrenWithCleanup(true);
-	// パーツステートオブジェクトを全て削除
-	// remove parts status objects.
-	m_partStates.removeAllObjects();
-	
-	m_jointSprites.removeAllObjects();
-	m_batchSprites.removeAllObjects();
-}
+		Entry() : chunkNo(-1), lastUsed(0), valid(false) {}
+	};
 
-bool SSPlayer::hasAnimation() const
-{
-	return m_ssDataHandle != 0;
-}
+	const SSDataHandle*		m_dataHandle;
+	std::vector<Entry>		m_entries;
+	unsigned int			m_useCount;
+};
 
-void SSPlayer::clearAnimation()
-{
-	if (!hasAnimation()) return;
 
-	CC_SAFE_DELETE(m_ssDataHandle);
-	m_imageList->release();
-	m_imageList = 0;
-}
 
-void SSPlayer::setAnimation(const SSData* ssData, SSImageList* imageList, int loop)
-{
-	CCAssert(ssData != NULL, "zero is ssData pointer");
-	CCAssert(imageList != NULL, "zero is imageList pointer");
+/**
+ * SSCurveEvaluator
+ * カーブ形式のデータから、コンバータと同じ計算で各パーツのフレーム情報を求めます.
+ * キーフレームの補間、親パーツからの継承、描画順のソートを行います.
+ */
 
-	this->unscheduleUpdate();//既存のSSPlayerに別のSSDataを読みこませようとすると落ちるので追加
-	clearAnimation();
+enum {
+	SS_CURVE_TAG_POSX = 1,
+	SS_CURVE_TAG_POSY,
+	SS_CURVE_TAG_ANGL,
+	SS_CURVE_TAG_SCAX,
+	SS_CURVE_TAG_SCAY,
+	SS_CURVE_TAG_TRAN,
+	SS_CURVE_TAG_PRIO,
+	SS_CURVE_TAG_FLPH,
+	SS_CURVE_TAG_FLPV,
+	SS_CURVE_TAG_HIDE,
+	SS_CURVE_TAG_IMGX,
+	SS_CURVE_TAG_IMGY,
+	SS_CURVE_TAG_IMGW,
+	SS_CURVE_TAG_IMGH,
+	SS_CURVE_TAG_ORFX,
+	SS_CURVE_TAG_ORFY,
+	SS_CURVE_TAG_PCOL,
+	SS_CURVE_TAG_PALT,
+	SS_CURVE_TAG_VERT,
+
+	NUM_SS_CURVE_FLOAT_TAGS = SS_CURVE_TAG_ORFY + 1
+};
 
-	SSDataHandle* dataHandle = new SSDataHandle(ssData);
+enum {
+	SS_CURVE_TYPE_NONE,
+	SS_CURVE_TYPE_LINEAR,
+	SS_CURVE_TYPE_HERMITE,
+	SS_CURVE_TYPE_BEZIER
+};
 
-	// パーツアロケート
-	// allocate parts.
-	bool useCustomShaderProgram = (dataHandle->getFlags() & SS_DATA_FLAG_USE_COLOR_BLEND) != 0;
-	allocParts(dataHandle->getNumParts(), useCustomShaderProgram);
+enum {
+	SS_CURVE_PART_TYPE_NORMAL,
+	SS_CURVE_PART_TYPE_ROOT,
+	SS_CURVE_PART_TYPE_NULL,
+	SS_CURVE_PART_TYPE_HIT_TEST,
+	SS_CURVE_PART_TYPE_SOUND
+};
 
-	// アニメーションパラメータ初期化
-	// initialize animation parameters.
-	m_ssDataHandle = dataHandle;
-	imageList->retain();
-	m_imageList = imageList;
+enum {
+	SS_CURVE_COLOR_TYPE_NONE,
+	SS_CURVE_COLOR_TYPE_PARTS,
+	SS_CURVE_COLOR_TYPE_VERTEX
+};
 
-	m_playingFrame = 0.0f;
-	m_step = 1.0f;
-	m_loop = loop;
-	m_loopCount = 0;
+enum {
+	SS_CURVE_BLEND_VOID,
+	SS_CURVE_BLEND_MIX,
+	SS_CURVE_BLEND_MULTIPLE,
+	SS_CURVE_BLEND_ADD,
+	SS_CURVE_BLEND_SUBTRACT
+};
 
-	if (!m_batch)
+class SSCurveEvaluator
+{
+public:
+	SSCurveEvaluator(const SSDataHandle* dataHandle)
+		: m_dataHandle(dataHandle)
+		, m_nodes(dataHandle->getCurveNodes())
+		, m_params((dataHandle->getFlags() & SS_DATA_FLAG_CURVES) ? dataHandle->getNumParts() : 0)
 	{
-		setFrame(0);
-		this->scheduleUpdate();
+		m_inheritEnabled = (dataHandle->getFlags() & SS_DATA_FLAG_USE_AFFINE_TRANS) == 0;
 	}
-}
-
-const SSData* SSPlayer::getAnimation() const
-{
-	return m_ssDataHandle->getData();
-}
 
-void SSPlayer::update(float dt)
-{
-	if (!m_batch)
+	/** 指定フレームの各パーツのフレーム情報を求め、描画順のパーツNoをorderに格納します.
+	 */
+	void evaluate(int frameNo, std::vector<SSPartFrame>& partFrames, std::vector<int>& order)
 	{
-		updateFrame(dt);
+		const SSPartData* partData = m_dataHandle->getPartData();
+		const int numParts = m_dataHandle->getNumParts();
+		Param rootParam;
+		rootParam.clear();
+
+		// 親は必ず子より前に並んでいるため、先頭から順に求めれば親の値は確定している
+		m_decoded.clear();
+		for (int i = 0; i < numParts; i++)
+		{
+			const SSCurveNode& node = m_nodes[i];
+			Param& param = m_params[i];
+			param.clear();
+			if (frameNo < node.firstFrameNo) continue;
+
+			param.decoded = true;
+			param.id = partData[i].id;
+			decodeNode(param, node, frameNo);
+
+			if (m_inheritEnabled)
+			{
+				const Param& parentParam = (node.parentIndex >= 0) ? m_params[node.parentIndex] : rootParam;
+				calcInheritance(param, parentParam, node);
+			}
+			m_decoded.push_back(i);
+		}
+
+		// 優先順位、パーツIDの順に並べる
+		std::sort(m_decoded.begin(), m_decoded.end(), PriorityComparator(m_params));
+
+		order.clear();
+		for (size_t i = 0; i < m_decoded.size(); i++)
+		{
+			int index = m_decoded[i];
+			const Param& param = m_params[index];
+			const SSCurveNode& node = m_nodes[index];
+
+			// 継承を計算したときは、表示されないパーツを除く
+			bool invisible = isInvisible(param, node);
+			if (m_inheritEnabled && invisible) continue;
+
+			makePartFrame(partFrames[param.id], param, node, invisible);
+			order.push_back(param.id);
+		}
 	}
-}
 
-void SSPlayer::updateFrame(float dt)
-{
-	if (!hasAnimation()) return;
-	
-	bool playEnd = false;
-	if (m_loop == 0 || m_loopCount < m_loop)
+private:
+	struct InheritPercent
 	{
-		// フレームを進める.
-		// forward frame.
-		const int numFrames = m_ssDataHandle->getNumFrames();
+		bool	isSet;
+		float	percent;
 
-		float fdt = m_frameSkipEnabled ? dt : CCDirector::sharedDirector()->getAnimationInterval();
-		float s = fdt / (1.0f / m_ssDataHandle->getFps());
-		
-		//if (!m_frameSkipEnabled) CCLOG("%f", s);
-		
-		float next = m_playingFrame + (s * m_step);
+		void reset()			{ isSet = false; percent = 0; }
+		void set(float value)	{ isSet = true; percent = value; }
+	};
 
-		int nextFrameNo = static_cast<int>(next);
-		float nextFrameDecimal = next - static_cast<float>(nextFrameNo);
-		int currentFrameNo = static_cast<int>(m_playingFrame);
-		
-		if (m_step >= 0)
+	/** 1パーツ分のアトリビュートの値 */
+	struct Param
+	{
+		bool			decoded;
+		int				id;
+		float			values[NUM_SS_CURVE_FLOAT_TAGS];
+		InheritPercent	inheritPercents[NUM_SS_CURVE_FLOAT_TAGS];
+		int				vert[4][2];
+		int				colorType;
+		int				colorBlend;
+		ss_u32			colors[4];		// ARGB
+
+		void clear()
 		{
-			// 順再生時.
-			// normal plays.
-			for (int c = nextFrameNo - currentFrameNo; c; c--)
+			static const float defaultValues[NUM_SS_CURVE_FLOAT_TAGS] = {
+				0,
+				0, 0, 0, 1, 1, 1,		// POSX, POSY, ANGL, SCAX, SCAY, TRAN
+				0, 0, 0, 0,				// PRIO, FLPH, FLPV, HIDE
+				0, 0, 0, 0, 0, 0		// IMGX, IMGY, IMGW, IMGH, ORFX, ORFY
+			};
+
+			decoded = false;
+			id = 0;
+			for (int tag = 0; tag < NUM_SS_CURVE_FLOAT_TAGS; tag++)
 			{
-				int incFrameNo = currentFrameNo + 1;
-				if (incFrameNo >= numFrames)
-				{
-					// アニメが一巡
-					// turned animation.
-					m_loopCount += 1;
-					if (m_loop && m_loopCount >= m_loop)
-					{
-						// 再生終了.
-						// play end.
-						playEnd = true;
-						break;
-					}
-					
-					incFrameNo = 0;
-				}
-				currentFrameNo = incFrameNo;
-
-				// このフレームのユーザーデータをチェック
-				// check the user data of this frame.
-				checkUserData(currentFrameNo);
+				values[tag] = defaultValues[tag];
+				inheritPercents[tag].reset();
+				if (tag >= SS_CURVE_TAG_POSX && tag <= SS_CURVE_TAG_TRAN) inheritPercents[tag].set(100);
+				if (tag >= SS_CURVE_TAG_FLPH && tag <= SS_CURVE_TAG_HIDE) inheritPercents[tag].set(0);
 			}
+			std::memset(vert, 0, sizeof(vert));
+			colorType = SS_CURVE_COLOR_TYPE_NONE;
+			colorBlend = SS_CURVE_BLEND_VOID;
+			std::memset(colors, 0, sizeof(colors));
 		}
-		else
+	};
+
+	class PriorityComparator
+	{
+		const std::vector<Param>&	m_params;
+	public:
+		PriorityComparator(const std::vector<Param>& params) : m_params(params) {}
+
+		bool operator()(int lhs, int rhs) const
 		{
-			// 逆再生時.
-			// reverse play.
-			for (int c = currentFrameNo - nextFrameNo; c; c--)
+			float lprio = m_params[lhs].values[SS_CURVE_TAG_PRIO];
+			float rprio = m_params[rhs].values[SS_CURVE_TAG_PRIO];
+			if (lprio <  rprio) return true;
+			if (lprio == rprio && m_params[lhs].id < m_params[rhs].id) return true;
+			return false;
+		}
+	};
+
+	static float toFloat(ss_u32 value)
+	{
+		float f;
+		std::memcpy(&f, &value, sizeof(f));
+		return f;
+	}
+
+	/** 指定フレーム以前と以後のキーを探します. 見つからないときはNULLを返します. */
+	void findKeys(const SSCurveAttribute& attr, int frameNo, const SSCurveKey*& forward, const SSCurveKey*& backward) const
+	{
+		const SSCurveKey* keys = static_cast<const SSCurveKey*>(m_dataHandle->getAddress(attr.keys));
+		int first = 0;
+		int last = attr.numKeys;
+		while (first < last)
+		{
+			int mid = (first + last) / 2;
+			if (keys[mid].frameNo < frameNo) first = mid + 1;
+			else last = mid;
+		}
+
+		if (first < attr.numKeys && keys[first].frameNo == frameNo)
+		{
+			forward = backward = &keys[first];
+			return;
+		}
+		forward = (first > 0) ? &keys[first - 1] : NULL;
+		backward = (first < attr.numKeys) ? &keys[first] : NULL;
+	}
+
+	static float calcTimeRatio(int forwardFrameNo, int backwardFrameNo, int frameNo)
+	{
+		float r = static_cast<float>(frameNo - forwardFrameNo) / static_cast<float>(backwardFrameNo - forwardFrameNo);
+		if (r < 0.0f) r = 0.0f;
+		if (r > 1.0f) r = 1.0f;
+		return r;
+	}
+
+	/** 前後のキーから補間値を求めます. 計算はコンバータと同じです. */
+	float calcCurve(const SSCurveKey& forward, const SSCurveKey& backward, float ratio, float forwardValue, float backwardValue) const
+	{
+		switch (forward.curveType)
+		{
+		case SS_CURVE_TYPE_LINEAR:
+			return (backwardValue - forwardValue) * ratio + forwardValue;
+
+		case SS_CURVE_TYPE_HERMITE:
 			{
-				int decFrameNo = currentFrameNo - 1;
-				if (decFrameNo < 0)
+				const float* params = static_cast<const float*>(m_dataHandle->getAddress(forward.curve));
+				const float fTemp1 = ratio;
+				const float fTemp2 = fTemp1 * fTemp1;
+				const float fTemp3 = fTemp2 * fTemp1;
+				return (2 * fTemp3 - 3 * fTemp2 + 1) * forwardValue +
+					(-2 * fTemp3 + 3 * fTemp2) * backwardValue +
+					(fTemp3 - 2 * fTemp2 + fTemp1) * (params[1] - forwardValue) +
+					(fTemp3 - fTemp2) * (params[3] - backwardValue);
+			}
+
+		case SS_CURVE_TYPE_BEZIER:
+			{
+				const float* params = static_cast<const float*>(m_dataHandle->getAddress(forward.curve));
+				const int forwardFrameNo = forward.frameNo;
+				const int backwardFrameNo = backward.frameNo;
+				const float fCurrentPos = (backwardFrameNo - forwardFrameNo) * ratio + forwardFrameNo;
+				float fCurrent = 0.5f;
+				float fCalcRange = 0.5f;
+				float fTemp1, fTemp2, fTemp3;
+
+				for (int iLoop = 0; iLoop < 8; iLoop++)
 				{
-					// アニメが一巡
-					// turned animation.
-					m_loopCount += 1;
-					if (m_loop && m_loopCount >= m_loop)
-					{
-						// 再生終了.
-						// play end.
-						playEnd = true;
-						break;
-					}
-				
-					decFrameNo = numFrames - 1;
+					fTemp1 = 1.0f - fCurrent;
+					fTemp2 = fTemp1 * fTemp1;
+					fTemp3 = fTemp2 * fTemp1;
+					float x = (fTemp3 * forwardFrameNo) +
+						(3 * fTemp2 * fCurrent * (params[0] + forwardFrameNo)) +
+						(3 * fTemp1 * fCurrent * fCurrent * (params[2] + backwardFrameNo)) +
+						(fCurrent * fCurrent * fCurrent * backwardFrameNo);
+
+					fCalcRange *= 0.5f;
+					if (x > fCurrentPos) fCurrent -= fCalcRange;
+					else fCurrent += fCalcRange;
 				}
-				currentFrameNo = decFrameNo;
-				
-				// このフレームのユーザーデータをチェック
-				// check the user data of this frame.
-				checkUserData(currentFrameNo);
+
+				fTemp1 = 1.0f - fCurrent;
+				fTemp2 = fTemp1 * fTemp1;
+				fTemp3 = fTemp2 * fTemp1;
+				return (fTemp3 * forwardValue) +
+					(3 * fTemp2 * fCurrent * (params[1] + forwardValue)) +
+					(3 * fTemp1 * fCurrent * fCurrent * (params[3] + backwardValue)) +
+					(fCurrent * fCurrent * fCurrent * backwardValue);
 			}
+
+		default:
+			return forwardValue;
 		}
-		
-		m_playingFrame = static_cast<float>(currentFrameNo) + nextFrameDecimal;
 	}
 
-	setFrame(getFrameNo());
+	static int clipColor(float value)
+	{
+		int v = static_cast<int>(value + 0.5f);
+		return v <= 0 ? 0 : (v >= 255 ? 255 : v);
+	}
 
-	if (playEnd && m_playEndTarget)
+	void decodeFloat(Param& param, const SSCurveAttribute& attr, int frameNo) const
 	{
-		(m_playEndTarget->*m_playEndSelector)(this);
+		const SSCurveKey* forward;
+		const SSCurveKey* backward;
+		findKeys(attr, frameNo, forward, backward);
+
+		float& value = param.values[attr.tag];
+		if (!forward)
+		{
+			// タイムラインが始まるまでは常に非表示にする
+			if (attr.tag == SS_CURVE_TAG_HIDE) value = 1.0f;
+			else if (backward) value = toFloat(backward->value);
+		}
+		else if (!backward || forward == backward)
+		{
+			value = toFloat(forward->value);
+		}
+		else
+		{
+			float ratio = calcTimeRatio(forward->frameNo, backward->frameNo, frameNo);
+			value = calcCurve(*forward, *backward, ratio, toFloat(forward->value), toFloat(backward->value));
+		}
 	}
-}
 
-int SSPlayer::getFrameNo() const
-{
-	return static_cast<int>(m_playingFrame);
-}
+	void decodeVertex(Param& param, const SSCurveAttribute& attr, int frameNo) const
+	{
+		const SSCurveKey* forward;
+		const SSCurveKey* backward;
+		findKeys(attr, frameNo, forward, backward);
 
-void SSPlayer::setFrameNo(int frameNo)
-{
-	m_playingFrame = frameNo;
-}
+		const SSCurveKey* key = forward ? forward : backward;
+		if (!key) return;
 
-float SSPlayer::getStep() const
-{
-	return m_step;
-}
+		const SSCurveVertex4* forwardValue = static_cast<const SSCurveVertex4*>(m_dataHandle->getAddress(key->value));
+		if (!forward || !backward || forward == backward)
+		{
+			for (int v = 0; v < 4; v++)
+			{
+				param.vert[v][0] = forwardValue->v[v][0];
+				param.vert[v][1] = forwardValue->v[v][1];
+			}
+			return;
+		}
 
-void SSPlayer::setStep(float step)
-{
-	m_step = step;
-}
+		const SSCurveVertex4* backwardValue = static_cast<const SSCurveVertex4*>(m_dataHandle->getAddress(backward->value));
+		float ratio = calcTimeRatio(forward->frameNo, backward->frameNo, frameNo);
+		for (int v = 0; v < 4; v++)
+		{
+			for (int c = 0; c < 2; c++)
+			{
+				param.vert[v][c] = static_cast<int>(calcCurve(*forward, *backward, ratio,
+					static_cast<float>(forwardValue->v[v][c]), static_cast<float>(backwardValue->v[v][c])));
+			}
+		}
+	}
 
-int SSPlayer::getLoop() const
-{
-	return m_loop;
-}
+	void decodeColorBlend(Param& param, const SSCurveAttribute& attr, int frameNo) const
+	{
+		const SSCurveKey* forward;
+		const SSCurveKey* backward;
+		findKeys(attr, frameNo, forward, backward);
 
-void SSPlayer::setLoop(int loop)
-{
-	if (loop < 0) return;
-	m_loop = loop;
-}
+		const SSCurveKey* key = forward ? forward : backward;
+		if (!key) return;
 
-int SSPlayer::getLoopCount() const
-{
-	return m_loopCount;
-}
+		const SSCurveColorBlend* forwardValue = static_cast<const SSCurveColorBlend*>(m_dataHandle->getAddress(key->value));
+		if (!forward || !backward || forward == backward)
+		{
+			param.colorType = forwardValue->type;
+			param.colorBlend = forwardValue->blend;
+			for (int v = 0; v < 4; v++) param.colors[v] = forwardValue->colors[v];
+			return;
+		}
 
-void SSPlayer::clearLoopCount()
-{
-	m_loopCount = 0;
-}
+		const SSCurveColorBlend* backwardValue = static_cast<const SSCurveColorBlend*>(m_dataHandle->getAddress(backward->value));
+		float ratio = calcTimeRatio(forward->frameNo, backward->frameNo, frameNo);
 
-void SSPlayer::setFrameSkipEnabled(bool enabled)
-{
-	m_frameSkipEnabled = enabled;
-	m_playingFrame = (int)m_playingFrame;
-}
-	
-bool SSPlayer::isFrameSkipEnabled() const
-{
-	return m_frameSkipEnabled;
-}
-
-void SSPlayer::setIntegerPositionEnabled(bool enabled)
-{
-	m_integerPositionEnabled = enabled;
-}
-
-bool SSPlayer::isIntegerPositionEnabled() const
-{
-	return m_integerPositionEnabled;
-}
-
-void SSPlayer::setDelegate(SSPlayerDelegate* delegate)
-{
-	m_delegate = delegate;
-}
+		param.colorBlend = forwardValue->blend;
+		if (forwardValue->type == SS_CURVE_COLOR_TYPE_NONE && backwardValue->type == SS_CURVE_COLOR_TYPE_NONE)
+		{
+			param.colorType = SS_CURVE_COLOR_TYPE_NONE;
+		}
+		else if (forwardValue->type == SS_CURVE_COLOR_TYPE_VERTEX || backwardValue->type == SS_CURVE_COLOR_TYPE_VERTEX)
+		{
+			param.colorType = SS_CURVE_COLOR_TYPE_VERTEX;
+		}
+		else
+		{
+			param.colorType = SS_CURVE_COLOR_TYPE_PARTS;
+		}
 
-void SSPlayer::setPlayEndCallback(CCObject* target, SEL_PlayEndHandler selector)
-{
-	CC_SAFE_RELEASE(m_playEndTarget);
-	CC_SAFE_RETAIN(target);
-	m_playEndTarget = target;
-	m_playEndSelector = selector;
-}
+		// 色の指定が無い側は、もう一方の色のまま補間する. αは常に前後の値で補間する
+		const ss_u32* rgbFrom = forwardValue->colors;
+		const ss_u32* rgbTo = backwardValue->colors;
+		if (forwardValue->type == SS_CURVE_COLOR_TYPE_NONE) rgbFrom = backwardValue->colors;
+		else if (backwardValue->type == SS_CURVE_COLOR_TYPE_NONE) rgbTo = forwardValue->colors;
+		for (int v = 0; v < 4; v++)
+		{
+			ss_u32 color = 0;
+			for (int shift = 0; shift < 24; shift += 8)
+			{
+				float from = static_cast<float>((rgbFrom[v] >> shift) & 0xff);
+				float to = static_cast<float>((rgbTo[v] >> shift) & 0xff);
+				color |= clipColor(calcCurve(*forward, *backward, ratio, from, to)) << shift;
+			}
+			float fromAlpha = static_cast<float>(forwardValue->colors[v] >> 24);
+			float toAlpha = static_cast<float>(backwardValue->colors[v] >> 24);
+			color |= static_cast<ss_u32>(clipColor(calcCurve(*forward, *backward, ratio, fromAlpha, toAlpha))) << 24;
+			param.colors[v] = color;
+		}
+	}
 
-bool SSPlayer::getPartState(SSPlayer::PartState& result, const char* name)
-{
-	if (hasAnimation())
+	void decodeNode(Param& param, const SSCurveNode& node, int frameNo) const
 	{
-		int index = m_ssDataHandle->indexOfPart(name);
-		if (index >= 0 && index < static_cast<int>(m_partStates.count()))
+		const SSCurveAttribute* attributes = static_cast<const SSCurveAttribute*>(m_dataHandle->getAddress(node.attributes));
+		for (int i = 0; i < node.numAttributes; i++)
 		{
-			const SSPartState* partState = static_cast<SSPartState*>( m_partStates.objectAtIndex(index) );
-			partState->copyParameters(result);
-			return true;
+			const SSCurveAttribute& attr = attributes[i];
+			if (attr.tag < NUM_SS_CURVE_FLOAT_TAGS)
+			{
+				decodeFloat(param, attr, frameNo);
+				param.inheritPercents[attr.tag].isSet = attr.hasInheritPercent != 0;
+				param.inheritPercents[attr.tag].percent = attr.hasInheritPercent ? attr.inheritPercent : 0;
+			}
+			else if (attr.tag == SS_CURVE_TAG_VERT)
+			{
+				decodeVertex(param, attr, frameNo);
+			}
+			else if (attr.tag == SS_CURVE_TAG_PCOL)
+			{
+				decodeColorBlend(param, attr, frameNo);
+			}
 		}
 	}
-	return false;
-}
 
-void SSPlayer::setFrame(int frameNo)
-{
-	setChildVisibleAll(false);
-
-	// αブレンドでmix以外を使用、カラーブレンド、頂点変形が必要なものはバッチノードを使わず描画する
-	bool useCustomSprite = (m_ssDataHandle->getFlags() & (SS_DATA_FLAG_USE_ALPHA_BLEND | SS_DATA_FLAG_USE_COLOR_BLEND | SS_DATA_FLAG_USE_VERTEX_OFFSET)) != 0;
-	// カラーブレンドはカスタムシェーダーを使用する
-	bool useCustomShaderProgram = (m_ssDataHandle->getFlags() & SS_DATA_FLAG_USE_COLOR_BLEND) != 0;
-	// アフィン変換の有無
-	bool useAffineTransformation = (m_ssDataHandle->getFlags() & SS_DATA_FLAG_USE_AFFINE_TRANS) != 0;
+	/** 親パーツの値を継承します. */
+	static void calcInheritance(Param& param, const Param& parentParam, const SSCurveNode& node)
+	{
+		// 個別指定が無ければ親の継承設定を使う
+		static const int inheritTags[] = {
+			SS_CURVE_TAG_POSX, SS_CURVE_TAG_POSY, SS_CURVE_TAG_ANGL, SS_CURVE_TAG_SCAX, SS_CURVE_TAG_SCAY,
+			SS_CURVE_TAG_TRAN, SS_CURVE_TAG_FLPH, SS_CURVE_TAG_FLPV, SS_CURVE_TAG_HIDE
+		};
+		for (size_t i = 0; i < sizeof(inheritTags) / sizeof(inheritTags[0]); i++)
+		{
+			int tag = inheritTags[i];
+			if (node.inheritEach)
+			{
+				if (tag >= SS_CURVE_TAG_TRAN && !param.inheritPercents[tag].isSet) param.inheritPercents[tag].set(0);
+			}
+			else
+			{
+				param.inheritPercents[tag] = parentParam.inheritPercents[tag];
+			}
+		}
 
+		float* values = param.values;
+		const float* parentValues = parentParam.values;
+		float x = values[SS_CURVE_TAG_POSX];
+		float y = values[SS_CURVE_TAG_POSY];
 
-	const SSFrameData* frameData = &(m_ssDataHandle->getFrameData()[frameNo]);
-	size_t numParts = static_cast<size_t>(frameData->numParts);
-	SSDataReader r( static_cast<const ss_u16*>( m_ssDataHandle->getAddress(frameData->partFrameData)) );
-	int nodeIndex = 0;//SSPlayerの子要素のCCSpriteBatchNodeのインデックス
-	int spriteIndex = 0;//CCSpriteBatchNodeの子要素のスプライトのIndex
+		if (isInherit(param, SS_CURVE_TAG_SCAX)) x *= parentValues[SS_CURVE_TAG_SCAX];
+		if (isInherit(param, SS_CURVE_TAG_SCAY)) y *= parentValues[SS_CURVE_TAG_SCAY];
 
+		if (isInherit(param, SS_CURVE_TAG_ANGL) && parentValues[SS_CURVE_TAG_ANGL] != 0)
+		{
+			double a = parentValues[SS_CURVE_TAG_ANGL] * -1;
+			double asin = std::sin(a);
+			double acos = std::cos(a);
+			float rx = static_cast<float>( x * acos - y * asin );
+			float ry = static_cast<float>( x * asin + y * acos );
+			x = rx;
+			y = ry;
+		}
 
-	CCNode* parentNode = NULL;
-	CCSprite* jointNode = NULL;
-	int jointNodeIndex = -1;
-	bool jointToParentBatchNode = false;
-	
-	if (m_batch)
-	{
-		for (size_t i = 0; i < m_jointSprites.count(); i++)
+		if (isInherit(param, SS_CURVE_TAG_POSX)) values[SS_CURVE_TAG_POSX] = parentValues[SS_CURVE_TAG_POSX] + x;
+		if (isInherit(param, SS_CURVE_TAG_POSY)) values[SS_CURVE_TAG_POSY] = parentValues[SS_CURVE_TAG_POSY] + y;
+		if (isInherit(param, SS_CURVE_TAG_ANGL)) values[SS_CURVE_TAG_ANGL] += parentValues[SS_CURVE_TAG_ANGL];
+		if (isInherit(param, SS_CURVE_TAG_FLPH))
+		{
+			values[SS_CURVE_TAG_FLPH] = static_cast<float>(static_cast<int>(values[SS_CURVE_TAG_FLPH]) ^ static_cast<int>(parentValues[SS_CURVE_TAG_FLPH]));
+		}
+		if (isInherit(param, SS_CURVE_TAG_FLPV))
 		{
-			CCNode* jointNode = (CCNode*)m_jointSprites.objectAtIndex(i);
-			jointNode->removeAllChildrenWithCleanup(false);
+			values[SS_CURVE_TAG_FLPV] = static_cast<float>(static_cast<int>(values[SS_CURVE_TAG_FLPV]) ^ static_cast<int>(parentValues[SS_CURVE_TAG_FLPV]));
 		}
+		if (isInherit(param, SS_CURVE_TAG_SCAX)) values[SS_CURVE_TAG_SCAX] *= parentValues[SS_CURVE_TAG_SCAX];
+		if (isInherit(param, SS_CURVE_TAG_SCAY)) values[SS_CURVE_TAG_SCAY] *= parentValues[SS_CURVE_TAG_SCAY];
+		if (isInherit(param, SS_CURVE_TAG_HIDE)) values[SS_CURVE_TAG_HIDE] = parentValues[SS_CURVE_TAG_HIDE];
+		if (isInherit(param, SS_CURVE_TAG_TRAN)) values[SS_CURVE_TAG_TRAN] *= parentValues[SS_CURVE_TAG_TRAN];
 	}
 
+	static bool isInherit(const Param& param, int tag)
+	{
+		return param.inheritPercents[tag].isSet && param.inheritPercents[tag].percent != 0;
+	}
 
-	for (size_t i = 0; i < numParts; i++)
+	static bool isInvisible(const Param& param, const SSCurveNode& node)
 	{
-		unsigned int flags = r.readU32();
-		ss_u16 partNo = r.readU16();
-		int sx = r.readS16();
-		int sy = r.readS16();
-		int sw = r.readS16();
-		int sh = r.readS16();
-		float dx = r.readFloat();
-		float dy = r.readFloat();
+		return param.values[SS_CURVE_TAG_HIDE] != 0
+			|| param.values[SS_CURVE_TAG_TRAN] == 0
+			|| node.type == SS_CURVE_PART_TYPE_ROOT
+			|| node.type == SS_CURVE_PART_TYPE_HIT_TEST
+			|| node.type == SS_CURVE_PART_TYPE_SOUND;
+	}
 
-		if (m_integerPositionEnabled)
+	static ccColor4B toColor4B(ss_u32 argb)
+	{
+		ccColor4B color;
+		color.a = static_cast<GLubyte>(argb >> 24);
+		color.r = static_cast<GLubyte>(argb >> 16);
+		color.g = static_cast<GLubyte>(argb >> 8);
+		color.b = static_cast<GLubyte>(argb);
+		return color;
+	}
+
+	/** アトリビュートの値からフレーム情報を作ります. 計算はコンバータと同じです. */
+	static void makePartFrame(SSPartFrame& pf, const Param& param, const SSCurveNode& node, bool invisible)
+	{
+		static const double PI = 3.14159265358979323846;
+		const float* values = param.values;
+
+		int left   = node.picLeft + static_cast<int>(values[SS_CURVE_TAG_IMGX]);
+		int top    = node.picTop  + static_cast<int>(values[SS_CURVE_TAG_IMGY]);
+		int right  = left + node.picWidth  + static_cast<int>(values[SS_CURVE_TAG_IMGW]);
+		int bottom = top  + node.picHeight + static_cast<int>(values[SS_CURVE_TAG_IMGH]);
+		if (right < left) std::swap(left, right);
+		if (bottom < top) std::swap(top, bottom);
+		const int width = right - left;
+		const int height = bottom - top;
+
+		int originX = node.originX + static_cast<int>(values[SS_CURVE_TAG_ORFX]);
+		int originY = height - (node.originY + static_cast<int>(values[SS_CURVE_TAG_ORFY]));
+		const int opacity = static_cast<int>(255 * values[SS_CURVE_TAG_TRAN]);
+		const float angle = values[SS_CURVE_TAG_ANGL] * 180.0f / static_cast<float>(PI);
+
+		ss_u32 flags = 0;
+		if (values[SS_CURVE_TAG_FLPH] != 0)	flags |= SS_PART_FLAG_FLIP_H;
+		if (values[SS_CURVE_TAG_FLPV] != 0)	flags |= SS_PART_FLAG_FLIP_V;
+		if (invisible)						flags |= SS_PART_FLAG_INVISIBLE;
+		if (originX != width / 2)			flags |= SS_PART_FLAG_ORIGIN_X;
+		if (originY != height / 2)			flags |= SS_PART_FLAG_ORIGIN_Y;
+		if (angle != 0)						flags |= SS_PART_FLAG_ROTATION;
+		if (values[SS_CURVE_TAG_SCAX] != 1)	flags |= SS_PART_FLAG_SCALE_X;
+		if (values[SS_CURVE_TAG_SCAY] != 1)	flags |= SS_PART_FLAG_SCALE_Y;
+		if (opacity < 255)					flags |= SS_PART_FLAG_OPACITY;
+
+		for (int v = 0; v < 4; v++)
 		{
-			dx = (int)dx;
-			dy = (int)dy;
+			if (param.vert[v][0] != 0 || param.vert[v][1] != 0) flags |= SS_PART_FLAG_VERTEX_OFFSET_TL << v;
 		}
 
-		int ox = (flags & SS_PART_FLAG_ORIGIN_X) ? r.readS16() : sw / 2;
-		int oy = (flags & SS_PART_FLAG_ORIGIN_Y) ? r.readS16() : sh / 2;
+		if (param.colorBlend != SS_CURVE_BLEND_VOID)
+		{
+			if (param.colorType == SS_CURVE_COLOR_TYPE_PARTS)
+			{
+				if (param.colors[0] >> 24) flags |= SS_PART_FLAG_COLOR;
+			}
+			else if (param.colorType == SS_CURVE_COLOR_TYPE_VERTEX)
+			{
+				for (int v = 0; v < 4; v++)
+				{
+					if (param.colors[v] >> 24) flags |= SS_PART_FLAG_VERTEX_COLOR_TL << v;
+				}
+			}
+		}
 
-		float rotation = (flags & SS_PART_FLAG_ROTATION) ? -r.readFloat() : 0;
-		float scaleX = (flags & SS_PART_FLAG_SCALE_X) ? r.readFloat() : 1.0f;
-		float scaleY = (flags & SS_PART_FLAG_SCALE_Y) ? r.readFloat() : 1.0f;
-		int opacity = (flags & SS_PART_FLAG_OPACITY) ? r.readU16() : 255;
-	
-		SSPartState* partState = static_cast<SSPartState*>( m_partStates.objectAtIndex(partNo) );
-		partState->m_sprite = NULL;
-		
-		// パーツの基本情報を取得
-		const SSPartData* partData = &m_ssDataHandle->getPartData()[partNo];
-		size_t imageNo = partData->imageNo;
-		CCTexture2D* tex = m_imageList->getTexture(imageNo);//このパーツの描画に使用するテクスチャ
-		if(!tex){ continue; }
-		SSPartType partType = static_cast<SSPartType>(partData->type);
+		pf.flags = flags;
+		pf.sx = left;
+		pf.sy = top;
+		pf.sw = width;
+		pf.sh = height;
+		pf.rectNo = -1;
+		pf.dx = values[SS_CURVE_TAG_POSX];
+		pf.dy = values[SS_CURVE_TAG_POSY];
+		pf.ox = (flags & SS_PART_FLAG_ORIGIN_X) ? originX : pf.sw / 2;
+		pf.oy = (flags & SS_PART_FLAG_ORIGIN_Y) ? originY : pf.sh / 2;
+		pf.rotation = (flags & SS_PART_FLAG_ROTATION) ? angle : 0;
+		pf.scaleX = (flags & SS_PART_FLAG_SCALE_X) ? values[SS_CURVE_TAG_SCAX] : 1.0f;
+		pf.scaleY = (flags & SS_PART_FLAG_SCALE_Y) ? values[SS_CURVE_TAG_SCAY] : 1.0f;
+		pf.opacity = (flags & SS_PART_FLAG_OPACITY) ? opacity : 255;
+		std::memcpy(pf.vertexOffsets, param.vert, sizeof(pf.vertexOffsets));
+
+		// ブレンド方法の番号は 0:ミックス, 1:乗算, 2:加算, 3:減算
+		pf.colorBlendFuncNo = (flags & SS_PART_FLAGS_COLOR_BLEND) ? param.colorBlend - SS_CURVE_BLEND_MIX : 0;
+		ccColor4B color4 = { 0xff, 0xff, 0xff, 0 };
+		if (flags & SS_PART_FLAG_COLOR) color4 = toColor4B(param.colors[0]);
+		for (int v = 0; v < 4; v++)
+		{
+			pf.colors[v] = (flags & (SS_PART_FLAG_VERTEX_COLOR_TL << v)) ? toColor4B(param.colors[v]) : color4;
+		}
+	}
 
-		#if USE_CUSTOM_SPRITE
-		SSSprite* sprite;
-		#else
-		CCSprite* sprite;
-		#endif
+private:
+	const SSDataHandle*			m_dataHandle;
+	const SSCurveNode*			m_nodes;			// パーツNo順
+	std::vector<Param>			m_params;			// パーツNo順
+	std::vector<int>			m_decoded;			// このフレームで値を求めたパーツ
+	bool						m_inheritEnabled;
+};
 
-		//SSPlayerの子要素数を取得。m_pChildrenは遅延生成されるためNULLチェック必須
-		int childrenCount;
-		if( m_pChildren ){ childrenCount = m_pChildren->count(); } else { childrenCount =  0; }
-		
-		bool setBlendEnabled = false;
 
-		if (m_batch)
+
+/**
+ * SSFrameCache
+ * 同じアニメーションデータを再生しているプレイヤーのあいだで、デコードしたフレームを共有します.
+ * フレームデータのレコードごとに描画するパーツの状態を保持し、メモリの上限を超えたときは最も長く使われていないものから破棄します.
+ * SSPlayerBatchのワーカースレッドからも使われるため、レコードごとに振り分けた区画単位でロックして行います.
+ * メモリの上限は区画ごとに等分します.
+ * 共有する相手のいないデータのフレームは登録しません. 破棄したエントリは区画ごとにいくつか残して使い回します.
+ */
+
+class SSFrameCache
+{
+public:
+	struct Entry
+	{
+		const SSData*				data;
+		int							recordNo;
+		std::vector<SSPartFrame>	frames;		// 描画順
+		std::vector<ss_s16>			slots;		// パーツNo順. framesでの位置、描画しないパーツは-1
+		std::vector<int>			order;		// 描画順のパーツNo
+		size_t						bytes;
+		int							refCount;	// キャッシュと、参照しているデコーダーの数
+		std::list<Entry*>::iterator	lru;
+	};
+
+	static SSFrameCache* getInstance()
+	{
+		pthread_once(&s_once, create);
+		return s_instance;
+	}
+
+	/**
+	 * キャッシュを使うか.
+	 * 上限はメインスレッドで変更し、ワーカースレッドで評価しているあいだは変わらないため、ロックせずに読む
+	 */
+	bool isEnabled() const
+	{
+		return m_memoryBudget != 0;
+	}
+
+	/** アニメーションデータを使うデコーダーを登録する */
+	void addUser(const SSData* data)
+	{
+		for (int i = 0; i < NUM_SHARDS; i++)
 		{
-			//bool useBatchNode = !useCustomSprite;
-			bool useBatchNode =
-				(flags & SS_PART_FLAGS_VERTEX_OFFSET) == 0 &&
-				partData->alphaBlend == kSSPartAlphaBlendMix &&
-				!useCustomShaderProgram;
-			
-			// 次のとき新たな親ノードを取得
-			bool changeParentNode =
-				(!parentNode) ||
-				(useBatchNode != jointToParentBatchNode) ||
-				(jointToParentBatchNode && jointNode->getTexture() != tex);
-		
-			if (changeParentNode)
+			Shard& shard = m_shards[i];
+			pthread_mutex_lock(&shard.mutex);
+			shard.users[data]++;
+			pthread_mutex_unlock(&shard.mutex);
+		}
+	}
+
+	/** デコーダーの登録を解除する. データを使うデコーダーが無くなったときは、そのデータのエントリを破棄する */
+	void removeUser(const SSData* data)
+	{
+		for (int i = 0; i < NUM_SHARDS; i++)
+		{
+			Shard& shard = m_shards[i];
+			pthread_mutex_lock(&shard.mutex);
+			std::map<const SSData*, int>::iterator user = shard.users.find(data);
+			if (user != shard.users.end() && --user->second == 0)
 			{
-				m_batch->getNode(parentNode, useBatchNode, tex);
-				
-				jointNodeIndex++;
-				if (jointNodeIndex >= m_jointSprites.count())
-				{
-					jointNode = CCSprite::createWithTexture(tex);
-					jointNode->setTextureRect(CCRect(0, 0, 0, 0));
-					m_jointSprites.addObject(jointNode);
-				}
-				else
+				// 同じアドレスに別のデータが読み込まれることがあるため、残しておかない
+				shard.users.erase(user);
+				EntryMap::iterator e = shard.entries.lower_bound(Key(data, INT_MIN));
+				while (e != shard.entries.end() && e->first.first == data)
 				{
-					jointNode = (CCSprite*)m_jointSprites.objectAtIndex(jointNodeIndex);
-					jointNode->setTexture(tex);
+					Entry* entry = (e++)->second;
+					remove(shard, entry);
 				}
-				
-				jointNode->setPositionX(this->getPositionX());
-				jointNode->setPositionY(this->getPositionY());
-				jointNode->setScaleX(this->m_fScaleX);
-				jointNode->setScaleY(this->m_fScaleY);
-				jointNode->setRotation(this->getRotation());
-				jointNode->setOpacity(this->getOpacity());
-				
-				parentNode->addChild(jointNode);
-				jointToParentBatchNode = useBatchNode;
-			}
-		
-		
-			childrenCount = m_batchSprites.count();
-			if (childrenCount <= i) {
-#if USE_CUSTOM_SPRITE
-				sprite =  SSSprite::create();
-				sprite->changeShaderProgram(useCustomShaderProgram);
-				sprite->setTexture(tex);
-#else
-				sprite = CCSprite::createWithTexture(tex);
-#endif
-				m_batchSprites.addObject(sprite);
-			} else {
-#if USE_CUSTOM_SPRITE
-				sprite = static_cast<SSSprite*>( m_batchSprites.objectAtIndex(i) );
-#else
-				sprite = static_cast<CCSprite*>( m_batchSprites.objectAtIndex(i) );
-#endif
-				sprite->setTexture(tex);
 			}
-			
-			jointNode->addChild(sprite);
+			pthread_mutex_unlock(&shard.mutex);
+		}
+	}
 
-			// ブレンド方法を設定する
-			setBlendEnabled = true;
+	/** レコードをデコードしたエントリを返す. 無いときはNULLを返す. 返したエントリはreleaseで解放すること */
+	const Entry* acquire(const SSData* data, int recordNo)
+	{
+		if (!isEnabled()) return NULL;
 
+		Shard& shard = getShard(data, recordNo);
+		pthread_mutex_lock(&shard.mutex);
+		Entry* entry = NULL;
+		EntryMap::iterator i = shard.entries.find(Key(data, recordNo));
+		if (i != shard.entries.end())
+		{
+			entry = i->second;
+			entry->refCount++;
+			shard.lru.splice(shard.lru.begin(), shard.lru, entry->lru);
+			shard.hits++;
 		}
-		else if (!useCustomSprite)
+		else
 		{
-			//-------------------------------------------------------------
-			//texと同じテクスチャを持っているバッチノードを探す
-			//-------------------------------------------------------------
-			CCSpriteBatchNode* node = NULL;//描画に使用するバッチノード
-			if( nodeIndex < childrenCount ){
-				//nodeIndexが指しているバッチノードが存在する
-				//texと同じテクスチャを持っているか調べる
-				node = static_cast<CCSpriteBatchNode*>( getChildren()->objectAtIndex(nodeIndex) );
-				if( node->getTexture() != tex ){
-					//描画したいテクスチャと同じテクスチャを持つバッチノードを順に検索する
-					spriteIndex = 0;//バッチノードが変わるのでスプライトのインデックスを初期化
-					do{
-						++nodeIndex;
-						if( nodeIndex == childrenCount ){
-							//texを使用するバッチノードは見つからなかった
-							node = NULL;
-							break; 
-						}
-						//SSPlayerの子要素には全てCCSpriteBatchNodeがセットされているので、キャストして順に検索する
-						node = static_cast<CCSpriteBatchNode*>( getChildren()->objectAtIndex(nodeIndex));
-					}while(node->getTexture() != tex );
-				}
-			}
-			
-			//描画したいテクスチャを持つバッチノードが見つからなかった
-			//子要素の最後尾に新しくバッチノードを作成し、追加する
-			if( !node ){
-				node = CCSpriteBatchNode::createWithTexture(tex);
-				addChild(node);
-			}
-			
-			//使用するバッチノードが決まったので表示状態にする
-			node->setVisible(true);
-			
-			//このバッチノードの子要素の未使用スプライトを取得する
-			//未使用スプライトが足りない場合は新規作成する
-			CCArray* aNodeChildren = node->getChildren();
-			int nodeChildrenCount;
-			if( aNodeChildren ){ nodeChildrenCount = aNodeChildren->count(); } else { nodeChildrenCount =  0; }
-			if( nodeChildrenCount == spriteIndex ){
-				//スプライトの数が足りないのでバッチノードの子要素として新しく作成する
-#if USE_CUSTOM_SPRITE
-				sprite =  SSSprite::create();
-				sprite->setTexture(node->getTexture());
-				sprite->changeShaderProgram(useCustomShaderProgram);
-#else
-				sprite = CCSprite::createWithTexture(tex);
-#endif
-				node->addChild(sprite);
-			} else {
-				//バッチノードの子要素のスプライトの数は足りているので、未使用のスプライトを描画に使用する
-#if USE_CUSTOM_SPRITE
-				sprite = static_cast<SSSprite*>( node->getChildren()->objectAtIndex( spriteIndex ) );
-#else
-				sprite = static_cast<CCSprite*>( node->getChildren()->objectAtIndex( spriteIndex ) );
-#endif
-			}
-			//このノードの子要素のspiretIndex番目のスプライトは使用済みなので、インデックスをインクリメントする
-			++spriteIndex;
+			shard.misses++;
+		}
+		pthread_mutex_unlock(&shard.mutex);
+		return entry;
+	}
+
+	void release(const Entry* entry)
+	{
+		Shard& shard = getShard(entry->data, entry->recordNo);
+		pthread_mutex_lock(&shard.mutex);
+		Entry* e = const_cast<Entry*>(entry);
+		if (--e->refCount == 0) recycle(shard, e);
+		pthread_mutex_unlock(&shard.mutex);
+	}
+
+	/** デコードしたレコードを登録する */
+	void insert(const SSData* data, int recordNo, const std::vector<SSPartFrame>& partFrames, const std::vector<int>& order)
+	{
+		size_t bytes = sizeof(Entry) + order.size() * (sizeof(SSPartFrame) + sizeof(int)) + partFrames.size() * sizeof(ss_s16);
+		if (!isEnabled() || bytes > getShardBudget()) return;
+
+		// 他に同じデータを使うデコーダーが無ければ、共有されないため入れない
+		Shard& shard = getShard(data, recordNo);
+		pthread_mutex_lock(&shard.mutex);
+		std::map<const SSData*, int>::const_iterator user = shard.users.find(data);
+		bool shared = user != shard.users.end() && user->second >= 2 && !shard.entries.count(Key(data, recordNo));
+		Entry* entry = NULL;
+		if (shared && !shard.freeEntries.empty())
+		{
+			entry = shard.freeEntries.back();
+			shard.freeEntries.pop_back();
+		}
+		pthread_mutex_unlock(&shard.mutex);
+		if (!shared) return;
+
+		// ロックしていないあいだに複製しておく
+		if (!entry) entry = new Entry();
+		entry->data = data;
+		entry->recordNo = recordNo;
+		entry->frames.resize(order.size());
+		entry->slots.assign(partFrames.size(), -1);
+		entry->order = order;
+		for (size_t i = 0; i < order.size(); i++)
+		{
+			entry->frames[i] = partFrames[order[i]];
+			entry->slots[order[i]] = static_cast<ss_s16>(i);
+		}
+		entry->bytes = bytes;
+		entry->refCount = 1;
+
+		pthread_mutex_lock(&shard.mutex);
+		// 登録が解除されたデータと、他のスレッドが先に登録したレコードは入れない
+		bool added = shard.users.count(data) && shard.entries.insert(EntryMap::value_type(Key(data, recordNo), entry)).second;
+		if (added)
+		{
+			shard.lru.push_front(entry);
+			entry->lru = shard.lru.begin();
+			shard.bytes += bytes;
+			evict(shard, getShardBudget());
+		}
+		else
+		{
+			recycle(shard, entry);
+		}
+		pthread_mutex_unlock(&shard.mutex);
+	}
+
+	void setMemoryBudget(size_t bytes)
+	{
+		m_memoryBudget = bytes;
+		for (int i = 0; i < NUM_SHARDS; i++)
+		{
+			Shard& shard = m_shards[i];
+			pthread_mutex_lock(&shard.mutex);
+			evict(shard, getShardBudget());
+			pthread_mutex_unlock(&shard.mutex);
+		}
+	}
+
+	size_t getMemoryBudget() const
+	{
+		return m_memoryBudget;
+	}
+
+	void getStats(SSPlayer::FrameCacheStats& stats)
+	{
+		stats.hits = 0;
+		stats.misses = 0;
+		stats.numEntries = 0;
+		stats.bytes = 0;
+		for (int i = 0; i < NUM_SHARDS; i++)
+		{
+			Shard& shard = m_shards[i];
+			pthread_mutex_lock(&shard.mutex);
+			stats.hits += shard.hits;
+			stats.misses += shard.misses;
+			stats.numEntries += shard.entries.size();
+			stats.bytes += shard.bytes;
+			pthread_mutex_unlock(&shard.mutex);
+		}
+	}
+
+	void resetStats()
+	{
+		for (int i = 0; i < NUM_SHARDS; i++)
+		{
+			Shard& shard = m_shards[i];
+			pthread_mutex_lock(&shard.mutex);
+			shard.hits = 0;
+			shard.misses = 0;
+			pthread_mutex_unlock(&shard.mutex);
+		}
+	}
+
+private:
+	typedef std::pair<const SSData*, int> Key;
+	typedef std::map<Key, Entry*> EntryMap;
+
+	enum { NUM_SHARDS = 16 };
+	enum { MAX_FREE_ENTRIES = 4 };		// 区画ごとに使い回すために残しておくエントリの数
+
+	/** ロックの単位. エントリはデータとレコードから決まる区画に置く */
+	struct Shard
+	{
+		pthread_mutex_t					mutex;
+		EntryMap						entries;
+		std::list<Entry*>				lru;			// 先頭ほど最近使われた
+		std::map<const SSData*, int>	users;			// データごとのデコーダーの数. すべての区画で同じ値を持つ
+		std::vector<Entry*>				freeEntries;	// 破棄したエントリ. フレームの配列の領域ごと使い回す
+		size_t							bytes;
+		unsigned int					hits;
+		unsigned int					misses;
+	};
+
+	SSFrameCache()
+		: m_memoryBudget(SHARED_FRAME_CACHE_MEMORY_BUDGET)
+	{
+		for (int i = 0; i < NUM_SHARDS; i++)
+		{
+			Shard& shard = m_shards[i];
+			pthread_mutex_init(&shard.mutex, NULL);
+			shard.bytes = 0;
+			shard.hits = 0;
+			shard.misses = 0;
+		}
+	}
+
+	static void create()
+	{
+		s_instance = new SSFrameCache();
+	}
+
+	Shard& getShard(const SSData* data, int recordNo)
+	{
+		// 同じデータの続いたレコードが別の区画に分かれるようにする
+		size_t hash = (reinterpret_cast<size_t>(data) >> 4) * 31 + static_cast<size_t>(recordNo);
+		return m_shards[hash % NUM_SHARDS];
+	}
+
+	size_t getShardBudget() const
+	{
+		return (m_memoryBudget + NUM_SHARDS - 1) / NUM_SHARDS;
+	}
+
+	// 以下は区画をロックした状態で呼ぶ
+
+	/** 上限に収まるまで、最も長く使われていないエントリから破棄する */
+	void evict(Shard& shard, size_t budget)
+	{
+		while (shard.bytes > budget && !shard.lru.empty())
+		{
+			remove(shard, shard.lru.back());
+		}
+	}
+
+	/** エントリをキャッシュから外す. デコーダーが参照しているあいだは解放しない */
+	void remove(Shard& shard, Entry* entry)
+	{
+		shard.entries.erase(Key(entry->data, entry->recordNo));
+		shard.lru.erase(entry->lru);
+		shard.bytes -= entry->bytes;
+		if (--entry->refCount == 0) recycle(shard, entry);
+	}
+
+	/** どこからも参照されなくなったエントリを、使い回すために残しておく */
+	void recycle(Shard& shard, Entry* entry)
+	{
+		if (shard.freeEntries.size() < MAX_FREE_ENTRIES)
+		{
+			shard.freeEntries.push_back(entry);
+		}
+		else
+		{
+			delete entry;
+		}
+	}
+
+	static pthread_once_t			s_once;
+	static SSFrameCache*			s_instance;
+
+	Shard							m_shards[NUM_SHARDS];
+	size_t							m_memoryBudget;		// メインスレッドで変更する
+};
+
+pthread_once_t SSFrameCache::s_once = PTHREAD_ONCE_INIT;
+SSFrameCache* SSFrameCache::s_instance = NULL;
+
+
+
+/**
+ * SSFrameDecoder
+ * フレームデータをデコードし、パーツごとの状態を保持します.
+ * 差分形式のデータでは、直前にデコードしたフレームかキーフレームからデコードを進めます.
+ * カーブ形式のデータでは、キーフレームからフレームの値を計算します.
+ */
+
+class SSFrameDecoder
+{
+public:
+	SSFrameDecoder(const SSDataHandle* dataHandle)
+		: m_dataHandle(dataHandle)
+		, m_partFrames(dataHandle->getNumParts())
+		, m_drawn(dataHandle->getNumParts())
+		, m_decodedFrameNo(-1)
+		, m_chunkCache(dataHandle)
+		, m_curveEvaluator(dataHandle)
+		, m_cachedFrame(NULL)
+	{
+		SSFrameCache::getInstance()->addUser(dataHandle->getData());
+		m_deltaFrames = (dataHandle->getFlags() & SS_DATA_FLAG_DELTA_FRAMES) != 0;
+		m_quantized = (dataHandle->getFlags() & SS_DATA_FLAG_QUANTIZED) != 0;
+		m_compressed = (dataHandle->getFlags() & SS_DATA_FLAG_COMPRESSED_FRAMES) != 0;
+		m_curves = (dataHandle->getFlags() & SS_DATA_FLAG_CURVES) != 0;
+		m_rectTable = (dataHandle->getFlags() & SS_DATA_FLAG_RECT_TABLE) != 0;
+		m_fixedRecords = (dataHandle->getFlags() & SS_DATA_FLAG_FIXED_RECORDS) != 0;
+	}
+
+	~SSFrameDecoder()
+	{
+		SSFrameCache* frameCache = SSFrameCache::getInstance();
+		if (m_cachedFrame) frameCache->release(m_cachedFrame);
+		frameCache->removeUser(m_dataHandle->getData());
+	}
+
+	/** 指定フレームをデコードします.
+	 *  他のプレイヤーが同じフレームをデコードしていれば、共有のキャッシュにある結果を使います.
+	 */
+	void decode(int frameNo)
+	{
+		SSFrameCache* frameCache = SSFrameCache::getInstance();
+		if (m_cachedFrame)
+		{
+			if (m_cachedFrame->recordNo == frameNo) return;
+			frameCache->release(m_cachedFrame);
+		}
+		// キャッシュにあったときは、差分形式などのデコードの状態は前のまま残しておく
+		bool cacheEnabled = frameCache->isEnabled();
+		m_cachedFrame = cacheEnabled ? frameCache->acquire(m_dataHandle->getData(), frameNo) : NULL;
+		if (m_cachedFrame) return;
+
+		// データが壊れていてデコードできないときは、何も描画しないフレームとする（共有のキャッシュには入れない）
+		bool result = decodeFrame(frameNo);
+		if (!result)
+		{
+			m_order.clear();
+			m_decodedFrameNo = -1;
+		}
+
+		// このフレームで描画するパーツに印を付ける
+		std::fill(m_drawn.begin(), m_drawn.end(), false);
+		for (size_t i = 0; i < m_order.size(); i++) m_drawn[m_order[i]] = true;
+
+		if (result && cacheEnabled) frameCache->insert(m_dataHandle->getData(), frameNo, m_partFrames, m_order);
+	}
+
+	/** デコードしたフレームの、描画するパーツ数を返します.
+	 */
+	size_t getNumParts() const { return m_cachedFrame ? m_cachedFrame->order.size() : m_order.size(); }
+
+	/** 描画順index番目のパーツNoを返します.
+	 */
+	int getPartNo(size_t index) const { return m_cachedFrame ? m_cachedFrame->order[index] : m_order[index]; }
+
+	/** 指定パーツがデコードしたフレームで描画されるか返します.
+	 */
+	bool isDrawn(int partNo) const { return m_cachedFrame ? m_cachedFrame->slots[partNo] >= 0 : m_drawn[partNo]; }
+
+	/** 指定パーツのフレーム情報を返します. 描画しないパーツは指定できません.
+	 */
+	const SSPartFrame& getPartFrame(int partNo) const
+	{
+		return m_cachedFrame ? m_cachedFrame->frames[m_cachedFrame->slots[partNo]] : m_partFrames[partNo];
+	}
+
+	/** 指定フレームのユーザーデータの先頭アドレスを返します. データが壊れているときはNULLを返します.
+	 */
+	const void* getUserData(int frameNo)
+	{
+		const SSFrameData* frameData = &(m_dataHandle->getFrameData()[frameNo]);
+		return getFrameAddress(frameNo, frameData->userData);
+	}
+
+private:
+	bool decodeFrame(int frameNo)
+	{
+		if (m_curves)
+		{
+			if (frameNo == m_decodedFrameNo) return true;
+			m_curveEvaluator.evaluate(frameNo, m_partFrames, m_order);
+			m_decodedFrameNo = frameNo;
+			return true;
+		}
+		if (!m_deltaFrames)
+		{
+			return m_fixedRecords ? readFixedFrame(frameNo) : readFrame(frameNo);
+		}
+		if (frameNo == m_decodedFrameNo) return true;
+
+		// 指定フレーム以前で最も近いキーフレームを探す
+		const ss_s16* keyframes = m_dataHandle->getKeyframeIndex();
+		const ss_s16* keyframesEnd = keyframes + m_dataHandle->getNumKeyframes();
+		const ss_s16* key = std::upper_bound(keyframes, keyframesEnd, static_cast<ss_s16>(frameNo));
+		CCAssert(key != keyframes, "Keyframe not found.");
+		int startFrameNo = *(key - 1);
+
+		// 同じキーフレーム区間を先に進むときは、直前にデコードしたフレームの続きから
+		if (m_decodedFrameNo >= startFrameNo && m_decodedFrameNo < frameNo)
+		{
+			startFrameNo = m_decodedFrameNo + 1;
+		}
+
+		for (int i = startFrameNo; i <= frameNo; i++)
+		{
+			if (!applyDelta(i)) return false;
+		}
+		m_decodedFrameNo = frameNo;
+		return true;
+	}
+
+	// 圧縮されたデータでは、フレームのデータはそのフレームを含むチャンクの先頭からのオフセット
+	// チャンクが壊れているときはNULLを返す
+	const void* getFrameAddress(int frameNo, ss_offset offset)
+	{
+		if (!m_compressed) return m_dataHandle->getAddress(offset);
+
+		const char* chunk = m_chunkCache.getChunk(frameNo / m_dataHandle->getFramesPerChunk());
+		return chunk ? static_cast<const void*>(chunk + offset) : NULL;
+	}
+
+	// 量子化されたデータでは、以下の要素が固定小数点数などで記録されている
+	ss_u32 readFlags(SSDataReader& r) const
+	{
+		return m_quantized ? r.readVarU32() : r.readU32();
+	}
+
+	float readPosition(SSDataReader& r) const
+	{
+		return m_quantized ? r.readVarFixed(m_dataHandle->getPositionFractionBits()) : r.readFloat();
+	}
+
+	float readRotation(SSDataReader& r) const
+	{
+		return m_quantized ? r.readAngle(m_dataHandle->getAngleBits()) : r.readFloat();
+	}
+
+	float readScale(SSDataReader& r) const
+	{
+		return m_quantized ? r.readFixed16(m_dataHandle->getScaleFractionBits()) : r.readFloat();
+	}
+
+	void readSourceRect(SSDataReader& r, SSPartFrame& pf, int partNo) const
+	{
+		if (m_rectTable)
+		{
+			setTextureRect(pf, partNo, r.readU16());
+		}
+		else
+		{
+			pf.rectNo = -1;
+			pf.sx = r.readS16();
+			pf.sy = r.readS16();
+			pf.sw = r.readS16();
+			pf.sh = r.readS16();
+		}
+	}
+
+	// 参照元の範囲の表から、パーツの画像での範囲を引く
+	void setTextureRect(SSPartFrame& pf, int partNo, int rectNo) const
+	{
+		const SSTextureRect* rect = m_dataHandle->getTextureRect(m_dataHandle->getPartData()[partNo].imageNo, rectNo);
+		pf.rectNo = rect ? rectNo : -1;
+		pf.sx = rect ? rect->left : 0;
+		pf.sy = rect ? rect->top : 0;
+		pf.sw = rect ? rect->width : 0;
+		pf.sh = rect ? rect->height : 0;
+	}
+
+	bool readFrame(int frameNo)
+	{
+		const SSFrameData* frameData = &(m_dataHandle->getFrameData()[frameNo]);
+		size_t numParts = static_cast<size_t>(frameData->numParts);
+
+		m_order.resize(numParts);
+		if (numParts == 0) return true;
+		const void* address = getFrameAddress(frameNo, frameData->partFrameData);
+		if (!address) return false;
+		SSDataReader r( static_cast<const ss_u16*>(address) );
+
+		for (size_t i = 0; i < numParts; i++)
+		{
+			ss_u32 flags = readFlags(r);
+			ss_u16 partNo = r.readU16();
+			m_order[i] = partNo;
+
+			SSPartFrame& pf = m_partFrames[partNo];
+			pf.flags = flags;
+			readSourceRect(r, pf, partNo);
+			pf.dx = readPosition(r);
+			pf.dy = readPosition(r);
+
+			pf.ox = (flags & SS_PART_FLAG_ORIGIN_X) ? r.readS16() : pf.sw / 2;
+			pf.oy = (flags & SS_PART_FLAG_ORIGIN_Y) ? r.readS16() : pf.sh / 2;
+
+			pf.rotation = (flags & SS_PART_FLAG_ROTATION) ? readRotation(r) : 0;
+			pf.scaleX = (flags & SS_PART_FLAG_SCALE_X) ? readScale(r) : 1.0f;
+			pf.scaleY = (flags & SS_PART_FLAG_SCALE_Y) ? readScale(r) : 1.0f;
+			pf.opacity = (flags & SS_PART_FLAG_OPACITY) ? r.readU16() : 255;
+
+			for (int v = 0; v < 4; v++)
+			{
+				bool exists = (flags & (SS_PART_FLAG_VERTEX_OFFSET_TL << v)) != 0;
+				pf.vertexOffsets[v][0] = exists ? r.readS16() : 0;
+				pf.vertexOffsets[v][1] = exists ? r.readS16() : 0;
+			}
+
+			ccColor4B color4 = { 0xff, 0xff, 0xff, 0 };
+			pf.colorBlendFuncNo = 0;
+			if (flags & SS_PART_FLAGS_COLOR_BLEND)
+			{
+				pf.colorBlendFuncNo = r.readU16();
+				if (flags & SS_PART_FLAG_COLOR) r.readColor(color4);
+			}
+			for (int v = 0; v < 4; v++)
+			{
+				pf.colors[v] = color4;
+				if (flags & (SS_PART_FLAG_VERTEX_COLOR_TL << v)) r.readColor(pf.colors[v]);
+			}
+		}
+		return true;
+	}
+
+	/** 固定長形式のフレームを読み込みます.
+	 * 要素ごとの配列が16バイト境界から並んでいるため、ポインタのキャストでそのまま参照します.
+	 * パーツ数nを8の倍数に切り上げた数をstrideとして、次の順に並びます.
+	 *	ss_u16		partNo[stride];
+	 *	ss_u32		flags[stride];
+	 *	ss_s16		sourceRect[stride][4];		// 参照元の範囲の表を使うときは ss_u16 rectNo[stride]
+	 *	float		position[stride][2];
+	 *	ss_s16		origin[stride][2];
+	 *	float		rotation[stride];
+	 *	float		scale[stride][2];
+	 *	ss_u16		opacity[stride];
+	 *	ss_u16		colorBlendFuncNo[stride];
+	 *	ss_u32		vertexOffsetMask[maskWords];	// maskWordsは(stride+31)/32を4の倍数に切り上げた数
+	 *	ss_u32		colorBlendMask[maskWords];
+	 *	ss_s16		vertexOffsets[numVertexOffsetParts][4][2];	// マスクのビットが立っているパーツの分だけ
+	 *	ss_u32		colors[numColorBlendParts][4];				// ARGB. マスクのビットが立っているパーツの分だけ
+	 */
+	bool readFixedFrame(int frameNo)
+	{
+		const SSFrameData* frameData = &(m_dataHandle->getFrameData()[frameNo]);
+		size_t numParts = static_cast<size_t>(frameData->numParts);
+
+		m_order.resize(numParts);
+		if (numParts == 0) return true;
+		const char* p = static_cast<const char*>(getFrameAddress(frameNo, frameData->partFrameData));
+		if (!p) return false;
+		CCAssert((reinterpret_cast<size_t>(p) & 3) == 0, "Fixed-stride frame data is not aligned.");
+
+		const size_t stride = (numParts + 7) & ~7;
+		const size_t maskWords = (((stride + 31) / 32) + 3) & ~3;
+		const ss_u16* partNos = reinterpret_cast<const ss_u16*>(p);				p += stride * sizeof(ss_u16);
+		const ss_u32* flags = reinterpret_cast<const ss_u32*>(p);				p += stride * sizeof(ss_u32);
+		const ss_s16* sourceRects = reinterpret_cast<const ss_s16*>(p);			p += stride * sizeof(ss_s16) * (m_rectTable ? 1 : 4);
+		const float* positions = reinterpret_cast<const float*>(p);				p += stride * sizeof(float) * 2;
+		const ss_s16* origins = reinterpret_cast<const ss_s16*>(p);				p += stride * sizeof(ss_s16) * 2;
+		const float* rotations = reinterpret_cast<const float*>(p);				p += stride * sizeof(float);
+		const float* scales = reinterpret_cast<const float*>(p);				p += stride * sizeof(float) * 2;
+		const ss_u16* opacities = reinterpret_cast<const ss_u16*>(p);			p += stride * sizeof(ss_u16);
+		const ss_u16* colorBlendFuncNos = reinterpret_cast<const ss_u16*>(p);	p += stride * sizeof(ss_u16);
+		const ss_u32* vertexOffsetMask = reinterpret_cast<const ss_u32*>(p);	p += maskWords * sizeof(ss_u32);
+		const ss_u32* colorBlendMask = reinterpret_cast<const ss_u32*>(p);		p += maskWords * sizeof(ss_u32);
+
+		// 全パーツが持つ要素は、フラグによる分岐なしで配列から読む
+		for (size_t i = 0; i < numParts; i++)
+		{
+			int partNo = partNos[i];
+			m_order[i] = partNo;
+
+			SSPartFrame& pf = m_partFrames[partNo];
+			pf.flags = flags[i];
+			if (m_rectTable)
+			{
+				setTextureRect(pf, partNo, static_cast<ss_u16>(sourceRects[i]));
+			}
+			else
+			{
+				pf.rectNo = -1;
+				pf.sx = sourceRects[i * 4 + 0];
+				pf.sy = sourceRects[i * 4 + 1];
+				pf.sw = sourceRects[i * 4 + 2];
+				pf.sh = sourceRects[i * 4 + 3];
+			}
+			pf.dx = positions[i * 2 + 0];
+			pf.dy = positions[i * 2 + 1];
+			pf.ox = origins[i * 2 + 0];
+			pf.oy = origins[i * 2 + 1];
+			pf.rotation = rotations[i];
+			pf.scaleX = scales[i * 2 + 0];
+			pf.scaleY = scales[i * 2 + 1];
+			pf.opacity = opacities[i];
+			pf.colorBlendFuncNo = colorBlendFuncNos[i];
+		}
+
+		// 頂点変形とカラーブレンドは、マスクのビットが立っているパーツの分だけ並んでいる
+		const ss_s16* vertexOffsets = reinterpret_cast<const ss_s16*>(p);
+		for (size_t i = 0; i < numParts; i++)
+		{
+			SSPartFrame& pf = m_partFrames[m_order[i]];
+			if (vertexOffsetMask[i / 32] & (1u << (i % 32)))
+			{
+				for (int v = 0; v < 4; v++)
+				{
+					pf.vertexOffsets[v][0] = vertexOffsets[v * 2 + 0];
+					pf.vertexOffsets[v][1] = vertexOffsets[v * 2 + 1];
+				}
+				vertexOffsets += 8;
+			}
+			else
+			{
+				std::memset(pf.vertexOffsets, 0, sizeof(pf.vertexOffsets));
+			}
+		}
+
+		const ss_u32* colors = reinterpret_cast<const ss_u32*>(vertexOffsets);
+		const ccColor4B defaultColor = { 0xff, 0xff, 0xff, 0 };
+		for (size_t i = 0; i < numParts; i++)
+		{
+			SSPartFrame& pf = m_partFrames[m_order[i]];
+			if (colorBlendMask[i / 32] & (1u << (i % 32)))
+			{
+				for (int v = 0; v < 4; v++)
+				{
+					ss_u32 raw = colors[v];
+					pf.colors[v].a = static_cast<GLubyte>(raw >> 24);
+					pf.colors[v].r = static_cast<GLubyte>(raw >> 16);
+					pf.colors[v].g = static_cast<GLubyte>(raw >> 8);
+					pf.colors[v].b = static_cast<GLubyte>(raw);
+				}
+				colors += 4;
+			}
+			else
+			{
+				for (int v = 0; v < 4; v++) pf.colors[v] = defaultColor;
+			}
+		}
+		return true;
+	}
+
+	bool applyDelta(int frameNo)
+	{
+		const SSFrameData* frameData = &(m_dataHandle->getFrameData()[frameNo]);
+		size_t numParts = static_cast<size_t>(frameData->numParts);
+
+		// 変化した要素だけが記録されているので、前フレームの状態に上書きする
+		m_order.resize(numParts);
+		if (numParts == 0) return true;
+		const void* address = getFrameAddress(frameNo, frameData->partFrameData);
+		if (!address) return false;
+		SSDataReader r( static_cast<const ss_u16*>(address) );
+
+		for (size_t i = 0; i < numParts; i++)
+		{
+			ss_u16 partNo = r.readU16();
+			ss_u16 delta = r.readU16();
+			m_order[i] = partNo;
+
+			SSPartFrame& pf = m_partFrames[partNo];
+			if (delta & SS_DELTA_FLAG_FLAGS) pf.flags = readFlags(r);
+			if (delta & SS_DELTA_FLAG_SOURCE_RECT) readSourceRect(r, pf, partNo);
+			if (delta & SS_DELTA_FLAG_POSITION)
+			{
+				pf.dx = readPosition(r);
+				pf.dy = readPosition(r);
+			}
+			if (delta & SS_DELTA_FLAG_ORIGIN)
+			{
+				pf.ox = r.readS16();
+				pf.oy = r.readS16();
+			}
+			if (delta & SS_DELTA_FLAG_ROTATION) pf.rotation = readRotation(r);
+			if (delta & SS_DELTA_FLAG_SCALE)
+			{
+				pf.scaleX = readScale(r);
+				pf.scaleY = readScale(r);
+			}
+			if (delta & SS_DELTA_FLAG_OPACITY) pf.opacity = r.readU16();
+			if (delta & SS_DELTA_FLAG_VERTEX_OFFSET)
+			{
+				for (int v = 0; v < 4; v++)
+				{
+					pf.vertexOffsets[v][0] = r.readS16();
+					pf.vertexOffsets[v][1] = r.readS16();
+				}
+			}
+			if (delta & SS_DELTA_FLAG_COLOR_BLEND)
+			{
+				pf.colorBlendFuncNo = r.readU16();
+				for (int v = 0; v < 4; v++) r.readColor(pf.colors[v]);
+			}
+		}
+		return true;
+	}
+
+private:
+	const SSDataHandle*			m_dataHandle;
+	std::vector<SSPartFrame>	m_partFrames;		// パーツNo順
+	std::vector<int>			m_order;			// 描画順のパーツNo
+	std::vector<bool>			m_drawn;			// パーツNo順. このフレームで描画するか
+	int							m_decodedFrameNo;	// 差分形式、カーブ形式で最後にデコードしたフレームNo
+	bool						m_deltaFrames;
+	bool						m_quantized;
+	bool						m_compressed;
+	bool						m_curves;
+	bool						m_rectTable;
+	bool						m_fixedRecords;
+	SSFrameChunkCache			m_chunkCache;		// 圧縮されたデータのときに使う
+	SSCurveEvaluator			m_curveEvaluator;	// カーブ形式のデータのときに使う
+	const SSFrameCache::Entry*	m_cachedFrame;		// 共有のキャッシュから取り出したフレーム. 無いときは自身でデコードしたもの
+};
+
+// SS_DECODER_END
+
+
+
+/**
+ * 2つのフレーム情報の間をratio(0-1)で補間した結果をresultに格納して返します.
+ * 座標、回転、スケール、不透明度、頂点変形を補間し、それ以外の要素はfromの値を使います.
+ */
+
+static const SSPartFrame& blendPartFrame(SSPartFrame& result, const SSPartFrame& from, const SSPartFrame& to, float ratio)
+{
+	// 量子化されたデータでは回転角が1周の範囲に折り返されているため、最短の向きに補間する
+	float rotationDelta = std::fmod(to.rotation - from.rotation + 180.0f, 360.0f);
+	if (rotationDelta < 0) rotationDelta += 360.0f;
+	rotationDelta -= 180.0f;
+
+	result = from;
+	result.dx = from.dx + (to.dx - from.dx) * ratio;
+	result.dy = from.dy + (to.dy - from.dy) * ratio;
+	result.rotation = from.rotation + rotationDelta * ratio;
+	result.scaleX = from.scaleX + (to.scaleX - from.scaleX) * ratio;
+	result.scaleY = from.scaleY + (to.scaleY - from.scaleY) * ratio;
+	result.opacity = from.opacity + static_cast<int>((to.opacity - from.opacity) * ratio);
+	for (int v = 0; v < 4; v++)
+	{
+		result.vertexOffsets[v][0] = from.vertexOffsets[v][0] + static_cast<int>((to.vertexOffsets[v][0] - from.vertexOffsets[v][0]) * ratio);
+		result.vertexOffsets[v][1] = from.vertexOffsets[v][1] + static_cast<int>((to.vertexOffsets[v][1] - from.vertexOffsets[v][1]) * ratio);
+	}
+
+	// 頂点変形が次のフレームで始まるときも、変形の途中を表示する
+	result.flags |= to.flags & SS_PART_FLAGS_VERTEX_OFFSET;
+	return result;
+}
+
+
+
+/**
+ * SSTextureRectTable
+ * 参照元の範囲の表の各要素について、描画で使う値をアニメーションの設定時に求めておきます.
+ * フレームごとのテクスチャ範囲とアンカーポイントの計算を省きます.
+ */
+
+class SSTextureRectTable
+{
+public:
+	struct Entry
+	{
+		CCRect		rect;			// setTextureRectに渡す範囲
+		CCSize		size;			// 元の大きさ（ピクセル）
+		float		invWidth;		// 原点からアンカーポイントを求めるときに掛ける値
+		float		invHeight;
+		CCPoint		defaultAnchor;	// 原点が省略されたとき（中心）のアンカーポイント
+	};
+
+	SSTextureRectTable(const SSDataHandle* dataHandle)
+	{
+		int numImages = dataHandle->getNumRectImages();
+		m_imageStarts.resize(numImages + 1, 0);
+
+		for (int imageNo = 0; imageNo < numImages; imageNo++)
+		{
+			m_imageStarts[imageNo] = m_entries.size();
+
+			int numRects = dataHandle->getImageRects()[imageNo].numRects;
+			for (int rectNo = 0; rectNo < numRects; rectNo++)
+			{
+				const SSTextureRect* r = dataHandle->getTextureRect(imageNo, rectNo);
+				float w = static_cast<float>(r->width);
+				float h = static_cast<float>(r->height);
+
+				Entry e;
+#if ADJUST_UV_BY_CONTENT_SCALE_FACTOR
+				float sf = CC_CONTENT_SCALE_FACTOR();
+				e.rect = CCRect((float)r->left / sf, (float)r->top / sf, w / sf, h / sf);
+#else
+				e.rect = CCRect(r->left, r->top, r->width, r->height);
+#endif
+				e.size = CCSize(w, h);
+				e.invWidth = 1.0f / w;
+				e.invHeight = 1.0f / h;
+				e.defaultAnchor = ccp((float)(r->width / 2) / w, (float)(r->height / 2) / h);
+				m_entries.push_back(e);
+			}
+		}
+		m_imageStarts[numImages] = m_entries.size();
+	}
+
+	const Entry& get(int imageNo, int rectNo) const
+	{
+		return m_entries[m_imageStarts[imageNo] + rectNo];
+	}
+
+private:
+	std::vector<Entry>	m_entries;
+	std::vector<size_t>	m_imageStarts;	// 画像ごとの先頭の位置
+};
+
+
+
+/**
+ * SSPartNameIndex
+ * パーツ名からパーツ番号を引くハッシュ表. 同じSSDataを使うプレイヤーの間で共有する
+ */
+
+class SSPartNameIndex
+{
+public:
+	/** dataHandleのデータの表を返す. 無いときは作る. 使い終わったらreleaseIndexで返す */
+	static SSPartNameIndex* retainIndex(const SSDataHandle* dataHandle)
+	{
+		IndexMap& indices = getIndices();
+		IndexMap::iterator it = indices.find(dataHandle->getData());
+		SSPartNameIndex* index;
+		if (it != indices.end())
+		{
+			index = it->second;
+		}
+		else
+		{
+			index = new SSPartNameIndex(dataHandle);
+			indices[dataHandle->getData()] = index;
+		}
+		index->m_refs++;
+		return index;
+	}
+
+	static void releaseIndex(SSPartNameIndex* index)
+	{
+		if (--index->m_refs > 0) return;
+		getIndices().erase(index->m_dataHandle.getData());
+		delete index;
+	}
+
+	/** 表を作るたびに振られる通し番号. 解放されたデータと同じアドレスに読み込まれたデータを区別するのに使う */
+	unsigned int getSerial() const { return m_serial; }
+
+	/** パーツ番号を返す. 見つからないときは-1を返す */
+	int indexOfPart(const char* partName) const
+	{
+		unsigned int hash = hashName(partName);
+		for (unsigned int i = hash & m_mask; m_slots[i] >= 0; i = (i + 1) & m_mask)
+		{
+			if (m_hashes[i] == hash && std::strcmp(partName, m_dataHandle.getPartName(m_slots[i])) == 0)
+			{
+				return m_slots[i];
+			}
+		}
+		return -1;
+	}
+
+private:
+	typedef std::map<const SSData*, SSPartNameIndex*> IndexMap;
+
+	static IndexMap& getIndices()
+	{
+		static IndexMap s_indices;
+		return s_indices;
+	}
+
+	SSPartNameIndex(const SSDataHandle* dataHandle)
+		: m_dataHandle(*dataHandle)
+		, m_refs(0)
+	{
+		// 0は無効なハンドルのために空けておく
+		static unsigned int s_serial = 0;
+		if (++s_serial == 0) ++s_serial;
+		m_serial = s_serial;
+
+		// 空きが半分以上残る大きさにして、探索を短く保つ
+		int numParts = dataHandle->getNumParts();
+		unsigned int size = 8;
+		while (size < static_cast<unsigned int>(numParts) * 2) size <<= 1;
+		m_mask = size - 1;
+		m_slots.resize(size, -1);
+		m_hashes.resize(size, 0);
+
+		// 同じ名前のパーツがあるときは、先頭から探したときと同じく若い番号を返すよう先に登録する
+		for (int partNo = 0; partNo < numParts; partNo++)
+		{
+			const char* name = dataHandle->getPartName(partNo);
+			if (indexOfPart(name) >= 0) continue;
+
+			unsigned int hash = hashName(name);
+			unsigned int i = hash & m_mask;
+			while (m_slots[i] >= 0) i = (i + 1) & m_mask;
+			m_slots[i] = partNo;
+			m_hashes[i] = hash;
+		}
+	}
+
+	/** FNV-1a */
+	static unsigned int hashName(const char* name)
+	{
+		unsigned int hash = 2166136261u;
+		for (const unsigned char* p = reinterpret_cast<const unsigned char*>(name); *p; p++)
+		{
+			hash = (hash ^ *p) * 16777619u;
+		}
+		return hash;
+	}
+
+	SSDataHandle				m_dataHandle;
+	std::vector<int>			m_slots;		// パーツ番号. 空きは-1
+	std::vector<unsigned int>	m_hashes;
+	unsigned int				m_mask;
+	int							m_refs;
+	unsigned int				m_serial;
+};
+
+
+
+/**
+ * SSDirectRenderer
+ * パーツごとのスプライトを使わず、全パーツの頂点を１つの配列に書き込んでまとめて描画します.
+ * 頂点はスプライトと同じ規則（setTextureRect, アンカーポイント, 回転, スケール, 反転）で求めます.
+ */
+
+class SSDirectRenderer
+{
+public:
+	SSDirectRenderer()
+		: m_numParts(0)
+		, m_useCustomShader(false)
+	{}
+
+	/** フレームの書き込みを始める */
+	void begin(bool useCustomShader)
+	{
+		m_numParts = 0;
+		m_commands.clear();
+#if USE_CUSTOM_SPRITE
+		m_useCustomShader = useCustomShader && SSSprite::getCustomShaderProgram() != NULL;
+#else
+		m_useCustomShader = false;
+#endif
+	}
+
+	/**
+	 * パーツを追加する. 頂点はパーツのローカル座標で書き込み、end()でまとめて変換する.
+	 * rect, rectSizeはスプライトのsetTextureRectに渡す値
+	 */
+	void addPart(int partNo, const SSPartFrame& pf, CCTexture2D* tex, const CCRect& rect, const CCSize& rectSize,
+		float ax, float ay, float x, float y, const ccBlendFunc& blendFunc)
+	{
+		if (m_numParts == m_quads.size())
+		{
+			size_t size = m_numParts ? m_numParts * 2 : 16;
+			m_quads.resize(size);
+			m_transforms.resize(size);
+			m_parts.resize(size);
+		}
+		size_t index = m_numParts++;
+
+		Part& part = m_parts[index];
+		part.partNo = partNo;
+		part.tex = tex;
+		part.blendFunc = blendFunc;
+		part.colorBlendFuncNo = pf.colorBlendFuncNo;
+		part.alpha = static_cast<float>(pf.opacity) / 255.0f;
+
+		ccV3F_C4B_T2F_Quad& quad = m_quads[index];
+		unsigned int flags = pf.flags;
+
+		// 頂点
+		float w = rectSize.width;
+		float h = rectSize.height;
+		quad.bl.vertices = vertex3(0, 0, 0);
+		quad.br.vertices = vertex3(w, 0, 0);
+		quad.tl.vertices = vertex3(0, h, 0);
+		quad.tr.vertices = vertex3(w, h, 0);
+
+		// vertex deformation
+		if (flags & SS_PART_FLAG_VERTEX_OFFSET_TL)
+		{
+			quad.tl.vertices.x += pf.vertexOffsets[0][0];
+			quad.tl.vertices.y -= pf.vertexOffsets[0][1];
+		}
+		if (flags & SS_PART_FLAG_VERTEX_OFFSET_TR)
+		{
+			quad.tr.vertices.x += pf.vertexOffsets[1][0];
+			quad.tr.vertices.y -= pf.vertexOffsets[1][1];
+		}
+		if (flags & SS_PART_FLAG_VERTEX_OFFSET_BL)
+		{
+			quad.bl.vertices.x += pf.vertexOffsets[2][0];
+			quad.bl.vertices.y -= pf.vertexOffsets[2][1];
+		}
+		if (flags & SS_PART_FLAG_VERTEX_OFFSET_BR)
+		{
+			quad.br.vertices.x += pf.vertexOffsets[3][0];
+			quad.br.vertices.y -= pf.vertexOffsets[3][1];
+		}
+
+		// テクスチャ座標
+		CCRect pixelRect = CC_RECT_POINTS_TO_PIXELS(rect);
+		float atlasWidth = static_cast<float>(tex->getPixelsWide());
+		float atlasHeight = static_cast<float>(tex->getPixelsHigh());
+#if CC_FIX_ARTIFACTS_BY_STRECHING_TEXEL
+		float left = (2 * pixelRect.origin.x + 1) / (2 * atlasWidth);
+		float right = left + (pixelRect.size.width * 2 - 2) / (2 * atlasWidth);
+		float top = (2 * pixelRect.origin.y + 1) / (2 * atlasHeight);
+		float bottom = top + (pixelRect.size.height * 2 - 2) / (2 * atlasHeight);
+#else
+		float left = pixelRect.origin.x / atlasWidth;
+		float right = (pixelRect.origin.x + pixelRect.size.width) / atlasWidth;
+		float top = pixelRect.origin.y / atlasHeight;
+		float bottom = (pixelRect.origin.y + pixelRect.size.height) / atlasHeight;
+#endif
+		if (flags & SS_PART_FLAG_FLIP_H) std::swap(left, right);
+		if (flags & SS_PART_FLAG_FLIP_V) std::swap(top, bottom);
+		quad.bl.texCoords.u = left;
+		quad.bl.texCoords.v = bottom;
+		quad.br.texCoords.u = right;
+		quad.br.texCoords.v = bottom;
+		quad.tl.texCoords.u = left;
+		quad.tl.texCoords.v = top;
+		quad.tr.texCoords.u = right;
+		quad.tr.texCoords.v = top;
+
+		// カラーブレンドはシェーダーで行い、不透明度はuniformで渡す
+		if (m_useCustomShader)
+		{
+			quad.tl.colors = pf.colors[0];
+			quad.tr.colors = pf.colors[1];
+			quad.bl.colors = pf.colors[2];
+			quad.br.colors = pf.colors[3];
+		}
+		else
+		{
+			GLubyte opacity = static_cast<GLubyte>(pf.opacity);
+			GLubyte rgb = tex->hasPremultipliedAlpha() ? static_cast<GLubyte>(255 * (pf.opacity / 255.0f)) : 255;
+			ccColor4B color4 = { rgb, rgb, rgb, opacity };
+			quad.tl.colors = color4;
+			quad.tr.colors = color4;
+			quad.bl.colors = color4;
+			quad.br.colors = color4;
+		}
+
+		// CCNode::nodeToParentTransformと同じ変換. 角度はスプライトに設定する値(-pf.rotation)の符号を反転したもの
+		float c = 1.0f;
+		float s = 0.0f;
+		if (pf.rotation != 0)
+		{
+			float radians = CC_DEGREES_TO_RADIANS(pf.rotation);
+			c = cosf(radians);
+			s = sinf(radians);
+		}
+		CCAffineTransform& t = m_transforms[index];
+		t.a = c * pf.scaleX;
+		t.b = s * pf.scaleX;
+		t.c = -s * pf.scaleY;
+		t.d = c * pf.scaleY;
+		float apx = ax * w;
+		float apy = ay * h;
+		t.tx = x - (t.a * apx + t.c * apy);
+		t.ty = y - (t.b * apx + t.d * apy);
+	}
+
+	size_t getNumParts() const { return m_numParts; }
+	int getPartNo(size_t index) const { return m_parts[index].partNo; }
+	CCAffineTransform& getTransform(size_t index) { return m_transforms[index]; }
+
+	/** 頂点を変換し、描画の状態が同じパーツをまとめる */
+	void end()
+	{
+		if (m_numParts == 0) return;
+
+		transformQuads(&m_quads[0], &m_transforms[0], m_numParts);
+
+		CCAssert(m_numParts * 4 <= 0x10000, "Too many parts to draw.");
+		if (m_indices.size() < m_numParts * 6)
+		{
+			size_t oldSize = m_indices.size() / 6;
+			m_indices.resize(m_quads.size() * 6);
+			for (size_t i = oldSize; i < m_quads.size(); i++)
+			{
+				// CCTextureAtlasと同じ並び
+				GLushort v = static_cast<GLushort>(i * 4);
+				GLushort* p = &m_indices[i * 6];
+				p[0] = v;
+				p[1] = v + 1;
+				p[2] = v + 2;
+				p[3] = v + 3;
+				p[4] = v + 2;
+				p[5] = v + 1;
+			}
+		}
+
+		Command command = { 0, 1 };
+		for (size_t i = 1; i < m_numParts; i++)
+		{
+			if (isSameState(m_parts[command.start], m_parts[i]))
+			{
+				command.count++;
+			}
+			else
+			{
+				m_commands.push_back(command);
+				command.start = i;
+				command.count = 1;
+			}
+		}
+		m_commands.push_back(command);
+	}
+
+	/** SSPlayerの座標系で描画する */
+	void draw(CCGLProgram* program)
+	{
+		if (m_commands.empty()) return;
+
+#if USE_CUSTOM_SPRITE
+		if (m_useCustomShader) program = SSSprite::getCustomShaderProgram();
+#endif
+		program->use();
+#if (COCOS2D_VERSION >= 0x00020100)
+		program->setUniformsForBuiltins();
+#else
+		program->setUniformForModelViewProjectionMatrix();
+#endif
+
+		ccGLEnableVertexAttribs(kCCVertexAttribFlag_PosColorTex);
+
+		const size_t stride = sizeof(m_quads[0].bl);
+		const char* base = reinterpret_cast<const char*>(&m_quads[0]);
+		glVertexAttribPointer(kCCVertexAttrib_Position, 3, GL_FLOAT, GL_FALSE, stride, base + offsetof(ccV3F_C4B_T2F, vertices));
+		glVertexAttribPointer(kCCVertexAttrib_TexCoords, 2, GL_FLOAT, GL_FALSE, stride, base + offsetof(ccV3F_C4B_T2F, texCoords));
+		glVertexAttribPointer(kCCVertexAttrib_Color, 4, GL_UNSIGNED_BYTE, GL_TRUE, stride, base + offsetof(ccV3F_C4B_T2F, colors));
+
+		for (size_t i = 0; i < m_commands.size(); i++)
+		{
+			const Command& command = m_commands[i];
+			const Part& part = m_parts[command.start];
+			ccGLBlendFunc(part.blendFunc.src, part.blendFunc.dst);
+			ccGLBindTexture2D(part.tex->getName());
+#if USE_CUSTOM_SPRITE
+			if (m_useCustomShader)
+			{
+				glUniform1i(SSSprite::ssSelectorLocation, part.colorBlendFuncNo);
+				glUniform1f(SSSprite::ssAlphaLocation, part.alpha);
+			}
+#endif
+			glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(command.count * 6), GL_UNSIGNED_SHORT, &m_indices[command.start * 6]);
+		}
+
+		CHECK_GL_ERROR_DEBUG();
+		CC_INCREMENT_GL_DRAWS(m_commands.size());
+	}
+
+	/** 描画するパーツをすべて取り除く */
+	void clear()
+	{
+		m_numParts = 0;
+		m_commands.clear();
+	}
+
+private:
+	struct Part
+	{
+		int				partNo;
+		CCTexture2D*	tex;				// SSImageListが保持している
+		ccBlendFunc		blendFunc;
+		int				colorBlendFuncNo;
+		float			alpha;
+	};
+
+	struct Command
+	{
+		size_t			start;
+		size_t			count;
+	};
+
+	bool isSameState(const Part& a, const Part& b) const
+	{
+		if (a.tex != b.tex || a.blendFunc.src != b.blendFunc.src || a.blendFunc.dst != b.blendFunc.dst) return false;
+		// カスタムシェーダーではパーツごとにuniformを設定する
+		return !m_useCustomShader || (a.colorBlendFuncNo == b.colorBlendFuncNo && a.alpha == b.alpha);
+	}
+
+	/**
+	 * 四角形の4頂点をまとめて変換する.
+	 * 分岐のない単純なループにしてあり、コンパイラのベクトル化が効きやすい.
+	 */
+	static void transformQuads(ccV3F_C4B_T2F_Quad* quads, const CCAffineTransform* transforms, size_t count)
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			const CCAffineTransform& t = transforms[i];
+			ccV3F_C4B_T2F* v = &quads[i].tl;
+			for (int j = 0; j < 4; j++)
+			{
+				float x = v[j].vertices.x;
+				float y = v[j].vertices.y;
+				v[j].vertices.x = t.a * x + t.c * y + t.tx;
+				v[j].vertices.y = t.b * x + t.d * y + t.ty;
+			}
+		}
+	}
+
+	std::vector<ccV3F_C4B_T2F_Quad>	m_quads;
+	std::vector<CCAffineTransform>	m_transforms;
+	std::vector<Part>				m_parts;
+	std::vector<Command>			m_commands;
+	std::vector<GLushort>			m_indices;
+	size_t							m_numParts;		// 使用中の要素数. 配列は縮めずに使い回す
+	bool							m_useCustomShader;
+};
+
+
+
+/**
+ * SSSpriteApplyCache
+ * 前のフレームでスプライトに設定した値を描画順ごとに保持し、変わったプロパティだけを設定し直すために使います.
+ * 表示中のスプライトとバッチノードも保持し、表示状態が切り替わるノードだけを設定します.
+ */
+
+class SSSpriteApplyCache
+{
+public:
+	struct Entry
+	{
+		CCSprite*		sprite;
+		unsigned int	stamp;				// 値を設定したフレーム
+		CCTexture2D*	tex;
+		ccBlendFunc		blendFunc;
+		CCRect			rect;
+		CCSize			rectSize;
+		unsigned int	quadFlags;			// 反転と頂点変形のフラグ
+		int				vertexOffsets[4][2];
+		int				opacity;
+		float			ax, ay;
+		float			rotation;
+		float			scaleX, scaleY;
+		float			x, y;
+
+		Entry() : sprite(NULL), stamp(0) {}
+	};
+
+	SSSpriteApplyCache()
+		: m_stamp(0)
+	{}
+
+	/** フレームの適用を始める */
+	void begin()
+	{
+		m_stamp++;
+	}
+
+	/**
+	 * 描画順indexのスプライトに前のフレームで設定した値を返す.
+	 * 直前のフレームで同じスプライトに値を設定していないときはvalidをfalseにする. このときはすべて設定し直す
+	 */
+	Entry& get(size_t index, CCSprite* sprite, bool& valid)
+	{
+		if (index >= m_entries.size()) m_entries.resize(index + 1);
+		Entry& entry = m_entries[index];
+		valid = entry.sprite == sprite && entry.stamp + 1 == m_stamp;
+		entry.sprite = sprite;
+		entry.stamp = m_stamp;
+		return entry;
+	}
+
+	/** 描画順indexのスプライトの値を破棄する. 次に取得したときはすべて設定し直す */
+	void invalidate(size_t index)
+	{
+		if (index < m_entries.size()) m_entries[index].sprite = NULL;
+	}
+
+	/** このフレームで表示するノード */
+	void show(CCNode* node)
+	{
+		if (!node->isVisible()) node->setVisible(true);
+		m_shownNodes.push_back(node);
+	}
+
+	/** 前のフレームで表示していて、このフレームで表示しなかったノードを非表示にする */
+	void hideUnused()
+	{
+		std::sort(m_shownNodes.begin(), m_shownNodes.end());
+		for (size_t i = 0; i < m_visibleNodes.size(); i++)
+		{
+			CCNode* node = m_visibleNodes[i];
+			if (!std::binary_search(m_shownNodes.begin(), m_shownNodes.end(), node)) node->setVisible(false);
+		}
+		m_visibleNodes.swap(m_shownNodes);
+		m_shownNodes.clear();
+	}
+
+	/** 保持している値を破棄する. 子ノードを削除したときや、すべて非表示にしたときに呼ぶ */
+	void clear()
+	{
+		m_entries.clear();
+		m_visibleNodes.clear();
+		m_shownNodes.clear();
+	}
+
+private:
+	std::vector<Entry>		m_entries;
+	std::vector<CCNode*>	m_visibleNodes;		// 前のフレームで表示したノード（ソート済み）
+	std::vector<CCNode*>	m_shownNodes;		// このフレームで表示したノード
+	unsigned int			m_stamp;
+};
+
+
+
+/**
+ * SSBatchPlan
+ * SSPlayerBatch配下で、ジョイント（描画順が続き同じノードへ置けるパーツのまとまり）ごとの配置を保持します.
+ * ジョイントの並び（バッチノードを使うか、テクスチャ）が前のフレームと同じあいだは、ジョイントをノードに付けたままにし、
+ * スプライトが入れ替わったジョイントだけをその場で組み直します.
+ */
+
+class SSBatchPlan
+{
+public:
+	SSBatchPlan()
+		: m_changed(true)
+	{}
+
+	/** フレームの配置を組み立て始める */
+	void begin()
+	{
+		m_nextRuns.clear();
+		m_nextSprites.clear();
+	}
+
+	/** 新しいジョイントを追加する */
+	void addRun(bool useBatchNode, CCTexture2D* tex)
+	{
+		Run run;
+		run.useBatchNode = useBatchNode;
+		run.tex = tex;
+		run.numSprites = 0;
+		m_nextRuns.push_back(run);
+	}
+
+	/** 最後に追加したジョイントへ、描画順indexのスプライトを追加する */
+	void addSprite(size_t index)
+	{
+		m_nextSprites.push_back(index);
+		m_nextRuns.back().numSprites++;
+	}
+
+	/**
+	 * 組み立てた配置を前のフレームと比べる.
+	 * ジョイントの並びが変わったときは、SSPlayerBatchでノードへ配置し直す.
+	 * 並びが同じときは、スプライトが入れ替わったジョイントだけを組み直す
+	 */
+	void end(CCArray& jointSprites, CCArray& batchSprites)
+	{
+		if (m_changed ||
+			m_nextRuns.size() != m_runs.size() ||
+			!std::equal(m_nextRuns.begin(), m_nextRuns.end(), m_runs.begin(), Run::sameNode))
+		{
+			m_runs.swap(m_nextRuns);
+			m_sprites.swap(m_nextSprites);
+			m_changed = true;
+			return;
+		}
+
+		// スプライトが入れ替わったジョイントを探す.
+		// 別のジョイントへ移るスプライトがあるため、すべて外してから付け直す
+		m_rebuiltRuns.clear();
+		size_t spriteNo = 0;
+		size_t prevSpriteNo = 0;
+		for (size_t i = 0; i < m_nextRuns.size(); i++)
+		{
+			const Run& run = m_nextRuns[i];
+			CCNode* jointNode = static_cast<CCNode*>( jointSprites.objectAtIndex(i) );
+			bool same = run.numSprites == m_runs[i].numSprites &&
+				std::equal(m_nextSprites.begin() + spriteNo, m_nextSprites.begin() + spriteNo + run.numSprites, m_sprites.begin() + prevSpriteNo);
+			for (int n = 0; same && n < run.numSprites; n++)
+			{
+				// バッチノードから先に外したスプライト
+				same = static_cast<CCNode*>( batchSprites.objectAtIndex(m_nextSprites[spriteNo + n]) )->getParent() == jointNode;
+			}
+			if (!same)
+			{
+				jointNode->removeAllChildrenWithCleanup(false);
+				m_rebuiltRuns.push_back(i);
+			}
+			spriteNo += run.numSprites;
+			prevSpriteNo += m_runs[i].numSprites;
+		}
+		m_runs.swap(m_nextRuns);
+		m_sprites.swap(m_nextSprites);
+
+		for (size_t r = 0; r < m_rebuiltRuns.size(); r++)
+		{
+			addSprites(m_rebuiltRuns[r], jointSprites, batchSprites);
+		}
+	}
+
+	/** ノードへ配置し直す必要があるか */
+	bool isChanged() const
+	{
+		return m_changed;
+	}
+
+	/** 配置を破棄し、ジョイントをノードから外す. 次の配置し直しでは何も置かない */
+	void clear(CCArray& jointSprites)
+	{
+		for (size_t i = 0; i < jointSprites.count(); i++)
+		{
+			static_cast<CCNode*>( jointSprites.objectAtIndex(i) )->removeFromParentAndCleanup(false);
+		}
+		m_runs.clear();
+		m_sprites.clear();
+		m_changed = true;
+	}
+
+	/**
+	 * バッチのノードへジョイントを配置する.
+	 * ノードの割り当てを揃えるため、配置し直すときは登録順にすべてのプレイヤーについて呼び出す.
+	 * 置き先のノードと描画順が変わらないジョイントは付けたままにする
+	 */
+	void attach(SSPlayerBatch* batch, CCArray& jointSprites, CCArray& batchSprites, int order)
+	{
+		if (m_changed)
+		{
+			for (size_t i = 0; i < jointSprites.count(); i++)
+			{
+				static_cast<CCNode*>( jointSprites.objectAtIndex(i) )->removeAllChildrenWithCleanup(false);
+			}
+		}
+
+		for (size_t i = 0; i < jointSprites.count(); i++)
+		{
+			CCSprite* jointNode = static_cast<CCSprite*>( jointSprites.objectAtIndex(i) );
+			CCNode* parentNode = NULL;
+			if (i < m_runs.size()) batch->getNode(parentNode, m_runs[i].useBatchNode, m_runs[i].tex);
+			if (jointNode->getParent() == parentNode && jointNode->getZOrder() == order) continue;
+
+			// バッチノードに付いたままテクスチャを変えることはできないため、外してから設定する
+			jointNode->removeFromParentAndCleanup(false);
+			if (!parentNode) continue;
+			jointNode->setTexture(m_runs[i].tex);
+			parentNode->addChild(jointNode, order);
+		}
+
+		if (m_changed)
+		{
+			for (size_t i = 0; i < m_runs.size(); i++)
+			{
+				addSprites(i, jointSprites, batchSprites);
+			}
+			m_changed = false;
+		}
+	}
+
+private:
+	struct Run
+	{
+		bool			useBatchNode;
+		CCTexture2D*	tex;
+		int				numSprites;
+
+		/** 同じノードへ置けるジョイントか */
+		static bool sameNode(const Run& lhs, const Run& rhs)
+		{
+			return lhs.useBatchNode == rhs.useBatchNode && lhs.tex == rhs.tex;
+		}
+	};
+
+	/** index番目のジョイントへスプライトを付ける */
+	void addSprites(size_t index, CCArray& jointSprites, CCArray& batchSprites)
+	{
+		size_t spriteNo = 0;
+		for (size_t i = 0; i < index; i++) spriteNo += m_runs[i].numSprites;
+
+		CCNode* jointNode = static_cast<CCNode*>( jointSprites.objectAtIndex(index) );
+		for (int n = 0; n < m_runs[index].numSprites; n++)
+		{
+			jointNode->addChild(static_cast<CCNode*>( batchSprites.objectAtIndex(m_sprites[spriteNo + n]) ));
+		}
+	}
+
+	std::vector<Run>		m_runs;
+	std::vector<size_t>		m_sprites;			// ジョイント順に並べた、スプライトの描画順
+	std::vector<Run>		m_nextRuns;
+	std::vector<size_t>		m_nextSprites;
+	std::vector<size_t>		m_rebuiltRuns;		// スプライトを付け直すジョイント
+	bool					m_changed;
+};
+
+
+
+/**
+ * SSFrameEvaluation
+ * フレームの評価（再生位置を進め、フレームデータをデコードする）の結果を、シーングラフへ適用するまで保持します.
+ * 評価はSSPlayerBatchのワーカースレッドで行われることがあるため、ユーザーデータもここに溜めておき、適用するときに通知します.
+ */
+
+struct SSFrameEvaluation
+{
+	struct UserDataEvent
+	{
+		unsigned int	animationNo;	// 溜めたときのanimationNo
+		int				frameNo;
+		int				partId;
+		SSUserData		data;
+		std::string		str;			// 展開したフレームデータは破棄されることがあるため、文字列はコピーしておく
+	};
+
+	bool			decoded;			// デコードしたフレームがあり、まだ適用していない
+	bool			unchanged;			// 適用済みのフレームと同じ
+	float			position;
+	bool			interpolate;		// 次のフレームとの間を補間する
+	float			ratio;
+	float			playingFrame;		// 評価した再生位置
+	bool			playEnd;
+	std::vector<UserDataEvent>	userData;
+	unsigned int	animationNo;		// アニメーションを解放するたびに進める
+
+	SSFrameEvaluation()
+		: decoded(false), unchanged(false), position(0.0f), interpolate(false), ratio(0.0f), playingFrame(0.0f), playEnd(false), animationNo(0)
+	{}
+};
+
+
+
+/**
+ * SSPlayer
+ */
+
+/**
+ * ブレンド方法を求める
+ * 標準状態でMIXブレンド相当になります
+ * BlendFuncの値を変更することでブレンド方法を切り替えます
+ */
+static ccBlendFunc getPartBlendFunc(CCTexture2D* tex, const SSPartData* partData, bool useCustomShaderProgram)
+{
+	ccBlendFunc blendFunc;
+	if (!tex->hasPremultipliedAlpha())
+	{
+		blendFunc.src = GL_SRC_ALPHA;
+		blendFunc.dst = GL_ONE_MINUS_SRC_ALPHA;
+	}
+	else
+	{
+		blendFunc.src = CC_BLEND_SRC;
+		blendFunc.dst = CC_BLEND_DST;
+	}
+
+	// カスタムシェーダを使用する場合
+	if (useCustomShaderProgram) {
+		blendFunc.src = GL_SRC_ALPHA;
+	}
+	// 加算ブレンド
+	if (partData->alphaBlend == kSSPartAlphaBlendAddition) {
+		blendFunc.dst = GL_ONE;
+	}
+	return blendFunc;
+}
+
+SSPlayer::SSPlayer(void)
+	: m_ssDataHandle(0)
+	, m_dataFile(0)
+	, m_frameDecoder(0)
+	, m_nextFrameDecoder(0)
+	, m_textureRectTable(0)
+	, m_partNameIndex(0)
+	, m_directRenderer(0)
+	, m_applyCache(new SSSpriteApplyCache())
+	, m_batchPlan(new SSBatchPlan())
+	, m_evaluation(new SSFrameEvaluation())
+	, m_appliedFramePosition(-1.0f)
+	, m_imageList(0)
+	, m_frameSkipEnabled(true)
+	, m_interpolationEnabled(false)
+	, m_delegate(0)
+	, m_playEndTarget(NULL)
+	, m_playEndSelector(NULL)
+	, m_batch(0)
+	, m_ssPlayerScaleX( 1.0f )
+	, m_ssPlayerScaleY( 1.0f )
+	, m_ssPlayerFlipX( false )
+	, m_ssPlayerFlipY( false )
+	, m_integerPositionEnabled(false)
+{
+}
+
+SSPlayer* SSPlayer::create()
+{
+	SSPlayer* player = new SSPlayer();
+	if (player && player->init())
+	{
+		player->autorelease();
+		return player;
+	}
+	CC_SAFE_DELETE(player);
+	return NULL;
+}
+	
+SSPlayer* SSPlayer::create(const SSData* ssData, SSImageList* imageList, int loop)
+{
+	SSPlayer* player = create();
+	if (player)
+	{
+		player->setAnimation(ssData, imageList, loop);
+	}
+	return player;
+}
+
+SSPlayer* SSPlayer::create(SSDataFile* dataFile, SSImageList* imageList, int loop)
+{
+	SSPlayer* player = create();
+	if (player)
+	{
+		player->setAnimation(dataFile, imageList, loop);
+	}
+	return player;
+}
+
+SSPlayer::~SSPlayer()
+{
+	this->unscheduleUpdate();
+	clearAnimation();
+	releaseParts();
+	CC_SAFE_DELETE(m_directRenderer);
+	CC_SAFE_DELETE(m_applyCache);
+	CC_SAFE_DELETE(m_batchPlan);
+	CC_SAFE_DELETE(m_evaluation);
+}
+
+bool SSPlayer::init()
+{
+    if ( !CCSprite::init() )
+    {
+        return false;
+    }
+
+	return true;
+}
+
+void SSPlayer::allocParts(int numParts, bool useCustomShaderProgram)
+{
+	//BatchNodeの数はパーツ数ではなく、構造によって変わってくるので、setFrameメソッドで動的に行う
+	//ここではインスタンスは生成せず、削除のみを行う
+	//パーツ数が同じでも構造が違えばBatchNodeの数は変わってくるので、
+	//以前のパーツ数に関わらず子要素を全て削除する
+	this->removeAllChildrenWithCleanup(true);
+	m_applyCache->clear();
+	m_batchPlan->clear(m_jointSprites);
+	invalidateFrame();
+	if (m_partStates.count() != numParts)
+	{
+		// 既存パーツ解放
+		// release old parts.
+		m_partStates.removeAllObjects();
+
+		m_jointSprites.removeAllObjects();
+		m_batchSprites.removeAllObjects();
+
+		// パーツ数だけSPartStateを作成する
+		// create SSPartState objects.
+		for (int i = 0; i < numParts; i++)
+		{
+			SSPartState* state = new SSPartState();
+			m_partStates.addObject(state);
+		}
+	}
+	else
+	{
+		// SPartState初期化
+		// initialize SPartState objects.
+		for (int i = 0; i < numParts; i++)
+		{
+			SSPartState* partState = static_cast<SSPartState*>( m_partStates.objectAtIndex(i) );
+			partState->init();
+		}
+	}
+}
+
+void SSPlayer::releaseParts()
+{
+	// パーツの子CCSpriteを全て削除
+	// remove children CCSprite objects.
+	this->removeAllChildrenWithCleanup(true);
+	m_applyCache->clear();
+	m_batchPlan->clear(m_jointSprites);
+	invalidateFrame();
+	// パーツステートオブジェクトを全て削除
+	// remove parts status objects.
+	m_partStates.removeAllObjects();
+	
+	m_jointSprites.removeAllObjects();
+	m_batchSprites.removeAllObjects();
+}
+
+bool SSPlayer::hasAnimation() const
+{
+	return m_ssDataHandle != 0;
+}
+
+void SSPlayer::clearAnimation()
+{
+	if (!hasAnimation()) return;
+
+	CC_SAFE_DELETE(m_frameDecoder);
+	CC_SAFE_DELETE(m_nextFrameDecoder);
+	CC_SAFE_DELETE(m_textureRectTable);
+	SSPartNameIndex::releaseIndex(m_partNameIndex);
+	m_partNameIndex = 0;
+	if (m_directRenderer) m_directRenderer->clear();
+	m_batchPlan->clear(m_jointSprites);
+	// 溜めているユーザーデータは解放するアニメーションのもの
+	m_evaluation->userData.clear();
+	m_evaluation->animationNo++;
+	CC_SAFE_DELETE(m_ssDataHandle);
+	if (m_dataFile) SSAssetManager::removeOwner(m_dataFile);
+	CC_SAFE_RELEASE_NULL(m_dataFile);
+	m_imageList->release();
+	m_imageList = 0;
+}
+
+void SSPlayer::setAnimation(const SSData* ssData, SSImageList* imageList, int loop)
+{
+	CCAssert(ssData != NULL, "zero is ssData pointer");
+	CCAssert(imageList != NULL, "zero is imageList pointer");
+
+	this->unscheduleUpdate();//既存のSSPlayerに別のSSDataを読みこませようとすると落ちるので追加
+	clearAnimation();
+
+	SSDataHandle* dataHandle = new SSDataHandle(ssData);
+
+	// パーツアロケート
+	// allocate parts.
+	bool useCustomShaderProgram = (dataHandle->getFlags() & SS_DATA_FLAG_USE_COLOR_BLEND) != 0;
+	allocParts(dataHandle->getNumParts(), useCustomShaderProgram);
+
+	// アニメーションパラメータ初期化
+	// initialize animation parameters.
+	m_ssDataHandle = dataHandle;
+	m_frameDecoder = new SSFrameDecoder(dataHandle);
+	if (dataHandle->getFlags() & SS_DATA_FLAG_RECT_TABLE)
+	{
+		m_textureRectTable = new SSTextureRectTable(dataHandle);
+	}
+	m_partNameIndex = SSPartNameIndex::retainIndex(dataHandle);
+	imageList->retain();
+	m_imageList = imageList;
+
+	m_playingFrame = 0.0f;
+	m_step = 1.0f;
+	m_loop = loop;
+	m_loopCount = 0;
+
+	if (!m_batch)
+	{
+		setFrame(0);
+		this->scheduleUpdate();
+	}
+}
+
+void SSPlayer::setAnimation(SSDataFile* dataFile, SSImageList* imageList, int loop)
+{
+	CCAssert(dataFile != NULL, "zero is dataFile pointer");
+
+	// 同じファイルを設定し直すときにclearAnimation()で解放されないよう、先に保持する
+	dataFile->retain();
+	SSAssetManager::addOwner(dataFile);
+	setAnimation(dataFile->getData(), imageList, loop);
+	m_dataFile = dataFile;
+}
+
+const SSData* SSPlayer::getAnimation() const
+{
+	return m_ssDataHandle->getData();
+}
+
+void SSPlayer::update(float dt)
+{
+	if (!m_batch)
+	{
+		updateFrame(dt);
+	}
+}
+
+void SSPlayer::updateFrame(float dt)
+{
+	if (!hasAnimation()) return;
+
+	evaluateFrame(dt, CCDirector::sharedDirector()->getAnimationInterval());
+	applyEvaluatedFrame();
+}
+
+void SSPlayer::evaluateFrame(float dt, float animationInterval)
+{
+	if (!hasAnimation()) return;
+	
+	bool playEnd = false;
+	if (m_loop == 0 || m_loopCount < m_loop)
+	{
+		// フレームを進める.
+		// forward frame.
+		const int numFrames = m_ssDataHandle->getNumFrames();
+
+		float fdt = m_frameSkipEnabled ? dt : animationInterval;
+		float s = fdt / (1.0f / m_ssDataHandle->getFps());
+		
+		//if (!m_frameSkipEnabled) CCLOG("%f", s);
+		
+		float next = m_playingFrame + (s * m_step);
+
+		int nextFrameNo = static_cast<int>(next);
+		float nextFrameDecimal = next - static_cast<float>(nextFrameNo);
+		int currentFrameNo = static_cast<int>(m_playingFrame);
+		
+		if (m_step >= 0)
+		{
+			// 順再生時.
+			// normal plays.
+			for (int c = nextFrameNo - currentFrameNo; c; c--)
+			{
+				int incFrameNo = currentFrameNo + 1;
+				if (incFrameNo >= numFrames)
+				{
+					// アニメが一巡
+					// turned animation.
+					m_loopCount += 1;
+					if (m_loop && m_loopCount >= m_loop)
+					{
+						// 再生終了.
+						// play end.
+						playEnd = true;
+						break;
+					}
+					
+					incFrameNo = 0;
+				}
+				currentFrameNo = incFrameNo;
+
+				// このフレームのユーザーデータをチェック
+				// check the user data of this frame.
+				queueUserData(currentFrameNo);
+			}
+		}
+		else
+		{
+			// 逆再生時.
+			// reverse play.
+			for (int c = currentFrameNo - nextFrameNo; c; c--)
+			{
+				int decFrameNo = currentFrameNo - 1;
+				if (decFrameNo < 0)
+				{
+					// アニメが一巡
+					// turned animation.
+					m_loopCount += 1;
+					if (m_loop && m_loopCount >= m_loop)
+					{
+						// 再生終了.
+						// play end.
+						playEnd = true;
+						break;
+					}
+				
+					decFrameNo = numFrames - 1;
+				}
+				currentFrameNo = decFrameNo;
+				
+				// このフレームのユーザーデータをチェック
+				// check the user data of this frame.
+				queueUserData(currentFrameNo);
+			}
+		}
+		
+		m_playingFrame = static_cast<float>(currentFrameNo) + nextFrameDecimal;
+	}
+
+	m_evaluation->playEnd = playEnd;
+	m_evaluation->playingFrame = m_playingFrame;
+	decodeFrame(getFrameNo(), m_playingFrame - static_cast<float>(getFrameNo()));
+}
+
+void SSPlayer::applyEvaluatedFrame()
+{
+	// ユーザーデータは評価した順に通知する
+	dispatchUserData();
+
+	bool playEnd = m_evaluation->playEnd;
+	m_evaluation->playEnd = false;
+
+	if (hasAnimation())
+	{
+		// 通知の中でアニメーションや再生位置が変えられたときは、デコードし直す
+		if (!m_evaluation->decoded || m_evaluation->playingFrame != m_playingFrame)
+		{
+			decodeFrame(getFrameNo(), m_playingFrame - static_cast<float>(getFrameNo()));
+		}
+		applyFrame();
+	}
+
+	if (playEnd && m_playEndTarget)
+	{
+		(m_playEndTarget->*m_playEndSelector)(this);
+	}
+}
+
+int SSPlayer::getFrameNo() const
+{
+	return static_cast<int>(m_playingFrame);
+}
+
+void SSPlayer::setFrameNo(int frameNo)
+{
+	m_playingFrame = frameNo;
+}
+
+float SSPlayer::getStep() const
+{
+	return m_step;
+}
+
+void SSPlayer::setStep(float step)
+{
+	m_step = step;
+}
+
+int SSPlayer::getLoop() const
+{
+	return m_loop;
+}
+
+void SSPlayer::setLoop(int loop)
+{
+	if (loop < 0) return;
+	m_loop = loop;
+	// 最後のフレームから先頭へ補間するかが変わる
+	invalidateFrame();
+}
+
+int SSPlayer::getLoopCount() const
+{
+	return m_loopCount;
+}
+
+void SSPlayer::clearLoopCount()
+{
+	m_loopCount = 0;
+}
+
+void SSPlayer::setFrameSkipEnabled(bool enabled)
+{
+	m_frameSkipEnabled = enabled;
+	m_playingFrame = (int)m_playingFrame;
+}
+	
+bool SSPlayer::isFrameSkipEnabled() const
+{
+	return m_frameSkipEnabled;
+}
+
+void SSPlayer::setInterpolationEnabled(bool enabled)
+{
+	m_interpolationEnabled = enabled;
+	invalidateFrame();
+}
+
+bool SSPlayer::isInterpolationEnabled() const
+{
+	return m_interpolationEnabled;
+}
+
+void SSPlayer::setIntegerPositionEnabled(bool enabled)
+{
+	m_integerPositionEnabled = enabled;
+	invalidateFrame();
+}
+
+bool SSPlayer::isIntegerPositionEnabled() const
+{
+	return m_integerPositionEnabled;
+}
+
+void SSPlayer::setDelegate(SSPlayerDelegate* delegate)
+{
+	m_delegate = delegate;
+}
+
+void SSPlayer::setPlayEndCallback(CCObject* target, SEL_PlayEndHandler selector)
+{
+	CC_SAFE_RELEASE(m_playEndTarget);
+	CC_SAFE_RETAIN(target);
+	m_playEndTarget = target;
+	m_playEndSelector = selector;
+}
+
+bool SSPlayer::getPartState(SSPlayer::PartState& result, const char* name)
+{
+	return getPartState(result, getPartHandle(name));
+}
+
+SSPlayer::PartHandle SSPlayer::getPartHandle(const char* name) const
+{
+	CCAssert(name != NULL, "zero is name pointer");
+
+	PartHandle handle;
+	if (hasAnimation())
+	{
+		int index = m_partNameIndex->indexOfPart(name);
+		if (index >= 0)
+		{
+			handle.data = m_ssDataHandle->getData();
+			handle.serial = m_partNameIndex->getSerial();
+			handle.index = index;
+		}
+	}
+	return handle;
+}
+
+bool SSPlayer::getPartState(SSPlayer::PartState& result, const PartHandle& handle)
+{
+	// 別のアニメーションで求めたハンドルは使えない. 同じアドレスに読み込み直したデータも通し番号で区別する
+	if (!hasAnimation() || handle.data != m_ssDataHandle->getData() || handle.serial != m_partNameIndex->getSerial()) return false;
+	if (handle.index < 0 || handle.index >= static_cast<int>(m_partStates.count())) return false;
+
+	const SSPartState* partState = static_cast<SSPartState*>( m_partStates.objectAtIndex(handle.index) );
+	partState->copyParameters(result);
+	return true;
+}
+
+void SSPlayer::setFrame(int frameNo, float frameDecimal)
+{
+	decodeFrame(frameNo, frameDecimal);
+	applyFrame();
+}
+
+void SSPlayer::invalidateFrame()
+{
+	m_appliedFramePosition = -1.0f;
+	m_evaluation->decoded = false;
+}
+
+void SSPlayer::decodeFrame(int frameNo, float frameDecimal)
+{
+	// シーングラフには触れない. SSPlayerBatchのワーカースレッドから呼ばれることがある
+	SSFrameEvaluation* e = m_evaluation;
+
+	// 前回と同じフレームのときは何もしない. SSPlayerBatch配下ではジョイントに自身の位置などを反映するため、常に適用する
+	float position = static_cast<float>(frameNo) + (m_interpolationEnabled ? frameDecimal : 0.0f);
+	e->decoded = true;
+	e->position = position;
+	e->unchanged = !m_batch && position == m_appliedFramePosition;
+	if (e->unchanged) return;
+
+	// パーツごとの状態をデコードしてから描画する
+	// フレームを間引いたデータでは、直前のフレームデータを使う
+	int recordNo = m_ssDataHandle->findFrameRecord(frameNo);
+	int recordTime = m_ssDataHandle->getFrameRecordTime(recordNo);
+	m_frameDecoder->decode(recordNo);
+
+	// 補間するとき、間引かれたフレームを表示するときは次のフレームデータもデコードしておく
+	bool interpolate = false;
+	float ratio = 0.0f;
+	if (position > static_cast<float>(recordTime))
+	{
+		int nextRecordNo = recordNo + 1;
+		int nextRecordTime;
+		if (nextRecordNo < m_ssDataHandle->getNumFrameRecords())
+		{
+			nextRecordTime = m_ssDataHandle->getFrameRecordTime(nextRecordNo);
+		}
+		else
+		{
+			// 最後のフレームからは先頭のフレームへ補間する. 再生が終わるときは補間しない
+			nextRecordNo = (m_loop == 0 || m_loopCount + 1 < m_loop) ? 0 : -1;
+			nextRecordTime = m_ssDataHandle->getNumFrames();
+		}
+		if (nextRecordNo >= 0)
+		{
+			if (!m_nextFrameDecoder) m_nextFrameDecoder = new SSFrameDecoder(m_ssDataHandle);
+			m_nextFrameDecoder->decode(nextRecordNo);
+			interpolate = true;
+			ratio = (position - static_cast<float>(recordTime)) / static_cast<float>(nextRecordTime - recordTime);
+		}
+	}
+	e->interpolate = interpolate;
+	e->ratio = ratio;
+}
+
+void SSPlayer::applyFrame()
+{
+	SSFrameEvaluation* e = m_evaluation;
+	if (!e->decoded) return;
+	e->decoded = false;
+	if (e->unchanged) return;
+	m_appliedFramePosition = m_batch ? -1.0f : e->position;
+
+	m_applyCache->begin();
+	if (m_batch) m_batchPlan->begin();
+
+	// αブレンドでmix以外を使用、カラーブレンド、頂点変形が必要なものはバッチノードを使わず描画する
+	bool useCustomSprite = (m_ssDataHandle->getFlags() & (SS_DATA_FLAG_USE_ALPHA_BLEND | SS_DATA_FLAG_USE_COLOR_BLEND | SS_DATA_FLAG_USE_VERTEX_OFFSET)) != 0;
+	// カラーブレンドはカスタムシェーダーを使用する
+	bool useCustomShaderProgram = (m_ssDataHandle->getFlags() & SS_DATA_FLAG_USE_COLOR_BLEND) != 0;
+	// アフィン変換の有無
+	bool useAffineTransformation = (m_ssDataHandle->getFlags() & SS_DATA_FLAG_USE_AFFINE_TRANS) != 0;
+	// 頂点を直接書き込んで描画する. SSPlayerBatch配下ではスプライトを使う
+	SSDirectRenderer* directRenderer = m_batch ? NULL : m_directRenderer;
+	if (directRenderer) directRenderer->begin(useCustomShaderProgram);
+
+	size_t numParts = m_frameDecoder->getNumParts();
+	bool interpolate = e->interpolate;
+	float ratio = e->ratio;
+	SSPartFrame blendedFrame;
+	int nodeIndex = 0;//SSPlayerの子要素のCCSpriteBatchNodeのインデックス
+	int spriteIndex = 0;//CCSpriteBatchNodeの子要素のスプライトのIndex
+
+
+	CCSprite* jointNode = NULL;
+	int jointNodeIndex = -1;
+	bool jointToParentBatchNode = false;
+	CCTexture2D* jointTexture = NULL;
+
+
+	for (size_t i = 0; i < numParts; i++)
+	{
+		ss_u16 partNo = m_frameDecoder->getPartNo(i);
+		// 次のフレームにも描画されるパーツは、次のフレームとの間を補間する
+		const SSPartFrame& pf = (interpolate && m_nextFrameDecoder->isDrawn(partNo))
+			? blendPartFrame(blendedFrame, m_frameDecoder->getPartFrame(partNo), m_nextFrameDecoder->getPartFrame(partNo), ratio)
+			: m_frameDecoder->getPartFrame(partNo);
+		unsigned int flags = pf.flags;
+		int sx = pf.sx;
+		int sy = pf.sy;
+		int sw = pf.sw;
+		int sh = pf.sh;
+		float dx = pf.dx;
+		float dy = pf.dy;
+
+		if (m_integerPositionEnabled)
+		{
+			dx = (int)dx;
+			dy = (int)dy;
+		}
+
+		int ox = pf.ox;
+		int oy = pf.oy;
+
+		float rotation = -pf.rotation;
+		float scaleX = pf.scaleX;
+		float scaleY = pf.scaleY;
+		int opacity = pf.opacity;
+	
+		SSPartState* partState = static_cast<SSPartState*>( m_partStates.objectAtIndex(partNo) );
+		partState->m_sprite = NULL;
+		
+		// パーツの基本情報を取得
+		const SSPartData* partData = &m_ssDataHandle->getPartData()[partNo];
+		size_t imageNo = partData->imageNo;
+		CCTexture2D* tex = m_imageList->getTexture(imageNo);//このパーツの描画に使用するテクスチャ
+		if(!tex){ continue; }
+		SSPartType partType = static_cast<SSPartType>(partData->type);
+
+		// 参照元の範囲の表があるときは、求めておいた値を使う
+		const SSTextureRectTable::Entry* textureRect = (m_textureRectTable && pf.rectNo >= 0)
+			? &m_textureRectTable->get(imageNo, pf.rectNo)
+			: NULL;
+
+		// setTextureRectに渡す範囲と元の大きさ
+		CCRect rect;
+		CCSize rectSize;
+		if (textureRect)
+		{
+			rect = textureRect->rect;
+			rectSize = textureRect->size;
+		}
+		else
+		{
+#if ADJUST_UV_BY_CONTENT_SCALE_FACTOR
+			float sf = CC_CONTENT_SCALE_FACTOR();
+			rect = CCRect((float)sx / sf, (float)sy / sf, (float)sw / sf, (float)sh / sf);
+			rectSize = CCSize(sw, sh);
+#else
+			rect = CCRect(sx, sy, sw, sh);
+			rectSize = rect.size;
+#endif
+		}
+
+		float ax, ay;
+		if (textureRect)
+		{
+			ax = (flags & SS_PART_FLAG_ORIGIN_X) ? (float)ox * textureRect->invWidth : textureRect->defaultAnchor.x;
+			ay = (flags & SS_PART_FLAG_ORIGIN_Y) ? (float)oy * textureRect->invHeight : textureRect->defaultAnchor.y;
+		}
+		else
+		{
+			ax = (float)ox / (float)sw;
+			ay = (float)oy / (float)sh;
+		}
+
+		// スプライトを使わず、頂点を直接書き込む
+		if (directRenderer)
+		{
+			partState->m_x = dx;
+			partState->m_y = -dy;
+			partState->m_scaleX = scaleX;
+			partState->m_scaleY = scaleY;
+			partState->m_rotation = rotation;
+
+			// Normalパーツのみ実際に表示する
+			if ((partType == kSSPartTypeNormal) && !(flags & SS_PART_FLAG_INVISIBLE))
+			{
+				directRenderer->addPart(partNo, pf, tex, rect, rectSize, ax, ay, dx, -dy,
+					getPartBlendFunc(tex, partData, useCustomShaderProgram));
+			}
+			continue;
+		}
+
+		#if USE_CUSTOM_SPRITE
+		SSSprite* sprite;
+		#else
+		CCSprite* sprite;
+		#endif
+
+		//SSPlayerの子要素数を取得。m_pChildrenは遅延生成されるためNULLチェック必須
+		int childrenCount;
+		if( m_pChildren ){ childrenCount = m_pChildren->count(); } else { childrenCount =  0; }
+		
+		bool setBlendEnabled = false;
+
+		if (m_batch)
+		{
+			//bool useBatchNode = !useCustomSprite;
+			bool useBatchNode =
+				(flags & SS_PART_FLAGS_VERTEX_OFFSET) == 0 &&
+				partData->alphaBlend == kSSPartAlphaBlendMix &&
+				!useCustomShaderProgram;
+			
+			// 次のとき新たなジョイントを使う. ノードへの配置はSSPlayerBatchでまとめて行う
+			bool changeParentNode =
+				(!jointNode) ||
+				(useBatchNode != jointToParentBatchNode) ||
+				(jointToParentBatchNode && jointTexture != tex);
+		
+			if (changeParentNode)
+			{
+				jointNodeIndex++;
+				if (jointNodeIndex >= m_jointSprites.count())
+				{
+					jointNode = CCSprite::createWithTexture(tex);
+					jointNode->setTextureRect(CCRect(0, 0, 0, 0));
+					m_jointSprites.addObject(jointNode);
+				}
+				else
+				{
+					// テクスチャはノードへ配置するときに設定する
+					jointNode = (CCSprite*)m_jointSprites.objectAtIndex(jointNodeIndex);
+				}
+				
+				jointNode->setPositionX(this->getPositionX());
+				jointNode->setPositionY(this->getPositionY());
+				jointNode->setScaleX(this->m_fScaleX);
+				jointNode->setScaleY(this->m_fScaleY);
+				jointNode->setRotation(this->getRotation());
+				jointNode->setOpacity(this->getOpacity());
+				
+				m_batchPlan->addRun(useBatchNode, tex);
+				jointToParentBatchNode = useBatchNode;
+				jointTexture = tex;
+			}
+		
+		
+			childrenCount = m_batchSprites.count();
+			if (childrenCount <= i) {
+#if USE_CUSTOM_SPRITE
+				sprite =  SSSprite::create();
+				sprite->changeShaderProgram(useCustomShaderProgram);
+				sprite->setTexture(tex);
+#else
+				sprite = CCSprite::createWithTexture(tex);
+#endif
+				m_batchSprites.addObject(sprite);
+			} else {
+#if USE_CUSTOM_SPRITE
+				sprite = static_cast<SSSprite*>( m_batchSprites.objectAtIndex(i) );
+#else
+				sprite = static_cast<CCSprite*>( m_batchSprites.objectAtIndex(i) );
+#endif
+				// バッチノードから外すと頂点が作り直されるため、頂点を設定する前に外しておく.
+				// バッチノードに付いたままではテクスチャを変えられないため、テクスチャが変わるときも外す
+				if (sprite->getBatchNode() && (!useBatchNode || sprite->getTexture() != tex))
+				{
+					sprite->removeFromParentAndCleanup(false);
+					m_applyCache->invalidate(i);
+				}
+				sprite->setTexture(tex);
+			}
+			m_batchPlan->addSprite(i);
+
+			// ブレンド方法を設定する
+			setBlendEnabled = true;
+
+		}
+		else if (!useCustomSprite)
+		{
+			//-------------------------------------------------------------
+			//texと同じテクスチャを持っているバッチノードを探す
+			//-------------------------------------------------------------
+			CCSpriteBatchNode* node = NULL;//描画に使用するバッチノード
+			if( nodeIndex < childrenCount ){
+				//nodeIndexが指しているバッチノードが存在する
+				//texと同じテクスチャを持っているか調べる
+				node = static_cast<CCSpriteBatchNode*>( getChildren()->objectAtIndex(nodeIndex) );
+				if( node->getTexture() != tex ){
+					//描画したいテクスチャと同じテクスチャを持つバッチノードを順に検索する
+					spriteIndex = 0;//バッチノードが変わるのでスプライトのインデックスを初期化
+					do{
+						++nodeIndex;
+						if( nodeIndex == childrenCount ){
+							//texを使用するバッチノードは見つからなかった
+							node = NULL;
+							break; 
+						}
+						//SSPlayerの子要素には全てCCSpriteBatchNodeがセットされているので、キャストして順に検索する
+						node = static_cast<CCSpriteBatchNode*>( getChildren()->objectAtIndex(nodeIndex));
+					}while(node->getTexture() != tex );
+				}
+			}
+			
+			//描画したいテクスチャを持つバッチノードが見つからなかった
+			//子要素の最後尾に新しくバッチノードを作成し、追加する
+			if( !node ){
+				node = CCSpriteBatchNode::createWithTexture(tex);
+				addChild(node);
+			}
+			
+			//使用するバッチノードが決まったので表示状態にする
+			m_applyCache->show(node);
+			
+			//このバッチノードの子要素の未使用スプライトを取得する
+			//未使用スプライトが足りない場合は新規作成する
+			CCArray* aNodeChildren = node->getChildren();
+			int nodeChildrenCount;
+			if( aNodeChildren ){ nodeChildrenCount = aNodeChildren->count(); } else { nodeChildrenCount =  0; }
+			if( nodeChildrenCount == spriteIndex ){
+				//スプライトの数が足りないのでバッチノードの子要素として新しく作成する
+#if USE_CUSTOM_SPRITE
+				sprite =  SSSprite::create();
+				sprite->setTexture(node->getTexture());
+				sprite->changeShaderProgram(useCustomShaderProgram);
+#else
+				sprite = CCSprite::createWithTexture(tex);
+#endif
+				node->addChild(sprite);
+			} else {
+				//バッチノードの子要素のスプライトの数は足りているので、未使用のスプライトを描画に使用する
+#if USE_CUSTOM_SPRITE
+				sprite = static_cast<SSSprite*>( node->getChildren()->objectAtIndex( spriteIndex ) );
+#else
+				sprite = static_cast<CCSprite*>( node->getChildren()->objectAtIndex( spriteIndex ) );
+#endif
+			}
+			//このノードの子要素のspiretIndex番目のスプライトは使用済みなので、インデックスをインクリメントする
+			++spriteIndex;
 		}
 		else {
 			// バッチノードを使わず描画
@@ -1177,535 +4118,1628 @@ void SSPlayer::setFrame(int frameNo)
 #if USE_CUSTOM_SPRITE
 				sprite = static_cast<SSSprite*>( m_pChildren->objectAtIndex(i) );
 #else
-				sprite = static_cast<CCSprite*>( m_pChildren->objectAtIndex(i) );
+				sprite = static_cast<CCSprite*>( m_pChildren->objectAtIndex(i) );
+#endif
+				sprite->setTexture(tex);
+			}
+
+			// ブレンド方法を設定する
+			setBlendEnabled = true;
+		}
+
+		
+		// 直前のフレームで同じスプライトに設定した値と比べ、変わったプロパティだけを設定する
+		// （setterはそれぞれスプライトを更新が必要な状態にするため）
+		// テクスチャが変わったときは、ブレンド方法とテクスチャ座標が設定し直されるためすべて設定する
+		bool valid;
+		SSSpriteApplyCache::Entry& last = m_applyCache->get(i, sprite, valid);
+		valid = valid && last.tex == tex;
+
+		ccBlendFunc blendFunc = getPartBlendFunc(tex, partData, useCustomShaderProgram);
+		if (setBlendEnabled && (!valid || blendFunc.src != last.blendFunc.src || blendFunc.dst != last.blendFunc.dst))
+		{
+			sprite->setBlendFunc(blendFunc);
+		}
+
+		// setTextureRectで頂点が作り直されるため、頂点変形もあわせて比べる
+		unsigned int quadFlags = flags & (SS_PART_FLAG_FLIP_H | SS_PART_FLAG_FLIP_V | SS_PART_FLAGS_VERTEX_OFFSET);
+		bool quadChanged = !valid ||
+			quadFlags != last.quadFlags ||
+			!rect.equals(last.rect) ||
+			!rectSize.equals(last.rectSize) ||
+			((quadFlags & SS_PART_FLAGS_VERTEX_OFFSET) && std::memcmp(pf.vertexOffsets, last.vertexOffsets, sizeof(pf.vertexOffsets)) != 0);
+
+		if (quadChanged)
+		{
+#if ADJUST_UV_BY_CONTENT_SCALE_FACTOR
+			sprite->setTextureRect(rect, false, rectSize);
+#else
+			sprite->setTextureRect(rect);
+#endif
+		}
+
+		if (!valid || opacity != last.opacity) sprite->setOpacity( opacity );
+
+		bool transformChanged = quadChanged;
+		if (!valid || ax != last.ax || ay != last.ay)
+		{
+			sprite->setAnchorPoint(ccp(ax, ay));
+			transformChanged = true;
+		}
+
+		if (quadChanged)
+		{
+			sprite->setFlipX((flags & SS_PART_FLAG_FLIP_H) != 0);
+			sprite->setFlipY((flags & SS_PART_FLAG_FLIP_V) != 0);
+		}
+		if (!valid || rotation != last.rotation)
+		{
+			sprite->setRotation(rotation);
+			transformChanged = true;
+		}
+		if (!valid || scaleX != last.scaleX || scaleY != last.scaleY)
+		{
+			sprite->setScaleX(scaleX);
+			sprite->setScaleY(scaleY);
+			transformChanged = true;
+		}
+		if (!valid || dx != last.x || dy != last.y)
+		{
+			sprite->setPosition(ccp(dx, -dy));
+			transformChanged = true;
+		}
+
+		last.tex = tex;
+		last.blendFunc = blendFunc;
+		last.rect = rect;
+		last.rectSize = rectSize;
+		last.quadFlags = quadFlags;
+		std::memcpy(last.vertexOffsets, pf.vertexOffsets, sizeof(pf.vertexOffsets));
+		last.opacity = opacity;
+		last.ax = ax;
+		last.ay = ay;
+		last.rotation = rotation;
+		last.scaleX = scaleX;
+		last.scaleY = scaleY;
+		last.x = dx;
+		last.y = dy;
+
+		
+		ccV3F_C4B_T2F_Quad tempQuad;
+
+		#if USE_CUSTOM_SPRITE
+		ccV3F_C4B_T2F_Quad& vquad = sprite->getAttributeRef();
+		ccV3F_C4B_T2F_Quad& cquad = sprite->isCustomShaderProgramEnabled() ? sprite->getAttributeRef() : tempQuad;
+		#else
+		ccV3F_C4B_T2F_Quad& vquad = tempQuad;
+		ccV3F_C4B_T2F_Quad& cquad = tempQuad;
+		#endif
+
+		// vertex deformation
+		// 頂点を作り直していないときは、前のフレームで加えた値が残っている
+		if (quadChanged)
+		{
+			if (flags & SS_PART_FLAG_VERTEX_OFFSET_TL)
+			{
+				vquad.tl.vertices.x += pf.vertexOffsets[0][0];
+				vquad.tl.vertices.y -= pf.vertexOffsets[0][1];
+			}
+			if (flags & SS_PART_FLAG_VERTEX_OFFSET_TR)
+			{
+				vquad.tr.vertices.x += pf.vertexOffsets[1][0];
+				vquad.tr.vertices.y -= pf.vertexOffsets[1][1];
+			}
+			if (flags & SS_PART_FLAG_VERTEX_OFFSET_BL)
+			{
+				vquad.bl.vertices.x += pf.vertexOffsets[2][0];
+				vquad.bl.vertices.y -= pf.vertexOffsets[2][1];
+			}
+			if (flags & SS_PART_FLAG_VERTEX_OFFSET_BR)
+			{
+				vquad.br.vertices.x += pf.vertexOffsets[3][0];
+				vquad.br.vertices.y -= pf.vertexOffsets[3][1];
+			}
+		}
+
+
+		// color blend
+		cquad.tl.colors = pf.colors[0];
+		cquad.tr.colors = pf.colors[1];
+		cquad.bl.colors = pf.colors[2];
+		cquad.br.colors = pf.colors[3];
+
+		if (flags & SS_PART_FLAGS_COLOR_BLEND)
+		{
+			#if USE_CUSTOM_SPRITE
+			sprite->setColorBlendFunc(pf.colorBlendFuncNo);
+			#endif
+		}
+
+		// この時点の座標、スケール値などを記録しておく
+		partState->m_x = sprite->getPositionX();
+		partState->m_y = sprite->getPositionY();
+		partState->m_scaleX = sprite->getScaleX();
+		partState->m_scaleY = sprite->getScaleY();
+		partState->m_rotation = sprite->getRotation();
+		partState->m_sprite = sprite;
+		partState->m_transformChanged = transformChanged;
+
+		// Normalパーツのみ実際に表示する
+		bool visibled = (partType == kSSPartTypeNormal) && !(flags & SS_PART_FLAG_INVISIBLE);
+		if (visibled)
+		{
+			m_applyCache->show(sprite);
+		}
+		else if (sprite->isVisible())
+		{
+			sprite->setVisible(false);
+		}
+	}
+
+	// 使わなくなったスプライトとバッチノードを非表示にする
+	m_applyCache->hideUnused();
+	if (m_batch) m_batchPlan->end(m_jointSprites, m_batchSprites);
+
+#if (COCOS2D_VERSION >= 0x00020100)
+	if (useAffineTransformation)
+	{
+		//親のアフィン変換を適用するコード(SS5準拠）
+		//ルートパーツ以外を処理
+		size_t partsCount = m_ssDataHandle->getNumParts();
+		for (size_t partNo = 1; partNo < partsCount; partNo++)
+		{
+			CCAffineTransform trans = CCAffineTransformMakeIdentity();
+
+			//親子を調べる
+			const SSPartData* partData = &m_ssDataHandle->getPartData()[partNo];
+			SSPartState* paernt_partState = static_cast<SSPartState*>( m_partStates.objectAtIndex(partData->parentId) );
+			trans = paernt_partState->m_trans;
+
+			trans = CCAffineTransformTranslate( trans , paernt_partState->m_x , paernt_partState->m_y );
+			trans = CCAffineTransformRotate( trans , CC_DEGREES_TO_RADIANS(-paernt_partState->m_rotation) );// Rad?
+			trans = CCAffineTransformScale( trans , paernt_partState->m_scaleX,paernt_partState->m_scaleY );
+
+			SSPartState* partState = static_cast<SSPartState*>( m_partStates.objectAtIndex(partNo) );
+//			CCLOG("addr: %08lx, %08lx, %f, %f, %f, %f, %f", partState, partState->m_sprite, partState->m_x, partState->m_y, partState->m_scaleX, partState->m_scaleY, partState->m_rotation);
+//			if (!partState->m_sprite) continue;
+
+			partState->m_trans = trans;
+			if (partState->m_sprite)
+			{
+				// 他のプロパティで変換を計算し直すときは、追加の変換も設定し直す必要がある
+				if (partState->m_transformChanged ||
+					partState->m_transSprite != partState->m_sprite ||
+					!CCAffineTransformEqualToTransform(trans, partState->m_appliedTrans))
+				{
+					partState->m_sprite->setAdditionalTransform( trans );
+				}
+			}
+			partState->m_transSprite = partState->m_sprite;
+			partState->m_appliedTrans = trans;
+		}
+
+		if (directRenderer)
+		{
+			for (size_t i = 0; i < directRenderer->getNumParts(); i++)
+			{
+				const SSPartState* partState = static_cast<SSPartState*>( m_partStates.objectAtIndex(directRenderer->getPartNo(i)) );
+				CCAffineTransform& trans = directRenderer->getTransform(i);
+				trans = CCAffineTransformConcat( trans, partState->m_trans );
+			}
+		}
+	}
+#endif
+
+	if (directRenderer) directRenderer->end();
+}
+
+void SSPlayer::setDirectRenderEnabled(bool enabled)
+{
+	if (enabled == isDirectRenderEnabled()) return;
+	invalidateFrame();
+
+	if (enabled)
+	{
+		m_directRenderer = new SSDirectRenderer();
+	}
+	else
+	{
+		CC_SAFE_DELETE(m_directRenderer);
+	}
+	if (hasAnimation() && !m_batch)
+	{
+		setFrame(getFrameNo(), m_playingFrame - static_cast<float>(getFrameNo()));
+	}
+}
+
+bool SSPlayer::isDirectRenderEnabled() const
+{
+	return m_directRenderer != 0;
+}
+
+void SSPlayer::getFrameCacheStats(FrameCacheStats& stats)
+{
+	SSFrameCache::getInstance()->getStats(stats);
+}
+
+void SSPlayer::resetFrameCacheStats()
+{
+	SSFrameCache::getInstance()->resetStats();
+}
+
+void SSPlayer::setFrameCacheMemoryBudget(size_t bytes)
+{
+	SSFrameCache::getInstance()->setMemoryBudget(bytes);
+}
+
+size_t SSPlayer::getFrameCacheMemoryBudget()
+{
+	return SSFrameCache::getInstance()->getMemoryBudget();
+}
+
+void SSPlayer::draw(void)
+{
+	if (m_directRenderer && !m_batch)
+	{
+		m_directRenderer->draw(getShaderProgram());
+		return;
+	}
+	CCSprite::draw();
+}
+
+void SSPlayer::setFlipX(bool bFlipX)
+{
+	m_ssPlayerFlipX = bFlipX;
+	setScaleX(m_ssPlayerScaleX); 
+}
+
+void SSPlayer::setFlipY(bool bFlipY)
+{
+	m_ssPlayerFlipY = bFlipY;
+	setScaleX(m_ssPlayerScaleY); 
+}
+
+void SSPlayer::setScaleX(float fScaleX)
+{
+	m_ssPlayerScaleX = fScaleX;	
+	float temp = m_ssPlayerFlipX == true ? -m_ssPlayerScaleX : m_ssPlayerScaleX;
+	cocos2d::CCSprite::setScaleX(temp);
+}
+
+void SSPlayer::setScaleY(float fScaleY)
+{
+	m_ssPlayerScaleY = fScaleY;	
+	float temp = m_ssPlayerFlipY == true ? -m_ssPlayerScaleY : m_ssPlayerScaleY;
+	cocos2d::CCSprite::setScaleY(temp);
+}
+
+float SSPlayer::getScaleX()
+{
+	return m_ssPlayerScaleX;
+}
+
+float SSPlayer::getScaleY()
+{
+	return m_ssPlayerScaleY;
+}
+
+float SSPlayer::getScale()
+{
+    CCAssert( m_ssPlayerScaleX == m_ssPlayerScaleY, "SSPlayer#scale. ScaleX != ScaleY. Don't know which one to return");
+	return m_ssPlayerScaleX;
+}
+
+void SSPlayer::queueUserData(int frameNo)
+{
+	if (!m_delegate) return;
+
+	// ユーザーデータのあるフレームは間引かれないので、フレームデータが無いフレームにはユーザーデータも無い
+	int recordNo = m_ssDataHandle->findFrameRecord(frameNo);
+	if (m_ssDataHandle->getFrameRecordTime(recordNo) != frameNo) return;
+
+	const SSFrameData* frameData = &(m_ssDataHandle->getFrameData()[recordNo]);
+	size_t numUserData = static_cast<size_t>(frameData->numUserData);
+	if (numUserData == 0) return;
+	const void* userData = m_frameDecoder->getUserData(recordNo);
+	if (!userData) return;
+	SSDataReader r( static_cast<const ss_u16*>(userData) );
+
+	std::vector<SSFrameEvaluation::UserDataEvent>& events = m_evaluation->userData;
+	for (size_t i = 0; i < numUserData; i++)
+	{
+		int flags = r.readU16();
+		int partId = r.readU16();
+
+		events.resize(events.size() + 1);
+		SSFrameEvaluation::UserDataEvent& event = events.back();
+		event.animationNo = m_evaluation->animationNo;
+		event.frameNo = frameNo;
+		event.partId = partId;
+		SSUserData& data = event.data;
+		data.flags = 0;
+
+		if (flags & SS_USER_DATA_FLAG_NUMBER)
+		{
+			data.flags |= SSUserData::FLAG_NUMBER;
+			data.number = r.readS32();
+		}
+		else
+		{
+			data.number = 0;
+		}
+		
+		if (flags & SS_USER_DATA_FLAG_RECT)
+		{
+			data.flags |= SSUserData::FLAG_RECT;
+			data.rect[0] = r.readS32();
+			data.rect[1] = r.readS32();
+			data.rect[2] = r.readS32();
+			data.rect[3] = r.readS32();
+		}
+		else
+		{
+			data.rect[0] =
+			data.rect[1] =
+			data.rect[2] =
+			data.rect[3] = 0;
+		}
+		
+		if (flags & SS_USER_DATA_FLAG_POINT)
+		{
+			data.flags |= SSUserData::FLAG_POINT;
+			data.point[0] = r.readS32();
+			data.point[1] = r.readS32();
+		}
+		else
+		{
+			data.point[0] =
+			data.point[1] = 0;
+		}
+		
+		if (flags & SS_USER_DATA_FLAG_STRING)
+		{
+			data.flags |= SSUserData::FLAG_STRING;
+			int length;
+			const char* str = r.getString(&length);
+			event.str.assign(str, length);
+			data.strSize = length;
+		}
+		else
+		{
+			event.str.clear();
+			data.strSize = 0;
+		}
+		data.str = 0;
+	}
+}
+
+void SSPlayer::dispatchUserData()
+{
+	std::vector<SSFrameEvaluation::UserDataEvent>& events = m_evaluation->userData;
+	const unsigned int animationNo = m_evaluation->animationNo;
+	for (size_t i = 0; i < events.size(); i++)
+	{
+		// 通知の中でアニメーションが変えられたときは、残りはclearAnimation()で破棄されている.
+		// 変えた後に溜めたユーザーデータは次の通知まで残す
+		if (m_evaluation->animationNo != animationNo) return;
+		// デリゲートが外されたときは、残りを通知しない
+		if (!m_delegate) break;
+
+		const SSFrameEvaluation::UserDataEvent& event = events[i];
+		if (event.animationNo != animationNo) continue;
+		m_userData = event.data;
+		if (m_userData.flags & SSUserData::FLAG_STRING) m_userData.str = event.str.c_str();
+
+		const char* partName = m_ssDataHandle->getPartName(event.partId);
+		m_delegate->onUserData(this, &m_userData, event.frameNo, partName);
+	}
+	events.clear();
+}
+
+void SSPlayer::registerBatch(SSPlayerBatch *batch)
+{
+	this->unscheduleUpdate();
+	m_batch = batch;
+	invalidateFrame();
+	m_batchPlan->clear(m_jointSprites);
+}
+
+void SSPlayer::unregisterBatch(SSPlayerBatch *batch)
+{
+	m_batch = 0;
+	invalidateFrame();
+	m_batchPlan->clear(m_jointSprites);
+	this->scheduleUpdate();
+}
+
+bool SSPlayer::isBatchPlanChanged() const
+{
+	return m_batchPlan->isChanged();
+}
+
+void SSPlayer::attachBatchNodes(int order)
+{
+	m_batchPlan->attach(m_batch, m_jointSprites, m_batchSprites, order);
+}
+
+
+
+/**
+ * SSPlayerDelegate
+ */
+
+SSPlayerDelegate::~SSPlayerDelegate()
+{}
+
+void SSPlayerDelegate::onUserData(SSPlayer* player, const SSUserData* data, int frameNo, const char* partName)
+{}
+
+
+
+/**
+ * SSEvaluationPool
+ * SSPlayerBatchに登録されたプレイヤーのフレームの評価を、ワーカースレッドに分けて行います.
+ * プレイヤーを小さなまとまりに分け、手の空いたスレッド（呼び出し元のスレッドも含む）が順に取り出して処理します.
+ * 評価はプレイヤー自身のデコーダーと、変更されないアニメーションデータだけを参照します.
+ */
+
+class SSEvaluationPool
+{
+public:
+	explicit SSEvaluationPool(int numThreads)
+		: m_players(NULL)
+		, m_numPlayers(0)
+		, m_next(0)
+		, m_numDone(0)
+		, m_chunkSize(1)
+		, m_dt(0.0f)
+		, m_animationInterval(0.0f)
+		, m_generation(0)
+		, m_quit(false)
+	{
+		pthread_mutex_init(&m_mutex, NULL);
+		pthread_cond_init(&m_cond, NULL);
+		pthread_cond_init(&m_doneCond, NULL);
+		for (int i = 0; i < numThreads; i++)
+		{
+			pthread_t thread;
+			if (pthread_create(&thread, NULL, threadMain, this) == 0) m_threads.push_back(thread);
+		}
+	}
+
+	~SSEvaluationPool()
+	{
+		pthread_mutex_lock(&m_mutex);
+		m_quit = true;
+		pthread_cond_broadcast(&m_cond);
+		pthread_mutex_unlock(&m_mutex);
+		for (size_t i = 0; i < m_threads.size(); i++) pthread_join(m_threads[i], NULL);
+
+		pthread_cond_destroy(&m_doneCond);
+		pthread_cond_destroy(&m_cond);
+		pthread_mutex_destroy(&m_mutex);
+	}
+
+	/** ワーカースレッドの数を返す */
+	size_t getNumThreads() const
+	{
+		return m_threads.size();
+	}
+
+	/** プレイヤーのフレームを評価する. すべて終わるまで戻らない */
+	void evaluate(SSPlayer** players, size_t numPlayers, float dt, float animationInterval)
+	{
+		if (numPlayers == 0) return;
+
+		pthread_mutex_lock(&m_mutex);
+		m_players = players;
+		m_numPlayers = numPlayers;
+		m_next = 0;
+		m_numDone = 0;
+		// スレッドごとに数回ずつ取り出せる大きさに分ける
+		m_chunkSize = std::max<size_t>(1, numPlayers / ((m_threads.size() + 1) * 4));
+		m_dt = dt;
+		m_animationInterval = animationInterval;
+		m_generation++;
+		pthread_cond_broadcast(&m_cond);
+		pthread_mutex_unlock(&m_mutex);
+
+		work();
+
+		pthread_mutex_lock(&m_mutex);
+		while (m_numDone < m_numPlayers) pthread_cond_wait(&m_doneCond, &m_mutex);
+		m_players = NULL;
+		pthread_mutex_unlock(&m_mutex);
+	}
+
+private:
+	static void* threadMain(void* arg)
+	{
+		static_cast<SSEvaluationPool*>(arg)->run();
+		return NULL;
+	}
+
+	void run()
+	{
+		unsigned int generation = 0;
+		for (;;)
+		{
+			pthread_mutex_lock(&m_mutex);
+			while (!m_quit && m_generation == generation) pthread_cond_wait(&m_cond, &m_mutex);
+			if (m_quit)
+			{
+				pthread_mutex_unlock(&m_mutex);
+				break;
+			}
+			generation = m_generation;
+			pthread_mutex_unlock(&m_mutex);
+
+			work();
+		}
+	}
+
+	/** 残っているプレイヤーを取り出して評価する */
+	void work()
+	{
+		for (;;)
+		{
+			pthread_mutex_lock(&m_mutex);
+			if (!m_players || m_next >= m_numPlayers)
+			{
+				pthread_mutex_unlock(&m_mutex);
+				break;
+			}
+			SSPlayer** players = m_players + m_next;
+			size_t count = std::min(m_chunkSize, m_numPlayers - m_next);
+			m_next += count;
+			float dt = m_dt;
+			float animationInterval = m_animationInterval;
+			pthread_mutex_unlock(&m_mutex);
+
+			for (size_t i = 0; i < count; i++)
+			{
+				players[i]->evaluateFrame(dt, animationInterval);
+			}
+
+			pthread_mutex_lock(&m_mutex);
+			m_numDone += count;
+			if (m_numDone == m_numPlayers) pthread_cond_signal(&m_doneCond);
+			pthread_mutex_unlock(&m_mutex);
+		}
+	}
+
+	pthread_mutex_t			m_mutex;
+	pthread_cond_t			m_cond;				// 評価の開始を知らせる
+	pthread_cond_t			m_doneCond;			// 評価の終了を知らせる
+	std::vector<pthread_t>	m_threads;
+
+	SSPlayer**				m_players;
+	size_t					m_numPlayers;
+	size_t					m_next;				// 次に取り出すプレイヤー
+	size_t					m_numDone;
+	size_t					m_chunkSize;
+	float					m_dt;
+	float					m_animationInterval;
+	unsigned int			m_generation;
+	bool					m_quit;
+};
+
+static SSEvaluationPool* s_evaluationPool = NULL;
+
+static SSEvaluationPool* getEvaluationPool()
+{
+	if (!s_evaluationPool)
+	{
+		int numThreads = BATCH_EVALUATION_THREADS;
+		if (numThreads < 0)
+		{
+#if USE_SYSCONF
+			// 呼び出し元のスレッドも評価を行うため、CPUの数より１つ少なくする
+			long numCpus = sysconf(_SC_NPROCESSORS_ONLN);
+			numThreads = numCpus > 1 ? static_cast<int>(numCpus) - 1 : 0;
+#else
+			numThreads = 0;
 #endif
-				sprite->setTexture(tex);
-			}
+		}
+		s_evaluationPool = new SSEvaluationPool(numThreads);
+	}
+	return s_evaluationPool;
+}
+
+
+
+/**
+ * SSPlayerBatch
+ *
+ * SSPlayerをSSPlayerBatch配下に配置（addChild）することにより、
+ * できる限りバッチノードを使った描画を行うようになります。
+ * ※SSPlayerBatchはSSPlayerのみ登録可能です。
+ *
+ * 以下の条件を満たしているとき、バッチノードを使った描画が行われます。（条件に合わないパーツは単独で描画されます）
+ * ・同一のテクスチャを使用している
+ * ・次の効果を使用していない：頂点変形、カラーブレンド、αブレンドでMIX以外
+ */
+
+SSPlayerBatch::SSPlayerBatch()
+	: m_players(NULL)
+	, m_bundles(NULL)
+	, m_defaultCapacity(kDefaultSpriteBatchCapacity)
+	, m_planInvalid(true)
+	, m_parallelEvaluationEnabled(true)
+{
+}
+
+SSPlayerBatch::~SSPlayerBatch()
+{
+	this->unscheduleUpdate();
+	CC_SAFE_RELEASE_NULL(m_bundles);
+	CC_SAFE_RELEASE_NULL(m_players);
+}
+
+SSPlayerBatch* SSPlayerBatch::create()
+{
+	SSPlayerBatch* batch = new SSPlayerBatch();
+	if (batch && batch->init())
+	{
+		batch->autorelease();
+		return batch;
+	}
+	CC_SAFE_DELETE(batch);
+	return NULL;
+}
+
+bool SSPlayerBatch::init()
+{
+    if (!CCNode::init())
+	{
+		return false;
+	}
+	
+	CC_SAFE_RELEASE_NULL(m_bundles);
+	CC_SAFE_RELEASE_NULL(m_players);
+	
+	CCNode* players = CCNode::create();
+	if (!players)
+	{
+		return false;
+	}
+	
+	CCNode* bundles = CCNode::create();
+	if (!bundles)
+	{
+		delete players;
+		return false;
+	}
+	
+	players->retain();
+	bundles->retain();
+	
+	m_players = players;
+	players->setVisible(false);
+	CCNode::addChild(players, 0, 0);
+	m_bundles = bundles;
+	CCNode::addChild(bundles, 0, 0);
+	
+	this->scheduleUpdate();
+	return true;
+}
+
+void SSPlayerBatch::setDefaultSpriteBatchCapacity(unsigned int capacity)
+{
+	m_defaultCapacity = capacity;
+}
+
+void SSPlayerBatch::addChild(CCNode* child, int zOrder, int tag)
+{
+    CCAssert(child != NULL, "child should not be null");
+    CCAssert(dynamic_cast<SSPlayer*>(child) != NULL, "SSPlayerBatch only supports SSPlayer as children");
+    SSPlayer* player = (SSPlayer*)(child);
+
+	m_players->addChild(child, zOrder, tag);
+	player->registerBatch(this);
+	m_planInvalid = true;
+}
+
+void SSPlayerBatch::addChild(CCNode* child, int zOrder)
+{
+	CCNode::addChild(child, zOrder);
+}
+
+void SSPlayerBatch::addChild(CCNode* child)
+{
+	CCNode::addChild(child);
+}
+
+void SSPlayerBatch::removeChild(CCNode* child)
+{
+    CCAssert(child != NULL, "child should not be null");
+    SSPlayer* player = (SSPlayer*)(child);
+
+	player->unregisterBatch(this);
+	m_players->removeChild(player);
+	m_planInvalid = true;
+}
 
-			// ブレンド方法を設定する
-			setBlendEnabled = true;
+enum SSPlayerBatchTag
+{
+	SSPLAYERBATCHTAG_NODE = 1,
+	SSPLAYERBATCHTAG_BATCH_NODE
+};
+
+void SSPlayerBatch::setParallelEvaluationEnabled(bool enabled)
+{
+	m_parallelEvaluationEnabled = enabled;
+}
+
+bool SSPlayerBatch::isParallelEvaluationEnabled() const
+{
+	return m_parallelEvaluationEnabled;
+}
+
+void SSPlayerBatch::purgeEvaluationThreads()
+{
+	CC_SAFE_DELETE(s_evaluationPool);
+}
+
+void SSPlayerBatch::update(float dt)
+{
+	CCObject* child;
+
+	// 再生位置を進め、フレームデータをデコードする. プレイヤーが多いときはワーカースレッドに分けて行う
+	float animationInterval = CCDirector::sharedDirector()->getAnimationInterval();
+	m_evaluationPlayers.clear();
+	if (m_players->getChildren())
+	{
+		CCARRAY_FOREACH(m_players->getChildren(), child)
+		{
+			SSPlayer* player = (SSPlayer*)child;
+			if (player) m_evaluationPlayers.push_back(player);
+		}
+	}
+	size_t numPlayers = m_evaluationPlayers.size();
+	SSEvaluationPool* pool = (m_parallelEvaluationEnabled && numPlayers >= BATCH_EVALUATION_MIN_PLAYERS) ? getEvaluationPool() : NULL;
+	if (pool && pool->getNumThreads() > 0)
+	{
+		pool->evaluate(&m_evaluationPlayers[0], numPlayers, dt, animationInterval);
+	}
+	else
+	{
+		for (size_t i = 0; i < numPlayers; i++)
+		{
+			m_evaluationPlayers[i]->evaluateFrame(dt, animationInterval);
 		}
+	}
+	m_evaluationPlayers.clear();
 
-		
-		if (setBlendEnabled)
+	// 登録順に、ユーザーデータの通知とフレームの適用を行い、ジョイントの配置を組み立てる
+	bool planChanged = m_planInvalid;
+	if (m_players->getChildren())
+	{
+		CCARRAY_FOREACH(m_players->getChildren(), child)
 		{
-			//
-			// ブレンド方法を設定
-			// 標準状態でMIXブレンド相当になります
-			// BlendFuncの値を変更することでブレンド方法を切り替えます
-			//
-			ccBlendFunc blendFunc = sprite->getBlendFunc();
-			if (!tex->hasPremultipliedAlpha())
+			SSPlayer* player = (SSPlayer*)child;
+			if (player)
 			{
-				blendFunc.src = GL_SRC_ALPHA;
-				blendFunc.dst = GL_ONE_MINUS_SRC_ALPHA;
+				player->applyEvaluatedFrame();
+				planChanged = planChanged || player->isBatchPlanChanged();
 			}
-			else
+		}
+	}
+
+	// どのプレイヤーのジョイントの並びも変わらなければ、ノードの構成はそのまま使う
+	if (planChanged) replan();
+}
+
+void SSPlayerBatch::replan()
+{
+	m_currentNodeIndex = -1;
+	m_currentNode = NULL;
+	m_currentBatchNode = NULL;
+	m_isBatchNodeCurrent = false;
+	m_currentTexture = NULL;
+	
+	CCObject* child;
+
+	// 登録順にノードを割り当て直す. 置き先が変わったジョイントだけが付け替えられる
+	int order = 0;
+	if (m_players->getChildren())
+	{
+		CCARRAY_FOREACH(m_players->getChildren(), child)
+		{
+			SSPlayer* player = (SSPlayer*)child;
+			if (player)
 			{
-				blendFunc.src = CC_BLEND_SRC;
-				blendFunc.dst = CC_BLEND_DST;
+				player->attachBatchNodes(order++);
 			}
+		}
+	}
 
-			// カスタムシェーダを使用する場合
-			if (useCustomShaderProgram) {
-				blendFunc.src = GL_SRC_ALPHA;
-			}
-			// 加算ブレンド
-			if (partData->alphaBlend == kSSPartAlphaBlendAddition) {
-				blendFunc.dst = GL_ONE;
+	// 使わなくなったノードを空にして非表示にする
+	if (m_bundles->getChildren())
+	{
+		for (int i = m_currentNodeIndex + 1; i < static_cast<int>(m_bundles->getChildren()->count()); i++)
+		{
+			CCNode* bundleNode = (CCNode*)m_bundles->getChildren()->objectAtIndex(i);
+			if (bundleNode->isVisible())
+			{
+				bundleNode->setVisible(false);
+				CCNode* node = (CCNode*)bundleNode->getChildByTag(SSPLAYERBATCHTAG_NODE);
+				CCSpriteBatchNode* batchNode = (CCSpriteBatchNode*)bundleNode->getChildByTag(SSPLAYERBATCHTAG_BATCH_NODE);
+				node->removeAllChildrenWithCleanup(false);
+				batchNode->removeAllChildrenWithCleanup(false);
 			}
-			sprite->setBlendFunc(blendFunc);
 		}
+	}
+	m_planInvalid = false;
+}
 
-#if ADJUST_UV_BY_CONTENT_SCALE_FACTOR
-		CCRect orgRect(sx, sy, sw, sh);
-		float sf = CC_CONTENT_SCALE_FACTOR();
-		float ssx = (float)sx / sf;
-		float ssy = (float)sy / sf;
-		float ssw = (float)sw / sf;
-		float ssh = (float)sh / sf;
-		sprite->setTextureRect(CCRect(ssx, ssy, ssw, ssh), false, orgRect.size);
-#else
-		sprite->setTextureRect(CCRect(sx, sy, sw, sh));
-#endif
-
-		sprite->setOpacity( opacity );
+void SSPlayerBatch::getNode(cocos2d::CCNode*& node, bool batchNodeRequired, cocos2d::CCTexture2D* tex)
+{
+	bool nextNode =
+		(m_currentNode == NULL) ||
+		(batchNodeRequired != m_isBatchNodeCurrent) ||
+		(m_isBatchNodeCurrent && tex != m_currentTexture);
 		
-		float ax = (float)ox / (float)sw;
-		float ay = (float)oy / (float)sh;
-		sprite->setAnchorPoint(ccp(ax, ay));
+	if (nextNode)
+	{
+		m_currentNodeIndex++;
+		if (!m_bundles->getChildren() || m_currentNodeIndex >= m_bundles->getChildren()->count())
+		{
+			// 新しくノードを生成する
+			m_currentNode = CCNode::create();
+			m_currentBatchNode = CCSpriteBatchNode::createWithTexture(tex, m_defaultCapacity);
 
-		sprite->setFlipX((flags & SS_PART_FLAG_FLIP_H) != 0);
-		sprite->setFlipY((flags & SS_PART_FLAG_FLIP_V) != 0);
-		sprite->setRotation(rotation);
-        sprite->setScaleX(scaleX);
-        sprite->setScaleY(scaleY);
-		sprite->setPosition(ccp(dx, -dy));
+			CCNode* bundleNode = CCNode::create();
+			bundleNode->addChild(m_currentNode, 0, SSPLAYERBATCHTAG_NODE);
+			bundleNode->addChild(m_currentBatchNode, 0, SSPLAYERBATCHTAG_BATCH_NODE);
+			m_bundles->addChild(bundleNode);
+		}
+		else
+		{
+			// 既存のノードを流用
+			CCNode* bundleNode = (CCNode*)m_bundles->getChildren()->objectAtIndex(m_currentNodeIndex);
+			m_currentNode = (CCNode*)bundleNode->getChildByTag(SSPLAYERBATCHTAG_NODE);
+			m_currentBatchNode = (CCSpriteBatchNode*)bundleNode->getChildByTag(SSPLAYERBATCHTAG_BATCH_NODE);
+			if (batchNodeRequired && m_currentBatchNode->getTexture() != tex) m_currentBatchNode->setTexture(tex);
+			if (!bundleNode->isVisible()) bundleNode->setVisible(true);
+		}
+		m_isBatchNodeCurrent = batchNodeRequired;
+		m_currentTexture = tex;
+	}
 
-		
-		ccV3F_C4B_T2F_Quad tempQuad;
+	node = m_isBatchNodeCurrent ? m_currentBatchNode : m_currentNode;
+}
 
-		#if USE_CUSTOM_SPRITE
-		ccV3F_C4B_T2F_Quad& vquad = sprite->getAttributeRef();
-		ccV3F_C4B_T2F_Quad& cquad = sprite->isCustomShaderProgramEnabled() ? sprite->getAttributeRef() : tempQuad;
-		#else
-		ccV3F_C4B_T2F_Quad& vquad = tempQuad;
-		ccV3F_C4B_T2F_Quad& cquad = tempQuad;
-		#endif
 
-		// vertex deformation
-		if (flags & SS_PART_FLAG_VERTEX_OFFSET_TL)
+
+
+
+/**
+ * SSPlayerLoader
+ */
+
+/**
+ * 非同期読み込みの作業の待ち行列とワーカースレッド.
+ * ワーカーは優先度の高い作業から取り出して処理し、終えた作業をメインスレッドへ返します.
+ */
+
+struct SSPlayerLoader::Job
+{
+	enum Type {
+		TYPE_FILE,			// ssbaファイルの読み込みと検証
+		TYPE_IMAGE			// 画像のデコード
+	};
+
+	Type			type;
+	int				requestId;
+	int				priority;
+	unsigned int	seq;				// 同じ優先度のときは要求された順
+	bool			cancelled;
+	std::string		fullpath;
+	std::string		key;				// テクスチャキャッシュに登録するときのパス
+	const unsigned char*	fileData;	// TYPE_FILEの結果. 読み込めなかったときはNULL. SSDataFileにはメインスレッドで包む
+	size_t			fileSize;
+	bool			fileMapped;
+	CCImage*		image;				// TYPE_IMAGEの結果. デコードできなかったときはNULL
+
+	Job(Type type, int requestId, int priority, unsigned int seq)
+		: type(type), requestId(requestId), priority(priority), seq(seq), cancelled(false)
+		, fileData(NULL), fileSize(0), fileMapped(false), image(NULL)
+	{}
+};
+
+struct SSPlayerLoader::Request
+{
+	int				id;
+	int				priority;
+	std::string		dir;
+	CCObject*		target;
+	SEL_LoadHandler	selector;
+	SSDataFile*		dataFile;
+	int				numPendingImages;
+};
+
+
+class SSLoaderQueue
+{
+public:
+	typedef SSPlayerLoader::Job Job;
+
+	SSLoaderQueue()
+		: m_seq(0)
+		, m_quit(false)
+	{
+		pthread_mutex_init(&m_mutex, NULL);
+		pthread_cond_init(&m_cond, NULL);
+		for (int i = 0; i < ASYNC_LOADER_THREADS; i++)
 		{
-			vquad.tl.vertices.x += r.readS16();
-			vquad.tl.vertices.y -= r.readS16();
+			pthread_t thread;
+			if (pthread_create(&thread, NULL, threadMain, this) == 0) m_threads.push_back(thread);
 		}
-		if (flags & SS_PART_FLAG_VERTEX_OFFSET_TR)
+	}
+
+	~SSLoaderQueue()
+	{
+		pthread_mutex_lock(&m_mutex);
+		m_quit = true;
+		pthread_cond_broadcast(&m_cond);
+		pthread_mutex_unlock(&m_mutex);
+		for (size_t i = 0; i < m_threads.size(); i++) pthread_join(m_threads[i], NULL);
+
+		// 残った作業の結果を破棄する
+		m_pending.insert(m_pending.end(), m_done.begin(), m_done.end());
+		for (size_t i = 0; i < m_pending.size(); i++)
 		{
-			vquad.tr.vertices.x += r.readS16();
-			vquad.tr.vertices.y -= r.readS16();
+			Job* job = m_pending[i];
+			unloadFileData(job->fileData, job->fileSize, job->fileMapped);
+			if (job->image) job->image->release();
+			delete job;
 		}
-		if (flags & SS_PART_FLAG_VERTEX_OFFSET_BL)
+
+		pthread_cond_destroy(&m_cond);
+		pthread_mutex_destroy(&m_mutex);
+	}
+
+	Job* newJob(Job::Type type, int requestId, int priority)
+	{
+		return new Job(type, requestId, priority, m_seq++);
+	}
+
+	void push(Job* job)
+	{
+		pthread_mutex_lock(&m_mutex);
+		m_pending.push_back(job);
+		pthread_cond_signal(&m_cond);
+		pthread_mutex_unlock(&m_mutex);
+	}
+
+	/** 処理を終えた作業をresultへ移します */
+	void takeDone(std::vector<Job*>& result)
+	{
+		pthread_mutex_lock(&m_mutex);
+		result.insert(result.end(), m_done.begin(), m_done.end());
+		m_done.clear();
+		pthread_mutex_unlock(&m_mutex);
+	}
+
+	/** 要求の作業を取り消します. 処理中の作業は結果が返ってから破棄されます */
+	void cancel(int requestId)
+	{
+		pthread_mutex_lock(&m_mutex);
+		for (size_t i = 0; i < m_pending.size(); i++)
 		{
-			vquad.bl.vertices.x += r.readS16();
-			vquad.bl.vertices.y -= r.readS16();
+			if (m_pending[i]->requestId == requestId) m_pending[i]->cancelled = true;
 		}
-		if (flags & SS_PART_FLAG_VERTEX_OFFSET_BR)
+		pthread_mutex_unlock(&m_mutex);
+	}
+
+	void setPriority(int requestId, int priority)
+	{
+		pthread_mutex_lock(&m_mutex);
+		for (size_t i = 0; i < m_pending.size(); i++)
 		{
-			vquad.br.vertices.x += r.readS16();
-			vquad.br.vertices.y -= r.readS16();
+			if (m_pending[i]->requestId == requestId) m_pending[i]->priority = priority;
 		}
+		pthread_mutex_unlock(&m_mutex);
+	}
 
+private:
+	static void* threadMain(void* arg)
+	{
+		static_cast<SSLoaderQueue*>(arg)->run();
+		return NULL;
+	}
 
-		// color blend
-		ccColor4B color4 = { 0xff, 0xff, 0xff, 0 };
-		cquad.tl.colors =
-		cquad.tr.colors =
-		cquad.bl.colors =
-		cquad.br.colors = color4;
-
-		if (flags & SS_PART_FLAGS_COLOR_BLEND)
+	void run()
+	{
+		for (;;)
 		{
-			int colorBlendFuncNo = r.readU16();
-			#if USE_CUSTOM_SPRITE
-			sprite->setColorBlendFunc(colorBlendFuncNo);
-			#endif
-		
-			if (flags & SS_PART_FLAG_COLOR)
+			pthread_mutex_lock(&m_mutex);
+			while (!m_quit && m_pending.empty()) pthread_cond_wait(&m_cond, &m_mutex);
+			if (m_quit)
+			{
+				pthread_mutex_unlock(&m_mutex);
+				break;
+			}
+
+			// 優先度が高く、先に要求された作業を取り出す
+			std::vector<Job*>::iterator best = m_pending.begin();
+			for (std::vector<Job*>::iterator i = m_pending.begin(); i != m_pending.end(); ++i)
 			{
-				r.readColor(color4);
-				cquad.tl.colors =
-				cquad.tr.colors =
-				cquad.bl.colors =
-				cquad.br.colors = color4;
+				if ((*i)->priority > (*best)->priority || ((*i)->priority == (*best)->priority && (*i)->seq < (*best)->seq)) best = i;
 			}
-			if (flags & SS_PART_FLAG_VERTEX_COLOR_TL)
+			Job* job = *best;
+			m_pending.erase(best);
+			bool cancelled = job->cancelled;
+			pthread_mutex_unlock(&m_mutex);
+
+			if (!cancelled) execute(job);
+
+			pthread_mutex_lock(&m_mutex);
+			m_done.push_back(job);
+			pthread_mutex_unlock(&m_mutex);
+		}
+	}
+
+	static void execute(Job* job)
+	{
+		if (job->type == Job::TYPE_FILE)
+		{
+			// ワーカーではCCObjectを生成せず、読み込んだ内容だけを返す
+			const unsigned char* data;
+			size_t size;
+			bool mapped;
+			if (loadFileData(job->fullpath.c_str(), data, size, mapped) && isValidData(data, size))
 			{
-				r.readColor(color4);
-				cquad.tl.colors = color4;
+				job->fileData = data;
+				job->fileSize = size;
+				job->fileMapped = mapped;
 			}
-			if (flags & SS_PART_FLAG_VERTEX_COLOR_TR)
+			else
 			{
-				r.readColor(color4);
-				cquad.tr.colors = color4;
+				CCLOG("ssba load failed: %s", job->fullpath.c_str());
+				unloadFileData(data, size, mapped);
 			}
-			if (flags & SS_PART_FLAG_VERTEX_COLOR_BL)
+		}
+		else
+		{
+			CCImage::EImageFormat format = getImageFormat(job->fullpath);
+			if (format == CCImage::kFmtUnKnown) return;
+
+			CCImage* image = new CCImage();
+			if (image->initWithImageFileThreadSafe(job->fullpath.c_str(), format))
 			{
-				r.readColor(color4);
-				cquad.bl.colors = color4;
+				job->image = image;
 			}
-			if (flags & SS_PART_FLAG_VERTEX_COLOR_BR)
+			else
 			{
-				r.readColor(color4);
-				cquad.br.colors = color4;
+				image->release();
 			}
 		}
+	}
 
-		// この時点の座標、スケール値などを記録しておく
-		partState->m_x = sprite->getPositionX();
-		partState->m_y = sprite->getPositionY();
-		partState->m_scaleX = sprite->getScaleX();
-		partState->m_scaleY = sprite->getScaleY();
-		partState->m_rotation = sprite->getRotation();
-		partState->m_sprite = sprite;
+	/** ヘッダーを検証し、各セクションがファイル内にあるか確かめる */
+	static bool isValidData(const unsigned char* fileData, size_t size)
+	{
+		// バージョン5のヘッダーはfpsまで、バージョン6は参照元の範囲の表を使うときだけ末尾まである
+		const SSData* data = reinterpret_cast<const SSData*>(fileData);
+		if (size < offsetof(SSData, numKeyframes)) return false;
+		if (data->id[0] != SSDATA_ID_0 || data->id[1] != SSDATA_ID_1) return false;
+		if (data->version < SSDATA_VERSION_MIN || data->version > SSDATA_VERSION) return false;
+		if (data->version >= 6)
+		{
+			size_t headerSize = (data->flags & SS_DATA_FLAG_RECT_TABLE) ? sizeof(SSData) : offsetof(SSData, imageRects);
+			if (size < headerSize) return false;
+		}
 
-		// Normalパーツのみ実際に表示する
-		bool visibled = (partType == kSSPartTypeNormal) && !(flags & SS_PART_FLAG_INVISIBLE);
-		sprite->setVisible(visibled);
+		const ss_offset offsets[] = { data->partData, data->frameData, data->imageData };
+		for (size_t i = 0; i < sizeof(offsets) / sizeof(offsets[0]); i++)
+		{
+			if (offsets[i] <= 0 || static_cast<size_t>(offsets[i]) >= size) return false;
+		}
+		return true;
 	}
 
-#if (COCOS2D_VERSION >= 0x00020100)
-	if (useAffineTransformation)
+	/** ThreadSafe版の読み込みでは形式を指定する. 対応していない形式はメインスレッドで読み込む */
+	static CCImage::EImageFormat getImageFormat(const std::string& path)
 	{
-		//親のアフィン変換を適用するコード(SS5準拠）
-		//ルートパーツ以外を処理
-		size_t partsCount = m_ssDataHandle->getNumParts();
-		for (size_t partNo = 1; partNo < partsCount; partNo++)
-		{
-			CCAffineTransform trans = CCAffineTransformMakeIdentity();
+		std::string ext;
+		size_t dot = path.find_last_of('.');
+		if (dot != std::string::npos) ext = path.substr(dot + 1);
+		std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+
+		if (ext == "png") return CCImage::kFmtPng;
+		if (ext == "jpg" || ext == "jpeg") return CCImage::kFmtJpg;
+		return CCImage::kFmtUnKnown;
+	}
 
-			//親子を調べる
-			const SSPartData* partData = &m_ssDataHandle->getPartData()[partNo];
-			SSPartState* paernt_partState = static_cast<SSPartState*>( m_partStates.objectAtIndex(partData->parentId) );
-			trans = paernt_partState->m_trans;
+	std::vector<pthread_t>	m_threads;
+	pthread_mutex_t			m_mutex;
+	pthread_cond_t			m_cond;
+	std::vector<Job*>		m_pending;		// ワーカーの処理を待つ作業
+	std::vector<Job*>		m_done;			// ワーカーが処理を終えた作業
+	unsigned int			m_seq;			// メインスレッドでのみ使う
+	bool					m_quit;
+};
 
-			trans = CCAffineTransformTranslate( trans , paernt_partState->m_x , paernt_partState->m_y );
-			trans = CCAffineTransformRotate( trans , CC_DEGREES_TO_RADIANS(-paernt_partState->m_rotation) );// Rad?
-			trans = CCAffineTransformScale( trans , paernt_partState->m_scaleX,paernt_partState->m_scaleY );
 
-			SSPartState* partState = static_cast<SSPartState*>( m_partStates.objectAtIndex(partNo) );
-//			CCLOG("addr: %08lx, %08lx, %f, %f, %f, %f, %f", partState, partState->m_sprite, partState->m_x, partState->m_y, partState->m_scaleX, partState->m_scaleY, partState->m_rotation);
-//			if (!partState->m_sprite) continue;
+static SSPlayerLoader* s_sharedLoader = NULL;
 
-			partState->m_trans = trans;
-			if (partState->m_sprite)
-			{
-				partState->m_sprite->setAdditionalTransform( trans );
-			}
-		}
+SSPlayerLoader* SSPlayerLoader::sharedLoader()
+{
+	if (!s_sharedLoader)
+	{
+		s_sharedLoader = new SSPlayerLoader();
 	}
-#endif
+	return s_sharedLoader;
 }
 
-void SSPlayer::setFlipX(bool bFlipX)
+void SSPlayerLoader::purgeSharedLoader()
 {
-	m_ssPlayerFlipX = bFlipX;
-	setScaleX(m_ssPlayerScaleX); 
+	CC_SAFE_RELEASE_NULL(s_sharedLoader);
 }
 
-void SSPlayer::setFlipY(bool bFlipY)
+SSPlayerLoader::SSPlayerLoader(void)
+	: m_queue(NULL)
+	, m_nextRequestId(1)
+	, m_uploadTimeBudget(ASYNC_LOADER_UPLOAD_BUDGET)
+	, m_updateScheduled(false)
 {
-	m_ssPlayerFlipY = bFlipY;
-	setScaleX(m_ssPlayerScaleY); 
 }
 
-void SSPlayer::setScaleX(float fScaleX)
+SSPlayerLoader::~SSPlayerLoader()
+{
+	cancelAll();
+	if (m_updateScheduled)
+	{
+		CCDirector::sharedDirector()->getScheduler()->unscheduleSelector(schedule_selector(SSPlayerLoader::update), this);
+	}
+	// ワーカーを止めてから、残った結果を破棄する
+	delete m_queue;
+	for (size_t i = 0; i < m_readyJobs.size(); i++) discardJob(m_readyJobs[i]);
+}
+
+int SSPlayerLoader::loadAsync(const char* ssbaPath, const char* dir, CCObject* target, SEL_LoadHandler selector, int priority)
+{
+	CCAssert(ssbaPath != NULL, "zero is ssbaPath pointer");
+
+	// スレッドは最初の要求で起動する
+	if (!m_queue) m_queue = new SSLoaderQueue();
+
+	Request* request = new Request();
+	request->id = m_nextRequestId++;
+	request->priority = priority;
+	request->dir = dir ? dir : "";
+	request->target = target;
+	request->selector = selector;
+	request->dataFile = NULL;
+	request->numPendingImages = 0;
+	CC_SAFE_RETAIN(target);
+	m_requests[request->id] = request;
+
+	// パスの解決はCCFileUtilsのキャッシュを使うため、メインスレッドで行う
+	Job* job = m_queue->newJob(Job::TYPE_FILE, request->id, priority);
+	job->fullpath = getFullPath(ssbaPath, dir);
+	m_queue->push(job);
+
+	startUpdate();
+	return request->id;
+}
+
+void SSPlayerLoader::cancel(int requestId)
 {
-	m_ssPlayerScaleX = fScaleX;	
-	float temp = m_ssPlayerFlipX == true ? -m_ssPlayerScaleX : m_ssPlayerScaleX;
-	cocos2d::CCSprite::setScaleX(temp);
+	std::map<int, Request*>::iterator i = m_requests.find(requestId);
+	if (i == m_requests.end()) return;
+
+	Request* request = i->second;
+	if (m_queue) m_queue->cancel(requestId);
+	CC_SAFE_RELEASE(request->dataFile);
+	CC_SAFE_RELEASE(request->target);
+	delete request;
+	m_requests.erase(i);
 }
 
-void SSPlayer::setScaleY(float fScaleY)
+void SSPlayerLoader::cancelAll()
 {
-	m_ssPlayerScaleY = fScaleY;	
-	float temp = m_ssPlayerFlipY == true ? -m_ssPlayerScaleY : m_ssPlayerScaleY;
-	cocos2d::CCSprite::setScaleY(temp);
+	while (!m_requests.empty())
+	{
+		cancel(m_requests.begin()->first);
+	}
 }
 
-float SSPlayer::getScaleX()
+void SSPlayerLoader::setPriority(int requestId, int priority)
 {
-	return m_ssPlayerScaleX;
+	std::map<int, Request*>::iterator i = m_requests.find(requestId);
+	if (i == m_requests.end()) return;
+
+	i->second->priority = priority;
+	if (m_queue) m_queue->setPriority(requestId, priority);
 }
 
-float SSPlayer::getScaleY()
+int SSPlayerLoader::getNumRequests() const
 {
-	return m_ssPlayerScaleY;
+	return static_cast<int>(m_requests.size());
 }
 
-float SSPlayer::getScale()
+void SSPlayerLoader::setUploadTimeBudget(float milliseconds)
 {
-    CCAssert( m_ssPlayerScaleX == m_ssPlayerScaleY, "SSPlayer#scale. ScaleX != ScaleY. Don't know which one to return");
-	return m_ssPlayerScaleX;
+	m_uploadTimeBudget = milliseconds;
 }
 
-void SSPlayer::setChildVisibleAll(bool visible)
+void SSPlayerLoader::startUpdate()
 {
-	//SSPlayerの子要素のバッチノードと、バッチノードの子要素のCCSpriteのVisibleを全てセットする
-	CCArray* a = getChildren();
-	int pn = getChildrenCount();
-	for( int i = 0; i < pn; ++i){
-		CCNode* nodep = static_cast<CCNode*>( a->objectAtIndex(i));
-		nodep->setVisible(visible);
-		int pc = nodep->getChildrenCount();
-		for( int j = 0; j < pc; ++j){
-			static_cast<CCNode*>( nodep->getChildren()->objectAtIndex(j))->setVisible(visible);
-		}
-	}
+	if (m_updateScheduled) return;
+	CCDirector::sharedDirector()->getScheduler()->scheduleSelector(schedule_selector(SSPlayerLoader::update), this, 0, false);
+	m_updateScheduled = true;
 }
 
-void SSPlayer::checkUserData(int frameNo)
+void SSPlayerLoader::update(float dt)
 {
-	if (!m_delegate) return;
+	if (m_queue) m_queue->takeDone(m_readyJobs);
 
-	const SSFrameData* frameData = &(m_ssDataHandle->getFrameData()[frameNo]);
-	size_t numUserData = static_cast<size_t>(frameData->numUserData);
-	SSDataReader r( static_cast<const ss_u16*>( m_ssDataHandle->getAddress(frameData->userData)) );
+	struct cc_timeval start;
+	CCTime::gettimeofdayCocos2d(&start, NULL);
+	bool uploaded = false;
 
-	for (size_t i = 0; i < numUserData; i++)
+	size_t next = 0;
+	for (; next < m_readyJobs.size(); next++)
 	{
-		int flags = r.readU16();
-		int partId = r.readU16();
-
-		m_userData.flags = 0;
-
-		if (flags & SS_USER_DATA_FLAG_NUMBER)
-		{
-			m_userData.flags |= SSUserData::FLAG_NUMBER;
-			m_userData.number = r.readS32();
-		}
-		else
-		{
-			m_userData.number = 0;
-		}
-		
-		if (flags & SS_USER_DATA_FLAG_RECT)
-		{
-			m_userData.flags |= SSUserData::FLAG_RECT;
-			m_userData.rect[0] = r.readS32();
-			m_userData.rect[1] = r.readS32();
-			m_userData.rect[2] = r.readS32();
-			m_userData.rect[3] = r.readS32();
-		}
-		else
-		{
-			m_userData.rect[0] =
-			m_userData.rect[1] =
-			m_userData.rect[2] =
-			m_userData.rect[3] = 0;
-		}
-		
-		if (flags & SS_USER_DATA_FLAG_POINT)
-		{
-			m_userData.flags |= SSUserData::FLAG_POINT;
-			m_userData.point[0] = r.readS32();
-			m_userData.point[1] = r.readS32();
-		}
-		else
+		Job* job = m_readyJobs[next];
+		std::map<int, Request*>::iterator found = m_requests.find(job->requestId);
+		if (job->cancelled || found == m_requests.end())
 		{
-			m_userData.point[0] =
-			m_userData.point[1] = 0;
+			discardJob(job);
+			continue;
 		}
-		
-		if (flags & SS_USER_DATA_FLAG_STRING)
+		Request* request = found->second;
+
+		if (job->type == Job::TYPE_FILE)
 		{
-			m_userData.flags |= SSUserData::FLAG_STRING;
-			int length;
-			m_userData.str = r.getString(&length);
+			// 読み込んだ内容はメインスレッドでSSDataFileに包む
+			if (job->fileData)
+			{
+				SSDataFile* dataFile = new SSDataFile();
+				dataFile->initWithFileData(job->fileData, job->fileSize, job->fileMapped);
+				job->fileData = NULL;
+				request->dataFile = dataFile;
+			}
+			discardJob(job);
+			if (!request->dataFile)
+			{
+				finishRequest(request, false);
+				continue;
+			}
+
+			// キャッシュに無いテクスチャの画像をデコードする
+			CCTextureCache* texCache = CCTextureCache::sharedTextureCache();
+			SSDataHandle dataHandle(request->dataFile->getData());
+			const ss_offset* imageData = dataHandle.getImageData();
+			const char* dir = request->dir.empty() ? NULL : request->dir.c_str();
+			for (size_t i = 0; imageData[i] != 0; i++)
+			{
+				const char* imageName = static_cast<const char*>(dataHandle.getAddress(imageData[i]));
+				std::string path = SSImageList::s_generator(imageName, dir);
+				if (texCache->textureForKey(path.c_str())) continue;
+
+				Job* imageJob = m_queue->newJob(Job::TYPE_IMAGE, request->id, request->priority);
+				imageJob->key = path;
+				imageJob->fullpath = getFullPath(path.c_str(), NULL);
+				m_queue->push(imageJob);
+				request->numPendingImages++;
+			}
+			if (request->numPendingImages == 0) finishRequest(request, true);
 		}
 		else
 		{
-			m_userData.str = 0;
+			// テクスチャの転送は１フレームあたりの時間を区切って行う
+			if (uploaded)
+			{
+				struct cc_timeval now;
+				CCTime::gettimeofdayCocos2d(&now, NULL);
+				if (CCTime::timersubCocos2d(&start, &now) >= m_uploadTimeBudget) break;
+			}
+
+			CCTextureCache* texCache = CCTextureCache::sharedTextureCache();
+			if (job->image)
+			{
+				texCache->addUIImage(job->image, job->key.c_str());
+			}
+			else
+			{
+				// デコードできなかった画像は従来通りメインスレッドで読み込む
+				texCache->addImage(job->key.c_str());
+			}
+			uploaded = true;
+			discardJob(job);
+
+			if (--request->numPendingImages == 0) finishRequest(request, true);
 		}
-		
-		const char* partName = m_ssDataHandle->getPartName(partId);
-		m_delegate->onUserData(this, &m_userData, frameNo, partName);
+	}
+	m_readyJobs.erase(m_readyJobs.begin(), m_readyJobs.begin() + next);
+
+	if (m_requests.empty() && m_readyJobs.empty())
+	{
+		CCDirector::sharedDirector()->getScheduler()->unscheduleSelector(schedule_selector(SSPlayerLoader::update), this);
+		m_updateScheduled = false;
 	}
 }
 
-void SSPlayer::registerBatch(SSPlayerBatch *batch)
+void SSPlayerLoader::finishRequest(Request* request, bool succeeded)
 {
-	this->unscheduleUpdate();
-	m_batch = batch;
+	m_requests.erase(request->id);
+
+	SSPlayer* player = NULL;
+	SSImageList* imageList = NULL;
+	if (succeeded)
+	{
+		// テクスチャはキャッシュ済みのため、SSImageListの構築で読み込みは発生しない
+		const char* dir = request->dir.empty() ? NULL : request->dir.c_str();
+		imageList = SSImageList::create(request->dataFile->getData(), dir);
+		player = SSPlayer::create(request->dataFile, imageList);
+	}
+
+	if (request->target && request->selector)
+	{
+		(request->target->*request->selector)(player, imageList);
+	}
+	CC_SAFE_RELEASE(request->dataFile);
+	CC_SAFE_RELEASE(request->target);
+	delete request;
 }
 
-void SSPlayer::unregisterBatch(SSPlayerBatch *batch)
+void SSPlayerLoader::discardJob(Job* job)
 {
-	m_batch = 0;
-	this->scheduleUpdate();
+	unloadFileData(job->fileData, job->fileSize, job->fileMapped);
+	CC_SAFE_RELEASE(job->image);
+	delete job;
 }
 
 
 
+
+
 /**
- * SSPlayerDelegate
+ * SSAssetManager
  */
 
-SSPlayerDelegate::~SSPlayerDelegate()
-{}
+struct SSAssetManager::Asset
+{
+	std::string			key;
+	SSDataFile*			dataFile;
+	SSImageList*		imageList;
+	size_t				bytes;			// ssbaファイルとテクスチャの合計
+	unsigned int		lastUsed;
+	int					numOwners;		// ファイルを設定しているSSPlayerの数
+};
 
-void SSPlayerDelegate::onUserData(SSPlayer* player, const SSUserData* data, int frameNo, const char* partName)
-{}
+/** テクスチャが占めるバイト数を見積もる */
+static size_t getTextureBytes(CCTexture2D* tex)
+{
+#if (COCOS2D_VERSION >= 0x00020100)
+	unsigned int bitsPerPixel = tex->bitsPerPixelForFormat();
+#else
+	unsigned int bitsPerPixel = 32;
+#endif
+	return static_cast<size_t>(tex->getPixelsWide()) * tex->getPixelsHigh() * bitsPerPixel / 8;
+}
 
 
+static SSAssetManager* s_sharedAssetManager = NULL;
 
-/**
- * SSPlayerBatch
- *
- * SSPlayerをSSPlayerBatch配下に配置（addChild）することにより、
- * できる限りバッチノードを使った描画を行うようになります。
- * ※SSPlayerBatchはSSPlayerのみ登録可能です。
- *
- * 以下の条件を満たしているとき、バッチノードを使った描画が行われます。（条件に合わないパーツは単独で描画されます）
- * ・同一のテクスチャを使用している
- * ・次の効果を使用していない：頂点変形、カラーブレンド、αブレンドでMIX以外
- */
+SSAssetManager* SSAssetManager::sharedManager()
+{
+	if (!s_sharedAssetManager)
+	{
+		s_sharedAssetManager = new SSAssetManager();
+	}
+	return s_sharedAssetManager;
+}
 
-SSPlayerBatch::SSPlayerBatch()
-	: m_players(NULL)
-	, m_bundles(NULL)
-	, m_defaultCapacity(kDefaultSpriteBatchCapacity)
+void SSAssetManager::purgeSharedManager()
 {
+	CC_SAFE_RELEASE_NULL(s_sharedAssetManager);
 }
 
-SSPlayerBatch::~SSPlayerBatch()
+SSAssetManager::SSAssetManager(void)
+	: m_memoryBudget(ASSET_MANAGER_MEMORY_BUDGET)
+	, m_residentBytes(0)
+	, m_useCounter(0)
 {
-	this->unscheduleUpdate();
-	CC_SAFE_RELEASE_NULL(m_bundles);
-	CC_SAFE_RELEASE_NULL(m_players);
 }
 
-SSPlayerBatch* SSPlayerBatch::create()
+SSAssetManager::~SSAssetManager()
 {
-	SSPlayerBatch* batch = new SSPlayerBatch();
-	if (batch && batch->init())
+	// 使用中のアセットは、SSPlayerが保持している間は残る
+	while (!m_assets.empty())
 	{
-		batch->autorelease();
-		return batch;
+		removeAsset(m_assets.begin()->second);
 	}
-	CC_SAFE_DELETE(batch);
-	return NULL;
 }
 
-bool SSPlayerBatch::init()
+bool SSAssetManager::getAsset(SSDataFile** outDataFile, SSImageList** outImageList, const char* ssbaPath, const char* dir)
 {
-    if (!CCNode::init())
-	{
-		return false;
-	}
-	
-	CC_SAFE_RELEASE_NULL(m_bundles);
-	CC_SAFE_RELEASE_NULL(m_players);
-	
-	CCNode* players = CCNode::create();
-	if (!players)
+	CCAssert(
+		outDataFile != NULL &&
+		outImageList != NULL &&
+		ssbaPath != NULL,
+		"SSAssetManager::getAsset: Invalid argument.");
+
+	*outDataFile = NULL;
+	*outImageList = NULL;
+
+	std::string key = makeKey(ssbaPath, dir);
+	Asset* asset = NULL;
+	std::map<std::string, Asset*>::iterator it = m_assets.find(key);
+	if (it != m_assets.end())
 	{
-		return false;
+		asset = it->second;
+
+		// 生成したときと同じく、受け取った側が保持するまで破棄されないようにする
+		asset->dataFile->retain();
+		asset->dataFile->autorelease();
+		asset->imageList->retain();
+		asset->imageList->autorelease();
 	}
-	
-	CCNode* bundles = CCNode::create();
-	if (!bundles)
+	else
 	{
-		delete players;
-		return false;
+		SSDataFile* dataFile = SSDataFile::create(ssbaPath, dir);
+		if (!dataFile) return false;
+		SSImageList* imageList = SSImageList::create(dataFile->getData(), dir);
+
+		asset = new Asset();
+		asset->key = key;
+		asset->dataFile = dataFile;
+		asset->imageList = imageList;
+		asset->bytes = dataFile->getSize();
+		asset->numOwners = 0;
+		dataFile->retain();
+		imageList->retain();
+		// 他のアセットと共有しているテクスチャがあるため、キャッシュからの削除はm_textureRefsで行う
+		imageList->m_keepTextureCache = true;
+		dataFile->m_assetManager = this;
+		m_assetsByFile[dataFile] = asset;
+
+		m_residentBytes += dataFile->getSize();
+		for (size_t i = 0; CCTexture2D* tex = imageList->getTexture(i); i++)
+		{
+			size_t texBytes = getTextureBytes(tex);
+			asset->bytes += texBytes;
+			if (m_textureRefs[tex]++ == 0) m_residentBytes += texBytes;
+		}
+		m_assets[key] = asset;
 	}
-	
-	players->retain();
-	bundles->retain();
-	
-	m_players = players;
-	players->setVisible(false);
-	CCNode::addChild(players, 0, 0);
-	m_bundles = bundles;
-	CCNode::addChild(bundles, 0, 0);
-	
-	this->scheduleUpdate();
+	asset->lastUsed = ++m_useCounter;
+
+	*outDataFile = asset->dataFile;
+	*outImageList = asset->imageList;
+
+	// 渡したアセットはSSPlayerに設定されるまで使用中にならないため、破棄の対象から外す
+	trim(asset);
 	return true;
 }
 
-void SSPlayerBatch::setDefaultSpriteBatchCapacity(unsigned int capacity)
+SSPlayer* SSAssetManager::createPlayer(const char* ssbaPath, const char* dir, int loop)
 {
-	m_defaultCapacity = capacity;
+	SSDataFile* dataFile = NULL;
+	SSImageList* imageList = NULL;
+	if (!getAsset(&dataFile, &imageList, ssbaPath, dir)) return NULL;
+	return SSPlayer::create(dataFile, imageList, loop);
 }
 
-void SSPlayerBatch::addChild(CCNode* child, int zOrder, int tag)
+void SSAssetManager::setMemoryBudget(size_t bytes)
 {
-    CCAssert(child != NULL, "child should not be null");
-    CCAssert(dynamic_cast<SSPlayer*>(child) != NULL, "SSPlayerBatch only supports SSPlayer as children");
-    SSPlayer* player = (SSPlayer*)(child);
-
-	m_players->addChild(child, zOrder, tag);
-	player->registerBatch(this);
+	m_memoryBudget = bytes;
+	trim();
 }
 
-void SSPlayerBatch::addChild(CCNode* child, int zOrder)
+size_t SSAssetManager::getUnusedBytes() const
 {
-	CCNode::addChild(child, zOrder);
+	size_t bytes = 0;
+	for (std::map<std::string, Asset*>::const_iterator it = m_assets.begin(); it != m_assets.end(); ++it)
+	{
+		if (isUnused(it->second)) bytes += it->second->bytes;
+	}
+	return bytes;
 }
 
-void SSPlayerBatch::addChild(CCNode* child)
+size_t SSAssetManager::getAssetBytes(const char* ssbaPath, const char* dir) const
 {
-	CCNode::addChild(child);
+	CCAssert(ssbaPath != NULL, "zero is ssbaPath pointer");
+
+	std::map<std::string, Asset*>::const_iterator it = m_assets.find(makeKey(ssbaPath, dir));
+	return it != m_assets.end() ? it->second->bytes : 0;
 }
 
-void SSPlayerBatch::removeChild(CCNode* child)
+void SSAssetManager::removeUnusedAssets()
 {
-    CCAssert(child != NULL, "child should not be null");
-    SSPlayer* player = (SSPlayer*)(child);
-
-	player->unregisterBatch(this);
-	m_players->removeChild(player);
+	std::vector<Asset*> unused;
+	for (std::map<std::string, Asset*>::iterator it = m_assets.begin(); it != m_assets.end(); ++it)
+	{
+		if (isUnused(it->second)) unused.push_back(it->second);
+	}
+	for (size_t i = 0; i < unused.size(); i++)
+	{
+		removeAsset(unused[i]);
+	}
 }
 
-enum SSPlayerBatchTag
+void SSAssetManager::trim()
 {
-	SSPLAYERBATCHTAG_NODE = 1,
-	SSPLAYERBATCHTAG_BATCH_NODE
-};
+	trim(NULL);
+}
 
-void SSPlayerBatch::update(float dt)
+void SSAssetManager::trim(const Asset* keep)
 {
-	m_currentNodeIndex = -1;
-	m_currentNode = NULL;
-	m_currentBatchNode = NULL;
-	m_isBatchNodeCurrent = false;
-	m_currentTexture = NULL;
-	
-	CCObject* child;
+	if (m_memoryBudget == 0) return;
 
-	if (m_bundles->getChildren())
+	while (m_residentBytes > m_memoryBudget)
 	{
-		CCARRAY_FOREACH(m_bundles->getChildren(), child)
+		Asset* oldest = NULL;
+		for (std::map<std::string, Asset*>::iterator it = m_assets.begin(); it != m_assets.end(); ++it)
 		{
-			CCNode* bundleNode = (CCNode*)child;
-			if (bundleNode && bundleNode->isVisible())
-			{
-				bundleNode->setVisible(false);
-				CCNode* node = (CCNode*)bundleNode->getChildByTag(SSPLAYERBATCHTAG_NODE);
-				CCSpriteBatchNode* batchNode = (CCSpriteBatchNode*)bundleNode->getChildByTag(SSPLAYERBATCHTAG_BATCH_NODE);
-				node->removeAllChildrenWithCleanup(false);
-				batchNode->removeAllChildrenWithCleanup(false);
-			}
+			Asset* asset = it->second;
+			if (asset != keep && isUnused(asset) && (!oldest || asset->lastUsed < oldest->lastUsed)) oldest = asset;
 		}
+		// 残りはすべて使用中
+		if (!oldest) break;
+		removeAsset(oldest);
 	}
+}
 
-	if (m_players->getChildren())
+void SSAssetManager::removeAsset(Asset* asset)
+{
+	CCTextureCache* texCache = CCTextureCache::sharedTextureCache();
+	m_residentBytes -= asset->dataFile->getSize();
+	for (size_t i = 0; CCTexture2D* tex = asset->imageList->getTexture(i); i++)
 	{
-		CCARRAY_FOREACH(m_players->getChildren(), child)
+		std::map<CCTexture2D*, int>::iterator ref = m_textureRefs.find(tex);
+		if (--ref->second == 0)
 		{
-			SSPlayer* player = (SSPlayer*)child;
-			if (player)
-			{
-				player->updateFrame(dt);
-			}
+			// どのアセットも使わなくなったテクスチャだけをキャッシュから削除する
+			m_residentBytes -= getTextureBytes(tex);
+			m_textureRefs.erase(ref);
+			texCache->removeTexture(tex);
 		}
 	}
+	m_assets.erase(asset->key);
+	m_assetsByFile.erase(asset->dataFile);
+
+	// SSPlayerが保持している間も、以後は共有のアセットとして扱わない
+	asset->dataFile->m_assetManager = NULL;
+	asset->imageList->release();
+	asset->dataFile->release();
+	delete asset;
 }
 
-void SSPlayerBatch::getNode(cocos2d::CCNode*& node, bool batchNodeRequired, cocos2d::CCTexture2D* tex)
+void SSAssetManager::addOwner(SSDataFile* dataFile)
 {
-	bool nextNode =
-		(m_currentNode == NULL) ||
-		(batchNodeRequired != m_isBatchNodeCurrent) ||
-		(m_isBatchNodeCurrent && tex != m_currentTexture);
-		
-	if (nextNode)
-	{
-		m_currentNodeIndex++;
-		if (!m_bundles->getChildren() || m_currentNodeIndex >= m_bundles->getChildren()->count())
-		{
-			// 新しくノードを生成する
-			m_currentNode = CCNode::create();
-			m_currentBatchNode = CCSpriteBatchNode::createWithTexture(tex, m_defaultCapacity);
+	SSAssetManager* manager = dataFile->m_assetManager;
+	if (!manager) return;
+	manager->m_assetsByFile[dataFile]->numOwners++;
+}
 
-			CCNode* bundleNode = CCNode::create();
-			bundleNode->addChild(m_currentNode, 0, SSPLAYERBATCHTAG_NODE);
-			bundleNode->addChild(m_currentBatchNode, 0, SSPLAYERBATCHTAG_BATCH_NODE);
-			m_bundles->addChild(bundleNode);
-		}
-		else
-		{
-			// 既存のノードを流用
-			CCNode* bundleNode = (CCNode*)m_bundles->getChildren()->objectAtIndex(m_currentNodeIndex);
-			m_currentNode = (CCNode*)bundleNode->getChildByTag(SSPLAYERBATCHTAG_NODE);
-			m_currentBatchNode = (CCSpriteBatchNode*)bundleNode->getChildByTag(SSPLAYERBATCHTAG_BATCH_NODE);
-			m_currentBatchNode->setTexture(tex);
-			bundleNode->setVisible(true);
-		}
-		m_isBatchNodeCurrent = batchNodeRequired;
-		m_currentTexture = tex;
-	}
+void SSAssetManager::removeOwner(SSDataFile* dataFile)
+{
+	SSAssetManager* manager = dataFile->m_assetManager;
+	if (!manager) return;
+	Asset* asset = manager->m_assetsByFile[dataFile];
+	CCAssert(asset->numOwners > 0, "Asset owner count is broken.");
+	if (--asset->numOwners == 0) manager->trim();
+}
 
-	node = m_isBatchNodeCurrent ? m_currentBatchNode : m_currentNode;
+/** どのSSPlayerにも設定されていないか */
+bool SSAssetManager::isUnused(const Asset* asset)
+{
+	return asset->numOwners == 0;
+}
+
+/** 画像はdirから読み込むため、同じssbaファイルでもdirが異なれば別のアセットとして扱う */
+std::string SSAssetManager::makeKey(const char* ssbaPath, const char* dir)
+{
+	std::string key = getFullPath(ssbaPath, dir);
+	key.append(1, '\n');
+	if (dir) key.append(dir);
+	return key;
 }
 
 
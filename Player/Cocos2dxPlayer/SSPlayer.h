@@ -2,6 +2,8 @@
 #define __SS_PLAYER_H__
 
 #include "cocos2d.h"
+#include <map>
+#include <vector>
 
 #include "SSPlayerData.h"
 
@@ -132,8 +134,65 @@ protected:
 	void addTexture(const char* imageName, const char* imageDir);
 
 	cocos2d::CCArray	m_imageList;
+	bool				m_keepTextureCache;	// trueのときは破棄してもテクスチャキャッシュから削除しない（SSAssetManagerが管理する）
 	
 	static ImagePathGenerator	s_generator;
+
+	friend class SSPlayerLoader;
+	friend class SSAssetManager;
+};
+
+
+
+/**
+ * SSDataFile
+ *
+ * ssbaファイルの内容を保持します. 参照カウントで寿命を管理し、設定されたSSPlayerが保持します.
+ * 対応する環境ではファイルをメモリにマップし、ヒープへコピーせずに参照します.
+ * （マップできないとき、Androidのapk内のファイルなどでは、通常の読み込みを行います）
+ * Holds the contents of a ssba file with reference-counted lifetime.
+ * The file is memory-mapped where available, falling back to a read.
+ */
+
+class SSDataFile : public cocos2d::CCObject
+{
+public:
+	/** ssbaファイルを読み込み、SSDataFileを生成します. 読み込めないときはNULLを返します.
+	 *  Create a SSDataFile object from ssba file. Returns NULL if the file cannot be loaded.
+	 */
+	static SSDataFile* create(const char* ssbaPath, const char* dir = NULL);
+
+	/** アニメーションデータを返します.
+	 *  Get animation data.
+	 */
+	const SSData* getData() const { return reinterpret_cast<const SSData*>(m_data); }
+
+	/** データのサイズを返します.
+	 *  Get size of data.
+	 */
+	size_t getSize() const { return m_size; }
+
+	/** ファイルをメモリにマップしているか返します.
+	 *  Returns whether the file is memory-mapped.
+	 */
+	bool isMapped() const { return m_mapped; }
+
+public:
+	SSDataFile(void);
+	virtual ~SSDataFile();
+	bool init(const char* ssbaPath, const char* dir = NULL);
+	bool initWithFullPath(const char* fullpath);
+	bool initWithFileData(const unsigned char* data, size_t size, bool mapped);
+
+protected:
+	void unload();
+
+	const unsigned char*	m_data;
+	size_t					m_size;
+	bool					m_mapped;
+	class SSAssetManager*	m_assetManager;		// 共有のアセットのとき、管理しているマネージャー
+
+	friend class SSAssetManager;
 };
 
 
@@ -181,11 +240,21 @@ public:
 	 */
 	static SSPlayer* create(const SSData* ssData, SSImageList* imageList, int loop = 0);
 
+	/** SSPlayerを生成し、ssbaファイルのアニメーションを設定します.
+	 *  Create a SSPlayer object, and set animation of ssba file.
+	 */
+	static SSPlayer* create(SSDataFile* dataFile, SSImageList* imageList, int loop = 0);
+
 	/** アニメーションを設定します.
 	 *  Set animation.
 	 */
 	void setAnimation(const SSData* ssData, SSImageList* imageList, int loop = 0);
 
+	/** ssbaファイルのアニメーションを設定します. dataFileはアニメーションを設定している間保持されます.
+	 *  Set animation of ssba file. dataFile is retained while the animation is set.
+	 */
+	void setAnimation(SSDataFile* dataFile, SSImageList* imageList, int loop = 0);
+
 	/** 設定されているアニメーションを返します.
 	 */
 	const SSData* getAnimation() const;
@@ -240,6 +309,16 @@ public:
 	 */
 	bool isFrameSkipEnabled() const;
 
+	/** フレーム間の補間の設定をします. 有効にすると再生位置の小数部で次のフレームとの間を補間して表示します. (default: false)
+	 *  Set interpolation between frames. If enabled, the part states are blended with the next frame by the fractional part of the playing position. (default: false)
+	 */
+	void setInterpolationEnabled(bool enabled);
+
+	/** フレーム間の補間の設定状態を返します.
+	 *  Get interpolation setting.
+	 */
+	bool isInterpolationEnabled() const;
+
 	/** trueを設定するとX,Y座標を整数値として扱います（小数部を切り捨てます）
 	 */
 	void setIntegerPositionEnabled(bool enabled);
@@ -248,6 +327,51 @@ public:
 	 */
 	bool isIntegerPositionEnabled() const;
 
+	/** trueを設定すると、パーツごとのスプライトを使わず、全パーツの頂点を１つの配列に書き込んで描画します.
+	 *  スプライトのプロパティの設定と変換の再計算を省くため、多数のSSPlayerを再生するときに効果があります.
+	 *  SSPlayerBatch配下では使われません. 有効な間、PartStateのspriteはNULLになります.
+	 *  Renders all parts by writing their vertices into one array, without per-part sprites.
+	 *  Skips sprite setters and transform updates, effective when playing many SSPlayers.
+	 *  Not used under SSPlayerBatch. PartState.sprite is NULL while enabled.
+	 */
+	void setDirectRenderEnabled(bool enabled);
+
+	/** setDirectRenderEnabled()で設定されている状態を返します.
+	 *  Get direct render setting.
+	 */
+	bool isDirectRenderEnabled() const;
+
+	/** 同じアニメーションデータを再生しているSSPlayerで共有する、デコードしたフレームのキャッシュの統計です.
+	 *  Statistics of the decoded frame cache shared by SSPlayers playing the same animation data.
+	 */
+	struct FrameCacheStats
+	{
+		unsigned int	hits;			// キャッシュにあった回数 / Lookups found in the cache
+		unsigned int	misses;			// デコードした回数 / Lookups decoded
+		size_t			numEntries;		// 保持しているフレームの数 / Number of cached frames
+		size_t			bytes;			// 使用しているメモリ / Memory in use (bytes)
+	};
+
+	/** フレームのキャッシュの統計を取得します.
+	 *  Get statistics of the frame cache.
+	 */
+	static void getFrameCacheStats(FrameCacheStats& stats);
+
+	/** フレームのキャッシュの、ヒット数とミス数を0に戻します.
+	 *  Reset hit and miss counts of the frame cache.
+	 */
+	static void resetFrameCacheStats();
+
+	/** フレームのキャッシュのメモリの上限を設定します. 0のときはキャッシュを使いません（初期値）. メインスレッドから呼び出してください.
+	 *  Set memory budget of the frame cache in bytes. 0 disables the cache (default). Call from the main thread.
+	 */
+	static void setFrameCacheMemoryBudget(size_t bytes);
+
+	/** フレームのキャッシュのメモリの上限を返します.
+	 *  Get memory budget of the frame cache.
+	 */
+	static size_t getFrameCacheMemoryBudget();
+
 	/** ユーザーデータなどの通知を受け取る、デリゲートを設定します.
 	 *  Set delegate. receive a notification, such as user data.
 	 */
@@ -286,6 +410,35 @@ public:
 	 *  Upon success, true is returned. otherwise false, parts not found.
 	 */
 	bool getPartState(PartState& result, const char* name);
+
+	/** パーツを指すハンドルです. 名前の検索を１度だけ行い、以降はハンドルで参照します.
+	 *  同じアニメーションデータを使うSSPlayerの間で共通に使えます.
+	 *  データを読み込み直したときは、同じアドレスに読み込まれても別のデータとして扱います.
+	 *  Handle to a part. Resolve the name once and query by handle after that.
+	 *  Valid for every SSPlayer using the same animation data.
+	 *  Data loaded again is treated as different data, even at the same address.
+	 */
+	struct PartHandle
+	{
+		const SSData*	data;
+		unsigned int	serial;		// データごとに振られる通し番号
+		int				index;
+
+		PartHandle() : data(NULL), serial(0), index(-1) {}
+		bool isValid() const { return data != NULL; }
+	};
+
+	/** 指定パーツのハンドルを返します. パーツが見つからないときは無効なハンドルを返します.
+	 *  Get handle of specified part. Returns invalid handle if the part is not found.
+	 */
+	PartHandle getPartHandle(const char* name) const;
+
+	/** ハンドルで指定したパーツの情報をPartInfoに格納します. 名前の検索を行わず、メモリの確保もしません.
+	 *  成功時はtrueを、ハンドルが無効か別のアニメーションのものであるときはfalseを返します.
+	 *  Get status of part specified by handle, set to PartInfo. No name lookup, no allocation.
+	 *  Upon success, true is returned. otherwise false, handle is invalid or of another animation.
+	 */
+	bool getPartState(PartState& result, const PartHandle& handle);
 	  
 	virtual void	setFlipX(bool bFlipX);
 	virtual void	setFlipY(bool bFlipY);
@@ -296,6 +449,7 @@ public:
 	virtual float	getScaleX();
 	virtual float	getScaleY();
 	virtual float	getScale();
+	virtual void	draw(void);
 
 
 public:
@@ -312,19 +466,40 @@ protected:
 	bool hasAnimation() const;
 
 	void updateFrame(float dt);
-	void setFrame(int frameNo);
-	void setChildVisibleAll(bool visible);
-	void checkUserData(int frameNo);
+	void setFrame(int frameNo, float frameDecimal = 0.0f);
+	void invalidateFrame();
+
+	// フレームの評価（ワーカースレッドから呼ばれることがある）と、シーングラフへの適用
+	void evaluateFrame(float dt, float animationInterval);
+	void decodeFrame(int frameNo, float frameDecimal);
+	void queueUserData(int frameNo);
+	void applyEvaluatedFrame();
+	void applyFrame();
+	void dispatchUserData();
 
 	friend class SSPlayerBatch;
+	friend class SSEvaluationPool;
 
 	void registerBatch(SSPlayerBatch* batch);
 	void unregisterBatch(SSPlayerBatch* batch);
+	bool isBatchPlanChanged() const;
+	void attachBatchNodes(int order);
 
 protected:
 	class SSDataHandle*	m_ssDataHandle;
+	SSDataFile*			m_dataFile;
+	class SSFrameDecoder*	m_frameDecoder;
+	class SSFrameDecoder*	m_nextFrameDecoder;
+	class SSTextureRectTable*	m_textureRectTable;
+	class SSPartNameIndex*	m_partNameIndex;
+	class SSDirectRenderer*	m_directRenderer;
+	class SSSpriteApplyCache*	m_applyCache;
+	class SSBatchPlan*	m_batchPlan;
+	struct SSFrameEvaluation*	m_evaluation;
+	float				m_appliedFramePosition;	// 適用済みのフレーム. 無いときは負の値
 	SSImageList*		m_imageList;
 	bool				m_frameSkipEnabled;
+	bool				m_interpolationEnabled;
 	bool				m_integerPositionEnabled;
 	SSPlayerDelegate*	m_delegate;
 	SSUserData			m_userData;
@@ -407,6 +582,23 @@ public:
 	 */
 	virtual void removeChild(CCNode * child);
 
+	/** フレームの評価（再生位置を進め、フレームデータをデコードする）をワーカースレッドで行うか設定します.
+	 *  ユーザーデータと再生終了の通知、シーングラフへの適用は、登録順にメインスレッドで行います. 初期値はtrueです.
+	 *  Set whether to evaluate frames (advance playback and decode frame data) on worker threads.
+	 *  Notifications and applying to the scene graph run on the main thread in registration order. Default is true.
+	 */
+	void setParallelEvaluationEnabled(bool enabled);
+
+	/** フレームの評価をワーカースレッドで行うか返します.
+	 *  Get whether to evaluate frames on worker threads.
+	 */
+	bool isParallelEvaluationEnabled() const;
+
+	/** フレームの評価に使うワーカースレッドを終了します. 次に必要になったときは作り直されます.
+	 *  Stop worker threads used for frame evaluation. They are recreated when needed.
+	 */
+	static void purgeEvaluationThreads();
+
 public:
 	SSPlayerBatch(void);
 	virtual ~SSPlayerBatch();
@@ -416,9 +608,15 @@ public:
 	void getNode(cocos2d::CCNode*& node, bool batchNodeRequired, cocos2d::CCTexture2D* tex);
 
 protected:
+	/** すべてのプレイヤーのジョイントにノードを割り当て直し、置き先が変わったジョイントだけを付け替えます */
+	void replan();
+
 	cocos2d::CCNode* m_players;
 	cocos2d::CCNode* m_bundles;
 	unsigned int m_defaultCapacity;
+	bool m_planInvalid;		// プレイヤーの増減などで、配置し直す必要がある
+	bool m_parallelEvaluationEnabled;
+	std::vector<SSPlayer*> m_evaluationPlayers;
 
 	int m_currentNodeIndex;
 	cocos2d::CCNode* m_currentNode;
@@ -429,6 +627,213 @@ protected:
 
 
 
+/**
+ * SSPlayerLoader
+ *
+ * ssbaファイルとテクスチャを非同期に読み込み、完成したSSPlayer/SSImageListをコールバックで渡します.
+ * ssbaの読み込みと検証、画像のデコードはワーカースレッドで行い、
+ * テクスチャの転送はメインスレッドで、１フレームあたりの時間を区切って行います.
+ * Loads ssba files and textures asynchronously, and delivers ready SSPlayer/SSImageList by callback.
+ * Reading ssba and decoding images run on worker threads,
+ * textures are uploaded on the main thread in time-sliced batches.
+ *
+ * @code
+ * int requestId = SSPlayerLoader::sharedLoader()->loadAsync("foo.ssba", "anim/", this, ssplayer_load_selector(MyScene::onLoaded));
+ * --
+ * void MyScene::onLoaded(SSPlayer* player, SSImageList* imageList)
+ * {
+ *   // 読み込めなかったときはNULL
+ *   if (player) addChild(player);
+ * }
+ * @endcode
+ */
+
+class SSPlayerLoader : public cocos2d::CCObject
+{
+public:
+	typedef void (cocos2d::CCObject::*SEL_LoadHandler)(SSPlayer* player, SSImageList* imageList);
+
+	/** 共有のローダーを返します.
+	 *  Get shared loader.
+	 */
+	static SSPlayerLoader* sharedLoader();
+
+	/** 共有のローダーを破棄します. 読み込み中の要求は取り消されます.
+	 *  Purge shared loader. In-flight requests are cancelled.
+	 */
+	static void purgeSharedLoader();
+
+	/** ssbaファイルの非同期読み込みを要求し、要求IDを返します.
+	 *  priorityが大きい要求から先に処理します. 完了時にtargetのselectorを呼び出します（targetは完了まで保持されます）.
+	 *  Request to load ssba file asynchronously, returns request id.
+	 *  Requests with higher priority are processed first. Calls selector of target on completion (target is retained until then).
+	 */
+	int loadAsync(const char* ssbaPath, const char* dir, cocos2d::CCObject* target, SEL_LoadHandler selector, int priority = 0);
+
+	/** 要求を取り消します. コールバックは呼ばれません.
+	 *  Cancel request. Callback is not called.
+	 */
+	void cancel(int requestId);
+
+	/** すべての要求を取り消します.
+	 *  Cancel all requests.
+	 */
+	void cancelAll();
+
+	/** 要求の優先度を変更します. 処理を待っている読み込みに反映されます.
+	 *  Change priority of request. Applies to loads not yet started.
+	 */
+	void setPriority(int requestId, int priority);
+
+	/** 処理中の要求の数を返します.
+	 *  Get number of requests in progress.
+	 */
+	int getNumRequests() const;
+
+	/** テクスチャの転送に使う１フレームあたりの時間（ミリ秒）を設定します. 少なくとも１枚は転送します.
+	 *  Set time budget per frame for uploading textures (milliseconds). At least one texture is uploaded.
+	 */
+	void setUploadTimeBudget(float milliseconds);
+
+public:
+	SSPlayerLoader(void);
+	virtual ~SSPlayerLoader();
+	void update(float dt);
+
+protected:
+	struct Request;
+	struct Job;
+	friend class SSLoaderQueue;
+
+	void finishRequest(Request* request, bool succeeded);
+	void discardJob(Job* job);
+	void startUpdate();
+
+	class SSLoaderQueue*		m_queue;
+	std::map<int, Request*>		m_requests;
+	std::vector<Job*>			m_readyJobs;		// ワーカーが処理を終え、メインスレッドでの処理を待つ
+	int							m_nextRequestId;
+	float						m_uploadTimeBudget;
+	bool						m_updateScheduled;
+};
+
+
+#define ssplayer_load_selector(_SELECTOR) (SSPlayerLoader::SEL_LoadHandler)(&_SELECTOR)
+
+
+
+/**
+ * SSAssetManager
+ *
+ * ssbaファイル（SSDataFile）とテクスチャ（SSImageList）をパスごとに共有し、複数のSSPlayerで使い回します.
+ * どのSSPlayerからも使われていないアセットは、メモリの上限を超えたときに最後に使われた時期が古いものから破棄します.
+ * Shares ssba files (SSDataFile) and textures (SSImageList) per path between SSPlayers.
+ * Assets not used by any SSPlayer are evicted in least-recently-used order when over the memory budget.
+ *
+ * @code
+ * SSAssetManager::sharedManager()->setMemoryBudget(16 * 1024 * 1024);
+ * SSPlayer* player = SSAssetManager::sharedManager()->createPlayer("foo.ssba", "anim/");
+ * --
+ * // メモリ警告を受けたとき
+ * SSAssetManager::sharedManager()->removeUnusedAssets();
+ * @endcode
+ */
+
+class SSAssetManager : public cocos2d::CCObject
+{
+public:
+	/** 共有のアセットマネージャーを返します.
+	 *  Get shared asset manager.
+	 */
+	static SSAssetManager* sharedManager();
+
+	/** 共有のアセットマネージャーを破棄します. 使用中のアセットは、使っているSSPlayerが解放するまで残ります.
+	 *  Purge shared asset manager. Assets in use remain until released by SSPlayers using them.
+	 */
+	static void purgeSharedManager();
+
+	/** アセットを取得します. 読み込まれていないときは読み込みます. 読み込めないときはfalseを返します.
+	 *  SSPlayerに設定されている間は使用中として扱い、破棄しません.
+	 *  Get asset, loading it if not resident. Returns false if the file cannot be loaded.
+	 *  The asset is treated as in use while it is set to a SSPlayer.
+	 */
+	bool getAsset(SSDataFile** outDataFile, SSImageList** outImageList, const char* ssbaPath, const char* dir = NULL);
+
+	/** 共有のアセットからSSPlayerを生成します. 読み込めないときはNULLを返します.
+	 *  Create a SSPlayer object from shared asset. Returns NULL if the file cannot be loaded.
+	 */
+	SSPlayer* createPlayer(const char* ssbaPath, const char* dir = NULL, int loop = 0);
+
+	/** メモリの上限（バイト数）を設定します. 0のときは上限を設けません.
+	 *  Set memory budget in bytes. 0 means unlimited.
+	 */
+	void setMemoryBudget(size_t bytes);
+
+	/** メモリの上限（バイト数）を返します.
+	 *  Get memory budget in bytes.
+	 */
+	size_t getMemoryBudget() const { return m_memoryBudget; }
+
+	/** 保持しているアセットのバイト数を返します. 複数のアセットで共有しているテクスチャは１回だけ数えます.
+	 *  Get bytes resident in all assets. Textures shared by several assets are counted once.
+	 */
+	size_t getResidentBytes() const { return m_residentBytes; }
+
+	/** どのSSPlayerからも使われていないアセットのバイト数を返します.
+	 *  Get bytes resident in assets not used by any SSPlayer.
+	 */
+	size_t getUnusedBytes() const;
+
+	/** 保持しているアセットの数を返します.
+	 *  Get number of resident assets.
+	 */
+	int getNumAssets() const { return static_cast<int>(m_assets.size()); }
+
+	/** アセットのバイト数（ssbaファイルとテクスチャの合計）を返します. 保持していないときは0を返します.
+	 *  Get bytes of asset (ssba file and textures). Returns 0 if not resident.
+	 */
+	size_t getAssetBytes(const char* ssbaPath, const char* dir = NULL) const;
+
+	/** どのSSPlayerからも使われていないアセットをすべて破棄します.
+	 *  Remove all assets not used by any SSPlayer.
+	 */
+	void removeUnusedAssets();
+
+	/** メモリの上限に収まるまで、使われていないアセットを古いものから破棄します.
+	 *  Remove unused assets in least-recently-used order until within memory budget.
+	 */
+	void trim();
+
+public:
+	SSAssetManager(void);
+	virtual ~SSAssetManager();
+
+	/** SSPlayerがファイルを使い始めたことを記録します. 共有のアセットでなければ何もしません.
+	 */
+	static void addOwner(SSDataFile* dataFile);
+
+	/** SSPlayerがファイルを使い終えたことを記録します. どのSSPlayerからも使われなくなったときはtrim()を行います.
+	 */
+	static void removeOwner(SSDataFile* dataFile);
+
+protected:
+	struct Asset;
+
+	void trim(const Asset* keep);
+	void removeAsset(Asset* asset);
+	static bool isUnused(const Asset* asset);
+	static std::string makeKey(const char* ssbaPath, const char* dir);
+
+	std::map<std::string, Asset*>				m_assets;
+	std::map<SSDataFile*, Asset*>				m_assetsByFile;
+	std::map<cocos2d::CCTexture2D*, int>		m_textureRefs;		// テクスチャを参照しているアセットの数. 0になったときにテクスチャキャッシュから削除する
+	size_t										m_memoryBudget;
+	size_t										m_residentBytes;
+	unsigned int								m_useCounter;
+};
+
+
+
 /**
  * helper
  */
@@ -448,6 +853,13 @@ struct SSPlayerHelper
 	 *  outData returned pointer used, must be discard with delete[].
 	 */
 	static void createFromFile(unsigned char** outData, SSPlayer** outPlayer, SSImageList** outImageList, const char* ssbaPath, const char* dir = NULL);
+
+	/** ssbaファイルからSSPlayer/SSImageListオブジェクトを構築します
+	 *  ファイルはSSDataFileで読み込み、SSPlayerが保持するため、破棄の必要はありません.
+	 *  Create SSPlayer/SSImageList objects, from ssba file.
+	 *  The file is loaded as SSDataFile and retained by SSPlayer, no need to discard.
+	 */
+	static void createFromFile(SSPlayer** outPlayer, SSImageList** outImageList, const char* ssbaPath, const char* dir = NULL);
 };
 
 
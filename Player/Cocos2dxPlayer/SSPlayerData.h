@@ -46,6 +46,75 @@ typedef struct {
 } SSPartData;
 
 
+typedef struct {
+	ss_offset	data;			// 圧縮されたチャンクのデータ
+	ss_u32		compressedSize;
+	ss_u32		size;			// 展開後のサイズ
+} SSFrameChunk;
+
+
+typedef struct {
+	ss_s16		frameNo;
+	ss_u16		curveType;		// 0:補間なし, 1:直線, 2:エルミート, 3:ベジェ
+	ss_u32		value;			// 数値アトリビュートはfloat. 頂点変形はSSCurveVertex4、カラーブレンドはSSCurveColorBlendへのオフセット
+	ss_offset	curve;			// エルミート、ベジェのときのパラメータ float[4] (startT, startV, endT, endV)
+} SSCurveKey;
+
+
+typedef struct {
+	ss_s16		v[4][2];		// TL, TR, BL, BR
+} SSCurveVertex4;
+
+
+typedef struct {
+	ss_u16		type;			// 0:なし, 1:単色, 2:頂点カラー
+	ss_u16		blend;			// 0:無効, 1:ミックス, 2:乗算, 3:加算, 4:減算
+	ss_u32		colors[4];		// TL, TR, BL, BR (ARGB)
+} SSCurveColorBlend;
+
+
+typedef struct {
+	ss_u16		tag;			// アトリビュートの種類
+	ss_u16		numKeys;
+	ss_u16		hasInheritPercent;
+	ss_u16		reserved;
+	float		inheritPercent;
+	ss_offset	keys;			// SSCurveKeyの配列
+} SSCurveAttribute;
+
+
+typedef struct {
+	ss_s16		parentIndex;	// 親パーツの位置. ルートパーツは-1
+	ss_u16		type;			// 0:通常, 1:ルート, 2:NULL, 3:当たり判定, 4:サウンド
+	ss_u16		inheritEach;	// 継承を個別に指定する
+	ss_s16		firstFrameNo;	// このフレーム以降に表示される
+	ss_s16		picLeft;
+	ss_s16		picTop;
+	ss_s16		picWidth;
+	ss_s16		picHeight;
+	ss_s16		originX;
+	ss_s16		originY;
+	ss_s16		numAttributes;
+	ss_s16		reserved;
+	ss_offset	attributes;		// SSCurveAttributeの配列
+} SSCurveNode;
+
+
+typedef struct {
+	ss_s16		left;
+	ss_s16		top;
+	ss_s16		width;
+	ss_s16		height;
+} SSTextureRect;
+
+
+typedef struct {
+	ss_offset	rects;			// SSTextureRectの配列
+	ss_s16		numRects;
+	ss_s16		reserved;
+} SSImageRects;
+
+
 typedef struct {
 	ss_u32		id[2];
 	ss_u32		version;
@@ -56,6 +125,20 @@ typedef struct {
 	ss_s16		numParts;
 	ss_s16		numFrames;
 	ss_s16		fps;
+	ss_s16		numKeyframes;	// version 6以降. 差分形式のフレームデータでデコードを始めるキーフレームの数
+	ss_offset	keyframeIndex;	// version 6以降. キーフレームのフレームNo(ss_s16)の配列
+	ss_u16		positionFractionBits;	// version 6以降. 量子化された座標の小数部ビット数
+	ss_u16		angleBits;				// version 6以降. 量子化された回転角の1周のビット数
+	ss_u16		scaleFractionBits;		// version 6以降. 量子化されたスケールの小数部ビット数
+	ss_s16		numFrameTimes;	// version 6以降. フレームを間引いたときの出力したフレームの数（0のときは間引いていない）
+	ss_s16		framesPerChunk;	// version 6以降. フレームデータを圧縮したチャンクのフレーム数（0のときは非圧縮）
+	ss_s16		numChunks;		// version 6以降. チャンクの数
+	ss_offset	chunkData;		// version 6以降. SSFrameChunkの配列
+	ss_offset	curveData;		// version 6以降. カーブ形式のときのSSCurveNodeの配列（パーツ情報と同じ順）
+	ss_offset	frameTimes;		// version 6以降. 出力したフレームごとの元のフレームNo(ss_s16)の配列. フレームデータはこの順に並ぶ
+	ss_offset	imageRects;		// version 6以降、参照元の範囲の表を使うときのみ. 画像ごとのSSImageRectsの配列（画像リストと同じ順）
+	ss_s16		numRectImages;	// version 6以降、参照元の範囲の表を使うときのみ. imageRectsの数
+	ss_s16		reserved;
 } SSData;
 
 
@@ -0,0 +1,259 @@
+#!/usr/bin/python
+# -*- coding: utf-8 -*-
+#
+# カーブ形式（SsToCocos2d -r）のssbaをプレイヤーで評価した結果が、
+# フレームを展開した通常のssbaのデコード結果と一致するか比較します。
+#
+# Cocos2dxPlayer/SSPlayer.cppから、// SS_DECODER_BEGIN と // SS_DECODER_END の行で囲まれた
+# フレームのデコード部分（cocos2d-xに依存しない部分）をすべて切り出し、
+# 比較用のmainと合わせてビルドして実行します。
+#
+from __future__ import print_function, unicode_literals
+import os
+import sys
+import shutil
+import argparse
+import tempfile
+import subprocess
+
+script_dir = os.path.dirname(os.path.abspath(__file__))
+default_player = os.path.join(script_dir, '..', '..', '..', 'Player', 'Cocos2dxPlayer', 'SSPlayer.cpp')
+
+# SSPlayer.cppで切り出す範囲を示すマーカー（行全体）
+begin_marker = '// SS_DECODER_BEGIN'
+end_marker = '// SS_DECODER_END'
+
+# 切り出した部分が使うcocos2d-xの型と、SSPlayer.cppの設定の代わり
+shim = r'''
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <climits>
+#include <vector>
+#include <string>
+#include <map>
+#include <list>
+#include <algorithm>
+#include <pthread.h>
+#include "SSPlayerData.h"
+
+#define FRAME_CHUNK_CACHE_SIZE				2
+#define SHARED_FRAME_CACHE_MEMORY_BUDGET	0
+#define CCAssert(cond, msg)	do { if (!(cond)) { std::fprintf(stderr, "assert: %s\n", msg); std::abort(); } } while (0)
+
+typedef unsigned char GLubyte;
+struct ccColor4B { GLubyte r, g, b, a; };
+struct SSPlayer { struct FrameCacheStats { unsigned int hits, misses; size_t numEntries, bytes; }; };
+'''
+
+main = r'''
+static std::vector<char> loadFile(const char* filename)
+{
+	std::vector<char> buffer;
+	FILE* fp = std::fopen(filename, "rb");
+	if (!fp) return buffer;
+	std::fseek(fp, 0, SEEK_END);
+	buffer.resize(static_cast<size_t>(std::ftell(fp)));
+	std::fseek(fp, 0, SEEK_SET);
+	if (!buffer.empty() && std::fread(&buffer[0], buffer.size(), 1, fp) != 1) buffer.clear();
+	std::fclose(fp);
+	return buffer;
+}
+
+static float angleDifference(float from, float to)
+{
+	float diff = std::fmod(to - from + 180.0f, 360.0f);
+	if (diff < 0) diff += 360.0f;
+	return diff - 180.0f;
+}
+
+struct Checker
+{
+	float	tolerance;
+	float	maxError;
+	int		numErrors;
+
+	Checker(float tolerance) : tolerance(tolerance), maxError(0), numErrors(0) {}
+
+	void error(int frameNo, int partNo, const char* name, double expected, double actual)
+	{
+		if (numErrors++ < 20) std::printf("frame %d part %d %s: baked %g, curve %g\n", frameNo, partNo, name, expected, actual);
+	}
+
+	void exact(int frameNo, int partNo, const char* name, int expected, int actual)
+	{
+		if (expected != actual) error(frameNo, partNo, name, expected, actual);
+	}
+
+	void near(int frameNo, int partNo, const char* name, float expected, float actual, float diff)
+	{
+		diff = std::fabs(diff);
+		maxError = std::max(maxError, diff);
+		if (diff > tolerance) error(frameNo, partNo, name, expected, actual);
+	}
+
+	void compare(int frameNo, int partNo, const SSPartFrame& b, const SSPartFrame& c)
+	{
+		exact(frameNo, partNo, "flags", b.flags, c.flags);
+		exact(frameNo, partNo, "sx", b.sx, c.sx);
+		exact(frameNo, partNo, "sy", b.sy, c.sy);
+		exact(frameNo, partNo, "sw", b.sw, c.sw);
+		exact(frameNo, partNo, "sh", b.sh, c.sh);
+		exact(frameNo, partNo, "ox", b.ox, c.ox);
+		exact(frameNo, partNo, "oy", b.oy, c.oy);
+		near(frameNo, partNo, "dx", b.dx, c.dx, b.dx - c.dx);
+		near(frameNo, partNo, "dy", b.dy, c.dy, b.dy - c.dy);
+		near(frameNo, partNo, "rotation", b.rotation, c.rotation, angleDifference(b.rotation, c.rotation));
+		near(frameNo, partNo, "scaleX", b.scaleX, c.scaleX, b.scaleX - c.scaleX);
+		near(frameNo, partNo, "scaleY", b.scaleY, c.scaleY, b.scaleY - c.scaleY);
+		exact(frameNo, partNo, "opacity", b.opacity, c.opacity);
+		for (int v = 0; v < 4; v++)
+		{
+			exact(frameNo, partNo, "vertexOffset.x", b.vertexOffsets[v][0], c.vertexOffsets[v][0]);
+			exact(frameNo, partNo, "vertexOffset.y", b.vertexOffsets[v][1], c.vertexOffsets[v][1]);
+		}
+		if (b.flags & SS_PART_FLAGS_COLOR_BLEND)
+		{
+			exact(frameNo, partNo, "colorBlendFuncNo", b.colorBlendFuncNo, c.colorBlendFuncNo);
+			for (int v = 0; v < 4; v++)
+			{
+				exact(frameNo, partNo, "color.r", b.colors[v].r, c.colors[v].r);
+				exact(frameNo, partNo, "color.g", b.colors[v].g, c.colors[v].g);
+				exact(frameNo, partNo, "color.b", b.colors[v].b, c.colors[v].b);
+				exact(frameNo, partNo, "color.a", b.colors[v].a, c.colors[v].a);
+			}
+		}
+	}
+};
+
+int main(int argc, char* argv[])
+{
+	if (argc < 3)
+	{
+		std::fprintf(stderr, "usage: %s baked.ssba curve.ssba [tolerance]\n", argv[0]);
+		return 2;
+	}
+	std::vector<char> bakedFile = loadFile(argv[1]);
+	std::vector<char> curveFile = loadFile(argv[2]);
+	if (bakedFile.empty() || curveFile.empty())
+	{
+		std::fprintf(stderr, "can not read %s\n", bakedFile.empty() ? argv[1] : argv[2]);
+		return 2;
+	}
+
+	SSDataHandle baked(reinterpret_cast<const SSData*>(&bakedFile[0]));
+	SSDataHandle curve(reinterpret_cast<const SSData*>(&curveFile[0]));
+	if ((curve.getFlags() & SS_DATA_FLAG_CURVES) == 0)
+	{
+		std::fprintf(stderr, "%s is not curve format\n", argv[2]);
+		return 2;
+	}
+	if (baked.getNumFrames() != curve.getNumFrames() || baked.getNumParts() != curve.getNumParts())
+	{
+		std::printf("number of frames or parts differs\n");
+		return 1;
+	}
+
+	Checker checker(argc > 3 ? static_cast<float>(std::atof(argv[3])) : 0.001f);
+	SSFrameDecoder bakedDecoder(&baked);
+	SSFrameDecoder curveDecoder(&curve);
+	int numCompared = 0;
+	for (int frameNo = 0; frameNo < baked.getNumFrames(); frameNo++)
+	{
+		// 間引かれたフレームはプレイヤーが補間するので、記録されているフレームだけを比べる
+		int bakedRecordNo = baked.findFrameRecord(frameNo);
+		int curveRecordNo = curve.findFrameRecord(frameNo);
+		if (baked.getFrameRecordTime(bakedRecordNo) != frameNo || curve.getFrameRecordTime(curveRecordNo) != frameNo) continue;
+		bakedDecoder.decode(bakedRecordNo);
+		curveDecoder.decode(curveRecordNo);
+		numCompared++;
+
+		if (bakedDecoder.getNumParts() != curveDecoder.getNumParts())
+		{
+			checker.error(frameNo, -1, "numParts", static_cast<double>(bakedDecoder.getNumParts()), static_cast<double>(curveDecoder.getNumParts()));
+			continue;
+		}
+		for (size_t i = 0; i < bakedDecoder.getNumParts(); i++)
+		{
+			int partNo = bakedDecoder.getPartNo(i);
+			if (partNo != curveDecoder.getPartNo(i))
+			{
+				checker.error(frameNo, partNo, "order", partNo, curveDecoder.getPartNo(i));
+				continue;
+			}
+			checker.compare(frameNo, partNo, bakedDecoder.getPartFrame(partNo), curveDecoder.getPartFrame(partNo));
+		}
+	}
+
+	std::printf("%d frames compared, %d errors, max error %g (tolerance %g)\n", numCompared, checker.numErrors, checker.maxError, checker.tolerance);
+	return checker.numErrors == 0 ? 0 : 1;
+}
+'''
+
+
+def extract(source):
+	"""begin_markerとend_markerの行で囲まれた範囲をすべて、順に連結して返します。"""
+	parts = []
+	inside = False
+	for line_no, line in enumerate(source.split('\n'), 1):
+		marker = line.strip()
+		if marker == begin_marker:
+			if inside:
+				raise ValueError('line %d: %s without %s' % (line_no, begin_marker, end_marker))
+			inside = True
+		elif marker == end_marker:
+			if not inside:
+				raise ValueError('line %d: %s without %s' % (line_no, end_marker, begin_marker))
+			inside = False
+		elif inside:
+			parts.append(line)
+	if inside:
+		raise ValueError('%s is not closed' % begin_marker)
+	if not parts:
+		raise ValueError('%s and %s not found' % (begin_marker, end_marker))
+	return '\n'.join(parts) + '\n'
+
+
+def build(player, cxx, work_dir):
+	with open(player, 'rb') as f:
+		source = f.read().decode('utf-8-sig').replace('\r\n', '\n')
+	try:
+		decoder = extract(source)
+	except ValueError as e:
+		print('%s: %s' % (player, e))
+		return None
+	code = shim + decoder + main
+
+	cpp = os.path.join(work_dir, 'curve_checker.cpp')
+	exe = os.path.join(work_dir, 'curve_checker')
+	with open(cpp, 'wb') as f:
+		f.write(code.encode('utf-8'))
+	command = [cxx, '-O1', '-I', os.path.dirname(os.path.abspath(player)), cpp, '-o', exe, '-lpthread']
+	if subprocess.call(command) != 0:
+		return None
+	return exe
+
+
+def check():
+	parser = argparse.ArgumentParser(description='Compare curve format ssba with baked ssba, frame by frame.')
+	parser.add_argument('baked', help='ssba converted without -r')
+	parser.add_argument('curve', help='ssba converted with -r')
+	parser.add_argument('--tolerance', type=float, default=0.001, help='allowed error of position, rotation and scale (default: 0.001)')
+	parser.add_argument('--player', default=default_player, help='path to Cocos2dxPlayer/SSPlayer.cpp')
+	parser.add_argument('--cxx', default=os.environ.get('CXX', 'c++'), help='C++ compiler (default: $CXX or c++)')
+	args = parser.parse_args()
+
+	work_dir = tempfile.mkdtemp()
+	try:
+		exe = build(args.player, args.cxx, work_dir)
+		if exe is None:
+			print('build failed')
+			return 2
+		return subprocess.call([exe, args.baked, args.curve, str(args.tolerance)])
+	finally:
+		shutil.rmtree(work_dir)
+
+
+if __name__ == '__main__':
+	sys.exit(check())